@@ -123,6 +123,8 @@ protected:
   BB8PosCtrlOutput posControlOutput_;
   bb::PIDController autoPosController_, posController_; 
   float posControllerZero_;
+  bb::ControlGraph controlGraph_;
+  bb::ControlGraph::NodeID autoPosNode_, posNode_;
 
   float remoteP_, remoteH_, remoteR_;
   float annealP_, annealH_, annealR_, annealTime_;
@@ -137,9 +137,22 @@ Result BB8::initialize() {
   configureTimers();
   driveMotor_.setCustomAnalogWrite(&customAnalogWrite);
 
-  driveController_.setAutoUpdate(false);
+  // The roll controller is not part of the graph, it runs in stepRollMotor() whether or not the drive is on. Its input
+  // is, so that it is sampled with the others.
+  controlGraph_.addInput(driveEncoder_, "drive_enc");
+  controlGraph_.addInput(balanceInput_, "balance_in");
+  controlGraph_.addInput(rollInput_, "roll_in");
+  controlGraph_.addController(driveController_, "drive");
+  ControlGraph::NodeID balance = controlGraph_.addController(balanceController_, "balance");
+  ControlGraph::NodeID posOut = controlGraph_.addOutput(posControlOutput_, "pos_out");
+  autoPosNode_ = controlGraph_.addController(autoPosController_, "auto_pos");
+  posNode_ = controlGraph_.addController(posController_, "pos");
+  controlGraph_.connect(posOut, balance); // sets the balance controller's offset
+  controlGraph_.setEnabled(autoPosNode_, false);
+  controlGraph_.setEnabled(posNode_, false);
+  controlGraph_.sort();
+
   //driveController_.setDebug(true);
-  balanceController_.setAutoUpdate(false);
   balanceController_.setRamp(100);
   //balanceController_.setDebug(true);
   rollController_.setAutoUpdate(false);
@@ -212,8 +225,7 @@ Result BB8::step() {
   Runloop::runloop.excuseOverrun();
 
   imu_.update();
-
-  driveEncoder_.update();
+  controlGraph_.sample();
 
   stepcount++;
   if (stepcount == 1 && BB8BattStatus::batt.available(BB8BattStatus::BATT_1)) BB8BattStatus::batt.updateVoltage(BB8BattStatus::BATT_1);
@@ -281,11 +293,7 @@ Result BB8::stepDriveMotor() {
     return RES_OK;
   }
 
-  balanceController_.update();
-  driveController_.update();
-  if(driveMode_ == DRIVE_POS) posController_.update();
-  else if(driveMode_ == DRIVE_AUTO_POS) autoPosController_.update();
-  return RES_OK;
+  return controlGraph_.evaluate();
 }
 
 Result BB8::stepRollMotor() {
@@ -562,6 +570,8 @@ void BB8::switchDrive(DriveMode mode) {
   posControllerZero_ = posController_.present();
 
   driveMode_ = mode;
+  controlGraph_.setEnabled(posNode_, driveMode_ == DRIVE_POS);
+  controlGraph_.setEnabled(autoPosNode_, driveMode_ == DRIVE_AUTO_POS);
   switch(driveMode_) {
     case DRIVE_OFF: 
       setLED(LED_DRIVE, OFF);
@@ -13,6 +13,7 @@ static const float         WHEEL_CIRCUMFERENCE = 722.566;              // Wheel
 static const float         WHEEL_TICKS_PER_TURN = 979.2 * (97.0/18.0); // 979.2 ticks per one turn of the drive gear, 18 teeth on the drive gear, 97 teeth on the main gear.
 static const float         WHEEL_DISTANCE = 95.0;                      // Distance between the drive wheels
 static const bool          HEAD_COUNTERWEIGHT = true;                  // set to false if you're running without a head counterweight
+static const float         IMU_ODOMETRY_SIGN = 1.0;                    // 1 if positive wheel speed moves the droid along IMU x, -1 if against it, 0 to keep odometry out of the IMU
 
 // Parameters - all of these can be set from the commandline and stored in flash.
 struct DOParams {
@@ -73,6 +74,13 @@ struct DOParams {
 
     bb::HWAddress leftRemoteAddress = {0,0};
     bb::HWAddress rightRemoteAddress = {0,0};
+
+    // Added after the above were in use. Stored blocks from before end here, see DODroid::initialize().
+    float jerk              = 10000; // mm/s^3, 0 for a linear acceleration ramp
+    float wheelKv           = 0.0;   // Wheel speed feed-forward, PWM per mm/s - off until tuned for the droid
+    float wheelKa           = 0.0;   // Wheel acceleration feed-forward, PWM per mm/s^2
+    float faHeadMaxVel      = 180;   // Head remote control and anneal trajectory, deg/s (0 for no limit)
+    float faHeadMaxAccel    = 720;   // Same, deg/s^2
 };
 
 // Battery constants
@@ -91,6 +99,13 @@ static const float ST_ABORT_MILLIAMPS      = 1800; // pure motor current - added
 static const float ST_ABORT_HEADING_CHANGE = 45.0;
 static const float ST_MIN_HEADING_CHANGE   = ST_ABORT_HEADING_CHANGE / 4.0;
 
+// Wheel speed autotune constants (see the autotune console command). The wheels must be off the ground.
+static const float        AT_AMPLITUDE  = 60.0;  // Relay amplitude in PWM
+static const float        AT_HYSTERESIS = 15.0;  // mm/s, above the noise of the encoder speed
+static const float        AT_MAX_ERROR  = 600.0; // mm/s - give up if the wheel gets this far from the goal speed
+static const unsigned int AT_CYCLES     = 8;     // Oscillations averaged
+static const float        AT_TIMEOUT    = 20.0;  // s
+
 // Servo IDs
 static const uint8_t SERVO_NECK         = 1;
 static const uint8_t SERVO_HEAD_PITCH   = 2;
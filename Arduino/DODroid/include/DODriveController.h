@@ -2,18 +2,31 @@
 #define DODRIVECONTROLLER_H
 
 #include <LibBB.h>
+#include <BBEncoder.h>
 
 using namespace bb;
 
 class DOVelControlOutput: public bb::ControlOutput {
 public:
-  DOVelControlOutput(bb::ControlOutput& left, bb::ControlOutput& right);
+  DOVelControlOutput(bb::PIDController& left, bb::PIDController& right);
 
   virtual void setGoalVelocity(float goalVel);
   virtual float goalVelocity() { return goalVel_; }
   virtual void setAcceleration(float accel);
+  //! Jerk limit in mm/s^3 for velocity and rotation changes. 0 ramps linearly at the acceleration limit.
+  virtual void setJerk(float jerk);
   virtual void setGoalRotation(float goalRot);
   void setDeadband(float deadband);
+  //! Feed-forward into the wheel speed controllers' control, within their control bounds: kv per mm/s of wheel goal
+  //! speed, ka per mm/s^2 of profiled acceleration. The PID then only corrects what the motor model gets wrong.
+  //! Both depend on motors, gearing and battery, so they have to be tuned per droid; 0 turns feed-forward off.
+  void setFeedForward(float kv, float ka);
+  //! Profiled velocity and rotation to 0, no feed-forward until the next set().
+  void reset();
+
+  //! Profiled velocity and rotation the wheel speed goals are made of.
+  float profileVelocity() { return velProfile_.velocity(); }
+  float profileRotation() { return rotProfile_.velocity(); }
 
   // These are used by the controller framework, do not call directly.
   virtual float present();
@@ -22,10 +35,11 @@ public:
   virtual void setMaxSpeed(float m) { maxSpeed_ = m; }
 
 protected:
-  float goalVel_, goalRot_, curVel_, curRot_;
-  float accel_;
+  float goalVel_, goalRot_;
+  bb::VelocityProfile velProfile_, rotProfile_;
   float deadband_;
-  bb::ControlOutput &left_, &right_;
+  float kv_, ka_;
+  bb::PIDController &left_, &right_;
   unsigned long lastCycleUS_;
   float maxSpeed_;
 };
@@ -35,11 +49,12 @@ public:
   DOVelControlInput(bb::ControlInput& left, bb::ControlInput& right);
 
   virtual float present(); // outputs velocity
-  virtual Result update() { return RES_OK; } // we call update() one by one in DODroid::step()
+  virtual Result update(); // samples left and right, if that has not happened in this cycle yet
 protected:
   bb::ControlInput& left_;
   bb::ControlInput& right_;
   unsigned long lastCycleUS_;
+  float value_;
 };
 
 class DOPosControlOutput: public bb::ControlOutput {
@@ -58,11 +73,12 @@ public:
   DOPosControlInput(bb::Encoder& left, bb::Encoder& right);
 
   virtual float present(); // outputs position
-  virtual Result update() { return RES_OK; }
+  virtual Result update(); // samples left and right, if that has not happened in this cycle yet
 
 protected:
   bb::Encoder& left_;
   bb::Encoder& right_;
+  float value_;
 };
 
 #endif // DODRIVECONTROLLER_H
\ No newline at end of file
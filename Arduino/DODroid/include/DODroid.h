@@ -51,6 +51,8 @@ public:
   Result stepPowerProtect();
   Result stepDrive();
   Result stepHead();
+  Result stepStatus();
+  bool hardwareAvailable();
 
   virtual String statusLine();
   virtual void printExtendedStatus(ConsoleStream *stream = NULL);
@@ -67,6 +69,10 @@ public:
 
   void switchDrive(DriveMode mode);
 
+  Result startWheelAutotune(float speed, float amplitude, ConsoleStream *stream = NULL);
+  Result acceptWheelAutotune(bb::PIDController::AutotuneRule rule, ConsoleStream *stream = NULL);
+  void stopWheelAutotune();
+
   virtual Result incomingControlPacket(const HWAddress& srcAddr, PacketSource source, uint8_t rssi, uint8_t seqnum, const ControlPacket& packet);
   virtual Result incomingConfigPacket(const HWAddress& srcAddr, PacketSource source, uint8_t rssi, uint8_t seqnum, ConfigPacket& packet);
   virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
@@ -117,6 +123,9 @@ protected:
   DOPosControlOutput posOutput_;
   bb::PIDController autoPosController_, posController_; 
   float posControllerZero_;
+
+  bb::ControlGraph controlGraph_;
+  bb::ControlGraph::NodeID autoPosNode_, posNode_;
   
   MotorStatus leftMotorStatus_, rightMotorStatus_;
 
@@ -130,12 +139,15 @@ protected:
 
   DriveMode driveMode_;
   bool driveSafety_;
+  bool wheelAutotune_;
   
   bool servosOK_, aerialsOK_;
-  float remoteP_, remoteH_, remoteR_;
+  float remoteP_, remoteH_, remoteR_;         // head goals from the remote
+  bb::Trajectory headTrajectory_;             // smooths them, axes as in remoteP_, remoteH_, remoteR_
+  unsigned long headMicros_;                  // when headTrajectory_ was last advanced
   float pitchAtRest_;
   float remoteAerial1_, remoteAerial2_, remoteAerial3_;
-  float annealP_, annealH_, annealR_, annealTime_;
+  float annealTime_;
   float lean_;
   bool headIsOn_;
 
@@ -1,13 +1,15 @@
 #include "DODriveController.h"
 
-DOVelControlOutput::DOVelControlOutput(bb::ControlOutput& left, bb::ControlOutput& right):
+// Longest step the profile takes in one set(). Anything longer means the drive was not running.
+static const float MAX_PROFILE_DT = 0.1f;
+
+DOVelControlOutput::DOVelControlOutput(bb::PIDController& left, bb::PIDController& right):
   left_(left),
   right_(right) {
     goalVel_ = 0;
     goalRot_ = 0;
-    curVel_ = 0;
-    curRot_ = 0;
-    accel_ = 0;
+    deadband_ = 0;
+    kv_ = ka_ = 0;
     maxSpeed_ = 0;
     lastCycleUS_ = micros();
 }
@@ -22,30 +24,23 @@ bb::Result DOVelControlOutput::set(float value) {
     dt = (us - lastCycleUS_)/1e6;
   }
   lastCycleUS_ = us;
+  dt = min(dt, MAX_PROFILE_DT);
 
-  if(curVel_ < goalVel_) {
-    curVel_ += fabs(accel_*dt);
-    if(curVel_ > goalVel_) curVel_ = goalVel_;
-  } else {
-    curVel_ -= fabs(accel_*dt);
-    if(curVel_ < goalVel_) curVel_ = goalVel_;
-  }
-
-  if(curRot_ < goalRot_) {
-    curRot_ += fabs(accel_*dt);
-    if(curRot_ > goalRot_) curRot_ = goalRot_;
-  } else {
-    curRot_ -= fabs(accel_*dt);
-    if(curRot_ < goalRot_) curRot_ = goalRot_;
-  }
+  float goalVel = goalVel_;
+  if(!EPSILON(maxSpeed_)) goalVel = constrain(goalVel, -maxSpeed_, maxSpeed_);
+  float curVel = velProfile_.update(goalVel, dt);
+  float curRot = rotProfile_.update(goalRot_, dt);
 
-  float leftGoal = curVel_ + curRot_ - value;
-  float rightGoal = curVel_ - curRot_ - value;
+  float leftGoal = curVel + curRot - value;
+  float rightGoal = curVel - curRot - value;
   if(!EPSILON(maxSpeed_)) {
     leftGoal = constrain(leftGoal, -maxSpeed_, maxSpeed_);
     rightGoal = constrain(rightGoal, -maxSpeed_, maxSpeed_);
   }
 
+  left_.setFeedForward(kv_*leftGoal + ka_*(velProfile_.acceleration() + rotProfile_.acceleration()));
+  right_.setFeedForward(kv_*rightGoal + ka_*(velProfile_.acceleration() - rotProfile_.acceleration()));
+
   resLeft = left_.set(leftGoal);
   resRight = right_.set(rightGoal);
 
@@ -60,42 +55,71 @@ float DOVelControlOutput::present() {
 
 void DOVelControlOutput::setGoalVelocity(float goalVel) {
   goalVel_ = goalVel;
-  if(EPSILON(accel_)) {
-    curVel_ = goalVel_;
-  }
 }
   
 void DOVelControlOutput::setAcceleration(float accel) {
-  accel_ = accel;
+  velProfile_.setLimits(accel, velProfile_.maxJerk());
+  rotProfile_.setLimits(accel, rotProfile_.maxJerk());
+}
+
+void DOVelControlOutput::setJerk(float jerk) {
+  velProfile_.setLimits(velProfile_.maxAcceleration(), jerk);
+  rotProfile_.setLimits(rotProfile_.maxAcceleration(), jerk);
 }
   
 void DOVelControlOutput::setGoalRotation(float goalRot) {
   goalRot_ = goalRot;
-  if(EPSILON(accel_)) {
-    curRot_ = goalRot_;
-  }
 }
 
 void DOVelControlOutput::setDeadband(float deadband) {
   deadband_ = deadband;  
 }
 
+void DOVelControlOutput::setFeedForward(float kv, float ka) {
+  kv_ = kv;
+  ka_ = ka;
+}
+
+void DOVelControlOutput::reset() {
+  velProfile_.reset();
+  rotProfile_.reset();
+  left_.setFeedForward(0);
+  right_.setFeedForward(0);
+  lastCycleUS_ = micros();
+}
+
 DOVelControlInput::DOVelControlInput(bb::ControlInput& left, bb::ControlInput& right):
-  left_(left), right_(right) {  
+  left_(left), right_(right), value_(0) {  
+}
+
+Result DOVelControlInput::update() {
+  Result resLeft = left_.sample();
+  Result resRight = right_.sample();
+  value_ = (left_.present() + right_.present())/2.0f;
+  if(resLeft != RES_OK) return resLeft;
+  return resRight;
 }
 
 float DOVelControlInput::present() {
-  return (left_.present() + right_.present())/2.0f;
+  return value_;
 }
 
 // ==
 
 DOPosControlInput::DOPosControlInput(bb::Encoder& left, bb::Encoder& right):
-  left_(left), right_(right) {
+  left_(left), right_(right), value_(0) {
+}
+
+Result DOPosControlInput::update() {
+  Result resLeft = left_.sample();
+  Result resRight = right_.sample();
+  value_ = (left_.presentPosition() + right_.presentPosition())/2.0f;
+  if(resLeft != RES_OK) return resLeft;
+  return resRight;
 }
 
 float DOPosControlInput::present() {
-  return (left_.presentPosition() + right_.presentPosition())/2.0f;
+  return value_;
 }
 
 // ==
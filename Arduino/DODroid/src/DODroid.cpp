@@ -63,6 +63,8 @@ DODroid::DODroid():
   autoPosController_(posInput_, posOutput_),
   posController_(posInput_, posOutput_),
 
+  headTrajectory_(3),
+
   statusPixels_(3, P_STATUS_NEOPIXEL, NEO_GRB+NEO_KHZ800)
 {
   // Pull down the GND pins for the motor controllers.
@@ -84,7 +86,9 @@ DODroid::DODroid():
 "\tsafety {on|off}\tSwitch safety functions on/off\n"\
 "\tdrive {off|pos|vel}\tSwitch drive system to off, position control, or velocity control\n"\
 "\tplay_sound [<folder>] <num>\tPlay sound\n"\
-"\tset_aerials A1 [A2 A3]\tMove aerials. A1, A2, A3: Angle between 0 and 180\n";
+"\tset_aerials A1 [A2 A3]\tMove aerials. A1, A2, A3: Angle between 0 and 180\n"\
+"\tcontrol_graph [reset]\tPrint (or reset) controller evaluation order and timing\n"\
+"\tautotune [start <speed> [<amplitude>] | accept [zn_pi|tl_pi|zn_pid] | abort]\tAutotune wheel speed controllers (wheels off the ground!)\n";
   started_ = false;
 
   operationStatus_ = RES_SUBSYS_NOT_STARTED;
@@ -94,6 +98,7 @@ DODroid::DODroid():
 
   commLEDOn_ = false;
   msLastLeftCtrlPacket_ = msLastRightCtrlPacket_ = msLastPrimaryCtrlPacket_ = 0;
+  headMicros_ = 0;
 }
 
 Result DODroid::initialize() {
@@ -125,6 +130,9 @@ Result DODroid::initialize() {
   addParameter("pos_kd", "Derivative constant for position PID controller", params_.posKd, -INT_MAX, INT_MAX);
 
   addParameter("accel", "Acceleration in mm/s^2", params_.accel, -INT_MAX, INT_MAX);
+  addParameter("jerk", "Change of acceleration in mm/s^3 (0 for none)", params_.jerk, 0, INT_MAX);
+  addParameter("wheel_kv", "Wheel speed controller feed-forward, PWM per mm/s", params_.wheelKv, 0, 1);
+  addParameter("wheel_ka", "Wheel speed controller feed-forward, PWM per mm/s^2", params_.wheelKa, 0, 1);
   addParameter("max_speed", "Maximum speed (only honored in speed control mode)", params_.maxSpeed, 0, INT_MAX);
   addParameter("speed_axis_gain", "Gain for controller speed axis", params_.speedAxisGain, -INT_MAX, INT_MAX);
   addParameter("rot_axis_gain", "Gain for controller rot axis", params_.rotAxisGain, -INT_MAX, INT_MAX);
@@ -144,6 +152,8 @@ Result DODroid::initialize() {
   addParameter("fa_head_heading_turn", "Free Anim: Head heading on turn speed", params_.faHeadHeadingTurn, -INT_MAX, INT_MAX);
   addParameter("fa_aerial_speed", "Free Anim: Aerial position on wheel speed setpoint", params_.faAerialSpeedSP, -INT_MAX, INT_MAX);
   addParameter("fa_head_anneal_time", "Free Anim: Head anneal time", params_.faHeadAnnealTime, -INT_MAX, INT_MAX);
+  addParameter("fa_head_max_vel", "Free Anim: Max head velocity under remote control and annealing, deg/s (0 for none)", params_.faHeadMaxVel, 0, INT_MAX);
+  addParameter("fa_head_max_accel", "Free Anim: Max head acceleration under remote control and annealing, deg/s^2 (0 for none)", params_.faHeadMaxAccel, 0, INT_MAX);
 
   addParameter("auto_pos_control", "Automatically switch to position control", params_.autoPosControl);
 
@@ -155,16 +165,41 @@ Result DODroid::initialize() {
   if(ConfigStorage::storage.blockIsValid(paramsHandle_)) {
     LOG(LOG_INFO, "Storage block 0x%x is valid.\n", paramsHandle_);
     ConfigStorage::storage.readBlock(paramsHandle_);
+    // Blocks stored before jerk, feed-forward and head limits existed leave them with whatever came after the block
+    DOParams defaults;
+    if(!(params_.jerk >= 0 && params_.jerk < 1e6)) params_.jerk = defaults.jerk;
+    if(!(params_.wheelKv >= 0 && params_.wheelKv <= 1)) params_.wheelKv = defaults.wheelKv;
+    if(!(params_.wheelKa >= 0 && params_.wheelKa <= 1)) params_.wheelKa = defaults.wheelKa;
+    if(!(params_.faHeadMaxVel >= 0 && params_.faHeadMaxVel < 1e5)) params_.faHeadMaxVel = defaults.faHeadMaxVel;
+    if(!(params_.faHeadMaxAccel >= 0 && params_.faHeadMaxAccel < 1e6)) params_.faHeadMaxAccel = defaults.faHeadMaxAccel;
     LOG(LOG_INFO, "Left Address: 0x%lx:%lx\n", params_.leftRemoteAddress.addrHi, params_.leftRemoteAddress.addrLo);
   } else {
     LOG(LOG_INFO, "Remote: Storage block 0x%x is invalid, using initialized parameters.\n", paramsHandle_);
     ConfigStorage::storage.writeBlock(paramsHandle_);
   }
 
-  lSpeedController_.setAutoUpdate(false);
-  rSpeedController_.setAutoUpdate(false);
+  // Inputs are sampled once per cycle in step(), controllers are evaluated in dependency order in stepDrive().
+  // The graph sees controller -> input/output edges itself; the ones below it cannot see.
+  ControlGraph::NodeID leftEnc = controlGraph_.addInput(leftEncoder_, "left_enc");
+  ControlGraph::NodeID rightEnc = controlGraph_.addInput(rightEncoder_, "right_enc");
+  controlGraph_.addInput(balanceInput_, "balance_in");
+  ControlGraph::NodeID posIn = controlGraph_.addInput(posInput_, "pos_in");
+  ControlGraph::NodeID lSpeed = controlGraph_.addController(lSpeedController_, "l_speed");
+  ControlGraph::NodeID rSpeed = controlGraph_.addController(rSpeedController_, "r_speed");
+  ControlGraph::NodeID velOut = controlGraph_.addOutput(velOutput_, "vel_out");
+  controlGraph_.addController(balanceController_, "balance");
+  ControlGraph::NodeID posOut = controlGraph_.addOutput(posOutput_, "pos_out");
+  autoPosNode_ = controlGraph_.addController(autoPosController_, "auto_pos");
+  posNode_ = controlGraph_.addController(posController_, "pos");
+  controlGraph_.connect(leftEnc, posIn);
+  controlGraph_.connect(rightEnc, posIn);
+  controlGraph_.connect(velOut, lSpeed);
+  controlGraph_.connect(velOut, rSpeed);
+  controlGraph_.connect(posOut, velOut);
+  controlGraph_.setEnabled(autoPosNode_, false);
+  controlGraph_.setEnabled(posNode_, false);
+  controlGraph_.sort();
 
-  balanceController_.setAutoUpdate(false);
   balanceController_.setReverse(true); // FIXME Not quite sure anymore why we're reversing here, we should be forwarding. Check!
   //balanceController_.setDebug(true);
  
@@ -172,6 +207,41 @@ Result DODroid::initialize() {
 
   setPacketSource(PACKET_SOURCE_DROID);
 
+  // Tasks run right after step(), with the runloop spreading them over cycles. Periods are in cycles at the
+  // default 100Hz: head and drive at 50Hz on alternating cycles, status at 25Hz, power protect at 1Hz.
+  // Status and power have no owner, so they also run before start() - state packets and battery readings are
+  // wanted then, too - and look for themselves whether D-O is running.
+  // SD card check and status pixel updates can wait, so they only run in the slack at the end of a cycle.
+  Runloop::runloop.addTask(this, "head", 2, [this]() { if(hardwareAvailable()) stepHead(); });
+  Runloop::runloop.addTask(this, "drive", 2, [this]() {
+    if(!hardwareAvailable()) return;
+    stepDrive();
+    updateHead();
+  });
+  Runloop::runloop.addTask(NULL, "status", 4, [this]() {
+    if(isStarted() && operationStatus() == RES_OK) stepStatus();
+    else fillAndSendStatePacket();
+  });
+  Runloop::runloop.addTask(NULL, "power", 100, [this]() {
+    if(!isStarted() || operationStatus() != RES_OK) {
+      if(!DOBattStatus::batt.available()) return;
+      DOBattStatus::batt.updateVoltage();
+      DOBattStatus::batt.updateCurrent();
+      return;
+    }
+    // Look for battery undervoltage
+    if(!hardwareAvailable()) return;
+    Runloop::runloop.excuseOverrun();
+    stepPowerProtect();
+  });
+  Runloop::runloop.addBackgroundTask(this, "sdcard", 1000000, [this]() {
+    // Check if SD card was changed
+    if(!hardwareAvailable() || driveMode_ != DRIVE_OFF) return;
+    Runloop::runloop.excuseOverrun(); // usually longer than a cycle, so it may have to run without fitting into the slack
+    DOSound::sound.checkSDCard();
+  });
+  Runloop::runloop.addBackgroundTask(this, "pixels", 0, [this]() { if(hardwareAvailable()) statusPixels_.show(); });
+
   return Subsystem::initialize();
 }
 
@@ -182,6 +252,7 @@ Result DODroid::start(ConsoleStream* stream) {
   aerialsOK_ = false;
   driveMode_ = DRIVE_OFF;
   driveSafety_ = true;
+  wheelAutotune_ = false;
   headIsOn_ = false;
   pitchAtRest_ = 0;
   lastLeftSeqnum_ = 255;
@@ -189,6 +260,7 @@ Result DODroid::start(ConsoleStream* stream) {
 
   DOSound::sound.begin();
   imu_.begin(IMU_ADDR);
+  imu_.setCalibrationStorage();
   DOBattStatus::batt.begin();
 
   //operationStatus_ = RES_OK;
@@ -219,7 +291,9 @@ Result DODroid::start(ConsoleStream* stream) {
 
   setControlParameters();
 
-  annealH_ = annealP_ = annealR_ = 0;
+  remoteP_ = remoteH_ = remoteR_ = 0;
+  headTrajectory_.reset(0.0f);
+  headMicros_ = micros();
 
   started_ = true;
   operationStatus_ = RES_OK;
@@ -255,6 +329,8 @@ void DODroid::setControlParameters() {
   rSpeedController_.setControlParameters(params_.wheelKp, params_.wheelKi, params_.wheelKd);
   lSpeedController_.setIBounds(-255, 255);
   rSpeedController_.setIBounds(-255, 255);
+  lSpeedController_.setControlBounds(-255, 255);
+  rSpeedController_.setControlBounds(-255, 255);
   lSpeedController_.reset();
   rSpeedController_.reset();
 
@@ -263,21 +339,19 @@ void DODroid::setControlParameters() {
   balanceController_.setErrorDeadband(-1.0, 1.0);
   balanceController_.reset();
   velOutput_.setAcceleration(params_.accel);
+  velOutput_.setJerk(params_.jerk);
+  velOutput_.setFeedForward(params_.wheelKv, params_.wheelKa);
   velOutput_.setMaxSpeed(params_.maxSpeed);
 
   autoPosController_.setControlParameters(params_.autoPosKp, params_.autoPosKi, params_.autoPosKd);
   posController_.setControlParameters(params_.posKp, params_.posKi, params_.posKd);
+
+  headTrajectory_.setLimits(params_.faHeadMaxVel, params_.faHeadMaxAccel);
 }
 
 Result DODroid::step() {
-  unsigned long seqnum = Runloop::runloop.getSequenceNumber();
-  static unsigned long lastSDCardCheck = millis();
-
-  // We're broken; still send out the state packet.
-  if(!imu_.available() || !DOBattStatus::batt.available()) {
-    if((seqnum % 4) == 0) {
-      fillAndSendStatePacket();
-    }
+  // We're broken; the status task still sends out the state packet.
+  if(!hardwareAvailable()) {
     if(!imu_.available()) {
       LOG(LOG_FATAL, "IMU missing - critical error\n");
       leftMotor_.set(0);
@@ -292,41 +366,28 @@ Result DODroid::step() {
     return RES_SUBSYS_HW_DEPENDENCY_MISSING;
   }
 
-  // Look for battery undervoltage
-  if((Runloop::runloop.getSequenceNumber() % 100) == 0) {
-    Runloop::runloop.excuseOverrun();
-    stepPowerProtect();
-  }
-
-  // Check if SD card was changed
-  if(WRAPPEDDIFF(millis(), lastSDCardCheck, ULONG_MAX) > 1000 && driveMode_ == DRIVE_OFF) {
-    Runloop::runloop.excuseOverrun();
-    DOSound::sound.checkSDCard();
-    lastSDCardCheck = millis();
-  }
-
-  // Encoder and IMU updates are needed for everything, so we do them here.
-  leftEncoder_.update();  
-  rightEncoder_.update();  
+  // Encoder and IMU updates are needed for everything, so we do them here. Everything else runs at lower rates
+  // as runloop tasks, see initialize().
   imu_.update();
+  controlGraph_.sample();
 
-  // We only run head and drive control at 50Hz
-  if((seqnum % 2) == 0) {
-    stepHead();
-  } else {
-    // stepDrive() takes less time than stepHead()
-    stepDrive();
-    updateHead();
+  // Wheel speed, so that the IMU can tell acceleration from tilt. Goes into the next update().
+  if(IMU_ODOMETRY_SIGN != 0) {
+    imu_.setOdometryVelocity(IMU_ODOMETRY_SIGN * (leftEncoder_.presentSpeed() + rightEncoder_.presentSpeed()) / 2000.0f, 0);
   }
 
-  if((seqnum % 4) == 0) {
-    fillAndSendStatePacket();
-    if(XBee::xbee.isStarted() && Servos::servos.isStarted()) setLED(LED_STATUS, GREEN, false);
-    else setLED(LED_STATUS, YELLOW, false);
-  }
+  return RES_OK;
+}
 
-  statusPixels_.show();
+bool DODroid::hardwareAvailable() {
+  return imu_.available() && DOBattStatus::batt.available();
+}
 
+Result DODroid::stepStatus() {
+  fillAndSendStatePacket();
+  if(!hardwareAvailable()) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  if(XBee::xbee.isStarted() && Servos::servos.isStarted()) setLED(LED_STATUS, GREEN, false);
+  else setLED(LED_STATUS, YELLOW, false);
   return RES_OK;
 }
 
@@ -371,6 +432,14 @@ bb::Result DODroid::stepHead() {
   float accelSP = (speedSP-speed);
   if(speedSP == 0) accelSP = 0;
 
+  // Remote head goals come in at the packet rate and jump; the servos get a smooth path towards them at the control rate.
+  // This runs as a task every few cycles, so advance by the time that has actually passed.
+  unsigned long now = micros();
+  float dt = (now - headMicros_) / 1e6;
+  headMicros_ = now;
+  headTrajectory_.update(dt < 0.1 ? dt : 0.1);
+  float headP = headTrajectory_.position(0), headH = headTrajectory_.position(1), headR = headTrajectory_.position(2);
+
   if(servosOK_) {
     if(headIsOn_) {
       float nod;
@@ -390,40 +459,23 @@ bb::Result DODroid::stepHead() {
       bb::Servos::servos.setGoalPos(SERVO_NECK, 180 + neck);
 
       float headPitch = -nod;
-      headPitch += remoteP_;
+      headPitch += headP;
       headPitch += params_.faHeadPitchSpeedSP*speedSP;
       bb::Servos::servos.setGoalPos(SERVO_HEAD_PITCH, 180 + headPitch);
-      bb::Servos::servos.setGoalPos(SERVO_HEAD_HEADING, 180.0 + params_.faHeadHeadingTurn * dh + remoteH_);
-      bb::Servos::servos.setGoalPos(SERVO_HEAD_ROLL, 180.0 - params_.faHeadRollTurn * dh + remoteR_);
+      bb::Servos::servos.setGoalPos(SERVO_HEAD_HEADING, 180.0 + params_.faHeadHeadingTurn * dh + headH);
+      bb::Servos::servos.setGoalPos(SERVO_HEAD_ROLL, 180.0 - params_.faHeadRollTurn * dh + headR);
     } else {
       bb::Servos::servos.setGoalPos(SERVO_NECK, 180);
     }
   }
   
   if(lastPrimaryCtrlPacket_.button3 == false && (float(millis())/1000.0f > annealTime_ + params_.faHeadAnnealDelay)) {
-    if(remoteP_ > 0.5) {
-      remoteP_ -= annealP_;
-      if(remoteP_ < 0) remoteP_ = 0;
-    } else if(remoteP_ < -0.5) {
-      remoteP_ += annealP_;
-      if(remoteP_ > 0) remoteP_ = 0;
-    } else remoteP_ = 0;
-
-    if(remoteH_ > 0.5) {
-      remoteH_ -= annealH_;
-      if(remoteH_ < 0) remoteH_ = 0;
-    } else if(remoteH_ < -0.5) {
-      remoteH_ += annealH_;
-      if(remoteH_ > 0) remoteH_ = 0;
-    } else remoteH_ = 0;
-
-    if(remoteR_ > 0.5) {
-      remoteR_ -= annealR_;
-      if(remoteR_ < 0) remoteR_ = 0;
-    } else if(remoteR_ < -0.5) {
-      remoteR_ += annealR_;
-      if(remoteR_ > 0) remoteR_ = 0;
-    } else remoteR_ = 0;
+    // Back to the free animation center, taking at least the anneal time
+    if(remoteP_ != 0 || remoteH_ != 0 || remoteR_ != 0) {
+      remoteP_ = remoteH_ = remoteR_ = 0;
+      float goals[3] = { 0, 0, 0 };
+      headTrajectory_.moveTo(goals, params_.faHeadAnnealTime);
+    }
   } else if(lastPrimaryCtrlPacket_.button3 == true){
     annealTime_ = float(millis()) / 1000.0f;
   }
@@ -459,12 +511,36 @@ bb::Result DODroid::stepDrive() {
     DOSound::sound.playSystemSound(SystemSounds::DISCONNECTED);
   }
 
-  if(driveMode_ != DRIVE_OFF && leftMotorStatus_ == MOTOR_OK && rightMotorStatus_ == MOTOR_OK) {
-    balanceController_.update();
+  // Autotune drives the motors itself, so it needs the same motor checks as the graph below
+  if(wheelAutotune_ && (leftMotorStatus_ != MOTOR_OK || rightMotorStatus_ != MOTOR_OK)) {
+    LOG(LOG_ERROR, "Motor fault (left %s, right %s). Aborting autotune.\n",
+        motorStatusToString(leftMotorStatus_), motorStatusToString(rightMotorStatus_));
+    stopWheelAutotune();
+  }
+
+  if(wheelAutotune_) {
+    // Drive is off, so nothing else in the graph moves the wheels
     lSpeedController_.update();
     rSpeedController_.update();
-    if(driveMode_ == DRIVE_POS) posController_.update();
-    else if(driveMode_ == DRIVE_AUTO_POS) autoPosController_.update();
+    if(lSpeedController_.autotuneState() != PIDController::AUTOTUNE_RUNNING &&
+       rSpeedController_.autotuneState() != PIDController::AUTOTUNE_RUNNING) {
+      float lKu, lTu, rKu, rTu, kp, ki, kd;
+      stopWheelAutotune();
+      if(lSpeedController_.getAutotuneResult(lKu, lTu) && rSpeedController_.getAutotuneResult(rKu, rTu)) {
+        LOG(LOG_INFO, "Autotune done. Left Ku %f Tu %fs, right Ku %f Tu %fs.\n", lKu, lTu, rKu, rTu);
+        for(PIDController::AutotuneRule rule: {PIDController::AUTOTUNE_ZN_PI, PIDController::AUTOTUNE_TL_PI, PIDController::AUTOTUNE_ZN_PID}) {
+          lSpeedController_.autotuneGains(rule, kp, ki, kd);
+          float lKp = kp, lKi = ki, lKd = kd;
+          rSpeedController_.autotuneGains(rule, kp, ki, kd);
+          LOG(LOG_INFO, "%s: kp %f ki %f kd %f\n", rule == PIDController::AUTOTUNE_ZN_PI ? "zn_pi" : (rule == PIDController::AUTOTUNE_TL_PI ? "tl_pi" : "zn_pid"), (lKp+kp)/2, (lKi+ki)/2, (lKd+kd)/2);
+        }
+        LOG(LOG_INFO, "\"autotune accept [<rule>]\" to use and store.\n");
+      } else {
+        LOG(LOG_ERROR, "Autotune failed - try a different speed or amplitude.\n");
+      }
+    }
+  } else if(driveMode_ != DRIVE_OFF && leftMotorStatus_ == MOTOR_OK && rightMotorStatus_ == MOTOR_OK) {
+    controlGraph_.evaluate();
   } else {
     leftMotor_.set(0);
     rightMotor_.set(0);
@@ -474,28 +550,21 @@ bb::Result DODroid::stepDrive() {
 
 bb::Result DODroid::stepIfNotStarted() {
   if(imu_.available()) imu_.update();
-  leftEncoder_.update();
-  rightEncoder_.update();
-  if((Runloop::runloop.getSequenceNumber() % 4) == 0) {
-    fillAndSendStatePacket();
-  }
-  if((Runloop::runloop.getSequenceNumber() % 100) == 0 && DOBattStatus::batt.available()) {
-    DOBattStatus::batt.updateVoltage();
-    DOBattStatus::batt.updateCurrent();
-  }
-
+  controlGraph_.sample();
   statusPixels_.show();
 
   return RES_OK;
 }
 
 void DODroid::switchDrive(DriveMode mode) {
+  stopWheelAutotune();
   lSpeedController_.reset();
   lSpeedController_.setGoal(0);
   rSpeedController_.reset();
   rSpeedController_.setGoal(0);
   balanceController_.reset();
   balanceController_.setGoal(-pitchAtRest_);
+  velOutput_.reset();
   autoPosController_.reset();
   autoPosController_.setPresentAsGoal();
   posController_.reset();
@@ -503,6 +572,8 @@ void DODroid::switchDrive(DriveMode mode) {
   posControllerZero_ = posController_.present();
 
   driveMode_ = mode;
+  controlGraph_.setEnabled(posNode_, driveMode_ == DRIVE_POS);
+  controlGraph_.setEnabled(autoPosNode_, driveMode_ == DRIVE_AUTO_POS);
   switch(driveMode_) {
     case DRIVE_OFF: 
       setLED(LED_DRIVE, OFF, false);
@@ -531,6 +602,54 @@ void DODroid::switchDrive(DriveMode mode) {
   }
 }
 
+Result DODroid::startWheelAutotune(float speed, float amplitude, ConsoleStream *stream) {
+  if(!started_ || !hardwareAvailable()) return RES_SUBSYS_NOT_OPERATIONAL;
+  if(driveMode_ != DRIVE_OFF || wheelAutotune_) return RES_SUBSYS_WRONG_MODE;
+  if(leftMotorStatus_ != MOTOR_OK || rightMotorStatus_ != MOTOR_OK) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  if(fabs(speed) > params_.maxSpeed) return RES_CMD_INVALID_ARGUMENT;
+
+  for(PIDController* c: {&lSpeedController_, &rSpeedController_}) {
+    c->reset();
+    c->setGoal(speed);
+    Result res = c->startAutotune(amplitude, AT_HYSTERESIS, AT_MAX_ERROR, AT_CYCLES, AT_TIMEOUT);
+    if(res != RES_OK) {
+      lSpeedController_.stopAutotune();
+      return res;
+    }
+  }
+  wheelAutotune_ = true;
+  bb::printf(stream, "Autotuning wheel speed controllers at %.0fmm/s. \"autotune abort\" to stop.\n", speed);
+  return RES_OK;
+}
+
+void DODroid::stopWheelAutotune() {
+  if(!wheelAutotune_) return;
+  wheelAutotune_ = false;
+  lSpeedController_.stopAutotune();
+  rSpeedController_.stopAutotune();
+  lSpeedController_.setGoal(0);
+  rSpeedController_.setGoal(0);
+  leftMotor_.set(0);
+  rightMotor_.set(0);
+}
+
+Result DODroid::acceptWheelAutotune(PIDController::AutotuneRule rule, ConsoleStream *stream) {
+  float lKp, lKi, lKd, rKp, rKi, rKd;
+  if(!lSpeedController_.autotuneGains(rule, lKp, lKi, lKd) || !rSpeedController_.autotuneGains(rule, rKp, rKi, rKd)) {
+    return RES_CMD_FAILURE;
+  }
+
+  // Both wheels share one set of gains
+  params_.wheelKp = (lKp + rKp) / 2;
+  params_.wheelKi = (lKi + rKi) / 2;
+  params_.wheelKd = (lKd + rKd) / 2;
+  setControlParameters();
+  ConfigStorage::storage.writeBlock(paramsHandle_);
+  ConfigStorage::storage.commit();
+  bb::printf(stream, "Stored wheel_kp %f, wheel_ki %f, wheel_kd %f.\n", params_.wheelKp, params_.wheelKi, params_.wheelKd);
+  return RES_OK;
+}
+
 String DODroid::statusLine() {
   String str = bb::Subsystem::statusLine();
   str += ", batt: ";
@@ -675,9 +794,8 @@ Result DODroid::incomingControlPacket(const HWAddress& srcAddr, PacketSource sou
       remoteR_ = packet.getAxis(2, ControlPacket::UNIT_DEGREES_CENTERED);
       remoteP_ = packet.getAxis(3, ControlPacket::UNIT_DEGREES_CENTERED);
       remoteH_ = packet.getAxis(4, ControlPacket::UNIT_DEGREES_CENTERED);
-      annealR_ = fabs(remoteR_ / (params_.faHeadAnnealTime / bb::Runloop::runloop.cycleTimeSeconds()));
-      annealP_ = fabs(remoteP_ / (params_.faHeadAnnealTime / bb::Runloop::runloop.cycleTimeSeconds()));
-      annealH_ = fabs(remoteH_ / (params_.faHeadAnnealTime / bb::Runloop::runloop.cycleTimeSeconds()));
+      float goals[3] = { remoteP_, remoteH_, remoteR_ };
+      headTrajectory_.moveTo(goals);
     }
 
     // Button 0, 1, 2 play different sounds
@@ -824,6 +942,44 @@ Result DODroid::handleConsoleCommand(const std::vector<String>& words, ConsoleSt
     } else return RES_CMD_INVALID_ARGUMENT;
   }
 
+  else if(words[0] == "control_graph") {
+    if(words.size() == 2 && words[1] == "reset") {
+      controlGraph_.resetTiming();
+      return RES_OK;
+    }
+    if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
+    controlGraph_.printTiming(stream);
+    return RES_OK;
+  }
+
+  else if(words[0] == "autotune") {
+    if(words.size() == 1) {
+      if(wheelAutotune_) bb::printf(stream, "Autotune running.\n");
+      else bb::printf(stream, "Autotune not running.\n");
+      return RES_OK;
+    }
+    if(words[1] == "start") {
+      if(words.size() != 3 && words.size() != 4) return RES_CMD_INVALID_ARGUMENT_COUNT;
+      float amplitude = words.size() == 4 ? words[3].toFloat() : AT_AMPLITUDE;
+      return startWheelAutotune(words[2].toFloat(), amplitude, stream);
+    } else if(words[1] == "accept") {
+      if(words.size() > 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
+      PIDController::AutotuneRule rule = PIDController::AUTOTUNE_ZN_PI;
+      if(words.size() == 3) {
+        if(words[2] == "zn_pi") rule = PIDController::AUTOTUNE_ZN_PI;
+        else if(words[2] == "tl_pi") rule = PIDController::AUTOTUNE_TL_PI;
+        else if(words[2] == "zn_pid") rule = PIDController::AUTOTUNE_ZN_PID;
+        else return RES_CMD_INVALID_ARGUMENT;
+      }
+      return acceptWheelAutotune(rule, stream);
+    } else if(words[1] == "abort") {
+      if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
+      stopWheelAutotune();
+      return RES_OK;
+    }
+    return RES_CMD_INVALID_ARGUMENT;
+  }
+
   else if(words[0] == "set_aerials") {
     if(words.size() == 2) {
       float angle = words[1].toFloat();
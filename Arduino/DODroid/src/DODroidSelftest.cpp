@@ -109,8 +109,12 @@ Result DODroid::selfTest(ConsoleStream *stream) {
   }
   LOG(LOG_INFO, "IMU OK. Pitch %.2f, Roll %.2f.\n", p, r);
 
-  DOSound::sound.playSystemSound(SystemSounds::CALIBRATING);
-  imu_.calibrate(stream);
+  if(imu_.hasCalibration()) {
+    LOG(LOG_INFO, "Using stored IMU calibration.\n");
+  } else {
+    DOSound::sound.playSystemSound(SystemSounds::CALIBRATING);
+    imu_.calibrate(stream);
+  }
 
   for(int i=0; i<100; i++) {
     imu_.update(true);
@@ -280,7 +284,7 @@ DODroid::MotorStatus DODroid::singleMotorTest(bb::DCMotor& mot, bb::Encoder& enc
   imu_.update();
   imu_.getFilteredPRH(p, r, h0);
 
-  unsigned long microsPerLoop = (unsigned long)(1e6 / imu_.dataRate());
+  unsigned long microsPerLoop = Runloop::runloop.cycleTimeMicros();
 
   DOBattStatus::batt.updateCurrent();
   DOBattStatus::batt.updateVoltage();
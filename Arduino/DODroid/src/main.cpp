@@ -41,6 +41,7 @@ void initializeSubsystems() {
   XBee::xbee.initialize(DEFAULT_CHAN, DEFAULT_PAN, 230400, serialTXSerial);
   XBee::xbee.setDebugFlags((XBee::DebugFlags)(XBee::DEBUG_PROTOCOL|XBee::DEBUG_XBEE_COMM));
   XBee::xbee.setName(DROID_NAME);
+  XBee::xbee.setLinkModeAllowed(true);
   Servos::servos.initialize();
   Servos::servos.setRequiredIds(std::vector<uint8_t>{SERVO_NECK}); // Rest of the head servos may be disconnected
   Servos::servos.setTorqueOffOnStop(false); // because this can crash the head
@@ -0,0 +1,128 @@
+#include <Arduino.h>
+#include "BBAttitudeEstimator.h"
+
+#include <math.h>
+
+static const float DEG2RAD = M_PI / 180.0f;
+static const float RAD2DEG = 180.0f / M_PI;
+static const float GRAVITY = 9.80665f;      // m/s^2 per g
+static const float MAX_BIAS = 10 * DEG2RAD; // integral windup limit
+static const float ODO_SMOOTHING = 0.5f;    // weight of the newest sample in the odometry acceleration
+
+bb::AttitudeEstimator::AttitudeEstimator() {
+  dt_ = 1.0f / 100.0f;
+  kp_ = 1.0f;
+  ki_ = 0.05f;
+  setAccelGate(0.2f);
+  reset();
+}
+
+void bb::AttitudeEstimator::begin(float sampleFreq) {
+  if(sampleFreq > 0) dt_ = 1.0f / sampleFreq;
+  reset();
+}
+
+void bb::AttitudeEstimator::reset() {
+  q_ = Quaternion();
+  intX_ = intY_ = intZ_ = 0;
+  initialized_ = false;
+  eulerValid_ = false;
+  roll_ = pitch_ = yaw_ = 0;
+  clearOdometry();
+}
+
+void bb::AttitudeEstimator::setOdometryVelocity(float vx, float vy) {
+  if(odoPrimed_) {
+    if(odoDT_ <= 0) return;
+    // In g, as the accelerometer measures
+    float ax = (vx - odoVX_) / (odoDT_ * GRAVITY), ay = (vy - odoVY_) / (odoDT_ * GRAVITY);
+    odoAX_ += ODO_SMOOTHING * (ax - odoAX_);
+    odoAY_ += ODO_SMOOTHING * (ay - odoAY_);
+    odoValid_ = true;
+  }
+  odoVX_ = vx; odoVY_ = vy;
+  odoDT_ = 0;
+  odoPrimed_ = true;
+}
+
+void bb::AttitudeEstimator::clearOdometry() {
+  odoValid_ = odoPrimed_ = false;
+  odoVX_ = odoVY_ = odoAX_ = odoAY_ = odoDT_ = 0;
+}
+
+void bb::AttitudeEstimator::update(float gx, float gy, float gz, float ax, float ay, float az, float dt) {
+  gx *= DEG2RAD; gy *= DEG2RAD; gz *= DEG2RAD;
+  if(dt <= 0) dt = dt_;
+  odoDT_ += dt;
+  eulerValid_ = false;
+
+  if(!initialized_) {
+    if(ax == 0 && ay == 0 && az == 0) return;
+    q_ = Quaternion::fromEuler(atan2f(ay, az), atan2f(-ax, sqrtf(ay*ay + az*az)), 0);
+    initialized_ = true;
+    return;
+  }
+
+  const float w = q_.w, x = q_.x, y = q_.y, z = q_.z;
+
+  if(odoValid_) {
+    // Horizontal directions of the sensor x and y axes in the world frame (the first two columns of the rotation
+    // matrix, without their z), the odometry acceleration along them, and that taken back into the sensor frame by
+    // projecting onto all three sensor axes.
+    float xx = 1 - 2*(y*y + z*z), xy = 2*(x*y + w*z);
+    float yx = 2*(x*y - w*z), yy = 1 - 2*(x*x + z*z);
+    float awx = 0, awy = 0;
+    float nx2 = xx*xx + xy*xy, ny2 = yx*yx + yy*yy;
+    if(odoAX_ != 0 && nx2 > 0.01f) { float k = odoAX_ / sqrtf(nx2); awx += k * xx; awy += k * xy; }
+    if(odoAY_ != 0 && ny2 > 0.01f) { float k = odoAY_ / sqrtf(ny2); awx += k * yx; awy += k * yy; }
+    float zx = 2*(x*z + w*y), zy = 2*(y*z - w*x);
+    ax -= xx*awx + xy*awy;
+    ay -= yx*awx + yy*awy;
+    az -= zx*awx + zy*awy;
+  }
+
+  float norm = sqrtf(ax*ax + ay*ay + az*az);
+  float weight = gate_ > 0 ? 1.0f - fabsf(norm - 1.0f) * invGate_ : 0;
+  if(norm > 0 && weight > 0) {
+    float inv = 1.0f / norm;
+    ax *= inv; ay *= inv; az *= inv;
+
+    // Gravity as the current estimate predicts it, and the rotation that takes it to the measurement
+    float vx = 2*(x*z - w*y), vy = 2*(w*x + y*z), vz = w*w - x*x - y*y + z*z;
+    float ex = ay*vz - az*vy, ey = az*vx - ax*vz, ez = ax*vy - ay*vx;
+
+    if(ki_ > 0) {
+      float k = ki_ * weight * dt;
+      intX_ = constrain(intX_ + k*ex, -MAX_BIAS, MAX_BIAS);
+      intY_ = constrain(intY_ + k*ey, -MAX_BIAS, MAX_BIAS);
+      intZ_ = constrain(intZ_ + k*ez, -MAX_BIAS, MAX_BIAS);
+    }
+    gx += kp_ * weight * ex;
+    gy += kp_ * weight * ey;
+    gz += kp_ * weight * ez;
+  }
+  gx += intX_; gy += intY_; gz += intZ_;
+
+  // q' = q + 1/2 q (0, g) dt
+  float h = 0.5f * dt;
+  q_.w += h * (-x*gx - y*gy - z*gz);
+  q_.x += h * ( w*gx + y*gz - z*gy);
+  q_.y += h * ( w*gy - x*gz + z*gx);
+  q_.z += h * ( w*gz + x*gy - y*gx);
+  q_.normalize();
+}
+
+void bb::AttitudeEstimator::getGyroBias(float& bx, float& by, float& bz) const {
+  bx = -intX_ * RAD2DEG;
+  by = -intY_ * RAD2DEG;
+  bz = -intZ_ * RAD2DEG;
+}
+
+void bb::AttitudeEstimator::computeEuler() {
+  if(eulerValid_) return;
+  q_.toEuler(roll_, pitch_, yaw_);
+  roll_ *= RAD2DEG;
+  pitch_ *= RAD2DEG;
+  yaw_ = yaw_ * RAD2DEG + 180.0f;
+  eulerValid_ = true;
+}
@@ -0,0 +1,72 @@
+#if !defined(BBATTITUDEESTIMATOR_H)
+#define BBATTITUDEESTIMATOR_H
+
+#include "BBQuaternion.h"
+
+namespace bb {
+
+/*!
+  \brief Attitude from gyro and accelerometer, optionally helped by wheel odometry.
+
+  A complementary filter on a quaternion (Mahony's, with the integral term): the gyro is integrated, and the angle
+  between measured and predicted gravity pulls the estimate back. The integral of that error is an online estimate of
+  the gyro bias, so the angles don't drift after the gyro has warmed up and walked away from its calibration.
+
+  An accelerometer on a droid that drives measures its acceleration as well as gravity, which the plain filter reads as
+  tilt. If the droid knows its horizontal velocity from its wheels (setOdometryVelocity()), the acceleration derived
+  from it is taken out of the measurement before the correction. Independently, the correction is weighted down the
+  further the measured magnitude is from 1g, and switched off past the accel gate.
+
+  Inputs are in the units the IMU delivers - deg/s and g. Euler angles are only computed when asked for, and use the
+  same conventions as the Madgwick filter this replaces (yaw in 0..360).
+
+  Without odometry, an update() costs a little less than one of the Madgwick filter. With odometry it costs about 1.6
+  times as much as Madgwick's, for the compensation. HostBench's attitude_replay measures both.
+*/
+class AttitudeEstimator {
+public:
+  AttitudeEstimator();
+
+  void begin(float sampleFreq);
+  //! Back to level, bias forgotten. Re-initialized from the next accelerometer reading.
+  void reset();
+
+  //! kp pulls towards measured gravity (1/s), ki integrates the gyro bias (1/s^2). 0 for ki switches bias estimation off.
+  void setGains(float kp, float ki) { kp_ = kp; ki_ = ki; }
+  //! Accelerometer readings whose magnitude is further than gate from 1g (after odometry compensation) are ignored.
+  void setAccelGate(float gate) { gate_ = gate; invGate_ = gate > 0 ? 1.0f / gate : 0; }
+
+  //! Gyro in deg/s, accelerometer in g, in the sensor frame. dt is the time since the last sample in seconds; 0 means
+  //! one period of the sample frequency.
+  void update(float gx, float gy, float gz, float ax, float ay, float az, float dt = 0);
+
+  //! Horizontal velocity in m/s, along the horizontal projections of the sensor x and y axes. Call at a steady rate,
+  //! e.g. once per control cycle; the estimator differentiates it over the updates in between. Call clearOdometry()
+  //! when there is no odometry any more.
+  void setOdometryVelocity(float vx, float vy);
+  void clearOdometry();
+
+  const Quaternion& orientation() const { return q_; }
+  //! Degrees, Madgwick conventions. Computed on the first call after an update().
+  float getRoll() { computeEuler(); return roll_; }
+  float getPitch() { computeEuler(); return pitch_; }
+  float getYaw() { computeEuler(); return yaw_; }
+  //! Current estimate of the gyro bias, in deg/s. Subtract from raw readings to correct them.
+  void getGyroBias(float& bx, float& by, float& bz) const;
+
+protected:
+  void computeEuler();
+
+  Quaternion q_;
+  float dt_, kp_, ki_, gate_, invGate_;
+  float intX_, intY_, intZ_; // integral term in rad/s, the negative gyro bias
+  bool initialized_, eulerValid_;
+  float roll_, pitch_, yaw_;
+
+  bool odoValid_, odoPrimed_;
+  float odoVX_, odoVY_, odoAX_, odoAY_, odoDT_;
+};
+
+};
+
+#endif // BBATTITUDEESTIMATOR_H
@@ -10,6 +10,9 @@ static const size_t MAXSIZE=EEPROM_EMULATION_SIZE;
 #include <nvs_flash.h>
 #include <nvs.h>
 static const size_t MAXSIZE=1024;
+#elif defined(ARDUINO_ARCH_HOST)
+#include <EEPROM.h>
+static const size_t MAXSIZE=1024;
 #else
 #error Unsupported architecture
 #endif
@@ -130,7 +133,7 @@ bool bb::ConfigStorage::blockIsValid(HANDLE handle) {
 bool bb::ConfigStorage::initialize() {
 	if(initialized_) return true;
 
-#if defined(ARDUINO_NANO_RP2040_CONNECT)
+#if defined(ARDUINO_NANO_RP2040_CONNECT) || defined(ARDUINO_ARCH_HOST)
 	EEPROM.begin(MAXSIZE);
 #elif defined(ARDUINO_ARCH_ESP32)
 	esp_err_t err = nvs_flash_init();
@@ -130,6 +130,7 @@ bb::Console::Console() {
 	help_ = "No help available";
 	firstResponder_ = this;
 	lineMode_ = false;
+	setBackgroundStep(true); // Parsing and executing commands can wait for the slack at the end of a cycle
 }
 
 bb::Result bb::Console::initialize() {
@@ -301,10 +302,7 @@ void bb::Console::printfBroadcast(const char* format, ...) {
 
 	va_list args;
 	va_start(args, format);
-	int len = vsnprintf(NULL, 0, format, args)+1;
-	if(len > PRINTF_MAXLEN) len = PRINTF_MAXLEN;
-	memset(str, 0, len);
-	vsnprintf(str, len, format, args);
+	vsnprintf(str, PRINTF_MAXLEN+1, format, args);
 	va_end(args);
 	for(auto& s: streams_) {
 		s->printf(str);
@@ -0,0 +1,194 @@
+#include <Arduino.h>
+#include <LibBB.h>
+
+using namespace bb;
+
+static_assert(bb::ControlGraph::MAX_NODES <= 32, "Predecessor sets are 32 bit masks");
+
+bb::ControlGraph::ControlGraph():
+  numNodes_(0),
+  sorted_(false),
+  sampled_(false),
+  sampledCycle_(0) {
+}
+
+bb::ControlGraph::NodeID bb::ControlGraph::addNode(NodeKind kind, const char* name) {
+  if(numNodes_ >= MAX_NODES) return INVALID_NODE;
+  Node& n = nodes_[numNodes_];
+  n.kind = kind;
+  n.name = name;
+  n.input = NULL;
+  n.controller = NULL;
+  n.output = NULL;
+  n.enabled = true;
+  n.links = n.preds = 0;
+  n.timing.reset();
+  sorted_ = false;
+  return numNodes_++;
+}
+
+bb::ControlGraph::NodeID bb::ControlGraph::addInput(ControlInput& input, const char* name) {
+  if(findInput(&input) != INVALID_NODE) return INVALID_NODE;
+  NodeID id = addNode(NODE_INPUT, name);
+  if(id != INVALID_NODE) nodes_[id].input = &input;
+  return id;
+}
+
+bb::ControlGraph::NodeID bb::ControlGraph::addController(PIDController& controller, const char* name) {
+  if(findOutput(&controller) != INVALID_NODE) return INVALID_NODE;
+  NodeID id = addNode(NODE_CONTROLLER, name);
+  if(id == INVALID_NODE) return id;
+  nodes_[id].controller = &controller;
+  nodes_[id].output = &controller;
+  controller.setAutoUpdate(false);
+  return id;
+}
+
+bb::ControlGraph::NodeID bb::ControlGraph::addOutput(ControlOutput& output, const char* name) {
+  if(findOutput(&output) != INVALID_NODE) return INVALID_NODE;
+  NodeID id = addNode(NODE_OUTPUT, name);
+  if(id != INVALID_NODE) nodes_[id].output = &output;
+  return id;
+}
+
+bb::ControlGraph::NodeID bb::ControlGraph::findInput(ControlInput* input) const {
+  for(unsigned int i=0; i<numNodes_; i++) {
+    if(nodes_[i].input == input) return i;
+  }
+  return INVALID_NODE;
+}
+
+bb::ControlGraph::NodeID bb::ControlGraph::findOutput(ControlOutput* output) const {
+  for(unsigned int i=0; i<numNodes_; i++) {
+    if(nodes_[i].output == output) return i;
+  }
+  return INVALID_NODE;
+}
+
+Result bb::ControlGraph::connect(NodeID from, NodeID to) {
+  if(from < 0 || from >= int(numNodes_) || to < 0 || to >= int(numNodes_)) return RES_COMMON_NOT_IN_LIST;
+  if(from == to) return RES_COMMON_OUT_OF_RANGE;
+  // Inputs are all sampled before any controller runs, so an input can only follow other inputs
+  if(nodes_[to].kind == NODE_INPUT && nodes_[from].kind != NODE_INPUT) return RES_CMD_INVALID_ARGUMENT;
+  if(nodes_[to].links & (1UL << from)) return RES_COMMON_DUPLICATE_IN_LIST;
+  nodes_[to].links |= (1UL << from);
+  sorted_ = false;
+  return RES_OK;
+}
+
+Result bb::ControlGraph::setEnabled(NodeID node, bool enabled) {
+  if(node < 0 || node >= int(numNodes_)) return RES_COMMON_NOT_IN_LIST;
+  nodes_[node].enabled = enabled;
+  return RES_OK;
+}
+
+bool bb::ControlGraph::isEnabled(NodeID node) const {
+  if(node < 0 || node >= int(numNodes_)) return false;
+  return nodes_[node].enabled;
+}
+
+const char* bb::ControlGraph::nodeName(NodeID node) const {
+  if(node < 0 || node >= int(numNodes_)) return NULL;
+  return nodes_[node].name;
+}
+
+const bb::Runloop::StepTiming* bb::ControlGraph::nodeTiming(NodeID node) const {
+  if(node < 0 || node >= int(numNodes_)) return NULL;
+  return &nodes_[node].timing;
+}
+
+Result bb::ControlGraph::sort() {
+  // Edges from each controller's input, and to its output - which may be another controller
+  for(unsigned int i=0; i<numNodes_; i++) nodes_[i].preds = nodes_[i].links;
+  for(unsigned int i=0; i<numNodes_; i++) {
+    if(nodes_[i].kind != NODE_CONTROLLER) continue;
+    NodeID in = findInput(&nodes_[i].controller->input());
+    if(in != INVALID_NODE) nodes_[i].preds |= (1UL << in);
+    NodeID out = findOutput(&nodes_[i].controller->output());
+    if(out != INVALID_NODE) nodes_[out].preds |= (1UL << i);
+  }
+
+  // Kahn's algorithm. Takes the lowest numbered ready node first, so that independent nodes stay in the order they
+  // were added in.
+  uint32_t done = 0;
+  for(unsigned int n=0; n<numNodes_; n++) {
+    unsigned int i;
+    for(i=0; i<numNodes_; i++) {
+      if((done & (1UL << i)) == 0 && (nodes_[i].preds & ~done) == 0) break;
+    }
+    if(i == numNodes_) {
+      Console::console.printfBroadcast("Control graph has a cycle through:");
+      for(i=0; i<numNodes_; i++) {
+        if((done & (1UL << i)) == 0) Console::console.printfBroadcast(" %s", nodes_[i].name);
+      }
+      Console::console.printfBroadcast("\n");
+      return RES_CMD_FAILURE;
+    }
+    order_[n] = i;
+    done |= (1UL << i);
+  }
+
+  sorted_ = true;
+  return RES_OK;
+}
+
+void bb::ControlGraph::run(NodeID node) {
+  Node& n = nodes_[node];
+  unsigned long us = micros();
+  if(n.kind == NODE_INPUT) n.input->sample();
+  else if(n.kind == NODE_CONTROLLER) n.controller->update();
+  n.timing.add(micros() - us);
+}
+
+Result bb::ControlGraph::sample() {
+  if(sorted_ == false) {
+    Result res = sort();
+    if(res != RES_OK) return res;
+  }
+
+  unsigned long cycle = Runloop::runloop.getSequenceNumber();
+  if(sampled_ && sampledCycle_ == cycle) return RES_OK;
+
+  for(unsigned int i=0; i<numNodes_; i++) {
+    if(nodes_[order_[i]].kind == NODE_INPUT) run(order_[i]);
+  }
+  sampled_ = true;
+  sampledCycle_ = cycle;
+  return RES_OK;
+}
+
+Result bb::ControlGraph::evaluate() {
+  Result res = sample();
+  if(res != RES_OK) return res;
+
+  for(unsigned int i=0; i<numNodes_; i++) {
+    const Node& n = nodes_[order_[i]];
+    if(n.kind == NODE_CONTROLLER && n.enabled) run(order_[i]);
+  }
+  return RES_OK;
+}
+
+void bb::ControlGraph::resetTiming() {
+  for(unsigned int i=0; i<numNodes_; i++) nodes_[i].timing.reset();
+}
+
+void bb::ControlGraph::printTiming(ConsoleStream* stream) {
+  if(sorted_ == false && sort() != RES_OK) return;
+
+  bb::printf(stream, "Control graph in evaluation order, timing over the last %d runs in us.\n", Runloop::StepTiming::WINDOW);
+  bb::printf(stream, "%-16s %-10s %-24s %6s %6s %6s %6s\n", "node", "kind", "after", "last", "min", "mean", "max");
+  for(unsigned int i=0; i<numNodes_; i++) {
+    const Node& n = nodes_[order_[i]];
+    const char* kind = n.kind == NODE_INPUT ? "input" : (n.kind == NODE_OUTPUT ? "output" : (n.enabled ? "controller" : "disabled"));
+
+    char after[25] = "";
+    size_t len = 0;
+    for(unsigned int j=0; j<numNodes_ && len < sizeof(after); j++) {
+      if(n.preds & (1UL << j)) len += snprintf(after+len, sizeof(after)-len, "%s%s", len ? "," : "", nodes_[j].name);
+    }
+
+    const Runloop::StepTiming& t = n.timing;
+    if(n.kind == NODE_OUTPUT) bb::printf(stream, "%-16s %-10s %-24s\n", n.name, kind, after);
+    else bb::printf(stream, "%-16s %-10s %-24s %6lu %6lu %6lu %6lu\n", n.name, kind, after, t.last(), t.minimum(), t.mean(), t.maximum());
+  }
+}
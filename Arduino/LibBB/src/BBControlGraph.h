@@ -0,0 +1,99 @@
+#if !defined(BBCONTROLGRAPH_H)
+#define BBCONTROLGRAPH_H
+
+#include <stdint.h>
+#include <BBError.h>
+#include <BBControllers.h>
+#include <BBRunloop.h>
+#include <BBConsole.h>
+
+namespace bb {
+
+/*!
+  \brief A set of ControlInputs, PIDControllers and ControlOutputs that are evaluated together, in dependency order.
+
+  Instead of calling update() on inputs and controllers by hand in the right order, register them here and let the
+  graph work out the order. Edges from a controller's input to the controller, and from the controller to its output,
+  are found automatically (PIDController::input() / output()). Dependencies the graph cannot see - an input that is
+  computed from other inputs, an output that sets the goal of other controllers - are added with connect().
+
+  sample() calls ControlInput::sample() on every input, so it can be called early in step(); evaluate() samples
+  if that has not happened in this cycle yet, then updates all enabled controllers in one pass. Controllers added to the
+  graph have their auto update switched off, so that they do not update their inputs a second time.
+
+  Everything is in fixed size tables, nothing is allocated. Node names are not copied.
+*/
+class ControlGraph {
+public:
+  static const unsigned int MAX_NODES = 16;
+  typedef int NodeID;
+  static const NodeID INVALID_NODE = -1;
+
+  ControlGraph();
+
+  //! Returns INVALID_NODE if the table is full or the object is already in the graph.
+  NodeID addInput(ControlInput& input, const char* name);
+  NodeID addController(PIDController& controller, const char* name);
+  NodeID addOutput(ControlOutput& output, const char* name);
+
+  //! from must be evaluated before to. Both must be in the graph. An input can only depend on other inputs, as all
+  //! inputs are sampled before any controller runs; an edge from a controller or output to an input would be one cycle
+  //! late, and returns RES_CMD_INVALID_ARGUMENT.
+  Result connect(NodeID from, NodeID to);
+
+  //! Disabled controllers are skipped by evaluate(). Inputs are always sampled.
+  Result setEnabled(NodeID node, bool enabled);
+  bool isEnabled(NodeID node) const;
+
+  //! Sorts the graph. Called by sample() and evaluate() after the graph has changed; call it yourself after setting the
+  //! graph up to find cycles early. Returns RES_CMD_FAILURE if there is one.
+  Result sort();
+
+  //! Updates all inputs, unless that has already happened in this runloop cycle.
+  Result sample();
+  //! Samples if necessary, then updates all enabled controllers.
+  Result evaluate();
+
+  //! Runloop cycle of the last sample(). Lets code that reads inputs outside the graph check whether they are current.
+  unsigned long sampledCycle() const { return sampledCycle_; }
+  unsigned int numNodes() const { return numNodes_; }
+  const char* nodeName(NodeID node) const;
+  const Runloop::StepTiming* nodeTiming(NodeID node) const;
+
+  void resetTiming();
+  void printTiming(ConsoleStream* stream = NULL);
+
+protected:
+  enum NodeKind {
+    NODE_INPUT,
+    NODE_CONTROLLER,
+    NODE_OUTPUT
+  };
+
+  struct Node {
+    NodeKind kind;
+    const char* name;
+    ControlInput* input;
+    PIDController* controller;
+    ControlOutput* output;   // for controllers, this is the controller itself
+    bool enabled;
+    uint32_t links;          // bit i set means connect(i, this node) was called
+    uint32_t preds;          // links plus the edges found by sort()
+    Runloop::StepTiming timing;
+  };
+
+  NodeID addNode(NodeKind kind, const char* name);
+  NodeID findInput(ControlInput* input) const;
+  NodeID findOutput(ControlOutput* output) const;
+  void run(NodeID node);
+
+  Node nodes_[MAX_NODES];
+  uint8_t order_[MAX_NODES];
+  unsigned int numNodes_;
+  bool sorted_, sampled_;
+  unsigned long sampledCycle_;
+};
+
+};
+
+#endif // BBCONTROLGRAPH_H
@@ -5,6 +5,18 @@
 
 using namespace bb;
 
+bb::Result bb::ControlInput::sample() {
+  unsigned long cycle = Runloop::runloop.getSequenceNumber();
+  if(sampled_ && sampledCycle_ == cycle) return RES_OK;
+  sampled_ = true;
+  sampledCycle_ = cycle;
+  return update();
+}
+
+bool bb::ControlInput::isCurrent() const {
+  return sampled_ && sampledCycle_ == Runloop::runloop.getSequenceNumber();
+}
+
 bb::PIDController::PIDController(ControlInput& input, ControlOutput& output): 
   input_(input), 
   output_(output), 
@@ -22,6 +34,9 @@ bb::PIDController::PIDController(ControlInput& input, ControlOutput& output):
   deadbandMin_ = deadbandMax_ = 0;
   errDeadbandMin_ = errDeadbandMax_ = 0;
   controlOffset_ = 0;
+  feedForward_ = 0;
+  atState_ = AUTOTUNE_IDLE;
+  atKu_ = atTu_ = 0;
 
   reset();
 }
@@ -71,17 +86,23 @@ void bb::PIDController::update(void) {
   } 
   if(err > errDeadbandMin_ && err < errDeadbandMax_) err = 0;
 
-  errI_ += err * dt;
-  if(iBounded_) {
-    errI_ = constrain(errI_, iMin_, iMax_);
-  }
+  if(atState_ == AUTOTUNE_RUNNING) {
+    lastErr_ = err;
+    lastControl_ = autotuneControl(err, dt);
+  } else {
+    errI_ += err * dt;
+    if(iBounded_) {
+      errI_ = constrain(errI_, iMin_, iMax_);
+    }
 
-  lastErrD_ = (err - lastErr_)/dt;
-  lastErr_ = err;
-  lastErrDFiltered_ = differentialFilter_.filter(lastErrD_);
+    lastErrD_ = (err - lastErr_)/dt;
+    lastErr_ = err;
+    lastErrDFiltered_ = differentialFilter_.filter(lastErrD_);
 
-  lastControl_ = kp_ * lastErr_ + ki_ * errI_ + kd_ * lastErrDFiltered_;
-  lastControl_ *= input_.controlGain();
+    lastControl_ = kp_ * lastErr_ + ki_ * errI_ + kd_ * lastErrDFiltered_;
+    lastControl_ *= input_.controlGain();
+    lastControl_ += feedForward_;
+  }
 
   if(controlBounded_) {
     lastControl_ = constrain(lastControl_, controlMin_, controlMax_);
@@ -172,3 +193,129 @@ void bb::PIDController::setErrorDeadband(float errDeadbandMin, float errDeadband
   errDeadbandMax_ = errDeadbandMax;
 }
 
+bb::Result bb::PIDController::startAutotune(float amplitude, float hysteresis, float maxError, unsigned int cycles, float timeout) {
+  if(amplitude <= 0 || hysteresis < 0 || maxError <= hysteresis || cycles == 0 || timeout <= 0) return RES_COMMON_OUT_OF_RANGE;
+
+  atBias_ = lastControl_;
+  if(controlBounded_) {
+    if(controlMax_ - controlMin_ < 2*amplitude) return RES_COMMON_OUT_OF_RANGE;
+    atBias_ = constrain(atBias_, controlMin_ + amplitude, controlMax_ - amplitude);
+  }
+
+  atAmplitude_ = amplitude;
+  atHysteresis_ = hysteresis;
+  atMaxError_ = maxError;
+  atCycles_ = cycles;
+  atTimeout_ = timeout;
+  atTime_ = atRiseTime_ = atFallTime_ = atHalf_ = 0;
+  atErrMin_ = atErrMax_ = lastErr_;
+  atPeriodSum_ = atAmplitudeSum_ = 0;
+  atRises_ = atUsed_ = 0;
+  atHigh_ = lastErr_ > 0;
+  atState_ = AUTOTUNE_RUNNING;
+
+  return RES_OK;
+}
+
+void bb::PIDController::stopAutotune() {
+  if(atState_ != AUTOTUNE_RUNNING) return;
+  atState_ = AUTOTUNE_IDLE;
+  errI_ = 0;
+}
+
+float bb::PIDController::autotuneControl(float err, float dt) {
+  atTime_ += dt;
+  if(fabsf(err) > atMaxError_ || atTime_ > atTimeout_) {
+    atState_ = AUTOTUNE_FAILED;
+    errI_ = 0;
+    return atBias_;
+  }
+
+  atErrMin_ = min(atErrMin_, err);
+  atErrMax_ = max(atErrMax_, err);
+
+  // Before the first switch, and whenever the relay stays on one side for much longer than the last half oscillation,
+  // the bias is too far off for the relay to reach the goal. Move it towards the goal at one amplitude per second.
+  float lastSwitch = max(atRiseTime_, atFallTime_);
+  if(atTime_ - lastSwitch > 2*atHalf_) {
+    atBias_ += (atHigh_ ? atAmplitude_ : -atAmplitude_) * dt;
+    if(controlBounded_) atBias_ = constrain(atBias_, controlMin_ + atAmplitude_, controlMax_ - atAmplitude_);
+  }
+
+  if(atHigh_ && err < -atHysteresis_) {
+    atHigh_ = false;
+    atHalf_ = atTime_ - lastSwitch;
+    atFallTime_ = atTime_;
+  } else if(!atHigh_ && err > atHysteresis_) {
+    atHigh_ = true;
+    atHalf_ = atTime_ - lastSwitch;
+    if(atRises_ > 0) {
+      // One full oscillation since the last rise. The first one is still settling; after that, only take those where
+      // the bias has settled, too, and the output was high about as long as it was low.
+      float period = atTime_ - atRiseTime_;
+      float asymmetry = ((atFallTime_ - atRiseTime_) - (atTime_ - atFallTime_)) / period;
+      if(atRises_ > 1 && fabsf(asymmetry) < 0.25f) {
+        atPeriodSum_ += period;
+        atAmplitudeSum_ += (atErrMax_ - atErrMin_) / 2;
+        atUsed_++;
+      }
+
+      // Average output over the last oscillation
+      atBias_ += atAmplitude_ * asymmetry;
+      if(controlBounded_) atBias_ = constrain(atBias_, controlMin_ + atAmplitude_, controlMax_ - atAmplitude_);
+    }
+    atRises_++;
+    atRiseTime_ = atTime_;
+    atErrMin_ = atErrMax_ = err;
+
+    if(atUsed_ >= atCycles_) {
+      float a = atAmplitudeSum_ / atUsed_;
+      errI_ = 0;
+      if(a <= atHysteresis_) {
+        atState_ = AUTOTUNE_FAILED;
+        return atBias_;
+      }
+      // Describing function of a relay with hysteresis
+      atKu_ = 4 * atAmplitude_ / (M_PI * sqrtf(a*a - atHysteresis_*atHysteresis_));
+      atTu_ = atPeriodSum_ / atUsed_;
+      atGain_ = input_.controlGain();
+      atState_ = AUTOTUNE_DONE;
+      return atBias_;
+    }
+  }
+
+  return atHigh_ ? atBias_ + atAmplitude_ : atBias_ - atAmplitude_;
+}
+
+bool bb::PIDController::getAutotuneResult(float& ku, float& tu) {
+  if(atState_ != AUTOTUNE_DONE) return false;
+  ku = atKu_;
+  tu = atTu_;
+  return true;
+}
+
+bool bb::PIDController::autotuneGains(AutotuneRule rule, float& kp, float& ki, float& kd) {
+  if(atState_ != AUTOTUNE_DONE || EPSILON(atGain_)) return false;
+
+  // The relay acts on the output directly, the PID law is scaled by the input's control gain.
+  float ku = atKu_ / atGain_;
+  switch(rule) {
+  case AUTOTUNE_ZN_PID:
+    kp = 0.6f * ku;
+    ki = kp / (atTu_ / 2);
+    kd = kp * atTu_ / 8;
+    break;
+  case AUTOTUNE_TL_PI:
+    kp = ku / 3.2f;
+    ki = kp / (2.2f * atTu_);
+    kd = 0;
+    break;
+  case AUTOTUNE_ZN_PI:
+  default:
+    kp = 0.45f * ku;
+    ki = kp / (atTu_ / 1.2f);
+    kd = 0;
+    break;
+  }
+  return true;
+}
@@ -7,11 +7,32 @@
 
 namespace bb {
 
+/*!
+  \brief Something a controller can read, like an encoder or an IMU axis.
+
+  update() reads the hardware and advances filters; present() only returns what the last update() computed, so it is
+  cheap and can be called as often as needed without changing anything. Code that reads an input from several places
+  should call sample() instead of update(), which does nothing if the input has already been updated in the current
+  runloop cycle.
+*/
 class ControlInput {
 public:
+  ControlInput(): sampled_(false), sampledCycle_(0) {}
+
   virtual float present() = 0;
   virtual Result update() = 0;
   virtual float controlGain() { return 1.0f; }
+
+  //! Calls update() unless sample() was already called in this runloop cycle.
+  Result sample();
+  //! Runloop cycle of the last sample().
+  unsigned long sampledCycle() const { return sampledCycle_; }
+  //! False if present() is from an earlier cycle, or sample() has never been called.
+  bool isCurrent() const;
+
+protected:
+  bool sampled_;
+  unsigned long sampledCycle_;
 };
 
 class ControlOutput {
@@ -34,6 +55,9 @@ public:
   void setAutoUpdate(bool yesno) { autoupdate_ = yesno; }
   bool doesAutoUpdate() { return autoupdate_; }
 
+  ControlInput& input() { return input_; }
+  ControlOutput& output() { return output_; }
+
   void setDebug(bool yesno) { debug_ = yesno; }
 
   void setGoal(const float& sp);
@@ -46,8 +70,12 @@ public:
   void setControlParameters(const float& kp, const float& ki, const float& kd);
   void getControlParameters(float& kp, float& ki, float& kd);
   void getControlState(float& err, float& errI, float& errD, float& control);
+  //! Added to the output after control bounds and deadband, e.g. the center position of a servo.
   void setControlOffset(float offset) { controlOffset_ = offset; }
   float controlOffset() { return controlOffset_; }
+  //! Added to the control before control bounds are applied, so that feed-forward and feedback together stay in them.
+  void setFeedForward(float ff) { feedForward_ = ff; }
+  float feedForward() { return feedForward_; }
 
   void setIBounds(float iMin, float iMax);
   void setIUnbounded();
@@ -72,9 +100,48 @@ public:
   void setRamp(float ramp) { ramp_ = ramp; }
   float ramp(void) { return ramp_; }
 
+  enum AutotuneState {
+    AUTOTUNE_IDLE,
+    AUTOTUNE_RUNNING,
+    AUTOTUNE_DONE,
+    AUTOTUNE_FAILED
+  };
+
+  enum AutotuneRule {
+    AUTOTUNE_ZN_PI,  //!< Ziegler-Nichols PI
+    AUTOTUNE_ZN_PID, //!< Ziegler-Nichols PID
+    AUTOTUNE_TL_PI   //!< Tyreus-Luyben PI - slower, but with much less overshoot than Ziegler-Nichols
+  };
+
+  /*! \brief Relay autotuning (Astrom-Hagglund) around the current goal.
+
+    Instead of the PID law, update() switches the control output between bias + amplitude and bias - amplitude
+    whenever the error changes sign, which makes the loop oscillate at its ultimate period. The bias starts at the
+    current control output and follows the average output, so that the oscillation is symmetric even when holding the
+    goal takes a nonzero output; if the relay cannot reach the goal at all, the bias moves towards it. The ultimate gain
+    and period are averaged over the given number of oscillations, after one to settle. Gains are not changed; get
+    proposals from autotuneGains().
+
+    Fails (and falls back to the bias as the output) if the error gets larger than maxError, or if there are not
+    enough oscillations within timeout seconds. Control bounds still apply, and limit amplitude and bias.
+    \param amplitude   Relay amplitude, in control output units.
+    \param hysteresis  Error band in which the relay does not switch, in input units. Set above the input noise.
+    \param maxError    Largest error before giving up, in input units.
+  */
+  Result startAutotune(float amplitude, float hysteresis, float maxError, unsigned int cycles = 4, float timeout = 30.0f);
+  //! Back to PID control with unchanged gains.
+  void stopAutotune();
+  AutotuneState autotuneState() { return atState_; }
+  //! Ultimate gain (in control output units per input unit) and period (s) of the last successful autotune.
+  bool getAutotuneResult(float& ku, float& tu);
+  //! Gains for this controller from the last successful autotune, by the given tuning rule.
+  bool autotuneGains(AutotuneRule rule, float& kp, float& ki, float& kd);
+
 protected:
   //! Overwrite this if you want to modify the pure control output with something.
   virtual Result setControlOutput(float value) { return output_.set(value); } 
+  //! Relay output for one autotune step.
+  float autotuneControl(float err, float dt);
 
   ControlInput& input_;
   ControlOutput& output_;
@@ -91,8 +158,15 @@ protected:
   float errDeadbandMin_, errDeadbandMax_;
   float goal_, ramp_, curSetpoint_;
   unsigned long lastCycleUS_;
-  float controlOffset_;
+  float controlOffset_, feedForward_;
   bb::LowPassFilter differentialFilter_;
+
+  AutotuneState atState_;
+  float atAmplitude_, atHysteresis_, atMaxError_, atTimeout_, atGain_;
+  float atBias_, atTime_, atRiseTime_, atFallTime_, atHalf_, atErrMin_, atErrMax_;
+  float atPeriodSum_, atAmplitudeSum_, atKu_, atTu_;
+  unsigned int atCycles_, atRises_, atUsed_;
+  bool atHigh_;
 };
 
 
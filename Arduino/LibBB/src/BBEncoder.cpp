@@ -2,41 +2,68 @@
 #include <BBConsole.h>
 
 #if defined(ARDUINO_CYTRON_MOTION_2350_PRO)
+#include <atomic>
+
 static const uint8_t NUM_ENC_SLOTS = 10;
 
+// Written only by the encoder's ISR, read only by Encoder::update(). value and edgeUS are published together under a
+// sequence lock: seq is odd while the ISR is writing, and the reader retries if it changed under it. No locking,
+// no disabling interrupts, and update() may run on the other core.
 struct EncDescr {
-  long value = 0;
+  volatile long value = 0;
+  volatile uint32_t edgeUS = 0;  // micros() at the last edge that moved value
+  std::atomic<uint32_t> seq{0};
   uint8_t pinA = 0, pinB = 0;
   uint8_t state = 0;
-  bool taken = false;
+  volatile bool taken = false;
 };
 
-static volatile EncDescr encDescr_[NUM_ENC_SLOTS];
+static EncDescr encDescr_[NUM_ENC_SLOTS];
 
 static inline __attribute__((always_inline)) void isr(int i) {  
   if(i >= NUM_ENC_SLOTS) return;
-  //noInterrupts();
-  uint8_t s = encDescr_[i].state;
-  if(digitalRead(encDescr_[i].pinA)) s |= 4;
-  if(digitalRead(encDescr_[i].pinB)) s |= 8;
+  EncDescr& d = encDescr_[i];
+  uint8_t s = d.state;
+  if(digitalRead(d.pinA)) s |= 4;
+  if(digitalRead(d.pinB)) s |= 8;
+  d.state = (s >> 2);
+
+  long delta;
   switch(s) {
   case 0: case 5: case 10: case 15:
-    break; // no movement
+    return; // no movement
   case 1: case 7: case 8: case 14:
-    encDescr_[i].value++;
+    delta = 1;
     break;
   case 2: case 4: case 11: case 13:
-    encDescr_[i].value--;
+    delta = -1;
     break;
   case 3: case 12:
-    encDescr_[i].value += 2;
+    delta = 2;
     break;
   default:
-    encDescr_[i].value -= 2;
+    delta = -2;
     break;
   }
-  encDescr_[i].state = (s >> 2);
-  //interrupts();
+
+  uint32_t now = micros();
+  uint32_t seq = d.seq.load(std::memory_order_relaxed);
+  d.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  d.value = d.value + delta;
+  d.edgeUS = now;
+  d.seq.store(seq + 2, std::memory_order_release);
+}
+
+static void readEncoder(uint8_t i, long& value, uint32_t& edgeUS) {
+  const EncDescr& d = encDescr_[i];
+  uint32_t seq;
+  do {
+    seq = d.seq.load(std::memory_order_acquire);
+    value = d.value;
+    edgeUS = d.edgeUS;
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while((seq & 1) || seq != d.seq.load(std::memory_order_relaxed));
 }
 
 static inline void isr0() {isr(0);}
@@ -55,8 +82,9 @@ bb::Encoder::Encoder(uint8_t pin_enc_a, uint8_t pin_enc_b, InputMode mode, Unit
 #if !defined(ARDUINO_CYTRON_MOTION_2350_PRO)
   enc_(pin_enc_a, pin_enc_b),
 #endif
-  filtSpeed_(25, 100, true), 
-  filtPos_(25, 100, true) {
+  filters_(100) {
+  filters_.setLowPass(FILTER_POS, 25);
+  filters_.setLowPass(FILTER_SPEED, 25);
   mode_ = mode;
   unit_ = unit;
   mmPT_ = 1.0;
@@ -65,6 +93,8 @@ bb::Encoder::Encoder(uint8_t pin_enc_a, uint8_t pin_enc_b, InputMode mode, Unit
   presentPos_ = enc_.read();
 #else
   presentPos_ = 0;
+  lastEdgeTicks_ = 0;
+  lastEdgeUS_ = lastCycleUS_;
   pinEncA_ = pin_enc_a;
   pinEncB_ = pin_enc_b;
 
@@ -144,14 +174,39 @@ void bb::Encoder::setUnit(Encoder::Unit unit) {
 
 bb::Result bb::Encoder::update() {
 #if defined(ARDUINO_CYTRON_MOTION_2350_PRO)
-  unsigned long ticks = encDescr_[enc_].value; // FIXME
+  if(enc_ >= NUM_ENC_SLOTS) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+
+  long ticks;
+  uint32_t edgeUS;
+  readEncoder(enc_, ticks, edgeUS);
+  unsigned long us = micros();
+
+  lastCycleTicks_ = ticks - presentPos_;
+  presentPos_ = ticks;
+  unsigned long dt = us - lastCycleUS_;
+  lastCycleUS_ = us;
+
+  // Speed from the time between edges, as the ISR saw them, not between runloop cycles. At low speeds that is the
+  // difference between a clean signal and one that jumps between 0 and one tick per cycle.
+  if(ticks != lastEdgeTicks_) {
+    uint32_t edgeDT = edgeUS - lastEdgeUS_;
+    if(edgeDT != 0) presentSpeed_ = (float)(ticks - lastEdgeTicks_) * 1e6f / (float)edgeDT;
+    lastEdgeTicks_ = ticks;
+    lastEdgeUS_ = edgeUS;
+  } else {
+    // No edge since last time, so we can be no faster than one tick since the last edge.
+    uint32_t sinceUS = us - lastEdgeUS_;
+    if(sinceUS >= STANDSTILL_US) {
+      presentSpeed_ = 0;
+    } else if(sinceUS != 0 && fabsf(presentSpeed_) * sinceUS > 1e6f) {
+      presentSpeed_ = copysignf(1e6f / sinceUS, presentSpeed_);
+    }
+  }
 #else
   unsigned long ticks = enc_.read();
-#endif
 
   lastCycleTicks_ = ticks - presentPos_; // FIXME compensate for wrap?
   presentPos_ = ticks;
-  presentPosFiltered_ = filtPos_.filter(presentPos_);
 
   unsigned long us = micros();
   unsigned long dt;
@@ -163,7 +218,13 @@ bb::Result bb::Encoder::update() {
   lastCycleUS_ = us;
 
   presentSpeed_ = ((double)lastCycleTicks_ / (double)dt)*1e6;
-  presentSpeedFiltered_ = filtSpeed_.filter(presentSpeed_);
+#endif
+
+  float filtered[2] = { float(presentPos_), presentSpeed_ };
+  if(dt != 0) filters_.setSampleFrequency(1e6f / dt, FILTER_RATE_TOLERANCE);
+  filters_.filter(filtered);
+  presentPosFiltered_ = filtered[FILTER_POS];
+  presentSpeedFiltered_ = filtered[FILTER_SPEED];
 
   return RES_OK;
 }
@@ -205,17 +266,17 @@ float bb::Encoder::presentSpeed(bool raw) {
 
 
 float bb::Encoder::speedFilterCutoff() {
-  return filtSpeed_.cutoff();
+  return filters_.frequency(FILTER_SPEED);
 }
   
 void bb::Encoder::setSpeedFilterCutoff(float co) {
-  filtSpeed_.setCutoff(co);
+  filters_.setLowPass(FILTER_SPEED, co);
 }
 
 float  bb::Encoder::positionFilterCutoff() {
-  return filtPos_.cutoff();
+  return filters_.frequency(FILTER_POS);
 }
 
 void bb::Encoder::setPositionFilterCutoff(float co) {
-  filtPos_.setCutoff(co);
+  filters_.setLowPass(FILTER_POS, co);
 }
@@ -6,7 +6,7 @@
 #endif // ARDUINO_CYTRON_MOTION_2350_PRO
 
 #include <BBControllers.h>
-#include <BBLowPassFilter.h>
+#include <BBFilterBank.h>
 #include <limits.h>
 #include <math.h>
 
@@ -30,6 +30,9 @@ public:
   void setUnit(Unit unit);
   InputMode mode() { return mode_; }
   Unit unit() { return unit_; }
+
+  // The present...() functions return what the last update() read. Update once per cycle, through sample() if the
+  // encoder is read in several places - the speed of the SAMD version is ticks per time between updates.
   virtual float present();
   virtual float present(InputMode mode, bool raw = false);
   virtual float presentPosition(bool raw = false);
@@ -50,12 +53,19 @@ protected:
   InputMode mode_;
   Unit unit_;
 #if defined(ARDUINO_CYTRON_MOTION_2350_PRO)
+  static const uint32_t STANDSTILL_US = 250000; // no edge for this long means speed 0
+
   uint8_t enc_;
   uint8_t pinEncA_, pinEncB_;
+  long lastEdgeTicks_;   // position and ISR timestamp of the last edge speed was computed from
+  uint32_t lastEdgeUS_;
 #else
   ::Encoder enc_; // FIXME -- since this requires SAMD, possibly replace by own encoder handling?
 #endif
-  bb::LowPassFilter filtSpeed_, filtPos_;
+  // Position and speed, filtered together at the measured update rate
+  enum { FILTER_POS = 0, FILTER_SPEED = 1 };
+  static constexpr float FILTER_RATE_TOLERANCE = 1.0f/64; // relative, as LowPassFilter's adaptive mode
+  bb::FilterBank<2> filters_;
 
   float mmPT_;
   long lastCycleTicks_;
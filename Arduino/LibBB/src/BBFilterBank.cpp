@@ -0,0 +1,40 @@
+#include <math.h>
+#include <BBFilterBank.h>
+
+bb::BiquadCoefficients bb::BiquadCoefficients::passThrough() {
+  BiquadCoefficients k;
+  k.b0 = 1; k.b1 = k.b2 = 0;
+  k.a1 = k.a2 = 0;
+  return k;
+}
+
+bb::BiquadCoefficients bb::BiquadCoefficients::butterworthLowPass(float cutoff, float sampleFreq, unsigned int order, unsigned int section) {
+  // Analog prototype s^2 + (w0/Q) s + w0^2 for the section's pole pair, through s = 2/T (1-z^-1)/(1+z^-1)
+  float q = 1.0f / (2.0f * cosf((2*section + 1) * M_PI / (2*order)));
+  float alpha = 2 * M_PI * cutoff / sampleFreq;
+  float alphaSq = alpha*alpha;
+  float d = alphaSq + 2*alpha/q + 4;
+
+  BiquadCoefficients k;
+  k.b0 = alphaSq / d;
+  k.b1 = 2*k.b0;
+  k.b2 = k.b0;
+  k.a1 = (2*alphaSq - 8) / d;
+  k.a2 = (alphaSq - 2*alpha/q + 4) / d;
+  return k;
+}
+
+bb::BiquadCoefficients bb::BiquadCoefficients::notch(float center, float q, float sampleFreq) {
+  float w = 2 * M_PI * center / sampleFreq;
+  float alpha = sinf(w) / (2*q);
+  float cosw = cosf(w);
+  float a0 = 1 + alpha;
+
+  BiquadCoefficients k;
+  k.b0 = 1 / a0;
+  k.b1 = -2*cosw / a0;
+  k.b2 = k.b0;
+  k.a1 = k.b1;
+  k.a2 = (1 - alpha) / a0;
+  return k;
+}
@@ -0,0 +1,201 @@
+#if !defined(BBFILTERBANK_H)
+#define BBFILTERBANK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <BBError.h>
+
+// GCC vector extensions map to SSE / NEON where the target has them. The MCUs the droids run on have no float SIMD
+// (SAMD21 has no FPU at all, the RP2350's M33 and the ESP32 have scalar FPUs), so they get the scalar loop.
+#if defined(__GNUC__) && (defined(__SSE__) || defined(__ARM_NEON))
+#define BB_FILTERBANK_SIMD 1
+#else
+#define BB_FILTERBANK_SIMD 0
+#endif
+
+namespace bb {
+
+//! One biquad section, normalized to a0 = 1: y = b0 x + b1 x[-1] + b2 x[-2] - a1 y[-1] - a2 y[-2].
+struct BiquadCoefficients {
+  float b0, b1, b2, a1, a2;
+
+  static BiquadCoefficients passThrough();
+  //! Section `section` of a Butterworth low pass of even order `order`, which takes order/2 sections. Bilinear
+  //! transform without prewarping, so that order 2 is exactly LowPassFilter.
+  static BiquadCoefficients butterworthLowPass(float cutoff, float sampleFreq, unsigned int order = 2, unsigned int section = 0);
+  //! Notch at center frequency, with bandwidth center/q. Prewarped, so the notch is exactly where it is asked for.
+  static BiquadCoefficients notch(float center, float q, float sampleFreq);
+};
+
+/*!
+  \brief CHANNELS independent filters of up to SECTIONS cascaded biquads each, all updated in one pass.
+
+  Coefficients and state are stored by section, then by channel, so that one section of several channels is computed
+  with the same instructions - four at a time on hosts with SSE or NEON. Sections run in transposed direct form II.
+  Coefficients are computed when a filter is set up or the sample frequency changes, never per sample; unused sections
+  pass through.
+
+  Use it where one owner has several signals sampled at the same rate, e.g. all axes of an IMU.
+*/
+template<unsigned int CHANNELS, unsigned int SECTIONS = 1> class FilterBank {
+public:
+#if BB_FILTERBANK_SIMD
+  typedef float Lanes __attribute__((vector_size(16)));
+  static const unsigned int LANES = 4;
+#else
+  typedef float Lanes;
+  static const unsigned int LANES = 1;
+#endif
+  static const unsigned int GROUPS = (CHANNELS + LANES - 1) / LANES;
+
+  FilterBank(float sampleFreq = 100.0f): sampleFreq_(sampleFreq) {
+    // so that the lanes past CHANNELS compute zeros, not garbage
+    memset(b0_, 0, sizeof(b0_)); memset(b1_, 0, sizeof(b1_)); memset(b2_, 0, sizeof(b2_));
+    memset(a1_, 0, sizeof(a1_)); memset(a2_, 0, sizeof(a2_));
+    for(unsigned int c=0; c<CHANNELS; c++) setPassThrough(c);
+    reset();
+  }
+
+  //! Recomputes all coefficients, if the frequency has moved by more than tolerance (relative) - so that owners that
+  //! measure their sample time can pass it on every sample. Notches that end up at or above Nyquist pass through until
+  //! the frequency is high enough again; RES_COMMON_OUT_OF_RANGE says there are any.
+  Result setSampleFrequency(float sampleFreq, float tolerance = 0) {
+    if(sampleFreq <= 0) return RES_COMMON_OUT_OF_RANGE;
+    if(fabsf(sampleFreq - sampleFreq_) <= sampleFreq_ * tolerance) return RES_OK;
+    sampleFreq_ = sampleFreq;
+    Result res = RES_OK;
+    for(unsigned int c=0; c<CHANNELS; c++) {
+      for(unsigned int s=0; s<SECTIONS; s++) {
+        if(!design(c, s)) res = RES_COMMON_OUT_OF_RANGE;
+      }
+    }
+    return res;
+  }
+  float sampleFrequency() const { return sampleFreq_; }
+  //! Cutoff or center frequency of a section; 0 if it passes through or has fixed coefficients.
+  float frequency(unsigned int channel, unsigned int section = 0) const {
+    if(channel >= CHANNELS || section >= SECTIONS) return 0;
+    const Design& d = designs_[channel][section];
+    return (d.type == DESIGN_LOWPASS || d.type == DESIGN_NOTCH) ? d.freq : 0;
+  }
+
+  //! Butterworth low pass of even order, in sections 0 .. order/2-1 of the channel.
+  Result setLowPass(unsigned int channel, float cutoff, unsigned int order = 2) {
+    if(channel >= CHANNELS || order < 2 || (order & 1) || order/2 > SECTIONS) return RES_COMMON_OUT_OF_RANGE;
+    for(unsigned int s=0; s<order/2; s++) {
+      designs_[channel][s] = Design(DESIGN_LOWPASS, cutoff, order, s);
+      design(channel, s);
+    }
+    return RES_OK;
+  }
+
+  //! Notch in the given section of the channel - e.g. at the frequency of motor vibration.
+  Result setNotch(unsigned int channel, unsigned int section, float center, float q = 2.0f) {
+    if(channel >= CHANNELS || section >= SECTIONS || center <= 0 || center >= sampleFreq_/2 || q <= 0) return RES_COMMON_OUT_OF_RANGE;
+    designs_[channel][section] = Design(DESIGN_NOTCH, center, q, 0);
+    design(channel, section);
+    return RES_OK;
+  }
+
+  //! Fixed coefficients, not recomputed when the sample frequency changes.
+  Result setSection(unsigned int channel, unsigned int section, const BiquadCoefficients& coeffs) {
+    if(channel >= CHANNELS || section >= SECTIONS) return RES_COMMON_OUT_OF_RANGE;
+    designs_[channel][section] = Design(DESIGN_FIXED, 0, 0, 0);
+    store(channel, section, coeffs);
+    return RES_OK;
+  }
+
+  Result setPassThrough(unsigned int channel) {
+    if(channel >= CHANNELS) return RES_COMMON_OUT_OF_RANGE;
+    for(unsigned int s=0; s<SECTIONS; s++) {
+      designs_[channel][s] = Design(DESIGN_PASSTHROUGH, 0, 0, 0);
+      design(channel, s);
+    }
+    return RES_OK;
+  }
+
+  void reset() {
+    memset(z1_, 0, sizeof(z1_));
+    memset(z2_, 0, sizeof(z2_));
+  }
+
+  //! Filters one sample per channel, in place.
+  void filter(float values[CHANNELS]) { filter(values, values); }
+
+  //! Filters one sample per channel. in and out may be the same.
+  void filter(const float in[CHANNELS], float out[CHANNELS]) {
+    Lanes v[GROUPS];
+    memset(v, 0, sizeof(v));
+    memcpy(v, in, CHANNELS * sizeof(float));
+    for(unsigned int s=0; s<SECTIONS; s++) {
+      for(unsigned int g=0; g<GROUPS; g++) {
+        Lanes x = v[g];
+        Lanes y = b0_[s][g]*x + z1_[s][g];
+        z1_[s][g] = b1_[s][g]*x - a1_[s][g]*y + z2_[s][g];
+        z2_[s][g] = b2_[s][g]*x - a2_[s][g]*y;
+        v[g] = y;
+      }
+    }
+    memcpy(out, v, CHANNELS * sizeof(float));
+  }
+
+protected:
+  enum DesignType {
+    DESIGN_PASSTHROUGH,
+    DESIGN_LOWPASS,
+    DESIGN_NOTCH,
+    DESIGN_FIXED
+  };
+
+  struct Design {
+    Design(): type(DESIGN_PASSTHROUGH), freq(0), param(0), section(0) {}
+    Design(DesignType t, float f, float p, uint8_t s): type(t), freq(f), param(p), section(s) {}
+    DesignType type;
+    float freq, param; // param is order for low pass, q for notch
+    uint8_t section;
+  };
+
+  // False if the design can't be realized at the present sample frequency, and passes through instead.
+  bool design(unsigned int c, unsigned int s) {
+    const Design& d = designs_[c][s];
+    switch(d.type) {
+    case DESIGN_LOWPASS:
+      store(c, s, BiquadCoefficients::butterworthLowPass(d.freq, sampleFreq_, (unsigned int)d.param, d.section));
+      break;
+    case DESIGN_NOTCH:
+      if(d.freq >= sampleFreq_/2) {
+        store(c, s, BiquadCoefficients::passThrough());
+        return false;
+      }
+      store(c, s, BiquadCoefficients::notch(d.freq, d.param, sampleFreq_));
+      break;
+    case DESIGN_PASSTHROUGH:
+      store(c, s, BiquadCoefficients::passThrough());
+      break;
+    case DESIGN_FIXED:
+    default:
+      break;
+    }
+    return true;
+  }
+
+  void store(unsigned int c, unsigned int s, const BiquadCoefficients& k) {
+    lane(b0_[s], c) = k.b0;
+    lane(b1_[s], c) = k.b1;
+    lane(b2_[s], c) = k.b2;
+    lane(a1_[s], c) = k.a1;
+    lane(a2_[s], c) = k.a2;
+  }
+
+  static float& lane(Lanes* groups, unsigned int c) { return reinterpret_cast<float*>(groups)[c]; }
+
+  float sampleFreq_;
+  Design designs_[CHANNELS][SECTIONS];
+  Lanes b0_[SECTIONS][GROUPS], b1_[SECTIONS][GROUPS], b2_[SECTIONS][GROUPS], a1_[SECTIONS][GROUPS], a2_[SECTIONS][GROUPS];
+  Lanes z1_[SECTIONS][GROUPS], z2_[SECTIONS][GROUPS];
+};
+
+};
+
+#endif // BBFILTERBANK_H
@@ -0,0 +1,68 @@
+#if !defined(BBFIXEDPOINT_H)
+#define BBFIXEDPOINT_H
+
+#include <stdint.h>
+
+namespace bb {
+
+//! Q16.16 fixed point number, for control code on MCUs without an FPU (SAMD21, AVR). Range is about +-32768 with a
+//! resolution of 1/65536. All arithmetic saturates instead of wrapping. Division needs a 64 bit divide and is slow
+//! on those MCUs; precompute reciprocals where possible.
+class Fix16 {
+public:
+  static const int32_t RAW_MAX = INT32_MAX;
+  static const int32_t RAW_MIN = -INT32_MAX; // symmetric, so that negating never overflows
+  static const int32_t RAW_ONE = 0x10000;
+
+  Fix16(): raw_(0) {}
+  Fix16(float f): raw_(fromFloat(f)) {}
+  static Fix16 fromRaw(int32_t raw) { Fix16 f; f.raw_ = raw; return f; }
+
+  int32_t raw() const { return raw_; }
+  float toFloat() const { return raw_ / float(RAW_ONE); }
+  explicit operator float() const { return toFloat(); }
+
+  Fix16 operator+(Fix16 other) const { return fromRaw(saturate(int64_t(raw_) + other.raw_)); }
+  Fix16 operator-(Fix16 other) const { return fromRaw(saturate(int64_t(raw_) - other.raw_)); }
+  Fix16 operator-() const { return fromRaw(-raw_); }
+  Fix16 operator*(Fix16 other) const { return fromRaw(saturate((int64_t(raw_) * other.raw_ + (RAW_ONE >> 1)) >> 16)); }
+  Fix16 operator/(Fix16 other) const {
+    if(other.raw_ == 0) return fromRaw(raw_ >= 0 ? RAW_MAX : RAW_MIN);
+    return fromRaw(saturate((int64_t(raw_) << 16) / other.raw_));
+  }
+
+  Fix16& operator+=(Fix16 other) { return *this = *this + other; }
+  Fix16& operator-=(Fix16 other) { return *this = *this - other; }
+  Fix16& operator*=(Fix16 other) { return *this = *this * other; }
+  Fix16& operator/=(Fix16 other) { return *this = *this / other; }
+
+  bool operator==(Fix16 other) const { return raw_ == other.raw_; }
+  bool operator!=(Fix16 other) const { return raw_ != other.raw_; }
+  bool operator<(Fix16 other) const  { return raw_ < other.raw_; }
+  bool operator>(Fix16 other) const  { return raw_ > other.raw_; }
+  bool operator<=(Fix16 other) const { return raw_ <= other.raw_; }
+  bool operator>=(Fix16 other) const { return raw_ >= other.raw_; }
+
+protected:
+  static int32_t saturate(int64_t v) {
+    if(v > RAW_MAX) return RAW_MAX;
+    if(v < RAW_MIN) return RAW_MIN;
+    return int32_t(v);
+  }
+  static int32_t fromFloat(float f) {
+    float scaled = f * float(RAW_ONE);
+    if(scaled >= 2147483520.0f) return RAW_MAX; // largest float below 2^31
+    if(scaled <= -2147483520.0f) return RAW_MIN;
+    return int32_t(scaled >= 0 ? scaled + 0.5f : scaled - 0.5f);
+  }
+
+  int32_t raw_;
+};
+
+// So that code templated on the scalar type can convert back without caring which one it is.
+inline float toFloat(float f) { return f; }
+inline float toFloat(Fix16 f) { return f.toFloat(); }
+
+};
+
+#endif // BBFIXEDPOINT_H
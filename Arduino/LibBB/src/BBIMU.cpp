@@ -5,21 +5,42 @@
 #include <vector>
 #include <limits.h>
 
+// ISM330DHCX registers and fields used for the FIFO, which the Adafruit driver does not cover
+static const uint8_t REG_FIFO_CTRL1 = 0x07, REG_FIFO_CTRL2 = 0x08, REG_FIFO_CTRL3 = 0x09, REG_FIFO_CTRL4 = 0x0a;
+static const uint8_t REG_INT1_CTRL = 0x0d, REG_CTRL10_C = 0x19;
+static const uint8_t REG_FIFO_STATUS1 = 0x3a, REG_FIFO_DATA_OUT_TAG = 0x78;
+static const uint8_t FIFO_BDR_417HZ = 0x66;               // gyro and accel batched at 417Hz
+static const uint8_t FIFO_MODE_BYPASS = 0x00, FIFO_MODE_CONTINUOUS = 0x06, FIFO_TS_EVERY_BATCH = 0x40;
+static const uint8_t INT1_FIFO_TH = 0x08, TIMESTAMP_EN = 0x20, FIFO_OVR_IA = 0x40;
+static const uint8_t FIFO_TEMP_12HZ = 0x20;               // temperature batched at 12.5Hz
+static const uint8_t TAG_GYRO = 0x01, TAG_ACCEL = 0x02, TAG_TEMPERATURE = 0x03, TAG_TIMESTAMP = 0x04;
+static const unsigned int FIFO_ENTRY_SIZE = 7;            // tag byte and six data bytes
+static const float FIFO_RATE = 416.0f;
+static const float TIMESTAMP_RESOLUTION = 25e-6f;         // seconds per timestamp LSB
+static const float ACCEL_SENSITIVITY = 0.122e-3f;         // g per LSB at +-4g
+static const float GYRO_SENSITIVITY = 70e-3f;             // deg/s per LSB at +-2000deg/s
+static const float TEMP_SENSITIVITY = 1.0f / 256.0f;      // K per LSB, 0 at 25C
+static const unsigned long CALIBRATION_SAVE_INTERVAL = 30UL * 60UL * 1000UL; // ms; flash wears
+
+// Only one IMU per droid can have its watermark interrupt connected.
+static volatile bool fifoWatermark = false;
+static void fifoWatermarkISR() { fifoWatermark = true; }
+
 bb::IMUControlInput::IMUControlInput(IMU& imu, IMUControlInput::ProbeType pt, bool inverse): filter_(100.0f, 100.0), imu_(imu) {
   pt_ = pt;
   bias_ = 0;
   deadband_ = 0;
   inv_ = inverse;
+  value_ = 0;
 }
 
 bb::Result bb::IMUControlInput::update() {
   // IMU update() is manually called in main droid step() function, so we don't do it here
-  return RES_OK;
-}
-
-float bb::IMUControlInput::present() {
   float p, r, h;
-  if(imu_.getFilteredPRH(p, r, h) == false) return 0.0f;
+  if(imu_.getFilteredPRH(p, r, h) == false) {
+    value_ = 0.0f;
+    return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  }
   
   float retval=0;
 
@@ -35,9 +56,14 @@ float bb::IMUControlInput::present() {
     break;
   }
 
-  if(fabs(retval) < fabs(deadband_)) return 0.0f;
-  if(inv_) return -retval;
-  return retval;
+  if(fabs(retval) < fabs(deadband_)) value_ = 0.0f;
+  else if(inv_) value_ = -retval;
+  else value_ = retval;
+  return RES_OK;
+}
+
+float bb::IMUControlInput::present() {
+  return value_;
 }
 
 void bb::IMUControlInput::setFilterCutoff(float frequency) {
@@ -46,13 +72,20 @@ void bb::IMUControlInput::setFilterCutoff(float frequency) {
 
 bb::IMU::IMU() {
   available_ = false;
-  calP_ = calR_ = calH_ = 0.0f;
-  calX_ = calY_ = calZ_ = 0.0f;
+  temperature_ = 25.0f;
+  calHandle_ = 0;
+  lastCalSave_ = 0;
   intRunning_ = false;
   rot_ = ROTATE_0;
+  sensorLowPassOn_ = sensorNotchOn_ = false;
+  fifoIntPin_ = -1;
+  fifoHaveGyro_ = fifoHaveAccel_ = false;
+  fifoTS_ = fusedTS_ = 0;
+  fifoTSValid_ = fusedTSValid_ = false;
+  fifoOverruns_ = 0;
 }
 
-bool bb::IMU::begin(uint8_t addr) {
+bool bb::IMU::begin(uint8_t addr, int fifoIntPin) {
   if(available_) return true;
 
   addr_ = addr;
@@ -88,11 +121,36 @@ bool bb::IMU::begin(uint8_t addr) {
     return false;
   }
 
-  imu_.setAccelDataRate(LSM6DS_RATE_104_HZ);
-  imu_.setGyroDataRate(LSM6DS_RATE_104_HZ);
-  dataRate_ = 104.0;
-  Runloop::runloop.setCycleTimeMicros(1000000/dataRate_);
-  madgwick_.begin(dataRate_);
+  sensors_event_t t;
+  // Ranges fixed, as FIFO readings are raw and converted with the sensitivities above
+  imu_.setAccelRange(LSM6DS_ACCEL_RANGE_4_G);
+  imu_.setGyroRange(LSM6DS_GYRO_RANGE_2000_DPS);
+  imu_.setAccelDataRate(LSM6DS_RATE_416_HZ);
+  imu_.setGyroDataRate(LSM6DS_RATE_416_HZ);
+  dataRate_ = FIFO_RATE;
+  estimator_.begin(dataRate_);
+  sensorFilter_.setSampleFrequency(dataRate_);
+
+  // Watermark at about one runloop cycle's worth of entries - a gyro, an accel and a timestamp entry per sample
+  unsigned int watermark = constrain(int(dataRate_ * Runloop::runloop.cycleTimeSeconds() * 3), 1, 511);
+  if(!writeRegister(REG_CTRL10_C, TIMESTAMP_EN) ||
+     !writeRegister(REG_FIFO_CTRL1, watermark & 0xff) ||
+     !writeRegister(REG_FIFO_CTRL2, watermark >> 8) ||
+     !writeRegister(REG_FIFO_CTRL3, FIFO_BDR_417HZ)) {
+    Console::console.printfBroadcast("IMU FIFO setup at 0x%x failed!\n", addr_);
+    return false;
+  }
+  resetFIFO();
+
+  temp_->getEvent(&t);
+  temperature_ = t.temperature;
+
+  fifoIntPin_ = fifoIntPin;
+  if(fifoIntPin_ >= 0) {
+    writeRegister(REG_INT1_CTRL, INT1_FIFO_TH);
+    pinMode(fifoIntPin_, INPUT);
+    attachInterrupt(digitalPinToInterrupt(fifoIntPin_), fifoWatermarkISR, RISING);
+  }
 
   available_ = true;
   return true;
@@ -106,37 +164,182 @@ void bb::IMU::printStats(const String& prefix) {
   temp_->printSensorDetails();
   accel_->printSensorDetails();
   gyro_->printSensorDetails();
+  Serial.print("FIFO overruns: ");
+  Serial.println(fifoOverruns_);
+  calibration_.printModel();
+}
+
+bool bb::IMU::readRegisters(uint8_t reg, uint8_t* buf, size_t len) {
+  Wire.beginTransmission(addr_);
+  Wire.write(reg);
+  if(Wire.endTransmission(false) != 0) return false;
+  if(Wire.requestFrom(addr_, len) != len) return false;
+  for(size_t i=0; i<len; i++) buf[i] = Wire.read();
+  return true;
+}
+
+bool bb::IMU::writeRegister(uint8_t reg, uint8_t value) {
+  Wire.beginTransmission(addr_);
+  Wire.write(reg);
+  Wire.write(value);
+  return Wire.endTransmission() == 0;
+}
+
+void bb::IMU::resetFIFO() {
+  // Going through bypass mode empties it
+  writeRegister(REG_FIFO_CTRL4, FIFO_TS_EVERY_BATCH | FIFO_TEMP_12HZ | FIFO_MODE_BYPASS);
+  writeRegister(REG_FIFO_CTRL4, FIFO_TS_EVERY_BATCH | FIFO_TEMP_12HZ | FIFO_MODE_CONTINUOUS);
+  fifoHaveGyro_ = fifoHaveAccel_ = false;
+  fifoTSValid_ = fusedTSValid_ = false;
 }
 
 bool bb::IMU::update(bool block) {
   if(!available_) return false;
+  if(fifoIntPin_ >= 0 && !fifoWatermark && !block) return false;
+  // Cleared before reading, so that a watermark that comes in meanwhile isn't lost. Set again if the FIFO can't be
+  // drained - INT1 stays high then, and without a new rising edge nothing would ever read it again.
+  fifoWatermark = false;
+
+  uint8_t status[2];
+  unsigned int entries = 0;
+  unsigned long start = micros(), timeout = block ? 2000000 / dataRate_ : 0;
+  do {
+    if(!readRegisters(REG_FIFO_STATUS1, status, 2)) {
+      fifoWatermark = true;
+      return false;
+    }
+    entries = status[0] | ((status[1] & 0x03) << 8);
+  } while(entries == 0 && micros() - start < timeout);
+
+  // Fallen behind, e.g. while calibrating. Reading all of it would take longer than a cycle, so drop it instead.
+  if((status[1] & FIFO_OVR_IA) || entries > FIFO_MAX_ENTRIES) {
+    fifoOverruns_++;
+    resetFIFO();
+    return false;
+  }
+
+  // The FIFO output registers wrap around to the tag register, so a burst reads consecutive entries.
+  uint8_t buf[FIFO_BURST_ENTRIES * FIFO_ENTRY_SIZE];
+  unsigned int fused = 0;
+  while(entries > 0) {
+    unsigned int n = entries < FIFO_BURST_ENTRIES ? entries : FIFO_BURST_ENTRIES;
+    if(!readRegisters(REG_FIFO_DATA_OUT_TAG, buf, n * FIFO_ENTRY_SIZE)) {
+      fifoWatermark = true;
+      break;
+    }
+    entries -= n;
+
+    for(unsigned int i=0; i<n; i++) {
+      const uint8_t* e = buf + i*FIFO_ENTRY_SIZE;
+      int16_t x = e[1] | (e[2] << 8), y = e[3] | (e[4] << 8), z = e[5] | (e[6] << 8);
+      switch(e[0] >> 3) {
+      case TAG_GYRO:
+        fifoGyro_[0] = x * GYRO_SENSITIVITY; fifoGyro_[1] = y * GYRO_SENSITIVITY; fifoGyro_[2] = z * GYRO_SENSITIVITY;
+        fifoHaveGyro_ = true;
+        break;
+      case TAG_ACCEL:
+        fifoAccel_[0] = x * ACCEL_SENSITIVITY; fifoAccel_[1] = y * ACCEL_SENSITIVITY; fifoAccel_[2] = z * ACCEL_SENSITIVITY;
+        fifoHaveAccel_ = true;
+        break;
+      case TAG_TEMPERATURE:
+        temperature_ = 25.0f + x * TEMP_SENSITIVITY;
+        break;
+      case TAG_TIMESTAMP:
+        fifoTS_ = e[1] | (e[2] << 8) | (uint32_t(e[3]) << 16) | (uint32_t(e[4]) << 24);
+        fifoTSValid_ = true;
+        break;
+      default:
+        break;
+      }
 
-  int timeout = 3;
-  if(block == true) {
-    while(!imu_.gyroscopeAvailable() && !imu_.accelerationAvailable()) {
-      if(timeout < 0) {
-        return false;
+      if(fifoHaveGyro_ && fifoHaveAccel_) {
+        // Time since the last sample from the sensor's own clock, unless it is missing or implausible
+        float dt = 1.0f / dataRate_;
+        if(fifoTSValid_ && fusedTSValid_) {
+          float tsdt = (fifoTS_ - fusedTS_) * TIMESTAMP_RESOLUTION;
+          if(tsdt > 0 && tsdt < 4.0f / dataRate_) dt = tsdt;
+        }
+        fusedTS_ = fifoTS_;
+        fusedTSValid_ = fifoTSValid_;
+        fuse(dt);
+        fifoHaveGyro_ = fifoHaveAccel_ = false;
+        fused++;
       }
-      timeout--;
-      delayMicroseconds(1);
     }
   }
-  
-  imu_.readGyroscope(lastP_, lastR_, lastH_);
-  imu_.readAcceleration(lastX_, lastY_, lastZ_);
 
-  madgwick_.updateIMU(lastP_+calP_, lastR_+calR_, lastH_+calH_, lastX_, lastY_, lastZ_);
+  // Not too often, and not without excusing the time it takes
+  if(calHandle_ != 0 && calibration_.changed() && millis() - lastCalSave_ > CALIBRATION_SAVE_INTERVAL) {
+    saveCalibration();
+    Runloop::runloop.excuseOverrun();
+  }
 
-  return true;
+  return fused > 0;
+}
+
+void bb::IMU::fuse(float dt) {
+  calibration_.addSample(fifoGyro_, fifoAccel_, temperature_);
+
+  lastP_ = fifoGyro_[0]; lastR_ = fifoGyro_[1]; lastH_ = fifoGyro_[2];
+  lastX_ = fifoAccel_[0]; lastY_ = fifoAccel_[1]; lastZ_ = fifoAccel_[2];
+
+  if(sensorLowPassOn_ || sensorNotchOn_) {
+    float v[6] = { lastP_, lastR_, lastH_, lastX_, lastY_, lastZ_ };
+    sensorFilter_.filter(v);
+    lastP_ = v[0]; lastR_ = v[1]; lastH_ = v[2];
+    lastX_ = v[3]; lastY_ = v[4]; lastZ_ = v[5];
+  }
+
+  float g[3] = { lastP_, lastR_, lastH_ }, a[3] = { lastX_, lastY_, lastZ_ };
+  calibration_.correctGyro(g, temperature_);
+  calibration_.correctAccel(a, temperature_, false);
+  estimator_.update(g[0], g[1], g[2], a[0], a[1], a[2], dt);
+}
+
+bb::Result bb::IMU::setSensorLowPass(float cutoff, unsigned int order) {
+  if(cutoff < 0 || (cutoff > 0 && (order < 2 || (order & 1) || order/2 > SENSOR_LOWPASS_SECTIONS))) return RES_COMMON_OUT_OF_RANGE;
+  for(unsigned int c=0; c<6; c++) {
+    for(unsigned int s=0; s<SENSOR_LOWPASS_SECTIONS; s++) sensorFilter_.setSection(c, s, BiquadCoefficients::passThrough());
+    if(cutoff > 0) sensorFilter_.setLowPass(c, cutoff, order);
+  }
+  sensorFilter_.reset();
+  sensorLowPassOn_ = cutoff > 0;
+  return RES_OK;
+}
+
+bb::Result bb::IMU::setSensorNotch(float center, float q) {
+  if(center < 0 || center >= sensorFilter_.sampleFrequency()/2 || q <= 0) return RES_COMMON_OUT_OF_RANGE;
+  for(unsigned int c=0; c<6; c++) {
+    if(center > 0) sensorFilter_.setNotch(c, SENSOR_NOTCH_SECTION, center, q);
+    else sensorFilter_.setSection(c, SENSOR_NOTCH_SECTION, BiquadCoefficients::passThrough());
+  }
+  sensorFilter_.reset();
+  sensorNotchOn_ = center > 0;
+  return RES_OK;
+}
+
+void bb::IMU::setOdometryVelocity(float vx, float vy) {
+  // Inverse of the rotation in getAccelMeasurement()
+  float sx, sy;
+  switch(rot_) {
+    case ROTATE_90: sx = -vy; sy = vx; break;
+    case ROTATE_180: sx = -vx; sy = -vy; break;
+    case ROTATE_270: sx = vy; sy = -vx; break;
+    case ROTATE_0:
+    default:
+    sx = vx; sy = vy;
+    break;
+  }
+  estimator_.setOdometryVelocity(sx, sy);
 }
 
 bool bb::IMU::getFilteredPRH(float &p, float &r, float &h) {
   if(!available_) return false;
 
-  // Madgwick filter switches axes
-  r = madgwick_.getPitch();
-  p = madgwick_.getRoll();
-  h = madgwick_.getYaw();
+  // Estimator's roll is around x, which we call pitch
+  r = estimator_.getPitch();
+  p = estimator_.getRoll();
+  h = estimator_.getYaw();
   float temp;
 
   switch(rot_) {
@@ -162,9 +365,9 @@ bool bb::IMU::getGyroMeasurement(float& p, float& r, float& h, bool calibrated)
 
   p = lastP_; r = lastR_; h = lastH_;
   if(calibrated) {
-    p += calP_;
-    r += calR_;
-    h += calH_;
+    float g[3] = { p, r, h };
+    calibration_.correctGyro(g, temperature_);
+    p = g[0]; r = g[1]; h = g[2];
   }
   float temp;
 
@@ -185,7 +388,9 @@ bool bb::IMU::getAccelMeasurement(float &x, float &y, float &z, bool calibrated)
 
   x = lastX_; y = lastY_; z = lastZ_;
   if(calibrated) {
-    x += calX_; y += calY_; z += calZ_;
+    float a[3] = { x, y, z };
+    calibration_.correctAccel(a, temperature_);
+    x = a[0]; y = a[1]; z = a[2];
   }
   float temp;
   
@@ -239,19 +444,50 @@ bool bb::IMU::calibrate(ConsoleStream *stream, int milliseconds, int step) {
   avgTemp /= count;
   avgP /= count; avgR /= count; avgH /= count;
   avgX /= count; avgY /= count; avgZ /= count;
-  avgZ -= 1.0;
 
   if(stream) {
     stream->printf("Calib finished (%d cycles, avg temp %f°C)\n", count, avgTemp);
-    stream->printf("P=%.6f R=%.6f H=%.6f X=%.6f Y=%.6f Z=%.6f\n", avgP, avgR, avgH, avgX, avgY, avgZ);
+    stream->printf("P=%.6f R=%.6f H=%.6f X=%.6f Y=%.6f Z=%.6f\n", avgP, avgR, avgH, avgX, avgY, avgZ-1.0);
   }
 
-  calP_ = -avgP; calR_ = -avgR; calH_ = -avgH;
-  calX_ = -avgX; calY_ = -avgY; calZ_ = -avgZ;
+  // Goes into the temperature model like this many stationary windows
+  float gyro[3] = { float(avgP), float(avgR), float(avgH) }, accel[3] = { float(avgX), float(avgY), float(avgZ) };
+  float weight = float(milliseconds) / 1000.0f * dataRate_ / IMUCalibration::WINDOW_SAMPLES;
+  calibration_.setFromStationary(gyro, accel, avgTemp, weight);
+  if(calHandle_ != 0) saveCalibration();
+
+  // Has overrun while we were polling
+  resetFIFO();
 
   return true;
 }
 
+bb::Result bb::IMU::setCalibrationStorage(const char* name) {
+  // Called again on every restart; the block stays reserved
+  if(calHandle_ == 0) {
+    calHandle_ = ConfigStorage::storage.reserveBlock(name, sizeof(IMUCalibration::Model), (uint8_t*)&calibration_.model());
+    if(calHandle_ == 0) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+  }
+  if(ConfigStorage::storage.blockIsValid(calHandle_)) {
+    ConfigStorage::storage.readBlock(calHandle_);
+    calibration_.modelLoaded();
+  } else {
+    calibration_.reset();
+  }
+  lastCalSave_ = millis();
+  return RES_OK;
+}
+
+bb::Result bb::IMU::saveCalibration() {
+  if(calHandle_ == 0) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+  Result res = ConfigStorage::storage.writeBlock(calHandle_);
+  if(res != RES_OK) return res;
+  ConfigStorage::storage.commit();
+  calibration_.clearChanged();
+  lastCalSave_ = millis();
+  return RES_OK;
+}
+
 bb::IMUState bb::IMU::getIMUState() {
   bb::IMUState imuState;
   if(!available_) {
@@ -260,9 +496,9 @@ bb::IMUState bb::IMU::getIMUState() {
   }
 
   imuState.errorState = ERROR_OK;
-  imuState.p = madgwick_.getPitch();
-  imuState.r = madgwick_.getRoll();
-  imuState.h = madgwick_.getYaw();
+  imuState.p = estimator_.getPitch();
+  imuState.r = estimator_.getRoll();
+  imuState.h = estimator_.getYaw();
   imuState.dp = lastP_;
   imuState.dr = lastR_;
   imuState.dh = lastH_;
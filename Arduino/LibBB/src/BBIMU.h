@@ -4,11 +4,14 @@
 #include "BBConsole.h"
 #include "BBControllers.h"
 #include "BBLowPassFilter.h"
+#include "BBFilterBank.h"
+#include "BBAttitudeEstimator.h"
+#include "BBIMUCalibration.h"
+#include "BBConfigStorage.h"
 #include "BBPacket.h"
 
 #include <math.h>
 #include <Adafruit_ISM330DHCX.h>
-#include <MadgwickAHRS.h>
 
 namespace bb {
 
@@ -23,7 +26,9 @@ public:
   } ProbeType;
 
   IMUControlInput(IMU& imu, ProbeType pt, bool inverse = false);
+  //! Filtered value as of the last update().
   float present();
+  //! Takes the IMU's current estimate (call IMU::update() first) and runs it through the filter.
   Result update();
 
   void setFilterCutoff(float frequency);
@@ -35,6 +40,7 @@ protected:
   float bias_, deadband_;
   IMU& imu_;
   bool inv_;
+  float value_;
 };
 
 
@@ -42,18 +48,58 @@ class IMU {
 public:
   IMU();
 
-  bool begin(uint8_t addr);
+  /*! \brief Starts the sensor, sampling into its FIFO at 416Hz.
+
+    update() drains the FIFO in one burst and runs every sample through the attitude estimator, so the runloop can
+    run at any rate. If fifoIntPin is connected to the sensor's INT1, it signals the FIFO watermark (about one
+    runloop cycle's worth of samples), and update() does not touch the bus until it has fired.
+  */
+  bool begin(uint8_t addr, int fifoIntPin = -1);
   bool available() { return available_; }
+  /*! \brief Blocking calibration, with the droid standing level and still.
+
+    Seeds the gyro bias at the current temperature, and takes the accelerometer offset that makes this pose level.
+    With a stored calibration (see setCalibrationStorage()) this is not needed at every boot - the model keeps fitting
+    itself whenever the IMU is at rest.
+  */
   bool calibrate(ConsoleStream *stream=NULL, int milliseconds = 2000, int step = 10);
+  //! Keeps the temperature calibration model in a ConfigStorage block of that name, and loads it if there is one.
+  //! Call after reserving the droid's own blocks, so that their addresses don't move. Calling it again reuses the block
+  //! and only reloads the model; name is then ignored.
+  Result setCalibrationStorage(const char* name = "imu");
+  //! Stored now. Otherwise the model is stored at most every 30 minutes when it has changed.
+  Result saveCalibration();
+  //! Whether there is a fitted calibration, from storage or from calibrate().
+  bool hasCalibration() const { return calibration_.valid(); }
+  IMUCalibration& calibration() { return calibration_; }
+  //! Degrees C, as of the last update().
+  float temperature() const { return temperature_; }
 
   bool getGyroMeasurement(float& dp, float& dr, float& dh, bool calibrated=true);
   bool getAccelMeasurement(float& ax, float& ay, float& az, bool calibrated=true);
   bool getGravCorrectedAccel(float& ax, float& ay, float& az);
+  //! Sensor output data rate in Hz. Not the rate update() is called at.
   float dataRate() { return dataRate_; }
 
+  //! Reads and fuses everything the FIFO holds. Returns false if there was nothing new. block waits for at least one
+  //! sample, up to two sample periods.
   virtual bool update(bool block=false);
   bool getFilteredPRH(float& p, float& r, float& h);
 
+  //! Butterworth low pass on gyro and accelerometer readings, before they go into the fusion filter. Order 2 or 4;
+  //! cutoff 0 switches it off. Off by default.
+  Result setSensorLowPass(float cutoff, unsigned int order = 2);
+  //! Notch on gyro and accelerometer readings, e.g. at the frequency the drive motors shake the droid at. center 0
+  //! switches it off. Off by default.
+  Result setSensorNotch(float center, float q = 2.0f);
+
+  //! Horizontal velocity of the droid in m/s, in the droid frame (after setRotationAroundZ()), e.g. from wheel
+  //! encoders. Lets the attitude estimate tell driving acceleration from tilt. Call once per control cycle.
+  void setOdometryVelocity(float vx, float vy);
+  //! Gyro bias the attitude estimator has learnt on top of calibrate(), in deg/s, sensor frame.
+  void getGyroBias(float& bp, float& br, float& bh) { estimator_.getGyroBias(bp, br, bh); }
+  AttitudeEstimator& attitudeEstimator() { return estimator_; }
+
   IMUState getIMUState();
   void printStats(const String& prefix = "");
 
@@ -66,12 +112,19 @@ public:
   void setRotationAroundZ(RotationAroundZ rot) { rot_ = rot; }
 
 private:  
+  bool readRegisters(uint8_t reg, uint8_t* buf, size_t len);
+  bool writeRegister(uint8_t reg, uint8_t value);
+  void resetFIFO();
+  void fuse(float dt);
 
-  Madgwick madgwick_;
+  AttitudeEstimator estimator_;
   bool available_;
   Adafruit_ISM330DHCX imu_;
   Adafruit_Sensor *temp_, *accel_, *gyro_;
-  float calR_, calP_, calH_, calX_, calY_, calZ_;
+  IMUCalibration calibration_;
+  ConfigStorage::HANDLE calHandle_;
+  unsigned long lastCalSave_;
+  float temperature_;
   float lastR_, lastP_, lastH_;
   float lastX_, lastY_, lastZ_;
   float intR_, intP_, intH_;
@@ -82,6 +135,20 @@ private:
   uint8_t addr_;
   
   RotationAroundZ rot_;
+
+  // FIFO entries are tagged, one sensor per entry; a gyro and an accel entry make a sample.
+  static const unsigned int FIFO_BURST_ENTRIES = 16, FIFO_MAX_ENTRIES = 64;
+  int fifoIntPin_;
+  float fifoGyro_[3], fifoAccel_[3];
+  bool fifoHaveGyro_, fifoHaveAccel_;
+  uint32_t fifoTS_, fusedTS_;
+  bool fifoTSValid_, fusedTSValid_;
+  unsigned int fifoOverruns_;
+
+  // Gyro p/r/h, then accel x/y/z. Sections 0 and 1 are the low pass, 2 is the notch.
+  static const unsigned int SENSOR_LOWPASS_SECTIONS = 2, SENSOR_NOTCH_SECTION = 2;
+  FilterBank<6, 3> sensorFilter_;
+  bool sensorLowPassOn_, sensorNotchOn_;
 };
 
 }; // namespace bb
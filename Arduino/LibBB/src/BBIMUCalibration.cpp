@@ -0,0 +1,261 @@
+#include <Arduino.h>
+#include "BBIMUCalibration.h"
+
+#include <math.h>
+#include <string.h>
+
+static const float FORGET = 0.999f;            // per stationary window, ~8 minutes at rest at 416Hz
+static const float STILL_GYRO_STD = 0.3f;      // deg/s
+static const float STILL_ACCEL_STD = 0.01f;    // g
+static const float STILL_GYRO_RATE = 2.0f;     // deg/s away from the current bias estimate
+static const float STILL_ACCEL_NORM = 0.05f;   // g away from 1g
+static const float MIN_TEMP_VAR = 1.0f;        // K^2, before the gyro slope is fitted
+static const float MIN_ACCEL_TT = 5.0f;        // K^2 * windows, before the accel slope is fitted
+static const float MAX_GYRO_SLOPE = 0.1f;      // deg/s/K
+static const float MAX_ACCEL_SLOPE = 0.002f;   // g/K
+static const float POSE_COS = 0.866f;          // poses closer than 30deg are the same pose
+static const unsigned int MIN_PERIOD_WINDOWS = 3;
+static const unsigned int MIN_POSES = 7;        // one more than there are parameters
+
+bb::IMUCalibration::IMUCalibration() {
+  reset();
+}
+
+void bb::IMUCalibration::reset() {
+  memset(&model_, 0, sizeof(model_));
+  model_.magic = MAGIC;
+  model_.refTemp = 25.0f;
+  for(int i=0; i<3; i++) model_.accelScale[i] = 1.0f;
+  changed_ = false;
+  stationaryWindows_ = 0;
+  winN_ = 0;
+  periodN_ = 0;
+  periodT_ = 0;
+}
+
+void bb::IMUCalibration::modelLoaded() {
+  if(model_.magic != MAGIC || isnan(model_.refTemp) || model_.numPoses > MAX_POSES) reset();
+  winN_ = 0;
+  periodN_ = 0;
+  changed_ = false;
+}
+
+float bb::IMUCalibration::gyroBias(unsigned int axis, float temp) const {
+  if(axis > 2) return 0;
+  return model_.gyroBias[axis] + model_.gyroSlope[axis] * (temp - model_.refTemp);
+}
+
+void bb::IMUCalibration::correctGyro(float g[3], float temp) const {
+  float dT = temp - model_.refTemp;
+  for(int i=0; i<3; i++) g[i] -= model_.gyroBias[i] + model_.gyroSlope[i] * dT;
+}
+
+void bb::IMUCalibration::correctAccel(float a[3], float temp, bool level) const {
+  float dT = temp - model_.refTemp;
+  for(int i=0; i<3; i++) {
+    a[i] = (a[i] - model_.accelOffset[i] - model_.accelSlope[i] * dT) * model_.accelScale[i];
+    if(level) a[i] += model_.levelOffset[i];
+  }
+}
+
+void bb::IMUCalibration::addSample(const float gyro[3], const float accel[3], float temp) {
+  if(winN_ == 0) {
+    for(int i=0; i<3; i++) {
+      win0G_[i] = gyro[i]; win0A_[i] = accel[i];
+      winG_[i] = winGG_[i] = winA_[i] = winAA_[i] = 0;
+    }
+    winT_ = 0;
+  }
+  for(int i=0; i<3; i++) {
+    float g = gyro[i] - win0G_[i], a = accel[i] - win0A_[i];
+    winG_[i] += g; winGG_[i] += g*g;
+    winA_[i] += a; winAA_[i] += a*a;
+  }
+  winT_ += temp;
+  if(++winN_ < WINDOW_SAMPLES) return;
+
+  float n = winN_, meanT = winT_ / n, dT = meanT - model_.refTemp;
+  float meanG[3], meanA[3];
+  bool still = true;
+  for(int i=0; i<3; i++) {
+    float mg = winG_[i] / n, ma = winA_[i] / n;
+    if(winGG_[i]/n - mg*mg > STILL_GYRO_STD*STILL_GYRO_STD) still = false;
+    if(winAA_[i]/n - ma*ma > STILL_ACCEL_STD*STILL_ACCEL_STD) still = false;
+    meanG[i] = mg + win0G_[i];
+    meanA[i] = ma + win0A_[i];
+    // A slow steady turn looks still, but not like the bias we know - unless we know none yet
+    if(valid() && fabsf(meanG[i] - gyroBias(i, meanT)) > STILL_GYRO_RATE) still = false;
+  }
+  float corrected[3] = { meanA[0], meanA[1], meanA[2] };
+  correctAccel(corrected, meanT, false);
+  float norm = sqrtf(corrected[0]*corrected[0] + corrected[1]*corrected[1] + corrected[2]*corrected[2]);
+  if(fabsf(norm - 1) > STILL_ACCEL_NORM) still = false;
+  winN_ = 0;
+
+  if(!still) {
+    endStationaryPeriod();
+    return;
+  }
+
+  stationaryWindows_++;
+  addGyroWindow(meanG, dT, 1.0f);
+  addAccelWindow(meanA, dT);
+}
+
+void bb::IMUCalibration::setFromStationary(const float gyro[3], const float accel[3], float temp, float weight) {
+  float dT = temp - model_.refTemp;
+  addGyroWindow(gyro, dT, weight);
+  float corrected[3] = { accel[0], accel[1], accel[2] };
+  correctAccel(corrected, temp, false);
+  model_.levelOffset[0] = -corrected[0];
+  model_.levelOffset[1] = -corrected[1];
+  model_.levelOffset[2] = 1.0f - corrected[2];
+  changed_ = true;
+}
+
+void bb::IMUCalibration::addGyroWindow(const float mean[3], float dT, float weight) {
+  Model& m = model_;
+  m.gyroW = m.gyroW*FORGET + weight;
+  m.gyroT = m.gyroT*FORGET + weight*dT;
+  m.gyroTT = m.gyroTT*FORGET + weight*dT*dT;
+  for(int i=0; i<3; i++) {
+    m.gyroB[i] = m.gyroB[i]*FORGET + weight*mean[i];
+    m.gyroTB[i] = m.gyroTB[i]*FORGET + weight*dT*mean[i];
+  }
+
+  float meanT = m.gyroT / m.gyroW, varT = m.gyroTT / m.gyroW - meanT*meanT;
+  for(int i=0; i<3; i++) {
+    float meanB = m.gyroB[i] / m.gyroW;
+    if(varT > MIN_TEMP_VAR) {
+      float slope = (m.gyroTB[i] / m.gyroW - meanT*meanB) / varT;
+      m.gyroSlope[i] = constrain(slope, -MAX_GYRO_SLOPE, MAX_GYRO_SLOPE);
+    }
+    m.gyroBias[i] = meanB - m.gyroSlope[i]*meanT;
+  }
+  changed_ = true;
+}
+
+void bb::IMUCalibration::addAccelWindow(const float mean[3], float dT) {
+  // Co-moment of temperature and reading within the period (Welford), so that the pose drops out
+  Model& m = model_;
+  if(++periodN_ == 1) {
+    periodT_ = dT;
+    for(int i=0; i<3; i++) periodA_[i] = mean[i];
+    return;
+  }
+  float deltaT = dT - periodT_;
+  periodT_ += deltaT / periodN_;
+  m.accelTT = m.accelTT*FORGET + deltaT*(dT - periodT_);
+  for(int i=0; i<3; i++) {
+    periodA_[i] += (mean[i] - periodA_[i]) / periodN_;
+    m.accelTA[i] = m.accelTA[i]*FORGET + deltaT*(mean[i] - periodA_[i]);
+    if(m.accelTT > MIN_ACCEL_TT) m.accelSlope[i] = constrain(m.accelTA[i] / m.accelTT, -MAX_ACCEL_SLOPE, MAX_ACCEL_SLOPE);
+  }
+}
+
+void bb::IMUCalibration::endStationaryPeriod() {
+  if(periodN_ >= MIN_PERIOD_WINDOWS) {
+    float pose[3];
+    for(int i=0; i<3; i++) pose[i] = periodA_[i] - model_.accelSlope[i] * periodT_;
+    addPose(pose);
+    if(fitAccel()) changed_ = true;
+  }
+  periodN_ = 0;
+  periodT_ = 0;
+}
+
+void bb::IMUCalibration::addPose(const float pose[3]) {
+  Model& m = model_;
+  float n = sqrtf(pose[0]*pose[0] + pose[1]*pose[1] + pose[2]*pose[2]);
+  if(n < 0.5f) return;
+
+  // Refresh the closest pose if it is the same one, otherwise add, or overwrite the oldest
+  int closest = -1;
+  float best = POSE_COS;
+  for(unsigned int k=0; k<m.numPoses; k++) {
+    const float* p = m.poses[k];
+    float pn = sqrtf(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+    float c = (p[0]*pose[0] + p[1]*pose[1] + p[2]*pose[2]) / (pn*n);
+    if(c > best) { best = c; closest = k; }
+  }
+  unsigned int slot;
+  if(closest >= 0) slot = closest;
+  else if(m.numPoses < MAX_POSES) slot = m.numPoses++;
+  else { slot = m.nextPose; m.nextPose = (m.nextPose + 1) % MAX_POSES; }
+  for(int i=0; i<3; i++) m.poses[slot][i] = pose[i];
+}
+
+// Solves A x = b for 6x6 A by Gaussian elimination with partial pivoting. Destroys A and b.
+static bool solve6(float A[6][6], float b[6], float x[6]) {
+  for(int c=0; c<6; c++) {
+    int p = c;
+    for(int r=c+1; r<6; r++) if(fabsf(A[r][c]) > fabsf(A[p][c])) p = r;
+    if(fabsf(A[p][c]) < 1e-9f) return false;
+    for(int j=0; j<6; j++) { float t = A[c][j]; A[c][j] = A[p][j]; A[p][j] = t; }
+    float t = b[c]; b[c] = b[p]; b[p] = t;
+    for(int r=c+1; r<6; r++) {
+      float f = A[r][c] / A[c][c];
+      for(int j=c; j<6; j++) A[r][j] -= f*A[c][j];
+      b[r] -= f*b[c];
+    }
+  }
+  for(int c=5; c>=0; c--) {
+    float s = b[c];
+    for(int j=c+1; j<6; j++) s -= A[c][j]*x[j];
+    x[c] = s / A[c][c];
+  }
+  return true;
+}
+
+bool bb::IMUCalibration::fitAccel() {
+  Model& m = model_;
+  if(m.numPoses < MIN_POSES) return false;
+
+  // Offset and scale on an axis are only separable if it has seen gravity from both sides
+  for(int i=0; i<3; i++) {
+    float lo = m.poses[0][i], hi = lo;
+    for(unsigned int k=1; k<m.numPoses; k++) { lo = fminf(lo, m.poses[k][i]); hi = fmaxf(hi, m.poses[k][i]); }
+    if(hi - lo < 1.0f) return false;
+  }
+
+  // Gauss-Newton on |scale * (pose - offset)| = 1, from the current model
+  float o[3], s[3], rms = 0;
+  for(int i=0; i<3; i++) { o[i] = m.accelOffset[i]; s[i] = m.accelScale[i]; }
+  for(int iter=0; iter<5; iter++) {
+    float JTJ[6][6] = {{0}}, JTr[6] = {0}, delta[6];
+    rms = 0;
+    for(unsigned int k=0; k<m.numPoses; k++) {
+      float d[3], u[3];
+      for(int i=0; i<3; i++) { d[i] = m.poses[k][i] - o[i]; u[i] = s[i]*d[i]; }
+      float n = sqrtf(u[0]*u[0] + u[1]*u[1] + u[2]*u[2]), r = n - 1;
+      float J[6] = { -s[0]*u[0]/n, -s[1]*u[1]/n, -s[2]*u[2]/n, u[0]*d[0]/n, u[1]*d[1]/n, u[2]*d[2]/n };
+      for(int a=0; a<6; a++) {
+        JTr[a] -= J[a]*r;
+        for(int b=0; b<6; b++) JTJ[a][b] += J[a]*J[b];
+      }
+      rms += r*r;
+    }
+    for(int a=0; a<6; a++) JTJ[a][a] += 1e-6f;
+    if(!solve6(JTJ, JTr, delta)) return false;
+    for(int i=0; i<3; i++) { o[i] += delta[i]; s[i] += delta[i+3]; }
+  }
+  rms = sqrtf(rms / m.numPoses);
+
+  for(int i=0; i<3; i++) {
+    if(fabsf(o[i]) > 0.2f || s[i] < 0.9f || s[i] > 1.1f) return false;
+  }
+  if(rms > 0.02f) return false;
+  for(int i=0; i<3; i++) { m.accelOffset[i] = o[i]; m.accelScale[i] = s[i]; }
+  return true;
+}
+
+void bb::IMUCalibration::printModel(ConsoleStream* stream) {
+  const Model& m = model_;
+  bb::printf(stream, "IMU calibration %s, reference %.1fC, %u stationary windows this run\n", valid() ? "fitted" : "not fitted", m.refTemp, stationaryWindows_);
+  bb::printf(stream, "Gyro bias  [deg/s]:   %8.4f %8.4f %8.4f, per K: %8.5f %8.5f %8.5f\n",
+             m.gyroBias[0], m.gyroBias[1], m.gyroBias[2], m.gyroSlope[0], m.gyroSlope[1], m.gyroSlope[2]);
+  bb::printf(stream, "Accel offset [g]:     %8.4f %8.4f %8.4f, per K: %8.5f %8.5f %8.5f\n",
+             m.accelOffset[0], m.accelOffset[1], m.accelOffset[2], m.accelSlope[0], m.accelSlope[1], m.accelSlope[2]);
+  bb::printf(stream, "Accel scale:          %8.4f %8.4f %8.4f (%d poses)\n", m.accelScale[0], m.accelScale[1], m.accelScale[2], m.numPoses);
+  bb::printf(stream, "Level offset [g]:     %8.4f %8.4f %8.4f\n", m.levelOffset[0], m.levelOffset[1], m.levelOffset[2]);
+}
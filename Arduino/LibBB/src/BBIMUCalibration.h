@@ -0,0 +1,99 @@
+#if !defined(BBIMUCALIBRATION_H)
+#define BBIMUCALIBRATION_H
+
+#include <stdint.h>
+#include "BBConsole.h"
+
+namespace bb {
+
+/*!
+  \brief Temperature dependent calibration of a 6 axis IMU, fitted while the sensor is at rest.
+
+  The model, per axis:
+  - gyro bias = gyroBias + gyroSlope * (T - refTemp)
+  - accel = (raw - (accelOffset + accelSlope * (T - refTemp))) * accelScale
+  - levelOffset is added on top, for readings that should be relative to how the droid is mounted (see IMU::calibrate()).
+
+  Feed it every raw sample with addSample(). Whenever a window of samples was stationary, it refits:
+  - The gyro bias is a least squares line over the stationary windows' mean rates and temperatures. The fit slowly
+    forgets old data, so the model follows an aging sensor. The slope is only fitted once the temperature has varied
+    by a few degrees.
+  - The accel offset's temperature slope comes from how the reading changes with temperature within one stationary
+    period, where the pose is constant.
+  - Accel offset and scale come from fitting an ellipsoid to the mean readings of 7 to MAX_POSES different poses. This
+    needs every axis to have pointed both up and down, so it happens on a remote that is turned around in the hand,
+    but usually not on a droid.
+
+  Model is plain data, meant to be stored through ConfigStorage with the fit state, so fitting carries on across boots.
+*/
+class IMUCalibration {
+public:
+  static const uint32_t MAGIC = 0xbb1ca001;
+  static const unsigned int MAX_POSES = 8;
+  static const unsigned int WINDOW_SAMPLES = 200;
+
+  struct Model {
+    uint32_t magic;
+    float refTemp;
+    float gyroBias[3], gyroSlope[3];                  // deg/s, deg/s/K
+    float accelOffset[3], accelSlope[3], accelScale[3]; // g, g/K, 1
+    float levelOffset[3];                             // g
+
+    // Fit state. Temperatures relative to refTemp.
+    float gyroW, gyroT, gyroTT, gyroB[3], gyroTB[3];  // weighted sums over stationary windows
+    float accelTT, accelTA[3];                        // co-moments within stationary periods
+    float poses[MAX_POSES][3];                        // mean raw accel at refTemp
+    uint8_t numPoses, nextPose;
+  };
+
+  IMUCalibration();
+
+  //! Uncalibrated: no bias, unit scale, nothing fitted.
+  void reset();
+  //! True once the gyro bias has been fitted from at least one stationary period.
+  bool valid() const { return model_.magic == MAGIC && model_.gyroW > 0; }
+  Model& model() { return model_; }
+  //! After the model was read from storage. Resets it if it is not a model.
+  void modelLoaded();
+
+  void correctGyro(float g[3], float temp) const;
+  void correctAccel(float a[3], float temp, bool level = true) const;
+  //! Current gyro bias in deg/s at the given temperature.
+  float gyroBias(unsigned int axis, float temp) const;
+
+  //! Raw readings in deg/s and g, temperature in degrees C.
+  void addSample(const float gyro[3], const float accel[3], float temp);
+  //! Averages taken while stationary with the droid level, as by IMU::calibrate(). Counts as weight windows.
+  void setFromStationary(const float gyro[3], const float accel[3], float temp, float weight);
+
+  //! Whether the model changed since clearChanged().
+  bool changed() const { return changed_; }
+  void clearChanged() { changed_ = false; }
+  unsigned int stationaryWindows() const { return stationaryWindows_; }
+
+  void printModel(ConsoleStream* stream = NULL);
+
+protected:
+  void addGyroWindow(const float mean[3], float dT, float weight);
+  void addAccelWindow(const float mean[3], float dT);
+  void endStationaryPeriod();
+  void addPose(const float pose[3]);
+  bool fitAccel();
+
+  Model model_;
+  bool changed_;
+  unsigned int stationaryWindows_;
+
+  // Current window, relative to its first sample
+  unsigned int winN_;
+  float win0G_[3], win0A_[3];
+  float winG_[3], winGG_[3], winA_[3], winAA_[3], winT_;
+
+  // Current stationary period
+  unsigned int periodN_;
+  float periodT_, periodA_[3];
+};
+
+};
+
+#endif // BBIMUCALIBRATION_H
@@ -1,16 +1,18 @@
 #if !defined(BBLINALG_H)
 #define BBLINALG_H
 
-#include <BasicLinearAlgebra.h>
+#include "BBRotation.h"
 
 namespace bb {
-    BLA::Matrix<3,3> eulerToRot(float r, float p, float h);
-    void rotToEuler(const BLA::Matrix<3, 3>& A, float &r, float &p, float &h);
+    // Angles in degrees. p rotates about x, r about y, h about z.
+    RotationMatrix eulerToRot(float p, float r, float h);
+    // Note the order: the angle about y comes out first, the angle about x second.
+    void rotToEuler(const RotationMatrix& A, float &r, float &p, float &h);
 
-    void transformRotation(float rIn, float pIn, float hIn, float rXf, float pXf, float hXf,
+    void transformRotation(float pIn, float rIn, float hIn, float pXf, float rXf, float hXf,
                            float& rOut, float& pOut, float& hOut, bool inverse);
-    void transformVector(float xIn, float yIn, float zIn, float rXf, float pXf, float hXf,
+    void transformVector(float xIn, float yIn, float zIn, float pXf, float rXf, float hXf,
                          float &xOut, float &yOut, float& zOut, bool inverse);
 };
 
-#endif // BBLINALG_H
\ No newline at end of file
+#endif // BBLINALG_H
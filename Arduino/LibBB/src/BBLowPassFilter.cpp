@@ -10,10 +10,7 @@ bb::LowPassFilter::LowPassFilter(float cutoff, float sampleFreq, bool adaptive)
 
     dt_ = 1.0/sampleFreq_;
     tn1_ = -dt_;
-    for(int k = 0; k < 3; k++){
-        x_[k] = 0;
-        y_[k] = 0;        
-    }
+    z1_ = z2_ = 0;
     computeCoefficients();
 }
 
@@ -37,16 +34,11 @@ void bb::LowPassFilter::setAdaptive(bool adaptive) {
 
 void bb::LowPassFilter::computeCoefficients() {
 	omega0_ = 6.28318530718*cutoff_;
+	dtCoeff_ = dt_;
 
-	if(adapt_){
-        float t = micros()/1.0e6;
-        dt_ = t - tn1_;
-        tn1_ = t;
-	}
-      
 	float alpha = omega0_*dt_;
     float alphaSq = alpha*alpha;
-    float beta[] = {1, sqrt(2), 1};
+    float beta[] = {1, M_SQRT2, 1};
     float D = alphaSq*beta[0] + 2*alpha*beta[1] + 4*beta[2];
     b_[0] = alphaSq/D;
     b_[1] = 2*b_[0];
@@ -58,26 +50,25 @@ void bb::LowPassFilter::computeCoefficients() {
 float bb::LowPassFilter::filter(float xn) {
 	// Provide me with the current raw value: x
 	// I will give you the current filtered value: y
-	if(adapt_ || needsRecalc_){
+	if(adapt_) {
+        float t = micros()/1.0e6;
+        dt_ = t - tn1_;
+        tn1_ = t;
+        if(fabsf(dt_ - dtCoeff_) > dtCoeff_*ADAPT_TOLERANCE) needsRecalc_ = true;
+	}
+	if(needsRecalc_){
 		computeCoefficients(); // Update coefficients if necessary   
 		needsRecalc_ = false;   
 	}
-	y_[0] = 0;
-	x_[0] = xn;
-	// Compute the filtered values
-	for(int k = 0; k < 2; k++){
-		y_[0] += a_[k]*y_[k+1] + b_[k]*x_[k];
-	}
-	y_[0] += b_[2]*x_[2];
 
-	// Save the historical values
-	for(int k = 2; k > 0; k--){
-		y_[k] = y_[k-1];
-		x_[k] = x_[k-1];
-	}
+	// Transposed direct form II - same filter as y = b0 x0 + b1 x1 + b2 x2 + a0 y1 + a1 y2, but only two state
+	// variables and nothing to shift around
+	float yn = b_[0]*xn + z1_;
+	z1_ = b_[1]*xn + a_[0]*yn + z2_;
+	z2_ = b_[2]*xn + a_[1]*yn;
 
 	// Return the filtered value    
-	return y_[0];
+	return yn;
 }
 
 bb::HighPassFilter::HighPassFilter(float cutoff, float freq) {
@@ -6,6 +6,8 @@ namespace bb {
 // Taken from the tutorial and example code of the EXCELLENT Curio Res (https://www.youtube.com/@curiores111, 
 // https://github.com/curiores/ArduinoTutorials/blob/main/BasicFilters/ArduinoImplementations/LowPass/LowPass2.0/LowPass2.0.ino)
 // This realizes a 2nd order Butterworth low pass filter with configurable cutoff frequency.
+// In adaptive mode the sample time is measured on every call, but coefficients are only recomputed when it has moved by
+// more than ADAPT_TOLERANCE from the one they were computed for. For many filters at a fixed rate, see FilterBank.
 class LowPassFilter {
 public:
 	LowPassFilter(float cutoff=100.0, float sampleFreq=0.1, bool adaptive=false);
@@ -21,14 +23,15 @@ public:
 
 	float filter(float xn);
 protected:
-	void computeBase();
+	static constexpr float ADAPT_TOLERANCE = 1.0f/64; // relative
+
 	void computeCoefficients();
 	float a_[2], b_[3];
 	float omega0_;
-	float dt_;
+	float dt_, dtCoeff_;
 	bool adapt_;
 	float tn1_ = 0;
-	float x_[3], y_[3];
+	float z1_, z2_; // transposed direct form II state
 
 	float cutoff_, sampleFreq_;
 
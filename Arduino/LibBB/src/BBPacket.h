@@ -248,11 +248,22 @@ struct __attribute__ ((packed)) PairingPacket {
 	PairingType      type: 7;
 	PairingReplyType reply: 1;
 
+	// Link capabilities, exchanged in PAIRING_INFO_REQ. The requester sends LINK_OFFER_V1 if it can do batched
+	// delta encoded frames (see PacketLink), and a responder that can as well answers LINK_ACCEPT_V1. Older
+	// firmware sends back the request's value unchanged, so it never looks like it accepted. Older firmware also
+	// leaves linkCaps uninitialized in its requests, so it only counts if the Packet's reserved bit is set - which
+	// the Packet constructor has always cleared, and which only senders that fill in linkCaps set. (With the type bits
+	// of a pairing packet, that first byte still never looks like a PacketLink frame marker.)
+	static const uint8_t LINK_NONE      = 0x00;
+	static const uint8_t LINK_OFFER_V1  = 0xa1;
+	static const uint8_t LINK_ACCEPT_V1 = 0xc1;
+
 	struct __attribute__ ((packed)) PairingInfo {
 		PacketSource packetSource;
 		uint8_t      builderId;
 		uint8_t      stationId;
 		uint8_t      stationDetail;
+		uint8_t      linkCaps;
 	};
 
 	union {
@@ -264,7 +275,7 @@ struct __attribute__ ((packed)) Packet {
 	PacketType type     : 2;
 	PacketSource source : 2;
 	uint8_t seqnum      : 3; // automatically set by Runloop
-	uint8_t reserved    : 1; 
+	uint8_t reserved    : 1; // in pairing packets: linkCaps is valid
 
 	union {
 		ControlPacket control;
@@ -287,6 +298,9 @@ struct __attribute__ ((packed)) Packet {
 
 static const uint8_t MAX_SEQUENCE_NUMBER = 8;
 
+//! The CRC used for packets, over an arbitrary buffer.
+uint8_t calculateCRC7(const uint8_t *buffer, size_t len);
+
 struct PacketFrame {
 	Packet packet;
 	uint8_t crc;
@@ -0,0 +1,291 @@
+#include "BBPacketLink.h"
+
+// Record and ack header: like the first byte of a Packet, with bit 7 as flag (delta record / valid ack).
+static inline uint8_t header(uint8_t type, uint8_t source, uint8_t seq, bool flag) {
+	return (type & 0x3) | ((source & 0x3) << 2) | ((seq & 0x7) << 4) | (flag ? 0x80 : 0);
+}
+static inline uint8_t headerType(uint8_t hdr) { return hdr & 0x3; }
+static inline uint8_t headerSource(uint8_t hdr) { return (hdr >> 2) & 0x3; }
+static inline uint8_t headerSeq(uint8_t hdr) { return (hdr >> 4) & 0x7; }
+static inline bool headerFlag(uint8_t hdr) { return (hdr & 0x80) != 0; }
+
+bb::PacketLink::PacketLink() {
+	reset();
+}
+
+void bb::PacketLink::reset(const HWAddress& peer) {
+	peer_ = peer;
+	used_ = !peer.isZero();
+	sending_ = false;
+
+	memset(tx_, 0, sizeof(tx_));
+	memset(rx_, 0, sizeof(rx_));
+	for(unsigned int i=0; i<MAX_STREAMS; i++) tx_[i].baseSeq = -1;
+
+	txFrameNo_ = 0;
+	rxFrameNo_ = 0;
+	rxFrameNoValid_ = false;
+	lastRecordsLen_ = 0;
+	lastRecordsNum_ = 0;
+	memset(&stats_, 0, sizeof(stats_));
+}
+
+size_t bb::PacketLink::payloadSize(uint8_t type) {
+	switch(type) {
+	case PACKET_TYPE_CONTROL: return sizeof(ControlPacket);
+	case PACKET_TYPE_STATE:   return sizeof(StatePacket);
+	default:                  return 0;
+	}
+}
+
+void bb::PacketLink::remember(Stream& s, uint8_t seq, const uint8_t* payload, size_t size, uint8_t crc) {
+	for(unsigned int other=slot(seq); other<MAX_SEQUENCE_NUMBER; other+=HISTORY) s.valid &= ~(1 << other);
+	memcpy(s.history[slot(seq)], payload, size);
+	s.crc[slot(seq)] = crc;
+	s.valid |= 1 << seq;
+}
+
+uint8_t bb::PacketLink::payloadCRC(uint8_t hdr, const uint8_t* payload, size_t size) {
+	uint8_t buf[1+MAX_PAYLOAD];
+	buf[0] = hdr & 0x7f;
+	memcpy(buf+1, payload, size);
+	return calculateCRC7(buf, size+1);
+}
+
+template<typename S> S* bb::PacketLink::findStream(S* streams, uint8_t type, uint8_t source, bool create) {
+	for(unsigned int i=0; i<MAX_STREAMS; i++) {
+		if(streams[i].used && streams[i].type == type && streams[i].source == source) return &streams[i];
+	}
+	if(!create) return NULL;
+	for(unsigned int i=0; i<MAX_STREAMS; i++) {
+		if(streams[i].used) continue;
+		streams[i].used = true;
+		streams[i].type = type;
+		streams[i].source = source;
+		streams[i].valid = 0;
+		return &streams[i];
+	}
+	return NULL;
+}
+
+bb::Result bb::PacketLink::queue(const Packet& packet) {
+	size_t size = payloadSize(packet.type);
+	if(size == 0) return RES_PACKET_INVALID_PACKET;
+
+	TxStream* s = findStream(tx_, packet.type, packet.source, true);
+	if(s == NULL) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+
+	s->queued = true;
+	s->queuedSeq = packet.seqnum;
+	memcpy(s->queuedPayload, &packet.payload, size);
+	return RES_OK;
+}
+
+bool bb::PacketLink::hasQueued() const {
+	for(unsigned int i=0; i<MAX_STREAMS; i++) {
+		if(tx_[i].used && tx_[i].queued) return true;
+	}
+	return false;
+}
+
+size_t bb::PacketLink::encode(uint8_t* buf) {
+	size_t pos = 3;
+
+	// Tell the peer what we have, so it can delta encode against it.
+	uint8_t numAcks = 0;
+	for(unsigned int i=0; i<MAX_STREAMS; i++) {
+		const RxStream& s = rx_[i];
+		if(!s.used) continue;
+		bool valid = !s.needFull && (s.valid & (1 << s.lastSeq));
+		buf[pos++] = header(s.type, s.source, s.lastSeq, valid);
+		buf[pos++] = valid ? s.crc[slot(s.lastSeq)] : 0;
+		numAcks++;
+	}
+
+	// Last frame's records, in case it got lost.
+	uint8_t numRedundant = 0;
+	if(lastRecordsLen_ != 0 && pos + lastRecordsLen_ + MAX_STREAMS*MAX_RECORD_SIZE + 1 <= MAX_FRAME_SIZE) {
+		memcpy(buf+pos, lastRecords_, lastRecordsLen_);
+		pos += lastRecordsLen_;
+		numRedundant = lastRecordsNum_;
+	}
+
+	size_t recordsStart = pos;
+	uint8_t numRecords = 0;
+	for(unsigned int i=0; i<MAX_STREAMS; i++) {
+		if(!tx_[i].used || !tx_[i].queued) continue;
+		pos += encodeRecord(tx_[i], buf+pos);
+		numRecords++;
+	}
+	lastRecordsLen_ = pos - recordsStart;
+	lastRecordsNum_ = numRecords;
+	memcpy(lastRecords_, buf+recordsStart, lastRecordsLen_);
+
+	buf[0] = FRAME_MARKER | VERSION;
+	buf[1] = txFrameNo_++;
+	buf[2] = numRecords | (numRedundant << 3) | (numAcks << 6);
+	buf[pos] = calculateCRC7(buf, pos);
+	pos++;
+
+	stats_.framesSent++;
+	stats_.bytesSent += pos;
+	stats_.recordsSent += numRecords;
+	return pos;
+}
+
+size_t bb::PacketLink::encodeRecord(TxStream& s, uint8_t* buf) {
+	size_t size = payloadSize(s.type);
+	uint8_t seq = s.queuedSeq;
+	uint8_t hdr = header(s.type, s.source, seq, false);
+	uint8_t crc = payloadCRC(hdr, s.queuedPayload, size);
+	size_t maskBytes = (size+7)/8;
+	size_t len;
+
+	size_t changed = size;
+	const uint8_t* base = NULL;
+	if(s.baseSeq >= 0 && s.baseSeq != seq && (s.valid & (1 << s.baseSeq))) {
+		base = s.history[slot(s.baseSeq)];
+		changed = 0;
+		for(size_t i=0; i<size; i++) if(s.queuedPayload[i] != base[i]) changed++;
+	}
+
+	if(base != NULL && 3 + maskBytes + changed < 1 + size) {
+		buf[0] = hdr | 0x80;
+		buf[1] = s.baseSeq;
+		buf[2] = crc;
+		uint8_t* mask = buf+3;
+		memset(mask, 0, maskBytes);
+		len = 3 + maskBytes;
+		for(size_t i=0; i<size; i++) {
+			if(s.queuedPayload[i] == base[i]) continue;
+			mask[i/8] |= 1 << (i%8);
+			buf[len++] = s.queuedPayload[i];
+		}
+		stats_.deltaRecordsSent++;
+	} else {
+		buf[0] = hdr;
+		memcpy(buf+1, s.queuedPayload, size);
+		len = 1 + size;
+	}
+
+	// The peer replaces its copy of the base when it gets this, so it can't be used anymore.
+	if(s.baseSeq == seq) s.baseSeq = -1;
+
+	remember(s, seq, s.queuedPayload, size, crc);
+	s.queued = false;
+	return len;
+}
+
+void bb::PacketLink::handleAck(uint8_t hdr, uint8_t crc) {
+	TxStream* s = findStream(tx_, headerType(hdr), headerSource(hdr), false);
+	if(s == NULL) return;
+
+	uint8_t seq = headerSeq(hdr);
+	if(!headerFlag(hdr)) {
+		s->baseSeq = -1;
+	} else if((s->valid & (1 << seq)) && s->crc[slot(seq)] == crc) {
+		s->baseSeq = seq;
+	}
+}
+
+bb::Result bb::PacketLink::decode(const uint8_t* buf, size_t len, uint8_t rssi, const std::vector<PacketReceiver*>& receivers) {
+	if(!isLinkFrame(buf, len)) return RES_PACKET_INVALID_PACKET;
+	if(calculateCRC7(buf, len-1) != buf[len-1]) {
+		stats_.decodeErrors++;
+		return RES_PACKET_INVALID_PACKET;
+	}
+
+	uint8_t frameNo = buf[1];
+	uint8_t numRecords = buf[2] & 0x7, numRedundant = (buf[2] >> 3) & 0x7, numAcks = buf[2] >> 6;
+	bool lost = rxFrameNoValid_ && frameNo != uint8_t(rxFrameNo_ + 1);
+	if(lost) stats_.framesLost += uint8_t(frameNo - rxFrameNo_ - 1);
+	rxFrameNo_ = frameNo;
+	rxFrameNoValid_ = true;
+	stats_.framesReceived++;
+
+	size_t pos = 3, end = len-1;
+
+	for(uint8_t i=0; i<numAcks; i++) {
+		if(pos + 2 > end) { stats_.decodeErrors++; return RES_PACKET_TOO_SHORT; }
+		handleAck(buf[pos], buf[pos+1]);
+		pos += 2;
+	}
+
+	// Redundant records only matter if we missed the frame they were first sent in.
+	for(uint8_t i=0; i<numRedundant; i++) {
+		size_t n = decodeRecord(buf+pos, end-pos, lost, rssi, receivers);
+		if(n == 0) { stats_.decodeErrors++; return RES_PACKET_INVALID_PACKET; }
+		if(lost) stats_.recordsRecovered++;
+		pos += n;
+	}
+
+	for(uint8_t i=0; i<numRecords; i++) {
+		size_t n = decodeRecord(buf+pos, end-pos, true, rssi, receivers);
+		if(n == 0) { stats_.decodeErrors++; return RES_PACKET_INVALID_PACKET; }
+		stats_.recordsReceived++;
+		pos += n;
+	}
+
+	return pos == end ? RES_OK : RES_PACKET_TOO_LONG;
+}
+
+size_t bb::PacketLink::decodeRecord(const uint8_t* buf, size_t len, bool deliver, uint8_t rssi, const std::vector<PacketReceiver*>& receivers) {
+	if(len < 1) return 0;
+	uint8_t hdr = buf[0];
+	uint8_t type = headerType(hdr), source = headerSource(hdr), seq = headerSeq(hdr);
+	size_t size = payloadSize(type);
+	if(size == 0) return 0;
+
+	size_t maskBytes = (size+7)/8, used;
+	const uint8_t* mask = NULL;
+	if(headerFlag(hdr)) {
+		if(len < 3 + maskBytes) return 0;
+		mask = buf+3;
+		used = 3 + maskBytes;
+		for(size_t i=0; i<size; i++) if(mask[i/8] & (1 << (i%8))) used++;
+	} else {
+		used = 1 + size;
+	}
+	if(used > len) return 0;
+	if(!deliver) return used;
+
+	RxStream* s = findStream(rx_, type, source, true);
+	uint8_t payload[MAX_PAYLOAD];
+
+	if(mask != NULL) {
+		uint8_t baseSeq = buf[1] & 0x7;
+		if(s == NULL || !(s->valid & (1 << baseSeq))) {
+			if(s != NULL) s->needFull = true;
+			stats_.decodeErrors++;
+			return used;
+		}
+		memcpy(payload, s->history[slot(baseSeq)], size);
+		const uint8_t* changed = buf + 3 + maskBytes;
+		for(size_t i=0; i<size; i++) {
+			if(mask[i/8] & (1 << (i%8))) payload[i] = *changed++;
+		}
+		if(payloadCRC(hdr, payload, size) != buf[2]) {
+			s->needFull = true;
+			stats_.decodeErrors++;
+			return used;
+		}
+	} else {
+		memcpy(payload, buf+1, size);
+	}
+
+	if(s != NULL) {
+		remember(*s, seq, payload, size, payloadCRC(hdr, payload, size));
+		s->lastSeq = seq;
+		s->needFull = false;
+	}
+
+	Packet packet(PacketType(type), PacketSource(source), seq);
+	memset(&packet.payload, 0, sizeof(packet.payload));
+	memcpy(&packet.payload, payload, size);
+	packet.crc = packet.calculateCRC();
+	for(auto& r: receivers) {
+		r->incomingPacket(peer_, rssi, packet);
+	}
+
+	return used;
+}
@@ -0,0 +1,118 @@
+#if !defined(BBPACKETLINK_H)
+#define BBPACKETLINK_H
+
+#include <Arduino.h>
+#include <vector>
+#include "BBPacket.h"
+
+namespace bb {
+
+/*!
+	\brief Batched, delta encoded control and state packets to and from one peer station.
+
+	Used by XBee for peers that have agreed to it during pairing (see PairingPacket::LINK_OFFER_V1). Instead of
+	one API frame per Packet, everything queued for the peer during a runloop cycle goes out in one frame:
+
+	\verbatim
+	marker (0x80|version) | frame number | counts | acks | redundant records | records | crc
+	\endverbatim
+
+	A record is a control or state payload, with a header byte laid out like the first byte of a Packet, the reserved
+	bit marking delta records. Delta records only carry the bytes that changed against a base payload the peer has
+	acknowledged, plus a checksum of the result so that a wrong base is detected. Acks ride on the frames going the
+	other way. Instead of blindly repeating frames, each frame also carries the records of the frame before; if that
+	frame got lost, the receiver recovers its records from the next one. That holds after a longer gap, too - the
+	frames before are gone, but the records of the last one are still the newest the receiver has missed.
+
+	No allocation; all state is in fixed tables.
+*/
+class PacketLink {
+public:
+	static const uint8_t FRAME_MARKER = 0x80;
+	static const uint8_t VERSION = 1;
+	static const size_t MAX_FRAME_SIZE = 96; // XBee 802.15.4 RF payload is max 100 bytes
+	static const unsigned int MAX_STREAMS = 2; // per direction, i.e. control and state from one source
+
+	PacketLink();
+	void reset(const HWAddress& peer = HWAddress{0, 0});
+
+	const HWAddress& peer() const { return peer_; }
+	bool isUsed() const { return used_; }
+	//! Whether we send to the peer this way. Decoding works regardless.
+	bool isSending() const { return sending_; }
+	void setSending(bool sending) { sending_ = sending; }
+
+	static bool isLinkFrame(const uint8_t* buf, size_t len) { return len >= 4 && buf[0] == (FRAME_MARKER | VERSION); }
+
+	//! Queue a control or state packet for the next frame. Replaces what is already queued for the same type and source.
+	Result queue(const Packet& packet);
+	bool hasQueued() const;
+	//! Build the next frame from the queue, into buf (at least MAX_FRAME_SIZE bytes). Returns its length.
+	size_t encode(uint8_t* buf);
+	//! Decode a frame from the peer, handing all packets in it to the receivers in order.
+	Result decode(const uint8_t* buf, size_t len, uint8_t rssi, const std::vector<PacketReceiver*>& receivers);
+
+	struct Stats {
+		unsigned long framesSent, bytesSent, recordsSent, deltaRecordsSent;
+		unsigned long framesReceived, recordsReceived, recordsRecovered, framesLost, decodeErrors;
+	};
+	const Stats& stats() const { return stats_; }
+
+protected:
+	static const size_t MAX_PAYLOAD = sizeof(ControlPacket);
+	// Payloads kept per stream, by sequence number modulo HISTORY. Acks come back within a frame or two, so the base
+	// a delta is encoded against is never older than that; if it has been overwritten, a full record goes out.
+	static const unsigned int HISTORY = 4;
+	static const size_t MAX_RECORD_SIZE = 4 + MAX_PAYLOAD + (MAX_PAYLOAD+7)/8;
+
+	struct Stream {
+		bool used;
+		uint8_t type, source;
+		uint8_t history[HISTORY][MAX_PAYLOAD];
+		uint8_t crc[HISTORY];
+		uint8_t valid;                         // bit mask over sequence numbers that are in history
+	};
+
+	struct TxStream: public Stream {
+		int8_t baseSeq;                        // acknowledged by the peer, or -1
+		bool queued;
+		uint8_t queuedSeq;
+		uint8_t queuedPayload[MAX_PAYLOAD];
+	};
+
+	struct RxStream: public Stream {
+		uint8_t lastSeq;
+		bool needFull;                         // delta could not be decoded, ask for a full record
+	};
+
+	static size_t payloadSize(uint8_t type);
+	static unsigned int slot(uint8_t seq) { return seq % HISTORY; }
+	static void remember(Stream& s, uint8_t seq, const uint8_t* payload, size_t size, uint8_t crc);
+	static uint8_t payloadCRC(uint8_t hdr, const uint8_t* payload, size_t size);
+	template<typename S> static S* findStream(S* streams, uint8_t type, uint8_t source, bool create);
+
+	size_t encodeRecord(TxStream& s, uint8_t* buf);
+	// Returns the number of bytes used, or 0 if the record is malformed.
+	size_t decodeRecord(const uint8_t* buf, size_t len, bool deliver, uint8_t rssi, const std::vector<PacketReceiver*>& receivers);
+	void handleAck(uint8_t hdr, uint8_t crc);
+
+	HWAddress peer_;
+	bool used_, sending_;
+
+	TxStream tx_[MAX_STREAMS];
+	RxStream rx_[MAX_STREAMS];
+
+	uint8_t txFrameNo_, rxFrameNo_;
+	bool rxFrameNoValid_;
+
+	// Records of the last frame, sent again as redundancy
+	uint8_t lastRecords_[MAX_STREAMS * MAX_RECORD_SIZE];
+	size_t lastRecordsLen_;
+	uint8_t lastRecordsNum_;
+
+	Stats stats_;
+};
+
+};
+
+#endif // BBPACKETLINK_H
@@ -0,0 +1,64 @@
+#if !defined(BBQUATERNION_H)
+#define BBQUATERNION_H
+
+#include <math.h>
+
+namespace bb {
+
+//! Rotation quaternion, w + xi + yj + zk. Header only, float only.
+struct Quaternion {
+  float w, x, y, z;
+
+  constexpr Quaternion(): w(1), x(0), y(0), z(0) {}
+  constexpr Quaternion(float w_, float x_, float y_, float z_): w(w_), x(x_), y(y_), z(z_) {}
+
+  //! From roll (about x), pitch (about y), yaw (about z), in radians, applied in that order.
+  static Quaternion fromEuler(float roll, float pitch, float yaw) {
+    float cr = cosf(roll/2), sr = sinf(roll/2);
+    float cp = cosf(pitch/2), sp = sinf(pitch/2);
+    float cy = cosf(yaw/2), sy = sinf(yaw/2);
+    return Quaternion(cr*cp*cy + sr*sp*sy,
+                      sr*cp*cy - cr*sp*sy,
+                      cr*sp*cy + sr*cp*sy,
+                      cr*cp*sy - sr*sp*cy);
+  }
+
+  constexpr Quaternion operator*(const Quaternion& o) const {
+    return Quaternion(w*o.w - x*o.x - y*o.y - z*o.z,
+                      w*o.x + x*o.w + y*o.z - z*o.y,
+                      w*o.y - x*o.z + y*o.w + z*o.x,
+                      w*o.z + x*o.y - y*o.x + z*o.w);
+  }
+
+  constexpr Quaternion conjugate() const { return Quaternion(w, -x, -y, -z); }
+
+  float norm() const { return sqrtf(w*w + x*x + y*y + z*z); }
+  void normalize() {
+    float n = norm();
+    if(n == 0) { *this = Quaternion(); return; }
+    float inv = 1.0f/n;
+    w *= inv; x *= inv; y *= inv; z *= inv;
+  }
+
+  //! Rotates the vector by this quaternion (body to world, if this is the body's orientation).
+  void rotate(float& vx, float& vy, float& vz) const {
+    // v + 2w (q x v) + 2 q x (q x v), with q the vector part
+    float tx = 2*(y*vz - z*vy), ty = 2*(z*vx - x*vz), tz = 2*(x*vy - y*vx);
+    float rx = vx + w*tx + (y*tz - z*ty);
+    float ry = vy + w*ty + (z*tx - x*tz);
+    float rz = vz + w*tz + (x*ty - y*tx);
+    vx = rx; vy = ry; vz = rz;
+  }
+
+  //! Roll, pitch and yaw in radians, for the same convention as fromEuler().
+  void toEuler(float& roll, float& pitch, float& yaw) const {
+    roll = atan2f(w*x + y*z, 0.5f - x*x - y*y);
+    float s = -2.0f * (x*z - w*y);
+    pitch = s >= 1 ? M_PI_2 : (s <= -1 ? -M_PI_2 : asinf(s));
+    yaw = atan2f(x*y + w*z, 0.5f - y*y - z*z);
+  }
+};
+
+};
+
+#endif // BBQUATERNION_H
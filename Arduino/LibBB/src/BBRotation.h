@@ -0,0 +1,128 @@
+#if !defined(BBROTATION_H)
+#define BBROTATION_H
+
+#include <math.h>
+#include "BBQuaternion.h"
+
+// Polynomial sin / cos / atan2 / asin instead of libm in the rotation code. Worth it on MCUs without an FPU, where
+// libm trig costs thousands of cycles; accurate to about 1e-5 rad. Define to 1 in build_flags to make it the default.
+#if !defined(BB_FAST_TRIG)
+#define BB_FAST_TRIG 0
+#endif
+
+namespace bb {
+
+//! sin and cos of x (radians) from a polynomial, max error about 4e-6.
+inline void fastSinCos(float x, float& s, float& c) {
+  // Reduce to [-pi, pi], then fold into [-pi/2, pi/2] where the series converges quickly
+  x = x - 2*float(M_PI) * floorf((x + float(M_PI)) / (2*float(M_PI)));
+  float xs = x > float(M_PI_2) ? float(M_PI) - x : (x < -float(M_PI_2) ? -float(M_PI) - x : x);
+  float xc = x + float(M_PI_2);
+  if(xc > float(M_PI)) xc -= 2*float(M_PI);
+  xc = xc > float(M_PI_2) ? float(M_PI) - xc : (xc < -float(M_PI_2) ? -float(M_PI) - xc : xc);
+  float s2 = xs*xs, c2 = xc*xc;
+  s = xs * (1 + s2*(-1.0f/6 + s2*(1.0f/120 + s2*(-1.0f/5040 + s2*(1.0f/362880)))));
+  c = xc * (1 + c2*(-1.0f/6 + c2*(1.0f/120 + c2*(-1.0f/5040 + c2*(1.0f/362880)))));
+}
+
+//! atan2 from a polynomial (Abramowitz & Stegun 4.4.49), max error about 1e-5 rad.
+inline float fastAtan2(float y, float x) {
+  float ax = fabsf(x), ay = fabsf(y);
+  if(ax == 0 && ay == 0) return 0;
+  float z = ax > ay ? ay/ax : ax/ay, z2 = z*z;
+  float a = z * (0.9998660f + z2*(-0.3302995f + z2*(0.1801410f + z2*(-0.0851330f + z2*0.0208351f))));
+  if(ay > ax) a = float(M_PI_2) - a;
+  if(x < 0) a = float(M_PI) - a;
+  return y < 0 ? -a : a;
+}
+
+inline float fastAsin(float x) {
+  return fastAtan2(x, sqrtf(fmaxf(0.0f, 1 - x*x)));
+}
+
+struct Vector3 {
+  float x, y, z;
+
+  constexpr Vector3 operator+(const Vector3& o) const { return Vector3{x+o.x, y+o.y, z+o.z}; }
+  constexpr Vector3 operator-(const Vector3& o) const { return Vector3{x-o.x, y-o.y, z-o.z}; }
+  constexpr Vector3 operator*(float f) const { return Vector3{x*f, y*f, z*f}; }
+  constexpr float dot(const Vector3& o) const { return x*o.x + y*o.y + z*o.z; }
+  constexpr Vector3 cross(const Vector3& o) const { return Vector3{y*o.z - z*o.y, z*o.x - x*o.z, x*o.y - y*o.x}; }
+};
+
+/*!
+  \brief 3x3 rotation matrix, row major.
+
+  Euler angles are rotations about x, then y, then z, so that R = Rz * Ry * Rx - the convention bb::eulerToRot() has
+  always used, and the same as Quaternion::fromEuler(). A rotation's inverse is its transpose.
+*/
+struct RotationMatrix {
+  float m[3][3];
+
+  static constexpr RotationMatrix identity() { return RotationMatrix{{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}}; }
+
+  //! Angles in radians. FAST selects the polynomial trig functions.
+  template<bool FAST = BB_FAST_TRIG> static RotationMatrix fromEuler(float rx, float ry, float rz) {
+    float sx, cx, sy, cy, sz, cz;
+    if(FAST) {
+      fastSinCos(rx, sx, cx); fastSinCos(ry, sy, cy); fastSinCos(rz, sz, cz);
+    } else {
+      sx = sinf(rx); cx = cosf(rx); sy = sinf(ry); cy = cosf(ry); sz = sinf(rz); cz = cosf(rz);
+    }
+    return RotationMatrix{{{cz*cy, cz*sy*sx - sz*cx, cz*sy*cx + sz*sx},
+                           {sz*cy, sz*sy*sx + cz*cx, sz*sy*cx - cz*sx},
+                           {-sy,   cy*sx,            cy*cx}}};
+  }
+
+  static RotationMatrix fromQuaternion(const Quaternion& q) {
+    const float w = q.w, x = q.x, y = q.y, z = q.z;
+    return RotationMatrix{{{1 - 2*(y*y + z*z), 2*(x*y - w*z),     2*(x*z + w*y)},
+                           {2*(x*y + w*z),     1 - 2*(x*x + z*z), 2*(y*z - w*x)},
+                           {2*(x*z - w*y),     2*(y*z + w*x),     1 - 2*(x*x + y*y)}}};
+  }
+
+  //! Inverse rotation.
+  constexpr RotationMatrix transposed() const {
+    return RotationMatrix{{{m[0][0], m[1][0], m[2][0]}, {m[0][1], m[1][1], m[2][1]}, {m[0][2], m[1][2], m[2][2]}}};
+  }
+
+  //! Composition - applies o first, then this.
+  constexpr RotationMatrix operator*(const RotationMatrix& o) const {
+    return RotationMatrix{{{rowCol(o, 0, 0), rowCol(o, 0, 1), rowCol(o, 0, 2)},
+                           {rowCol(o, 1, 0), rowCol(o, 1, 1), rowCol(o, 1, 2)},
+                           {rowCol(o, 2, 0), rowCol(o, 2, 1), rowCol(o, 2, 2)}}};
+  }
+
+  constexpr Vector3 operator*(const Vector3& v) const {
+    return Vector3{m[0][0]*v.x + m[0][1]*v.y + m[0][2]*v.z,
+                   m[1][0]*v.x + m[1][1]*v.y + m[1][2]*v.z,
+                   m[2][0]*v.x + m[2][1]*v.y + m[2][2]*v.z};
+  }
+
+  //! Angles in radians, ry in [-pi/2, pi/2]. At ry = +-pi/2 only rx - rz is defined (rx + rz for -pi/2); rz is 0 there.
+  template<bool FAST = BB_FAST_TRIG> void toEuler(float& rx, float& ry, float& rz) const {
+    static const float GIMBAL_EPS = 0.001f;
+    if(fabsf(fabsf(m[2][0]) - 1) >= GIMBAL_EPS) {
+      ry = FAST ? -fastAsin(m[2][0]) : -asinf(m[2][0]);
+      rx = FAST ? fastAtan2(m[2][1], m[2][2]) : atan2f(m[2][1], m[2][2]);
+      rz = FAST ? fastAtan2(m[1][0], m[0][0]) : atan2f(m[1][0], m[0][0]);
+    } else if(m[2][0] < 0) {
+      ry = float(M_PI_2);
+      rx = FAST ? fastAtan2(m[0][1], m[0][2]) : atan2f(m[0][1], m[0][2]);
+      rz = 0;
+    } else {
+      ry = -float(M_PI_2);
+      rx = FAST ? fastAtan2(-m[0][1], -m[0][2]) : atan2f(-m[0][1], -m[0][2]);
+      rz = 0;
+    }
+  }
+
+protected:
+  constexpr float rowCol(const RotationMatrix& o, int i, int j) const {
+    return m[i][0]*o.m[0][j] + m[i][1]*o.m[1][j] + m[i][2]*o.m[2][j];
+  }
+};
+
+};
+
+#endif // BBROTATION_H
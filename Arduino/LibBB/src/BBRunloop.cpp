@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include <limits.h>
+#include <algorithm>
 #include "BBRunloop.h"
 #include "BBConsole.h"
 
@@ -11,11 +12,17 @@ bb::Runloop::Runloop() {
 	help_ = "Started once after all subsystems are added. Its start() only returns if stop() is called.\n"\
 "Commands:\n"\
 "\trunning_status [on|off]:    Print running status on timing\n"\
-"\tsuppress_overrun [on|off]:  Suppress overrun messages";
+"\tsuppress_overrun [on|off]:  Suppress overrun messages\n"\
+"\tstats [reset]:              Print (or reset) step timing per subsystem and task over the last cycles\n"\
+"\trebalance:                  Re-pick automatic phases from measured step times";
 	cycleTime_ = DEFAULT_CYCLETIME;
 	runningStatus_ = false;
 	suppressOverrun_ = false;
 	excuseOverrun_ = false;
+	maxCycles_ = 0;
+	overruns_ = 0;
+	lastMicros_ = 0;
+	monotonicMicros_ = 0;
 }
 
 bb::Result bb::Runloop::start(ConsoleStream* stream) {
@@ -27,64 +34,64 @@ bb::Result bb::Runloop::start(ConsoleStream* stream) {
 	startTime_ = millis();
 
 	while(running_) {
-		unsigned long micros_start_loop = micros();
+		uint64_t cycleStart = monotonicMicros();
 		seqnum_++;
 
-		// First of all run any timed callbacks...
-		uint64_t m = millis();
-		for(std::vector<TimedCallback>::iterator iter = timedCallbacks_.begin(); iter != timedCallbacks_.end(); iter++) {
-			if(iter->triggerMS < m) { // FIXME there is highly likely an integer wrap in here...?
-				iter->cb();
-				if(true == iter->oneshot) {
-					iter = timedCallbacks_.erase(iter);
-					if(iter == timedCallbacks_.end()) break;
-				} else {
-					iter->triggerMS = m + iter->deltaMS;
-				}
-			}
-		}
+		// First of all run any timed callbacks that are due...
+		timers_.advance(cycleStart);
+
+		// ...then run step() on all subsystems that are due in this cycle, each followed by its tasks...
+		const std::vector<Subsystem*>& subsys = SubsystemManager::manager.subsystems();
+		if(subsysSched_.size() != subsys.size()) subsysSched_.resize(subsys.size()); // only when subsystems were added
 
-		// ...then run step() on all subsystems...
-		std::vector<String> timingInfo;
+		for(size_t i=0; i<subsys.size(); i++) {
+			Subsystem* s = subsys[i];
+			if(i >= subsysSched_.size()) continue; // subsystem was registered during this cycle
+			Schedule& sched = subsysSched_[i];
+			sched.background = s->isBackgroundStep();
+			sched.periodUS = s->backgroundPeriod();
+			if(!sched.background && (sched.period != s->stepPeriod() || sched.requestedPhase != s->stepPhase())) {
+				configure(sched, s->stepPeriod(), s->stepPhase());
+			}
 
-		std::vector<Subsystem*> subsys = SubsystemManager::manager.subsystems();
-		for(auto& s: subsys) {
-			unsigned long us = micros();
-			if(s->isStarted() && s->operationStatus() == RES_OK) {
-				s->step();
-			} else {
-				s->stepIfNotStarted();
+			bool ok = s->isStarted() && s->operationStatus() == RES_OK;
+			if(sched.isDue(seqnum_)) {
+				unsigned long us = micros();
+				if(ok) s->step();
+				else s->stepIfNotStarted();
+				sched.timing.add(micros()-us);
+				sched.lastRun = seqnum_;
+				if(runningStatus_) Console::console.printfBroadcast("%s: %luus ", s->name(), sched.timing.last());
 			}
-			String str = String(s->name())  + ": " + (micros()-us) + "us ";
-			timingInfo.push_back(str);
-			if(runningStatus_) Console::console.printfBroadcast(str.c_str());
+			if(ok) runTasks(s);
 		}
+		runTasks(NULL);
 
-		// ...find out how long we took...
-		unsigned long micros_end_loop = micros();
-		unsigned long looptime;
-		if(micros_end_loop >= micros_start_loop) {
-			looptime = micros_end_loop - micros_start_loop;
+		// ...use the slack for background work and timed callbacks, and wait for the end of the cycle...
+		uint64_t cycleEnd = cycleStart + cycleTime_;
+		unsigned long waited = 0;
+		if(monotonicMicros() <= cycleEnd) {
+			waited = idleUntil(cycleEnd);
 		} else {
-			looptime = ULONG_MAX - micros_start_loop + micros_end_loop;
+			while(runBackground(cycleEnd)); // no slack, so this only runs background work that would starve otherwise
 		}
-		if(runningStatus_) Console::console.printfBroadcast("Total: %dus", looptime);
+
+		// ...find out how long we were busy...
+		unsigned long looptime = monotonicMicros() - cycleStart - waited;
+		cycleTiming_.add(looptime);
+		if(runningStatus_) Console::console.printfBroadcast("Total: %luus", looptime);
 
 		// ...and bicker if we overran the allotted time.
-		if(looptime <= cycleTime_) {
-			delayMicroseconds(cycleTime_-looptime);
-		} else if(excuseOverrun_ == false && suppressOverrun_ == false) {
-			String msg;
-			char buf[255];
-			snprintf(buf, 255, "%ld/%ldus spent in loop: ", looptime, cycleTime_);
-			msg = buf;
-			for(auto& t: timingInfo) {
-				msg = msg + t.c_str() + " ";
-			}
-			LOG(LOG_WARN, "%s\n", msg.c_str());
+		if(looptime > cycleTime_) {
+			handleOverrun(looptime, excuseOverrun_ == false && suppressOverrun_ == false);
 		}
 
 		excuseOverrun_ = false;
+
+		// Once every schedule has been run a couple of times, the measured step times are better weights than the guesses.
+		if(seqnum_ == 2*SCHEDULE_HYPERPERIOD) rebalance();
+
+		if(maxCycles_ != 0 && seqnum_ >= maxCycles_) running_ = false;
 	}
 
 	started_ = false;
@@ -92,6 +99,253 @@ bb::Result bb::Runloop::start(ConsoleStream* stream) {
 	return RES_OK;
 }
 
+// Counts the overrun for everything that ran in this cycle, and blames whatever took longest compared to its
+// usual step time - that is most likely what blew the budget.
+void bb::Runloop::handleOverrun(unsigned long looptime, bool report) {
+	overruns_++;
+
+	int culprit = -1;
+	long worstExcess = LONG_MIN;
+	for(int i=0; i<int(subsysSched_.size() + MAX_TASKS); i++) {
+		Schedule& sched = scheduleAt(i);
+		if(sched.period == 0 || sched.lastRun != seqnum_) continue;
+		sched.timing.addOverrun();
+		long excess = long(sched.timing.last()) - long(sched.timing.mean());
+		if(excess > worstExcess) {
+			culprit = i;
+			worstExcess = excess;
+		}
+	}
+	if(culprit >= 0) scheduleAt(culprit).timing.addBlame();
+	if(!report) return;
+
+	// Formatted into a fixed buffer so that an overrun does not cause a heap allocation on top.
+	// Only what actually ran in this cycle is listed.
+	char buf[255];
+	int len = snprintf(buf, sizeof(buf), "%lu/%luus spent in loop", looptime, cycleTime_);
+	if(culprit >= 0) {
+		const StepTiming& t = scheduleAt(culprit).timing;
+		len += snprintf(buf+len, sizeof(buf)-len, ", blaming ");
+		if(len < int(sizeof(buf))) len += scheduleName(buf+len, sizeof(buf)-len, culprit);
+		if(len < int(sizeof(buf))) len += snprintf(buf+len, sizeof(buf)-len, " (%luus, usually %luus)", t.last(), t.mean());
+	}
+	if(len < int(sizeof(buf))) len += snprintf(buf+len, sizeof(buf)-len, ": ");
+	for(int i=0; i<int(subsysSched_.size() + MAX_TASKS) && len < int(sizeof(buf)); i++) {
+		const Schedule& sched = scheduleAt(i);
+		if(sched.period == 0 || sched.lastRun != seqnum_) continue;
+		len += scheduleName(buf+len, sizeof(buf)-len, i);
+		if(len < int(sizeof(buf))) len += snprintf(buf+len, sizeof(buf)-len, ": %luus ", sched.timing.last());
+	}
+	LOG(LOG_WARN, "%s\n", buf);
+}
+
+// Name of a subsystem (index < number of subsystems) or a task (index - number of subsystems), as owner.task.
+int bb::Runloop::scheduleName(char* buf, size_t len, int index) {
+	const std::vector<Subsystem*>& subsys = SubsystemManager::manager.subsystems();
+	if(index < int(subsysSched_.size())) {
+		return snprintf(buf, len, "%s", index < int(subsys.size()) ? subsys[index]->name() : "?");
+	}
+	const Task& t = tasks_[index-subsysSched_.size()];
+	if(t.owner == NULL) return snprintf(buf, len, "%s", t.name);
+	return snprintf(buf, len, "%s.%s", t.owner->name(), t.name);
+}
+
+void bb::Runloop::printTimingLine(ConsoleStream* stream, const char* name, const Schedule& sched) {
+	char rate[24];
+	if(sched.background && sched.periodUS == 0) snprintf(rate, sizeof(rate), "bg");
+	else if(sched.background) snprintf(rate, sizeof(rate), "bg/%lums", sched.periodUS/1000);
+	else if(sched.phase == AUTO_PHASE) snprintf(rate, sizeof(rate), "%u/-", sched.period);
+	else snprintf(rate, sizeof(rate), "%u/%u%s", sched.period, sched.phase, sched.requestedPhase == AUTO_PHASE ? "a" : "");
+	const StepTiming& t = sched.timing;
+	bb::printf(stream, "%-16s %9s %6lu %6lu %6lu %6lu %6lu %8lu %8lu %6lu\n", name, rate, t.last(), t.minimum(), t.mean(), t.percentile(99), t.maximum(), t.maxEver(), t.overruns(), t.blamed());
+}
+
+void bb::Runloop::printTiming(ConsoleStream* stream) {
+	bb::printf(stream, "Step timing over the last %d runs, in us (%lu overruns total). Rate is period/phase in cycles, a = auto phase,\n", StepTiming::WINDOW, overruns_);
+	bb::printf(stream, "or bg[/period] for background work. Overruns counts the overrunning cycles something ran in, blamed how often it was the culprit.\n");
+	bb::printf(stream, "%-16s %9s %6s %6s %6s %6s %6s %8s %8s %6s\n", "subsystem", "rate", "last", "min", "mean", "p99", "max", "max ever", "overruns", "blamed");
+
+	char name[20];
+	const std::vector<Subsystem*>& subsys = SubsystemManager::manager.subsystems();
+	for(size_t i=0; i<subsys.size() && i<subsysSched_.size(); i++) {
+		printTimingLine(stream, subsys[i]->name(), subsysSched_[i]);
+		for(unsigned int j=0; j<MAX_TASKS; j++) {
+			if(tasks_[j].period == 0 || tasks_[j].owner != subsys[i]) continue;
+			snprintf(name, sizeof(name), "  %s", tasks_[j].name);
+			printTimingLine(stream, name, tasks_[j]);
+		}
+	}
+	for(unsigned int j=0; j<MAX_TASKS; j++) {
+		if(tasks_[j].period == 0 || tasks_[j].owner != NULL) continue;
+		printTimingLine(stream, tasks_[j].name, tasks_[j]);
+	}
+
+	const StepTiming& t = cycleTiming_;
+	bb::printf(stream, "%-16s %9s %6lu %6lu %6lu %6lu %6lu %8lu %8lu\n", "total", "", t.last(), t.minimum(), t.mean(), t.percentile(99), t.maximum(), t.maxEver(), overruns_);
+}
+
+const bb::Runloop::StepTiming* bb::Runloop::stepTiming(unsigned int index) const {
+	if(index >= subsysSched_.size()) return NULL;
+	return &subsysSched_[index].timing;
+}
+
+const bb::Runloop::StepTiming* bb::Runloop::taskTiming(TaskID task) const {
+	if(task < 0 || task >= int(MAX_TASKS) || tasks_[task].period == 0) return NULL;
+	return &tasks_[task].timing;
+}
+
+void bb::Runloop::resetTiming() {
+	for(auto& sched: subsysSched_) sched.timing.reset();
+	for(auto& task: tasks_) task.timing.reset();
+	cycleTiming_.reset();
+	overruns_ = 0;
+}
+
+bb::Runloop::TaskID bb::Runloop::allocateTask(Subsystem* owner, const char* name, unsigned int period, unsigned int phase) {
+	if(period == 0) return INVALID_TASK;
+	for(unsigned int i=0; i<MAX_TASKS; i++) {
+		Task& t = tasks_[i];
+		if(t.period != 0) continue;
+		t.owner = owner;
+		t.name = name;
+		t.lastRun = 0;
+		t.background = false;
+		t.periodUS = 0;
+		t.releaseUS = 0;
+		t.timing.reset();
+		configure(t, period, phase);
+		return i;
+	}
+	return INVALID_TASK;
+}
+
+bb::Result bb::Runloop::setTaskRate(TaskID task, unsigned int period, unsigned int phase) {
+	if(task < 0 || task >= int(MAX_TASKS) || tasks_[task].period == 0) return RES_COMMON_NOT_IN_LIST;
+	if(period == 0) return RES_COMMON_OUT_OF_RANGE;
+	configure(tasks_[task], period, phase);
+	return RES_OK;
+}
+
+bb::Result bb::Runloop::removeTask(TaskID task) {
+	if(task < 0 || task >= int(MAX_TASKS) || tasks_[task].period == 0) return RES_COMMON_NOT_IN_LIST;
+	// The callback itself is only destroyed when the slot is reused, so a task can remove itself.
+	tasks_[task].period = 0;
+	tasks_[task].owner = NULL;
+	return RES_OK;
+}
+
+void bb::Runloop::configure(Schedule& sched, unsigned int period, unsigned int phase) {
+	sched.period = period > 0 ? period : 1;
+	sched.requestedPhase = phase;
+	sched.phase = AUTO_PHASE; // so that it does not count towards the load while picking
+	sched.phase = phase == AUTO_PHASE ? leastLoadedPhase(sched.period) : phase % sched.period;
+}
+
+// Picks the phase for the given period that minimizes the highest per-cycle load over the hyperperiod, counting
+// everything that already has a phase. The load of a schedule is its mean step time, or 1 if it has never run.
+unsigned int bb::Runloop::leastLoadedPhase(unsigned int period) {
+	unsigned long load[SCHEDULE_HYPERPERIOD];
+	for(unsigned int c=0; c<SCHEDULE_HYPERPERIOD; c++) load[c] = 0;
+
+	auto addLoad = [&](const Schedule& sched) {
+		if(sched.period == 0 || sched.background || sched.phase == AUTO_PHASE) return;
+		unsigned long w = sched.weight();
+		for(unsigned int c=sched.phase % SCHEDULE_HYPERPERIOD; c<SCHEDULE_HYPERPERIOD; c+=sched.period) load[c] += w;
+	};
+	for(auto& sched: subsysSched_) addLoad(sched);
+	for(auto& task: tasks_) addLoad(task);
+
+	unsigned int best = 0;
+	unsigned long bestLoad = ULONG_MAX;
+	unsigned int candidates = period < SCHEDULE_HYPERPERIOD ? period : SCHEDULE_HYPERPERIOD;
+	for(unsigned int phase=0; phase<candidates; phase++) {
+		unsigned long worst = 0;
+		for(unsigned int c=phase; c<SCHEDULE_HYPERPERIOD; c+=period) if(load[c] > worst) worst = load[c];
+		if(worst < bestLoad) {
+			best = phase;
+			bestLoad = worst;
+		}
+	}
+	return best;
+}
+
+void bb::Runloop::rebalance() {
+	for(auto& sched: subsysSched_) if(!sched.background && sched.requestedPhase == AUTO_PHASE) sched.phase = AUTO_PHASE;
+	for(auto& task: tasks_) if(task.period != 0 && !task.background && task.requestedPhase == AUTO_PHASE) task.phase = AUTO_PHASE;
+
+	// Greedy, highest load per cycle (step time / period) first. Quadratic, but there are only a handful of schedules
+	// and this is called rarely.
+	while(true) {
+		Schedule* heaviest = NULL;
+		for(int i=0; i<int(subsysSched_.size() + MAX_TASKS); i++) {
+			Schedule& sched = scheduleAt(i);
+			if(sched.period == 0 || sched.background || sched.phase != AUTO_PHASE) continue;
+			if(heaviest == NULL || sched.weight() * heaviest->period > heaviest->weight() * sched.period) heaviest = &sched;
+		}
+		if(heaviest == NULL) break;
+		heaviest->phase = leastLoadedPhase(heaviest->period);
+	}
+}
+
+void bb::Runloop::runTasks(Subsystem* owner) {
+	for(unsigned int i=0; i<MAX_TASKS; i++) {
+		Task& t = tasks_[i];
+		if(t.period == 0 || t.owner != owner || !t.isDue(seqnum_)) continue;
+		unsigned long us = micros();
+		t.cb();
+		t.timing.add(micros()-us);
+		t.lastRun = seqnum_;
+		if(runningStatus_) Console::console.printfBroadcast("%s: %luus ", t.name, t.timing.last());
+	}
+}
+
+void bb::Runloop::StepTiming::reset() {
+	pos_ = 0;
+	count_ = 0;
+	last_ = 0;
+	maxEver_ = 0;
+	overruns_ = 0;
+	blamed_ = 0;
+}
+
+void bb::Runloop::StepTiming::add(unsigned long us) {
+	last_ = us;
+	if(us > maxEver_) maxEver_ = us;
+	window_[pos_] = us > 0xffff ? 0xffff : us;
+	pos_ = (pos_ + 1) % WINDOW;
+	if(count_ < WINDOW) count_++;
+}
+
+unsigned long bb::Runloop::StepTiming::minimum() const {
+	if(count_ == 0) return 0;
+	uint16_t m = 0xffff;
+	for(unsigned int i=0; i<count_; i++) if(window_[i] < m) m = window_[i];
+	return m;
+}
+
+unsigned long bb::Runloop::StepTiming::maximum() const {
+	uint16_t m = 0;
+	for(unsigned int i=0; i<count_; i++) if(window_[i] > m) m = window_[i];
+	return m;
+}
+
+unsigned long bb::Runloop::StepTiming::mean() const {
+	if(count_ == 0) return 0;
+	unsigned long sum = 0;
+	for(unsigned int i=0; i<count_; i++) sum += window_[i];
+	return sum / count_;
+}
+
+unsigned long bb::Runloop::StepTiming::percentile(unsigned int p) const {
+	if(count_ == 0) return 0;
+	// Only called for printing, so a sorted copy on the stack is fine.
+	uint16_t sorted[WINDOW];
+	memcpy(sorted, window_, count_*sizeof(uint16_t));
+	std::sort(sorted, sorted+count_);
+	unsigned int index = ((count_-1) * p) / 100;
+	return sorted[index];
+}
+
 bb::Result bb::Runloop::stop(ConsoleStream *stream) {
 	stream = stream; // make compiler happy
 	if(!started_) return RES_SUBSYS_NOT_STARTED;
@@ -108,6 +362,22 @@ bb::Result bb::Runloop::handleConsoleCommand(const std::vector<String>& words, C
 		runningStatus_ = words[1] == "on" ? true : false;
 		return RES_OK;
 	}
+	if(words[0] == "stats") {
+		if(words.size() == 1) {
+			printTiming(stream);
+			return RES_OK;
+		}
+		if(words.size() == 2 && words[1] == "reset") {
+			resetTiming();
+			return RES_OK;
+		}
+		return RES_CMD_INVALID_ARGUMENT_COUNT;
+	}
+	if(words[0] == "rebalance") {
+		if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		rebalance();
+		return RES_OK;
+	}
 	if(words[0] == "suppress_overrun") {
 		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
 		suppressOverrun_ = words[1] == "on" ? true : false;
@@ -133,21 +403,89 @@ uint64_t bb::Runloop::millisSinceStart() {
 	return millis() - startTime_;
 }
 
-void* bb::Runloop::scheduleTimedCallback(uint64_t ms, std::function<void(void)> cb, bool oneshot) {
-	TimedCallback c = {millis() + ms, ms, oneshot, cb};
-	timedCallbacks_.push_back(c);
-	return (void*)&(*timedCallbacks_.end());
+bb::Result bb::Runloop::cancelTimedCallback(TimerWheel::Handle handle) {
+	return timers_.cancel(handle);
 }
 
-bb::Result bb::Runloop::cancelTimedCallback(void* handle) {
-	for(std::vector<TimedCallback>::iterator iter = timedCallbacks_.begin(); iter != timedCallbacks_.end(); iter++) {
-		if(handle == (void*)&(*iter)) {
-			iter = timedCallbacks_.erase(iter);
-			return RES_OK;
+uint64_t bb::Runloop::monotonicMicros() {
+	unsigned long us = micros();
+	monotonicMicros_ += uint32_t(us - lastMicros_);
+	lastMicros_ = us;
+	return monotonicMicros_;
+}
+
+// Use the rest of the cycle for timed callbacks as they come due and for background work, and wait for the end of it.
+// Returns the time spent waiting.
+unsigned long bb::Runloop::idleUntil(uint64_t us) {
+	unsigned long waited = 0;
+	while(true) {
+		uint64_t now = monotonicMicros();
+		timers_.advance(now);
+		if(runBackground(us)) continue;
+		now = monotonicMicros();
+		if(now >= us) return waited;
+
+		uint64_t next = timers_.nextEventHint();
+		if(next > us) next = us;
+		if(next > now) {
+			delayMicroseconds(next - now);
+			waited += next - now;
 		}
 	}
-	Console::console.printfBroadcast("Callback not found!\n");
-	return RES_COMMON_NOT_IN_LIST;
 }
 
+// Runs the pending background subsystem or task with the earliest deadline that either fits before cycleEnd or is
+// starving. Everything runs at most once per cycle. Returns false if there was nothing to run.
+bool bb::Runloop::runBackground(uint64_t cycleEnd) {
+	const std::vector<Subsystem*>& subsys = SubsystemManager::manager.subsystems();
+	int numSubsys = subsysSched_.size() < subsys.size() ? subsysSched_.size() : subsys.size();
+	uint64_t now = monotonicMicros();
+
+	Schedule* best = NULL;
+	int bestIndex = -1;
+	uint64_t bestDeadline = UINT64_MAX;
+	for(int i=0; i<numSubsys + int(MAX_TASKS); i++) {
+		Schedule* sched;
+		if(i < numSubsys) {
+			sched = &subsysSched_[i];
+		} else {
+			Task& t = tasks_[i-numSubsys];
+			if(t.period == 0 || !taskMayRun(t)) continue;
+			sched = &t;
+		}
+		if(!sched->background || sched->lastRun == seqnum_) continue;
+		if(sched->releaseUS == 0) sched->releaseUS = now;
+		if(now < sched->releaseUS) continue;
 
+		uint64_t interval = sched->periodUS != 0 ? sched->periodUS : cycleTime_;
+		uint64_t deadline = sched->releaseUS + interval;
+		bool starving = now >= deadline + interval && seqnum_ - sched->lastRun > 1; // missed at least one whole cycle
+		bool fits = now + sched->timing.maximum() <= cycleEnd;
+		if((fits || starving) && deadline < bestDeadline) {
+			best = sched;
+			bestIndex = i;
+			bestDeadline = deadline;
+		}
+	}
+	if(best == NULL) return false;
+
+	unsigned long us = micros();
+	if(bestIndex < numSubsys) {
+		Subsystem* s = subsys[bestIndex];
+		if(s->isStarted() && s->operationStatus() == RES_OK) s->step();
+		else s->stepIfNotStarted();
+	} else {
+		tasks_[bestIndex-numSubsys].cb();
+	}
+	best->timing.add(micros()-us);
+	best->lastRun = seqnum_;
+
+	now = monotonicMicros();
+	if(best->periodUS == 0) {
+		best->releaseUS = now;
+	} else {
+		best->releaseUS += best->periodUS;
+		if(best->releaseUS <= now) best->releaseUS = now + best->periodUS; // don't try to catch up after a stall
+	}
+	return true;
+}
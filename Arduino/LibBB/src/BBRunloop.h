@@ -2,6 +2,7 @@
 #define BBRUNLOOP_H
 
 #include "BBSubsystem.h"
+#include "BBTimerWheel.h"
 
 #include <vector>
 #include <functional>
@@ -34,30 +35,160 @@ public:
 
 	uint64_t millisSinceStart();
 
+	// Make start() return after the given number of cycles. 0 (the default) runs forever.
+	// Only really useful for benchmarking and simulation on the host.
+	void setMaxCycles(unsigned long cycles) { maxCycles_ = cycles; }
+
+
+	// Schedule a timed callback (oneshot or recurring). Callbacks are run from the runloop, either at the start of
+	// a cycle or in the idle time at its end, with microsecond resolution independent of the cycle time. Callbacks
+	// are stored in a fixed pool (TimerWheel::MAX_TIMERS entries, TimerWheel::CALLBACK_SIZE bytes of captures
+	// each), so scheduling never allocates. Returns TimerWheel::INVALID_HANDLE if the pool is exhausted.
+	template<typename F> TimerWheel::Handle scheduleTimedCallback(uint64_t milliseconds, F&& cb, bool oneshot = true) {
+		return scheduleTimedCallbackMicros(milliseconds*1000, std::forward<F>(cb), oneshot);
+	}
+	template<typename F> TimerWheel::Handle scheduleTimedCallbackMicros(uint64_t microseconds, F&& cb, bool oneshot = true) {
+		uint64_t now = monotonicMicros();
+		if(timers_.numScheduled() == 0) timers_.setTime(now);
+		return timers_.schedule(now + microseconds, oneshot ? 0 : microseconds, std::forward<F>(cb));
+	}
+	Result cancelTimedCallback(TimerWheel::Handle handle);
+
+	// Microseconds on a 64bit clock that does not wrap. Needs to be called at least every 71 minutes to catch
+	// wraps of micros() - the runloop does that.
+	uint64_t monotonicMicros();
+
+	/*!
+		\brief Step timing statistics over a sliding window of the last WINDOW runs.
+
+		Fixed size, so recording a sample never allocates. Samples are in microseconds, saturating at 65535.
+		Also counts how often the step or task was part of a cycle that overran, and how often it was blamed for it.
+	*/
+	class StepTiming {
+	public:
+		static const unsigned int WINDOW = 64;
+
+		StepTiming() { reset(); }
+		void reset();
+		void add(unsigned long us);
+		void addOverrun() { overruns_++; }
+		void addBlame() { blamed_++; }
+
+		unsigned long last() const { return last_; }
+		unsigned long minimum() const;
+		unsigned long maximum() const;
+		unsigned long mean() const;
+		unsigned long percentile(unsigned int p) const;
+		unsigned long maxEver() const { return maxEver_; }
+		unsigned int count() const { return count_; }
+		unsigned long overruns() const { return overruns_; }
+		unsigned long blamed() const { return blamed_; }
+
+	protected:
+		uint16_t window_[WINDOW];
+		unsigned int pos_, count_;
+		unsigned long last_, maxEver_, overruns_, blamed_;
+	};
 
-	// Schedule a timed callback (oneshot or recurring). Please note that this is currently only working within
-	// the runloop granularity. E.g. if you're running a runloop with a cycle time of 10,000us or 10ms, timed
-	// callback execution will have a granularity of 10ms. Do not use for high precision events obviously... :-)
-	virtual void* scheduleTimedCallback(uint64_t milliseconds, std::function<void(void)> cb, bool oneshot = true);
-	virtual Result cancelTimedCallback(void* handle);
+	//! Timing for the subsystem at the given index in SubsystemManager::manager.subsystems(), or NULL.
+	const StepTiming* stepTiming(unsigned int index) const;
+	//! Timing for a whole cycle, timed callbacks included.
+	const StepTiming& cycleTiming() const { return cycleTiming_; }
+	unsigned long overrunCount() const { return overruns_; }
+	void resetTiming();
+
+	static const unsigned int MAX_TASKS = 8;
+	//! Phases are balanced over this many cycles. Periods that do not divide it are balanced approximately.
+	static const unsigned int SCHEDULE_HYPERPERIOD = 100;
+
+	typedef int TaskID;
+	static const TaskID INVALID_TASK = -1;
+
+	// Add a task that is run every period cycles, in those cycles where (sequence number % period) == phase. Use this
+	// instead of dividing the rate by hand in step(). Tasks with an owner are run right after the owner's step() (whether
+	// or not that is due in the same cycle), and only while the owner is started and OK; the owner must be registered
+	// with the SubsystemManager. Tasks without an owner are run after all subsystems. With AUTO_PHASE the runloop picks
+	// the phase with the least load, and picks it again from measured step times once the runloop has settled.
+	// name is not copied. Returns INVALID_TASK if all MAX_TASKS are taken.
+	template<typename F> TaskID addTask(Subsystem* owner, const char* name, unsigned int period, F&& cb, unsigned int phase = AUTO_PHASE) {
+		TaskID id = allocateTask(owner, name, period, phase);
+		if(id != INVALID_TASK) tasks_[id].cb.assign(std::forward<F>(cb));
+		return id;
+	}
+	// Add a task that is run in the slack at the end of a cycle instead of inside it - for work that can wait, like SD card
+	// checks or display updates. Pending background work is run earliest deadline first, as long as its longest recent
+	// run time still fits before the end of the cycle. The deadline is periodMicros after the last run, or the end of the
+	// next cycle if periodMicros is 0. Work that has missed its deadline by another full period is run even if it does
+	// not fit, so that it does not starve, and gets the blame if the cycle overruns because of it.
+	template<typename F> TaskID addBackgroundTask(Subsystem* owner, const char* name, unsigned long periodMicros, F&& cb) {
+		TaskID id = allocateTask(owner, name, 1, 0);
+		if(id == INVALID_TASK) return id;
+		tasks_[id].cb.assign(std::forward<F>(cb));
+		tasks_[id].background = true;
+		tasks_[id].periodUS = periodMicros;
+		return id;
+	}
+	Result setTaskRate(TaskID task, unsigned int period, unsigned int phase = AUTO_PHASE);
+	Result removeTask(TaskID task);
+	const StepTiming* taskTiming(TaskID task) const;
+
+	// Re-pick the phases of all subsystems and tasks scheduled with AUTO_PHASE, heaviest first, using measured step times.
+	void rebalance();
+
+	void printTiming(ConsoleStream* stream = NULL);
 
 
 protected:
 
-	struct TimedCallback {
-		uint64_t triggerMS, deltaMS;
-		bool oneshot;
-		std::function<void()> cb;
+	unsigned long idleUntil(uint64_t us);
+	bool runBackground(uint64_t cycleEnd);
+
+	TimerWheel timers_;
+	unsigned long lastMicros_;
+	uint64_t monotonicMicros_;
+
+	void handleOverrun(unsigned long looptime, bool report);
+
+	struct Schedule {
+		unsigned int period, phase, requestedPhase;
+		unsigned long lastRun;
+		StepTiming timing;
+		bool background;
+		unsigned long periodUS;
+		uint64_t releaseUS;
+
+		Schedule(): period(0), phase(AUTO_PHASE), requestedPhase(AUTO_PHASE), lastRun(0), background(false), periodUS(0), releaseUS(0) {}
+		bool isDue(unsigned long seqnum) const { return !background && phase != AUTO_PHASE && (seqnum % period) == phase; }
+		unsigned long weight() const { return timing.count() != 0 ? timing.mean() + 1 : 1; }
 	};
 
-	std::vector<TimedCallback> timedCallbacks_;
+	struct Task: public Schedule {
+		Subsystem* owner;
+		const char* name;
+		InplaceCallback<TimerWheel::CALLBACK_SIZE> cb;
+	};
 
+	TaskID allocateTask(Subsystem* owner, const char* name, unsigned int period, unsigned int phase);
+	bool taskMayRun(const Task& task) { return task.owner == NULL || (task.owner->isStarted() && task.owner->operationStatus() == RES_OK); }
+	void configure(Schedule& sched, unsigned int period, unsigned int phase);
+	unsigned int leastLoadedPhase(unsigned int period);
+	void runTasks(Subsystem* owner);
+	void printTimingLine(ConsoleStream* stream, const char* name, const Schedule& sched);
+	// Subsystems first, in SubsystemManager order, then tasks.
+	Schedule& scheduleAt(int index) { return index < int(subsysSched_.size()) ? subsysSched_[index] : static_cast<Schedule&>(tasks_[index-subsysSched_.size()]); }
+	int scheduleName(char* buf, size_t len, int index);
+
+	std::vector<Schedule> subsysSched_;
+	Task tasks_[MAX_TASKS];
+	StepTiming cycleTiming_;
+	unsigned long overruns_;
 
 	Runloop();
 	bool running_;
 	unsigned long seqnum_;
 	unsigned long cycleTime_;
 	unsigned long startTime_;
+	unsigned long maxCycles_;
 	bool runningStatus_, suppressOverrun_;
 	bool excuseOverrun_;
 };
@@ -0,0 +1,540 @@
+#include "BBServoBus.h"
+
+using namespace bb;
+
+static const uint8_t HEADER[4] = { 0xff, 0xff, 0xfd, 0x00 };
+static const unsigned int HEADER_LENGTH = 7;  // header, ID, length
+static const unsigned long TIMEOUT_MARGIN = 2000; // us
+
+#if !defined(ARDUINO_ARCH_HOST)
+bb::ServoSerialPort::ServoSerialPort(HardwareSerial& serial, int dirPin): serial_(serial), dirPin_(dirPin), baud_(0) {
+}
+
+void bb::ServoSerialPort::begin(unsigned long baud) {
+  serial_.begin(baud);
+  pinMode(dirPin_, OUTPUT);
+  digitalWrite(dirPin_, LOW);
+  baud_ = baud;
+}
+
+void bb::ServoSerialPort::transmit(const uint8_t* buf, size_t len) {
+  digitalWrite(dirPin_, HIGH);
+  serial_.write(buf, len);
+  serial_.flush();
+  digitalWrite(dirPin_, LOW);
+}
+#endif
+
+bb::ServoBus::ServoBus(ServoPort* port): port_(port) {
+  for(unsigned int i=0; i<NUM_WRITE_ITEMS; i++) {
+    writeItems_[i] = { 0, 0 };
+    deadbands_[i] = 0;
+  }
+  readBlock_ = { 0, 0 };
+  strategy_ = READ_FAST_SYNC;
+  returnDelay_ = 500; // Dynamixel default
+  transactions_ = failedTransactions_ = bytesSent_ = bytesReceived_ = goalsWritten_ = goalsSkipped_ = 0;
+  clear();
+}
+
+void bb::ServoBus::clear() {
+  entries_.clear();
+  txLen_ = 0;
+  txOverflow_ = false;
+  rxLen_ = 0;
+  requestID_ = NO_REQUEST;
+  busy_ = false;
+  result_ = RES_OK;
+  replies_ = 0;
+  numReaders_ = 0;
+  lastMicros_ = 0;
+  sizeBuffers();
+}
+
+Result bb::ServoBus::addServo(uint8_t id) {
+  if(entryWithID(id) != NULL) return RES_COMMON_DUPLICATE_IN_LIST;
+  if(id >= BROADCAST_ID) return RES_COMMON_OUT_OF_RANGE;
+  Entry e;
+  memset(&e, 0, sizeof(e));
+  e.id = id;
+  for(unsigned int i=0; i<NUM_WRITE_ITEMS; i++) e.write[i] = writeItems_[i];
+  e.read = readBlock_;
+  e.dirty = (1<<NUM_WRITE_ITEMS) - 1;
+  entries_.push_back(e);
+  sizeBuffers();
+  return RES_OK;
+}
+
+Result bb::ServoBus::setWriteItem(WriteItem item, uint16_t addr, uint8_t length) {
+  if(item >= NUM_WRITE_ITEMS || length > 4) return RES_COMMON_OUT_OF_RANGE;
+  writeItems_[item] = { addr, length };
+  for(auto& e: entries_) {
+    e.write[item] = writeItems_[item];
+    e.dirty |= (1<<item);
+  }
+  sizeBuffers();
+  return RES_OK;
+}
+
+Result bb::ServoBus::setWriteItem(uint8_t id, WriteItem item, uint16_t addr, uint8_t length) {
+  if(item >= NUM_WRITE_ITEMS || length > 4) return RES_COMMON_OUT_OF_RANGE;
+  Entry *e = entryWithID(id);
+  if(e == NULL) return RES_COMMON_NOT_IN_LIST;
+  e->write[item] = { addr, length };
+  e->dirty |= (1<<item);
+  sizeBuffers();
+  return RES_OK;
+}
+
+void bb::ServoBus::setDeadband(WriteItem item, uint32_t deadband) {
+  if(item >= NUM_WRITE_ITEMS) return;
+  deadbands_[item] = deadband;
+}
+
+Result bb::ServoBus::setReadBlock(uint16_t addr, uint8_t length) {
+  if(length > MAX_READ_LENGTH) return RES_COMMON_OUT_OF_RANGE;
+  readBlock_ = { addr, length };
+  for(auto& e: entries_) e.read = readBlock_;
+  sizeBuffers();
+  return RES_OK;
+}
+
+Result bb::ServoBus::setReadBlock(uint8_t id, uint16_t addr, uint8_t length) {
+  if(length > MAX_READ_LENGTH) return RES_COMMON_OUT_OF_RANGE;
+  Entry *e = entryWithID(id);
+  if(e == NULL) return RES_COMMON_NOT_IN_LIST;
+  e->read = { addr, length };
+  sizeBuffers();
+  return RES_OK;
+}
+
+bb::ServoBus::ReadStrategy bb::ServoBus::activeReadStrategy() const {
+  const Item* first = NULL;
+  for(auto& e: entries_) {
+    if(e.read.length == 0) continue;
+    if(first == NULL) first = &e.read;
+    else if(e.read.addr != first->addr || e.read.length != first->length) return READ_BULK;
+  }
+  return strategy_;
+}
+
+void bb::ServoBus::sizeBuffers() {
+  // Worst case with every item written to every servo, with the longer Bulk Write form, and a stuffing byte for every
+  // three bytes. Requests to single servos fit, too.
+  unsigned int n = entries_.size(), readers = 0, maxRead = 0, maxWrite[NUM_WRITE_ITEMS] = { 0 };
+  for(auto& e: entries_) {
+    for(unsigned int i=0; i<NUM_WRITE_ITEMS; i++) if(e.write[i].length > maxWrite[i]) maxWrite[i] = e.write[i].length;
+    if(e.read.length > maxRead) maxRead = e.read.length;
+    if(e.read.length > 0) readers++;
+  }
+  unsigned int tx = HEADER_LENGTH + 7 + MAX_REPLY_LENGTH;
+  for(unsigned int i=0; i<NUM_WRITE_ITEMS; i++) {
+    if(maxWrite[i] > 0) tx += HEADER_LENGTH + 7 + n*(5 + maxWrite[i]);
+  }
+  if(readers > 0) tx += HEADER_LENGTH + 7 + readers*5;
+
+  unsigned int rx = HEADER_LENGTH + 4 + MAX_REPLY_LENGTH;
+  if(HEADER_LENGTH + 4 + maxRead > rx) rx = HEADER_LENGTH + 4 + maxRead;
+  if(HEADER_LENGTH + 1 + readers*(4 + maxRead) > rx) rx = HEADER_LENGTH + 1 + readers*(4 + maxRead);
+
+  tx_.resize(tx + tx/3 + 4);
+  rx_.resize(rx + rx/3 + 4);
+}
+
+bool bb::ServoBus::setGoal(uint8_t id, WriteItem item, int32_t value) {
+  Entry *e = entryWithID(id);
+  if(e == NULL || item >= NUM_WRITE_ITEMS) return false;
+  e->goal[item] = value;
+
+  // Compare against what the servo has, not the last goal, so slow drifts within the deadband still get through
+  int64_t diff = int64_t(value) - int64_t(e->sent[item]);
+  if(diff < 0) diff = -diff;
+  if(diff > deadbands_[item]) e->dirty |= (1<<item);
+  return true;
+}
+
+int32_t bb::ServoBus::goal(uint8_t id, WriteItem item) {
+  Entry *e = entryWithID(id);
+  if(e == NULL || item >= NUM_WRITE_ITEMS) return 0;
+  return e->goal[item];
+}
+
+void bb::ServoBus::invalidate() {
+  for(auto& e: entries_) e.dirty = (1<<NUM_WRITE_ITEMS) - 1;
+}
+
+bool bb::ServoBus::dirty(uint8_t id, WriteItem item) {
+  Entry *e = entryWithID(id);
+  if(e == NULL || item >= NUM_WRITE_ITEMS) return false;
+  return (e->dirty & (1<<item)) != 0;
+}
+
+int32_t bb::ServoBus::present(uint8_t id, uint16_t addr, uint8_t length) {
+  Entry *e = entryWithID(id);
+  if(e == NULL || length == 0 || length > 4) return 0;
+  if(addr < e->read.addr || addr + length > e->read.addr + e->read.length) return 0;
+
+  const uint8_t *p = e->present + (addr - e->read.addr);
+  uint32_t v = 0;
+  for(int i=length-1; i>=0; i--) v = (v << 8) | p[i];
+  if(length < 4 && (v & (1UL << (8*length-1)))) v |= ~((1UL << (8*length)) - 1); // sign extend
+  return int32_t(v);
+}
+
+bool bb::ServoBus::received(uint8_t id) {
+  Entry *e = entryWithID(id);
+  return e != NULL && e->received;
+}
+
+uint8_t bb::ServoBus::statusError(uint8_t id) {
+  Entry *e = entryWithID(id);
+  return e != NULL ? e->error : 0;
+}
+
+unsigned int bb::ServoBus::replyBytes() const {
+  unsigned int n = 0, bytes = 0;
+  for(auto& e: entries_) {
+    if(e.read.length == 0) continue;
+    n++;
+    bytes += HEADER_LENGTH + 4 + e.read.length;                            // one status per servo
+  }
+  if(n == 0) return 0;
+  if(activeReadStrategy() == READ_FAST_SYNC) return HEADER_LENGTH + 1 + n*(4 + firstReader()->read.length); // one status; 2+len per servo, CRC in between
+  return bytes;
+}
+
+unsigned long bb::ServoBus::timeoutFor(unsigned int replyBytes, unsigned int numReplies) {
+  // Generously covers the replies on the wire, at 10 bits per byte, plus every servo's return delay.
+  unsigned long baud = port_->baudrate() > 0 ? port_->baudrate() : 1000000;
+  unsigned long replyMicros = (unsigned long)(replyBytes * 10000000ULL / baud) + numReplies * returnDelay_;
+  return 2*replyMicros + TIMEOUT_MARGIN;
+}
+
+Result bb::ServoBus::startCycle() {
+  if(busy_) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+  if(port_ == NULL) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  if(entries_.size() == 0) return RES_OK;
+
+  txLen_ = 0;
+  txOverflow_ = false;
+
+  for(unsigned int i=0; i<NUM_WRITE_ITEMS; i++) addWrite(i);
+
+  unsigned int readers = 0;
+  for(auto& e: entries_) if(e.read.length > 0) readers++;
+  ReadStrategy strategy = activeReadStrategy();
+  if(readers > 0 && strategy == READ_BULK) {
+    beginPacket(BROADCAST_ID, INST_BULK_READ);
+    for(auto& e: entries_) {
+      if(e.read.length == 0) continue;
+      addByte(e.id);
+      addValue(e.read.addr, 2);
+      addValue(e.read.length, 2);
+    }
+    endPacket();
+  } else if(readers > 0) {
+    const Item& block = firstReader()->read;
+    beginPacket(BROADCAST_ID, strategy == READ_FAST_SYNC ? INST_FAST_SYNC_READ : INST_SYNC_READ);
+    addValue(block.addr, 2);
+    addValue(block.length, 2);
+    for(auto& e: entries_) if(e.read.length > 0) addByte(e.id);
+    endPacket();
+  }
+
+  if(txOverflow_) return RES_PACKET_TOO_LONG;
+  if(txLen_ == 0) return RES_OK; // nothing changed, nothing to read
+
+  // Stale bytes, e.g. from a timed out transaction, would get in the way of the replies
+  while(port_->available()) port_->read();
+  for(auto& e: entries_) e.received = false;
+  rxLen_ = 0;
+  replies_ = 0;
+  numReaders_ = readers;
+
+  port_->transmit(tx_.data(), txLen_);
+  bytesSent_ += txLen_;
+  transactions_++;
+  for(auto& e: entries_) {
+    for(unsigned int i=0; i<NUM_WRITE_ITEMS; i++) {
+      if(e.dirty & (1<<i)) e.sent[i] = e.goal[i];
+    }
+    e.sending = e.dirty;
+    e.dirty = 0;
+  }
+
+  if(readers == 0) {
+    finish(RES_OK);
+    return RES_OK;
+  }
+
+  timeout_ = timeoutFor(replyBytes(), readers);
+  startMicros_ = micros();
+  busy_ = true;
+
+  return RES_OK;
+}
+
+void bb::ServoBus::poll() {
+  while(busy_ && port_->available()) {
+    consume(port_->read());
+  }
+  if(busy_ && micros() - startMicros_ > timeout_) finish(RES_COMM_TIMEOUT);
+}
+
+Result bb::ServoBus::wait() {
+  while(busy_) poll();
+  return result_;
+}
+
+Result bb::ServoBus::ping(uint8_t id, uint16_t* model) {
+  Result res = request(id, INST_PING, NULL, 0, 3);
+  if(res == RES_OK && model != NULL) *model = reply_[0] | (uint16_t(reply_[1]) << 8);
+  return res;
+}
+
+Result bb::ServoBus::read(uint8_t id, uint16_t addr, uint8_t length, int32_t& value) {
+  if(length == 0 || length > 4) return RES_COMMON_OUT_OF_RANGE;
+  uint8_t params[4] = { uint8_t(addr & 0xff), uint8_t(addr >> 8), length, 0 };
+  Result res = request(id, INST_READ, params, 4, length);
+  if(res != RES_OK) return res;
+
+  uint32_t v = 0;
+  for(int i=length-1; i>=0; i--) v = (v << 8) | reply_[i];
+  if(length < 4 && (v & (1UL << (8*length-1)))) v |= ~((1UL << (8*length)) - 1); // sign extend
+  value = int32_t(v);
+  return RES_OK;
+}
+
+Result bb::ServoBus::write(uint8_t id, uint16_t addr, uint8_t length, int32_t value) {
+  if(length == 0 || length > 4) return RES_COMMON_OUT_OF_RANGE;
+  uint8_t params[6] = { uint8_t(addr & 0xff), uint8_t(addr >> 8) };
+  for(uint8_t i=0; i<length; i++) params[2+i] = (uint32_t(value) >> (8*i)) & 0xff;
+  return request(id, INST_WRITE, params, 2+length, 0);
+}
+
+Result bb::ServoBus::reboot(uint8_t id) {
+  return request(id, INST_REBOOT, NULL, 0, 0);
+}
+
+Result bb::ServoBus::request(uint8_t id, uint8_t inst, const uint8_t* params, unsigned int numParams, unsigned int replyLength) {
+  if(port_ == NULL) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  if(id >= BROADCAST_ID || replyLength > MAX_REPLY_LENGTH) return RES_COMMON_OUT_OF_RANGE;
+  if(busy_) wait();
+
+  txLen_ = 0;
+  txOverflow_ = false;
+  beginPacket(id, inst);
+  for(unsigned int i=0; i<numParams; i++) addByte(params[i]);
+  endPacket();
+  if(txOverflow_) return RES_PACKET_TOO_LONG;
+
+  while(port_->available()) port_->read();
+  rxLen_ = 0;
+  requestID_ = id;
+  replied_ = false;
+  port_->transmit(tx_.data(), txLen_);
+  bytesSent_ += txLen_;
+
+  unsigned long timeout = timeoutFor(HEADER_LENGTH + 4 + replyLength, 1);
+  unsigned long start = micros();
+  while(!replied_ && micros() - start <= timeout) {
+    if(port_->available()) consume(port_->read());
+  }
+  requestID_ = NO_REQUEST;
+
+  if(!replied_) return RES_COMM_TIMEOUT;
+  if((replyError_ & 0x7f) != 0) return RES_SUBSYS_PROTOCOL_ERROR; // bit 7 is the hardware alert, not about this request
+  return RES_OK;
+}
+
+// One Sync Write of the item to all servos it changed on, or a Bulk Write if their control tables disagree.
+void bb::ServoBus::addWrite(unsigned int i) {
+  uint8_t bit = 1<<i;
+  const Item* first = NULL;
+  bool uniform = true;
+  unsigned int numDirty = 0, numWritable = 0;
+  for(auto& e: entries_) {
+    if(e.write[i].length == 0) continue;
+    numWritable++;
+    if((e.dirty & bit) == 0) continue;
+    numDirty++;
+    if(first == NULL) first = &e.write[i];
+    else if(e.write[i].addr != first->addr || e.write[i].length != first->length) uniform = false;
+  }
+  goalsSkipped_ += numWritable - numDirty;
+  if(numDirty == 0) return;
+
+  if(uniform) {
+    beginPacket(BROADCAST_ID, INST_SYNC_WRITE);
+    addValue(first->addr, 2);
+    addValue(first->length, 2);
+  } else {
+    beginPacket(BROADCAST_ID, INST_BULK_WRITE);
+  }
+  for(auto& e: entries_) {
+    if(e.write[i].length == 0 || (e.dirty & bit) == 0) continue;
+    addByte(e.id);
+    if(!uniform) {
+      addValue(e.write[i].addr, 2);
+      addValue(e.write[i].length, 2);
+    }
+    addValue(e.goal[i], e.write[i].length);
+  }
+  endPacket();
+  goalsWritten_ += numDirty;
+}
+
+void bb::ServoBus::finish(Result res) {
+  busy_ = false;
+  result_ = res;
+  lastMicros_ = micros() - startMicros_;
+  for(auto& e: entries_) {
+    // A garbled write would otherwise not be repeated until the goal changes again
+    if(res != RES_OK) e.dirty |= e.sending;
+    e.sending = 0;
+  }
+  if(res != RES_OK) failedTransactions_++;
+}
+
+const bb::ServoBus::Entry* bb::ServoBus::firstReader() const {
+  for(auto& e: entries_) {
+    if(e.read.length > 0) return &e;
+  }
+  return NULL;
+}
+
+bb::ServoBus::Entry* bb::ServoBus::entryWithID(uint8_t id) {
+  for(auto& e: entries_) {
+    if(e.id == id) return &e;
+  }
+  return NULL;
+}
+
+void bb::ServoBus::beginPacket(uint8_t id, uint8_t inst) {
+  packetStart_ = txLen_;
+  if(txLen_ + HEADER_LENGTH + 1 > tx_.size()) {
+    txOverflow_ = true;
+    return;
+  }
+  memcpy(&tx_[txLen_], HEADER, sizeof(HEADER));
+  tx_[txLen_+4] = id;
+  txLen_ += HEADER_LENGTH; // length is filled in by endPacket()
+  addByte(inst);
+}
+
+// Protocol 2.0 byte stuffing: 0xfd is inserted after every 0xff 0xff 0xfd in instruction and parameters, so the
+// header cannot appear inside a packet.
+void bb::ServoBus::addByte(uint8_t byte) {
+  if(txLen_ + 4 > tx_.size()) { // room for a stuffing byte and the CRC
+    txOverflow_ = true;
+    return;
+  }
+  tx_[txLen_++] = byte;
+  if(txLen_ - packetStart_ >= HEADER_LENGTH + 3 &&
+     tx_[txLen_-3] == 0xff && tx_[txLen_-2] == 0xff && tx_[txLen_-1] == 0xfd) {
+    tx_[txLen_++] = 0xfd;
+  }
+}
+
+void bb::ServoBus::addValue(int32_t value, uint8_t length) {
+  for(uint8_t i=0; i<length; i++) addByte((uint32_t(value) >> (8*i)) & 0xff);
+}
+
+void bb::ServoBus::endPacket() {
+  if(txOverflow_) return;
+  uint16_t len = txLen_ - packetStart_ - HEADER_LENGTH + 2;
+  tx_[packetStart_+5] = len & 0xff;
+  tx_[packetStart_+6] = len >> 8;
+  uint16_t crc = crc16(0, &tx_[packetStart_], txLen_ - packetStart_);
+  tx_[txLen_++] = crc & 0xff;
+  tx_[txLen_++] = crc >> 8;
+}
+
+void bb::ServoBus::consume(uint8_t byte) {
+  bytesReceived_++;
+
+  if(rxLen_ < sizeof(HEADER)) {
+    if(byte == HEADER[rxLen_]) rx_[rxLen_++] = byte;
+    else if(byte == 0xff && rxLen_ == 2) return; // a third 0xff, still two in a row
+    else rxLen_ = (byte == 0xff) ? 1 : 0;
+    return;
+  }
+
+  rx_[rxLen_++] = byte;
+  if(rxLen_ < HEADER_LENGTH) return;
+
+  uint16_t len = rx_[5] | (uint16_t(rx_[6]) << 8);
+  if(len < 4 || HEADER_LENGTH + len > rx_.size()) { // not a status packet we can take, look for the next one
+    rxLen_ = 0;
+    return;
+  }
+  if(rxLen_ < HEADER_LENGTH + len) return;
+
+  rxLen_ = 0;
+  uint16_t crc = rx_[HEADER_LENGTH+len-2] | (uint16_t(rx_[HEADER_LENGTH+len-1]) << 8);
+  if(crc16(0, rx_.data(), HEADER_LENGTH+len-2) != crc) return;
+
+  // Undo byte stuffing in place
+  uint8_t *body = &rx_[HEADER_LENGTH];
+  uint16_t bodyLen = 0;
+  uint8_t last[3] = { 0, 0, 0 };
+  for(uint16_t i=0; i<len-2; i++) {
+    uint8_t b = body[i];
+    bool stuffed = (i >= 3 && last[0] == 0xff && last[1] == 0xff && last[2] == 0xfd && b == 0xfd);
+    last[0] = last[1]; last[1] = last[2]; last[2] = b;
+    if(!stuffed) body[bodyLen++] = b;
+  }
+
+  handleStatus(rx_[4], body, bodyLen);
+}
+
+void bb::ServoBus::handleStatus(uint8_t id, const uint8_t* body, uint16_t len) {
+  if(len < 2 || body[0] != INST_STATUS) return;
+
+  if(requestID_ != NO_REQUEST) {
+    if(id != requestID_ || len > 2 + MAX_REPLY_LENGTH) return;
+    replyError_ = body[1];
+    memcpy(reply_, body+2, len-2);
+    replied_ = true;
+    return;
+  }
+
+  if(id == BROADCAST_ID) {
+    // Fast Sync Read: error, ID and data for every servo, with a CRC between each servo's part and the next
+    unsigned int n = numReaders_;
+    if(n == 0 || activeReadStrategy() != READ_FAST_SYNC) return;
+    uint8_t rlen = firstReader()->read.length;
+    if(len != 1 + n*(2+rlen) + (n-1)*2) return;
+    const uint8_t *p = body + 1;
+    for(unsigned int i=0; i<n; i++) {
+      Entry *e = entryWithID(p[1]);
+      if(e != NULL && !e->received) {
+        e->error = p[0];
+        memcpy(e->present, p+2, rlen);
+        e->received = true;
+        replies_++;
+      }
+      p += 2 + rlen + 2;
+    }
+  } else {
+    Entry *e = entryWithID(id);
+    if(e == NULL || e->received || e->read.length == 0 || len != 2 + e->read.length) return;
+    e->error = body[1];
+    memcpy(e->present, body+2, e->read.length);
+    e->received = true;
+    replies_++;
+  }
+
+  if(replies_ == numReaders_) finish(RES_OK);
+}
+
+// CRC-16 as specified for Protocol 2.0 (polynomial 0x8005, not reflected)
+uint16_t bb::ServoBus::crc16(uint16_t crc, const uint8_t* buf, size_t len) {
+  for(size_t i=0; i<len; i++) {
+    crc ^= uint16_t(buf[i]) << 8;
+    for(int bit=0; bit<8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x8005 : (crc << 1);
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,238 @@
+#if !defined(BBSERVOBUS_H)
+#define BBSERVOBUS_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <vector>
+#include "BBError.h"
+
+namespace bb {
+
+/*!
+  \brief Byte level access to a half-duplex Dynamixel bus.
+*/
+class ServoPort {
+public:
+  virtual ~ServoPort() {}
+
+  virtual void begin(unsigned long baud) = 0;
+  virtual unsigned long baudrate() = 0;
+  //! Sends the bytes. Returns once they are on the wire and the bus has been switched back to receiving.
+  virtual void transmit(const uint8_t* buf, size_t len) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+};
+
+#if !defined(ARDUINO_ARCH_HOST)
+/*!
+  \brief ServoPort on a hardware UART with a direction pin, as used by the Dynamixel shield.
+
+  Received bytes are buffered by the UART's interrupt handler, so replies can be collected whenever it is convenient.
+*/
+class ServoSerialPort: public ServoPort {
+public:
+  ServoSerialPort(HardwareSerial& serial, int dirPin);
+
+  virtual void begin(unsigned long baud);
+  virtual unsigned long baudrate() { return baud_; }
+  virtual void transmit(const uint8_t* buf, size_t len);
+  virtual int available() { return serial_.available(); }
+  virtual int read() { return serial_.read(); }
+
+protected:
+  HardwareSerial& serial_;
+  int dirPin_;
+  unsigned long baud_;
+};
+#endif
+
+/*!
+  \brief Cyclic Dynamixel Protocol 2.0 traffic: all goals out and all present values in, in one transaction.
+
+  A transaction is a single burst of instruction packets: one Sync Write for every goal item that changed on at least
+  one servo, listing only the servos it changed on, followed by one read of the same block of present values from
+  every servo - a Fast Sync Read, to which the servos answer in a single combined status packet, or for firmware that
+  doesn't know that, a Sync Read or Bulk Read.
+  startCycle() sends the burst and returns immediately; the replies are collected by poll() whenever the caller gets
+  around to it, typically at the start of the next cycle. In between, the CPU is free.
+
+  Every servo keeps a dirty bit per goal item. A goal counts as changed once it differs from the value last sent by more
+  than the item's deadband, so jitter below what the servo can resolve doesn't cost bus time.
+
+  Everything here works on raw control table values. Which addresses the goal items and the present block live at is
+  up to the caller (see Servos), and can differ from servo to servo. Where the servos in a write or read don't agree,
+  Bulk Write or Bulk Read is used instead of the Sync instruction. For setup and configuration, there is blocking
+  access to single servos.
+
+  Several buses, each with its own ServoBus, can be serviced concurrently: start a cycle on each, and the replies
+  arrive in parallel while the CPU is busy elsewhere.
+*/
+class ServoBus {
+public:
+  static const uint8_t BROADCAST_ID = 0xfe;
+  static const unsigned int MAX_READ_LENGTH = 16;
+
+  //! Goal items, in the order they are written - profile velocity has to arrive before the goal position it applies to.
+  enum WriteItem {
+    ITEM_PROFILE_VELOCITY = 0,
+    ITEM_GOAL_POSITION    = 1,
+    ITEM_GOAL_VELOCITY    = 2,
+    ITEM_GOAL_CURRENT     = 3,
+    NUM_WRITE_ITEMS       = 4
+  };
+
+  enum ReadStrategy {
+    READ_FAST_SYNC,
+    READ_SYNC,
+    READ_BULK
+  };
+
+  ServoBus(ServoPort* port = NULL);
+
+  void setPort(ServoPort* port) { port_ = port; }
+  ServoPort* port() { return port_; }
+
+  //! Forgets all servos and any transaction in flight.
+  void clear();
+  Result addServo(uint8_t id);
+  unsigned int numServos() const { return entries_.size(); }
+
+  //! Sets the item for all servos, including those added later. A length of 0 means the item is not written.
+  Result setWriteItem(WriteItem item, uint16_t addr, uint8_t length);
+  //! Sets the item for one servo, whose control table differs from the others'.
+  Result setWriteItem(uint8_t id, WriteItem item, uint16_t addr, uint8_t length);
+  Result setReadBlock(uint16_t addr, uint8_t length);
+  Result setReadBlock(uint8_t id, uint16_t addr, uint8_t length);
+  void setReadStrategy(ReadStrategy strategy) { strategy_ = strategy; }
+  ReadStrategy readStrategy() const { return strategy_; }
+  //! The strategy actually used - Bulk Read if the servos' read blocks differ.
+  ReadStrategy activeReadStrategy() const;
+  //! Time each servo waits before answering, as set in its RETURN_DELAY_TIME (2us units). Used for the timeout.
+  void setReturnDelay(unsigned long us) { returnDelay_ = us; }
+
+  //! Goals within deadband raw units of the value last sent are not sent again. Defaults to 0, sending every change.
+  void setDeadband(WriteItem item, uint32_t deadband);
+  uint32_t deadband(WriteItem item) const { return item < NUM_WRITE_ITEMS ? deadbands_[item] : 0; }
+
+  //! Sets the raw goal value. It is sent with the next transaction if it moved out of the deadband around what was sent last.
+  bool setGoal(uint8_t id, WriteItem item, int32_t value);
+  int32_t goal(uint8_t id, WriteItem item);
+  //! Sends every goal item of every servo with the next transaction, whether it changed or not.
+  void invalidate();
+  bool dirty(uint8_t id, WriteItem item);
+
+  //! Present value from the last successful read, sign extended. addr and length must lie within the read block.
+  int32_t present(uint8_t id, uint16_t addr, uint8_t length);
+  //! Whether the servo answered in the last transaction.
+  bool received(uint8_t id);
+  //! Error byte of the servo's last status, bit 7 being the hardware error alert.
+  uint8_t statusError(uint8_t id);
+
+  //! Sends changed goals and the read request without waiting for replies. Fails if a transaction is still busy.
+  Result startCycle();
+  //! Processes whatever replies have arrived, without blocking. Ends the transaction when complete or timed out.
+  void poll();
+  //! Polls until the transaction is over.
+  Result wait();
+  bool busy() const { return busy_; }
+  //! Outcome of the last transaction that is over.
+  Result result() const { return result_; }
+  unsigned int repliesReceived() const { return replies_; }
+
+  //! Bytes one transaction's replies take, which must fit into the UART receive buffer.
+  unsigned int replyBytes() const;
+
+  //! Blocking access to single servos, which need not have been added. Waits for a transaction in flight first.
+  Result ping(uint8_t id, uint16_t* model = NULL);
+  Result read(uint8_t id, uint16_t addr, uint8_t length, int32_t& value);
+  Result write(uint8_t id, uint16_t addr, uint8_t length, int32_t value);
+  Result reboot(uint8_t id);
+
+  unsigned long transactions() const { return transactions_; }
+  unsigned long failedTransactions() const { return failedTransactions_; }
+  unsigned long bytesSent() const { return bytesSent_; }
+  unsigned long bytesReceived() const { return bytesReceived_; }
+  //! Single goal values written, and those not written because they had not changed.
+  unsigned long goalsWritten() const { return goalsWritten_; }
+  unsigned long goalsSkipped() const { return goalsSkipped_; }
+  //! Microseconds from sending the last transaction until its replies were complete.
+  unsigned long lastTransactionMicros() const { return lastMicros_; }
+
+  static uint16_t crc16(uint16_t crc, const uint8_t* buf, size_t len);
+
+protected:
+  static const uint8_t INST_PING           = 0x01;
+  static const uint8_t INST_READ           = 0x02;
+  static const uint8_t INST_WRITE          = 0x03;
+  static const uint8_t INST_REBOOT         = 0x08;
+  static const uint8_t INST_STATUS         = 0x55;
+  static const uint8_t INST_SYNC_READ      = 0x82;
+  static const uint8_t INST_SYNC_WRITE     = 0x83;
+  static const uint8_t INST_FAST_SYNC_READ = 0x8a;
+  static const uint8_t INST_BULK_READ      = 0x92;
+  static const uint8_t INST_BULK_WRITE     = 0x93;
+  static const uint8_t NO_REQUEST          = 0xff;
+  static const unsigned int MAX_REPLY_LENGTH = 8;
+
+  struct Item {
+    uint16_t addr;
+    uint8_t length;
+  };
+
+  struct Entry {
+    uint8_t id;
+    Item write[NUM_WRITE_ITEMS], read;
+    int32_t goal[NUM_WRITE_ITEMS], sent[NUM_WRITE_ITEMS];
+    uint8_t dirty, sending;             // bitmaps over WriteItem
+    uint8_t present[MAX_READ_LENGTH];
+    uint8_t error;
+    bool received;
+  };
+
+  Entry* entryWithID(uint8_t id);
+  //! The first servo that is read. All read blocks are the same unless Bulk Read is used.
+  const Entry* firstReader() const;
+  //! Makes the buffers big enough for the worst case of the current configuration.
+  void sizeBuffers();
+  void addWrite(unsigned int item);
+
+  void beginPacket(uint8_t id, uint8_t inst);
+  void addByte(uint8_t byte);
+  void addValue(int32_t value, uint8_t length);
+  void endPacket();
+
+  void consume(uint8_t byte);
+  void handleStatus(uint8_t id, const uint8_t* body, uint16_t len);
+  void finish(Result res);
+  unsigned long timeoutFor(unsigned int replyBytes, unsigned int numReplies);
+  Result request(uint8_t id, uint8_t inst, const uint8_t* params, unsigned int numParams, unsigned int replyLength);
+
+  ServoPort* port_;
+  std::vector<Entry> entries_;
+  Item writeItems_[NUM_WRITE_ITEMS];
+  uint32_t deadbands_[NUM_WRITE_ITEMS];
+  Item readBlock_;
+  ReadStrategy strategy_;
+  unsigned long returnDelay_;
+
+  std::vector<uint8_t> tx_;
+  unsigned int txLen_, packetStart_;
+  bool txOverflow_;
+
+  std::vector<uint8_t> rx_;
+  unsigned int rxLen_;
+
+  // Single servo request
+  uint8_t requestID_, reply_[MAX_REPLY_LENGTH], replyError_;
+  bool replied_;
+
+  bool busy_;
+  Result result_;
+  unsigned int replies_, numReaders_;
+  unsigned long startMicros_, timeout_, lastMicros_;
+  unsigned long transactions_, failedTransactions_, bytesSent_, bytesReceived_, goalsWritten_, goalsSkipped_;
+};
+
+};
+
+#endif // BBSERVOBUS_H
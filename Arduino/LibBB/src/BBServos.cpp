@@ -1,8 +1,10 @@
 #include <Wire.h>
 #include <LibBB.h>
+#if !defined(ARDUINO_ARCH_HOST)
+#include <DynamixelShield.h> // for DXL_SERIAL and DXL_DIR_PIN
+#endif
 
 static uint32_t SLOW_VEL = 5;
-static const uint8_t MAX_SERVO_ID = 4;
 
 using namespace bb;
 
@@ -11,30 +13,213 @@ static const unsigned int bpsList[] = { 1000000, 57600, 115200 };
 static const unsigned int numBps = 3;
 static const unsigned int goalBps = 1000000;
 
+// Operating modes
+static const uint8_t OPMODE_CURRENT = 0;
+static const uint8_t OPMODE_VELOCITY = 1;
+static const uint8_t OPMODE_POSITION = 3;
+static const uint8_t OPMODE_CURRENT_BASED_POSITION = 5;
+static const uint8_t OPMODE_XL320_JOINT = 2;
+static const uint8_t OPMODE_NONE = 255;
+
+struct CtrlTableEntry {
+  uint16_t addr;
+  uint8_t length;
+};
+
+// Control tables, in the order of Servos::Item. Length 0 means the model doesn't have the item.
+
+// X series with current control, MX-64 and MX-106 (Protocol 2.0)
+static const CtrlTableEntry xTable_[Servos::NUM_ITEMS] = {
+  {0, 2},   // MODEL_NUMBER
+  {8, 1},   // BAUD_RATE
+  {9, 1},   // RETURN_DELAY_TIME
+  {10, 1},  // DRIVE_MODE
+  {11, 1},  // OPERATING_MODE
+  {38, 2},  // CURRENT_LIMIT
+  {44, 4},  // VELOCITY_LIMIT
+  {48, 4},  // MAX_POSITION_LIMIT
+  {52, 4},  // MIN_POSITION_LIMIT
+  {63, 1},  // SHUTDOWN
+  {64, 1},  // TORQUE_ENABLE
+  {70, 1},  // HARDWARE_ERROR_STATUS
+  {80, 2},  // POSITION_D_GAIN
+  {82, 2},  // POSITION_I_GAIN
+  {84, 2},  // POSITION_P_GAIN
+  {102, 2}, // GOAL_CURRENT
+  {104, 4}, // GOAL_VELOCITY
+  {108, 4}, // PROFILE_ACCELERATION
+  {112, 4}, // PROFILE_VELOCITY
+  {116, 4}, // GOAL_POSITION
+  {126, 2}, // PRESENT_CURRENT
+  {128, 4}, // PRESENT_VELOCITY
+  {132, 4}  // PRESENT_POSITION
+};
+
+// X series without current control (XL430, XC430, 2XL430, 2XC430) and MX-28 (Protocol 2.0). Present load instead
+// of present current.
+static const CtrlTableEntry xLoadTable_[Servos::NUM_ITEMS] = {
+  {0, 2},   // MODEL_NUMBER
+  {8, 1},   // BAUD_RATE
+  {9, 1},   // RETURN_DELAY_TIME
+  {10, 1},  // DRIVE_MODE
+  {11, 1},  // OPERATING_MODE
+  {0, 0},   // CURRENT_LIMIT
+  {44, 4},  // VELOCITY_LIMIT
+  {48, 4},  // MAX_POSITION_LIMIT
+  {52, 4},  // MIN_POSITION_LIMIT
+  {63, 1},  // SHUTDOWN
+  {64, 1},  // TORQUE_ENABLE
+  {70, 1},  // HARDWARE_ERROR_STATUS
+  {80, 2},  // POSITION_D_GAIN
+  {82, 2},  // POSITION_I_GAIN
+  {84, 2},  // POSITION_P_GAIN
+  {0, 0},   // GOAL_CURRENT
+  {104, 4}, // GOAL_VELOCITY
+  {108, 4}, // PROFILE_ACCELERATION
+  {112, 4}, // PROFILE_VELOCITY
+  {116, 4}, // GOAL_POSITION
+  {126, 2}, // PRESENT_CURRENT (present load)
+  {128, 4}, // PRESENT_VELOCITY
+  {132, 4}  // PRESENT_POSITION
+};
+
+// XL-320. Moving speed doubles as profile velocity, CW and CCW angle limits as position limits.
+static const CtrlTableEntry xl320Table_[Servos::NUM_ITEMS] = {
+  {0, 2},   // MODEL_NUMBER
+  {4, 1},   // BAUD_RATE
+  {5, 1},   // RETURN_DELAY_TIME
+  {0, 0},   // DRIVE_MODE
+  {11, 1},  // OPERATING_MODE (control mode)
+  {0, 0},   // CURRENT_LIMIT
+  {0, 0},   // VELOCITY_LIMIT
+  {8, 2},   // MAX_POSITION_LIMIT
+  {6, 2},   // MIN_POSITION_LIMIT
+  {18, 1},  // SHUTDOWN
+  {24, 1},  // TORQUE_ENABLE
+  {50, 1},  // HARDWARE_ERROR_STATUS
+  {27, 1},  // POSITION_D_GAIN
+  {28, 1},  // POSITION_I_GAIN
+  {29, 1},  // POSITION_P_GAIN
+  {0, 0},   // GOAL_CURRENT
+  {0, 0},   // GOAL_VELOCITY
+  {0, 0},   // PROFILE_ACCELERATION
+  {32, 2},  // PROFILE_VELOCITY (moving speed)
+  {30, 2},  // GOAL_POSITION
+  {41, 2},  // PRESENT_CURRENT (present load)
+  {39, 2},  // PRESENT_VELOCITY
+  {37, 2}   // PRESENT_POSITION
+};
+
+struct bb::Servos::ModelInfo {
+  const CtrlTableEntry* table;
+  uint16_t maxPosition;
+  float ticksPerDegree;
+  float rpmPerVelocityUnit;
+  float mAPerCurrentUnit;                    // 0 if the model has no current control
+  uint8_t opPosition, opVelocity, opCurrent; // operating mode values, OPMODE_NONE if not supported
+  int16_t maxLoad;                           // present load at 100%; 0 to use the current limit
+  uint16_t loadDirectionBit;                 // present load as magnitude plus direction bit, not two's complement
+  uint8_t overloadBit;                       // in SHUTDOWN and HARDWARE_ERROR_STATUS
+};
+
+static const Servos::ModelInfo xSeries269_ = { xTable_, 4095, 4096/360.0f, 0.229f, 2.69f, OPMODE_POSITION, OPMODE_VELOCITY, OPMODE_CURRENT, 0, 0, 5 };
+static const Servos::ModelInfo xSeries134_ = { xTable_, 4095, 4096/360.0f, 0.229f, 1.34f, OPMODE_POSITION, OPMODE_VELOCITY, OPMODE_CURRENT, 0, 0, 5 };
+static const Servos::ModelInfo xSeries100_ = { xTable_, 4095, 4096/360.0f, 0.229f, 1.0f, OPMODE_POSITION, OPMODE_VELOCITY, OPMODE_CURRENT, 0, 0, 5 };
+static const Servos::ModelInfo mxSeries336_ = { xTable_, 4095, 4096/360.0f, 0.229f, 3.36f, OPMODE_POSITION, OPMODE_VELOCITY, OPMODE_CURRENT, 0, 0, 5 };
+static const Servos::ModelInfo xSeriesLoad_ = { xLoadTable_, 4095, 4096/360.0f, 0.229f, 0.0f, OPMODE_POSITION, OPMODE_VELOCITY, OPMODE_NONE, 1000, 0, 5 };
+static const Servos::ModelInfo xl320_ = { xl320Table_, 1023, 1024/300.0f, 0.111f, 0.0f, OPMODE_XL320_JOINT, OPMODE_NONE, OPMODE_NONE, 1023, 1024, 0 };
+
+struct ModelNumber {
+  uint16_t number;
+  const Servos::ModelInfo* info;
+};
+
+static const ModelNumber models_[] = {
+  {30, &xSeriesLoad_},   // MX-28 (2.0)
+  {311, &mxSeries336_},  // MX-64 (2.0)
+  {321, &mxSeries336_},  // MX-106 (2.0)
+  {350, &xl320_},        // XL-320
+  {1000, &xSeries134_},  // XH430-W350
+  {1010, &xSeries134_},  // XH430-W210
+  {1020, &xSeries269_},  // XM430-W350
+  {1030, &xSeries269_},  // XM430-W210
+  {1040, &xSeries134_},  // XH430-V350
+  {1050, &xSeries134_},  // XH430-V210
+  {1060, &xSeriesLoad_}, // XL430-W250
+  {1070, &xSeriesLoad_}, // XC430-W150
+  {1080, &xSeriesLoad_}, // XC430-W240
+  {1090, &xSeriesLoad_}, // 2XL430-W250
+  {1100, &xSeries269_},  // XH540-W270
+  {1110, &xSeries269_},  // XH540-W150
+  {1120, &xSeries269_},  // XM540-W270
+  {1130, &xSeries269_},  // XM540-W150
+  {1140, &xSeries269_},  // XH540-V270
+  {1150, &xSeries269_},  // XH540-V150
+  {1160, &xSeriesLoad_}, // 2XC430-W250
+  {1170, &xSeries269_},  // XW540-T260
+  {1180, &xSeries269_},  // XW540-T140
+  {1190, &xSeries100_},  // XL330-M077
+  {1200, &xSeries100_},  // XL330-M288
+  {1210, &xSeries100_},  // XC330-T181
+  {1220, &xSeries100_},  // XC330-T288
+  {1230, &xSeries100_},  // XC330-M181
+  {1240, &xSeries100_},  // XC330-M288
+  {1270, &xSeries269_},  // XW430-T333
+  {1280, &xSeries269_}   // XW430-T200
+};
+
+static const Servos::ModelInfo* modelInfo(uint16_t number) {
+  for(auto& m: models_) {
+    if(m.number == number) return m.info;
+  }
+  return NULL;
+}
+
+// Baud rate control table values
+static uint8_t baudRateValue(unsigned long bps) {
+  switch(bps) {
+  case 9600: return 0;
+  case 57600: return 1;
+  case 115200: return 2;
+  case 1000000: return 3;
+  case 2000000: return 4;
+  default: return 1;
+  }
+}
+
 struct StrToCtrlTable {
   const char *str;
-  ControlTableItem::ControlTableItemIndex idx;
+  Servos::Item item;
 };
 
 static const StrToCtrlTable strToCtrlTable_[] = {
-  {"vel_limit", ControlTableItem::VELOCITY_LIMIT},
-  {"current_limit", ControlTableItem::CURRENT_LIMIT},
-  {"profile_acc", ControlTableItem::PROFILE_ACCELERATION},
-  {"profile_vel", ControlTableItem::PROFILE_VELOCITY},
-  {"operating_mode", ControlTableItem::OPERATING_MODE},
-  {"goal_velocity", ControlTableItem::GOAL_VELOCITY},
-  {"goal_current", ControlTableItem::GOAL_CURRENT},
-  {"pos_p_gain", ControlTableItem::POSITION_P_GAIN},
-  {"pos_i_gain", ControlTableItem::POSITION_I_GAIN},
-  {"pos_d_gain", ControlTableItem::POSITION_D_GAIN}
+  {"vel_limit", Servos::ITEM_VELOCITY_LIMIT},
+  {"current_limit", Servos::ITEM_CURRENT_LIMIT},
+  {"profile_acc", Servos::ITEM_PROFILE_ACCELERATION},
+  {"profile_vel", Servos::ITEM_PROFILE_VELOCITY},
+  {"operating_mode", Servos::ITEM_OPERATING_MODE},
+  {"goal_velocity", Servos::ITEM_GOAL_VELOCITY},
+  {"goal_current", Servos::ITEM_GOAL_CURRENT},
+  {"pos_p_gain", Servos::ITEM_POSITION_P_GAIN},
+  {"pos_i_gain", Servos::ITEM_POSITION_I_GAIN},
+  {"pos_d_gain", Servos::ITEM_POSITION_D_GAIN}
 };
 
 static const int strToCtrlTableLen_ = 10;
 
-bb::ServoControlOutput::ServoControlOutput(uint8_t sn, float offset, Servos::ControlMode mode) {
+bb::ServoControlOutput::ServoControlOutput(uint8_t sn, float offset, Servos::ControlMode mode): trajectory_(1) {
   sn_ = sn;
   offset_ = offset;
   mode_ = mode;
+  smooth_ = false;
+  trajectoryStarted_ = false;
+  lastMicros_ = 0;
+}
+
+void bb::ServoControlOutput::setTrajectoryLimits(float maxVel, float maxAccel) {
+  trajectory_.setLimits(maxVel, maxAccel);
+  smooth_ = maxVel != 0 || maxAccel != 0;
+  trajectoryStarted_ = false;
 }
 
 bb::Result bb::ServoControlOutput::set(float value) {
@@ -42,6 +227,20 @@ bb::Result bb::ServoControlOutput::set(float value) {
   switch(mode_) {
   case Servos::CONTROL_POSITION:
     p = value+offset_;
+    if(smooth_) {
+      // Start from where the servo is, and replan whenever the goal changes. Long gaps between calls don't jump.
+      unsigned long now = micros();
+      if(!trajectoryStarted_) {
+        trajectory_.reset(Servos::servos.presentPos(sn_));
+        trajectoryStarted_ = true;
+        lastMicros_ = now;
+      }
+      float dt = (now - lastMicros_) / 1e6;
+      lastMicros_ = now;
+      if(p != trajectory_.goal(0)) trajectory_.moveTo(&p);
+      trajectory_.update(dt < 0.1 ? dt : 0.1);
+      p = trajectory_.position(0);
+    }
     //bb::printf("Setting position to %.1f (%.1f, %.1f)\n", p, value, offset_);
     if(Servos::servos.setGoalPos(sn_, p) == true) return RES_OK;
     break;
@@ -59,17 +258,50 @@ bb::Result bb::ServoControlOutput::set(float value) {
   return RES_CMD_FAILURE;
 }
 
+void bb::ServoControlOutput::setMode(Servos::ControlMode mode) {
+  mode_ = mode;
+  trajectoryStarted_ = false;
+}
+
 float bb::ServoControlOutput::present() {
   return Servos::servos.presentPos(sn_)-offset_;
 }
 
+#if !defined(ARDUINO_ARCH_HOST)
+bb::Servos::Servos(): serialPort_(DXL_SERIAL, DXL_DIR_PIN) {
+  buses_[0].setPort(&serialPort_);
+  numBuses_ = 1;
+}
+#else
 bb::Servos::Servos() {
-  infoXelsSrPresent = NULL;
-  infoXelsSrLoad = NULL;
-  infoXelsSwGoalPos = NULL;
-  infoXelsSwGoalVel = NULL;
-  infoXelsSwGoalCur = NULL;
-  infoXelsSwPrfVel = NULL;
+  numBuses_ = 1;
+}
+#endif
+
+void bb::Servos::setPort(ServoPort* port) {
+  buses_[0].setPort(port);
+  for(unsigned int i=1; i<numBuses_; i++) buses_[i].setPort(NULL);
+  numBuses_ = 1;
+}
+
+Result bb::Servos::addPort(ServoPort* port) {
+  if(started_) return RES_SUBSYS_ALREADY_STARTED;
+  if(numBuses_ == 1 && buses_[0].port() == NULL) {
+    buses_[0].setPort(port);
+    return RES_OK;
+  }
+  if(numBuses_ >= MAX_BUSES) return RES_COMMON_OUT_OF_RANGE;
+  buses_[numBuses_++].setPort(port);
+  return RES_OK;
+}
+
+int bb::Servos::busOf(uint8_t id) {
+  Servo *s = servoWithID(id);
+  return s != NULL ? s->bus : -1;
+}
+
+void bb::Servos::setGoalDeadband(ServoBus::WriteItem item, uint32_t deadband) {
+  for(unsigned int i=0; i<MAX_BUSES; i++) buses_[i].setDeadband(item, deadband);
 }
 
 Result bb::Servos::initialize() {
@@ -87,86 +319,107 @@ Result bb::Servos::initialize() {
           "\t<ctrltableitem> <servo> [<value>]   Get or set, options: vel_limit, current_limit, profile_acc, profile_vel, operating_mode, pos_p_gain, pos_i_gain, pos_d_gain.\r\n"
           "\reboot <servo>|all                   Reboot <servo>";
 
-  ctrlPresentPos_.addr = 0;
-  ctrlPresentLoad_.addr = 0;
-  ctrlGoalPos_.addr = 0;
-  ctrlProfileVel_.addr = 0;
-  ctrlGoalVel_.addr = 0;
   torqueOffOnStop_ = true;
   return Subsystem::initialize();
 }
 
-bool bb::Servos::getControlTableItemInfo(uint16_t model, uint8_t item, DYNAMIXEL::ControlTableItemInfo_t& info) {
-  DYNAMIXEL::ControlTableItemInfo_t itemInfo = DYNAMIXEL::getControlTableItemInfo(model, item);
-  if(itemInfo.addr == 0 && itemInfo.addr_length == 0) {
-    bb::printf("Servo model %d doesn't support item %d -- ignore if you think this is safe\n", model, item);
-    return false;
-  } else if(info.addr == 0 || info.addr_length == 0) {
-    info.addr = itemInfo.addr;
-    info.addr_length = itemInfo.addr_length;
-    return true;
-  } else if(info.addr == itemInfo.addr && info.addr_length == itemInfo.addr_length) {
-    return true;
-  } 
-
-  bb::printf("Servos use differing control tables (%d/%d), that is not supported currently!\n", itemInfo.addr, itemInfo.addr_length);
-  return false;
-}
-
-
-Result bb::Servos::start(ConsoleStream* stream) {
-  if (isStarted()) return RES_SUBSYS_ALREADY_STARTED;
-
-  Runloop::runloop.excuseOverrun();
-  servos_.clear();
-
-  dxl_.setPortProtocolVersion(2.0);
-  unsigned int bps = 0;
-
-  if(stream) stream->printf("Detecting Dynamixels... ");
+Result bb::Servos::detectServos(unsigned int b, ConsoleStream* stream, unsigned long& bps) {
+  ServoBus& bus = buses_[b];
+  unsigned int found = 0;
+  bps = 0;
+  if(stream) stream->printf("Detecting Dynamixels on bus %d... ", b);
 
   for (unsigned int i = 0; i < numBps; i++) {
-    dxl_.begin(bpsList[i]);
-    if (dxl_.scan() == false) {
-      if(stream) stream->printf("scan failed at %dbps...", bpsList[i]);
-      continue;
-    }
-
-    bps = bpsList[i];
-
-    if(stream) stream->printf("scan successful at %dbps, enumerating up to %d...", bps, MAX_SERVO_ID);
+    bus.port()->begin(bpsList[i]);
+    bus.setReturnDelay(500); // until we have set it ourselves
 
     for (uint8_t id = 1; id <= MAX_SERVO_ID; id++) {
-      if (dxl_.ping(id) == false) continue;
+      uint16_t model;
+      if (bus.ping(id, &model) != RES_OK) continue;
 
-      uint16_t model = dxl_.getModelNumber(id);
+      Servo *other = servoWithID(id);
+      if(other != NULL) {
+        bb::printf("Servo ID %d found on bus %d and bus %d, ignoring the second one\n", id, other->bus, b);
+        continue;
+      }
+
+      if(found == 0 && stream) stream->printf("found servos at %dbps, enumerating up to %d...", bpsList[i], MAX_SERVO_ID);
       if(stream) stream->printf("#%d: model # %d... ", id, model);
+      found++;
+      const ModelInfo* info = modelInfo(model);
+      if(info == NULL) {
+        bb::printf("Servo model %d unknown, assuming X series control table -- ignore if you think this is safe\n", model);
+        info = &xSeries269_;
+      }
 
+      // readItem() needs to know the servo's model and bus, so add it first and fill in the values after.
       Servo servo;
       servo.id = id;
+      servo.bus = b;
+      servo.modelNumber = model;
+      servo.model = info;
+      servo.maxLoad = info->maxLoad;
       servo.mode = CONTROL_POSITION;
-      servo.goalPos = dxl_.getPresentPosition(id);
-      servo.profileVel = dxl_.readControlTableItem(ControlTableItem::PROFILE_VELOCITY, id);
-      servo.presentPos = dxl_.getPresentPosition(id); 
+      servo.goalPos = 0;
+      servo.profileVel = 0;
+      servo.presentPos = 0;
       servo.goalVel = 0;
       servo.goalCur = 0;
-      servo.load = dxl_.readControlTableItem(ControlTableItem::PRESENT_LOAD, id);
-      servo.min = dxl_.readControlTableItem(ControlTableItem::MIN_POSITION_LIMIT, id);
-      servo.max = dxl_.readControlTableItem(ControlTableItem::MAX_POSITION_LIMIT, id);
+      servo.load = 0;
+      servo.min = 0;
+      servo.max = info->maxPosition;
       servo.offset = 0;
+      servo.lastVel = 0;
       servos_.push_back(servo);
 
-      getControlTableItemInfo(model, ControlTableItem::PRESENT_POSITION, ctrlPresentPos_);
-      getControlTableItemInfo(model, ControlTableItem::GOAL_POSITION, ctrlGoalPos_);
-      getControlTableItemInfo(model, ControlTableItem::GOAL_VELOCITY, ctrlGoalVel_);
-      getControlTableItemInfo(model, ControlTableItem::GOAL_CURRENT, ctrlGoalCur_);
-      getControlTableItemInfo(model, ControlTableItem::PROFILE_VELOCITY, ctrlProfileVel_);
-      getControlTableItemInfo(model, ControlTableItem::PRESENT_CURRENT, ctrlPresentLoad_);
-    } 
-    break;
+      int32_t pos = 0, vel = 0, cur = 0, min = 0, max = info->maxPosition, limit = 0;
+      readItem(id, ITEM_PRESENT_POSITION, pos);
+      readItem(id, ITEM_PROFILE_VELOCITY, vel);
+      readItem(id, ITEM_PRESENT_CURRENT, cur);
+      readItem(id, ITEM_MIN_POSITION_LIMIT, min);
+      readItem(id, ITEM_MAX_POSITION_LIMIT, max);
+
+      Servo& s = servos_.back();
+      s.goalPos = pos;
+      s.profileVel = vel;
+      s.presentPos = pos;
+      s.load = cur;
+      s.min = min;
+      s.max = max;
+      // Servos with current control are loaded fully at their current limit
+      if(s.maxLoad == 0) {
+        if(readItem(id, ITEM_CURRENT_LIMIT, limit) == RES_OK && limit > 0) s.maxLoad = limit;
+        else s.maxLoad = 1193;
+      }
+    }
+
+    if(found != 0) {
+      bps = bpsList[i];
+      break;
+    }
+    if(stream) stream->printf("scan failed at %dbps...", bpsList[i]);
   }
 
   if (stream) stream->printf("done.\n");
+  return RES_OK;
+}
+
+Result bb::Servos::start(ConsoleStream* stream) {
+  if (isStarted()) return RES_SUBSYS_ALREADY_STARTED;
+  for(unsigned int b=0; b<numBuses_; b++) {
+    if (buses_[b].port() == NULL) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  }
+
+  Runloop::runloop.excuseOverrun();
+  servos_.clear();
+  for(unsigned int b=0; b<numBuses_; b++) buses_[b].clear();
+
+  unsigned long bps[MAX_BUSES];
+  Result res;
+  for(unsigned int b=0; b<numBuses_; b++) {
+    res = detectServos(b, stream, bps[b]);
+    if(res != RES_OK) return res;
+  }
 
   for(auto id: requiredIds_) {
     if(servoWithID(id) == NULL) {
@@ -185,35 +438,51 @@ Result bb::Servos::start(ConsoleStream* stream) {
   }
 
   // Configure servos
-  if (bps != goalBps) {
+  for(unsigned int b=0; b<numBuses_; b++) {
+    if (bps[b] == goalBps) continue;
     for (auto& s : servos_) {
-      dxl_.torqueOff(s.id);
-      if(dxl_.setBaudrate(s.id, goalBps) == false) Console::console.printfBroadcast("Failed to set baud rate on #%d to %d\n", s.id, goalBps);
+      if(s.bus != b) continue;
+      writeItem(s.id, ITEM_TORQUE_ENABLE, 0);
+      if(writeItem(s.id, ITEM_BAUD_RATE, baudRateValue(goalBps)) != RES_OK) Console::console.printfBroadcast("Failed to set baud rate on #%d to %d\n", s.id, goalBps);
     }
     delay(30);
-    dxl_.begin(goalBps);
-    if (dxl_.scan() == false) {
-      if(stream) stream->printf("Could not rescan after switching to %dbps!\n", goalBps);
-      return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+    buses_[b].port()->begin(goalBps);
+    for (auto& s : servos_) {
+      if (s.bus == b && buses_[b].ping(s.id) != RES_OK) {
+        if(stream) stream->printf("Could not find #%d after switching to %dbps!\n", s.id, goalBps);
+        return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+      }
     }
-    bps = goalBps;
+    bps[b] = goalBps;
   }
 
-  setupSyncBuffers();
-  Result res = RES_OK;
-  for(int i=0; i<100; i++) {
-    res = syncReadInfo(stream);
-    if(res == RES_OK) break;
-    delay(5);
+  for(unsigned int b=0; b<numBuses_; b++) {
+    res = setupBus(b);
+    if(res != RES_OK) return res;
+    for(int i=0; i<100; i++) {
+      // Servos with older firmware don't answer Fast Sync Read. Alternate with plain Sync Read until one works.
+      buses_[b].setReadStrategy(i%2 == 0 ? ServoBus::READ_FAST_SYNC : ServoBus::READ_SYNC);
+      res = buses_[b].startCycle();
+      if(res == RES_OK) res = buses_[b].wait();
+      if(res == RES_OK) break;
+      delay(5);
+    }
+    if(res != RES_OK) {
+      if(stream) stream->printf("Servos on bus %d don't answer: %s\n", b, errorMessage(res));
+      return res;
+    }
   }
-  if(res != RES_OK) return res;
+  copyPresentValues();
 
+  // Operating mode, return delay time and drive mode are in the EEPROM area, which is only writable with torque off
   for (auto& s : servos_) {
-    dxl_.setOperatingMode(s.id, OP_POSITION);
-    dxl_.writeControlTableItem(ControlTableItem::RETURN_DELAY_TIME, s.id, 5);
-    dxl_.writeControlTableItem(ControlTableItem::DRIVE_MODE, s.id, 0);
-    dxl_.torqueOn(s.id);
+    writeItem(s.id, ITEM_TORQUE_ENABLE, 0);
+    writeItem(s.id, ITEM_OPERATING_MODE, s.model->opPosition);
+    writeItem(s.id, ITEM_RETURN_DELAY_TIME, 5);
+    writeItem(s.id, ITEM_DRIVE_MODE, 0); // fails harmlessly on models without drive mode
+    writeItem(s.id, ITEM_TORQUE_ENABLE, 1);
   }
+  for(unsigned int b=0; b<numBuses_; b++) buses_[b].setReturnDelay(10);
 
   operationStatus_ = RES_OK;
   started_ = true;
@@ -223,11 +492,12 @@ Result bb::Servos::start(ConsoleStream* stream) {
 Result bb::Servos::stop(ConsoleStream* stream) {
   (void)stream;
 
-  teardownSyncBuffers();
+  idleBus();
+  for(unsigned int b=0; b<numBuses_; b++) buses_[b].clear();
 
   if(torqueOffOnStop_) {
     for (auto& s : servos_) {
-      dxl_.torqueOff(s.id);
+      writeItem(s.id, ITEM_TORQUE_ENABLE, 0);
     }
   }
   servos_.clear();
@@ -249,20 +519,35 @@ Result bb::Servos::step() {
     return RES_SUBSYS_COMM_ERROR;
   }
 
-  Result res = syncReadInfo();
-  if(res!=RES_OK) {
-    failcount++;
-    return RES_SUBSYS_COMM_ERROR;
+  // Collect the replies to the transactions started at the end of the last step, which have had a whole cycle to
+  // arrive. If they are still coming in on any bus, leave everything as it is until the next step.
+  bool busy = false;
+  for(unsigned int b=0; b<numBuses_; b++) {
+    buses_[b].poll();
+    if(buses_[b].busy()) busy = true;
   }
+  if(busy) return RES_OK;
 
-  res = syncWriteInfo();
-  if(res!=RES_OK) {
+  Result res = RES_OK;
+  copyPresentValues();
+  for(unsigned int b=0; b<numBuses_; b++) {
+    if(buses_[b].result() == RES_OK) continue;
+    res = buses_[b].result();
+    Console::console.printfBroadcast("servo: Receiving present values failed on bus %d (%d instead of %d replies)!\n", b, buses_[b].repliesReceived(), buses_[b].numServos());
+  }
+
+  // Goals set since then go out with the next request, and the CPU is free while the servos answer.
+  for(unsigned int b=0; b<numBuses_; b++) {
+    Result startRes = buses_[b].startCycle();
+    if(res == RES_OK) res = startRes;
+  }
+  if(res != RES_OK) {
     failcount++;
     return RES_SUBSYS_COMM_ERROR;
   }
 
   for(auto& s: servos_) {
-    int maxload = (int)(1193.0*0.8);
+    int maxload = (int)(s.maxLoad*0.8);
     if(s.load > maxload || s.load < -maxload) {
       Console::console.printfBroadcast("Warning - servo %d load %d exceeds 80\%!\n", s.id, s.load);
     }
@@ -352,12 +637,13 @@ Result bb::Servos::handleConsoleCommand(const std::vector<String>& words, Consol
         if (stream) {
           stream->printf("Rebooting %d... ", s.id);
         }
-        dxl_.reboot(s.id);
+        buses_[s.bus].reboot(s.id);
       }
     } else {
       uint8_t id = words[1].toInt();
-      if(servoWithID(id) == NULL) return RES_CMD_INVALID_ARGUMENT;
-      dxl_.reboot(id);
+      Servo *s = servoWithID(id);
+      if(s == NULL) return RES_CMD_INVALID_ARGUMENT;
+      buses_[s->bus].reboot(id);
     }
 
     delay(1000);
@@ -368,7 +654,7 @@ Result bb::Servos::handleConsoleCommand(const std::vector<String>& words, Consol
   else {
     for(int i=0; i<strToCtrlTableLen_; i++) {
       if(words[0] == strToCtrlTable_[i].str) {
-        return handleCtrlTableCommand(strToCtrlTable_[i].idx, words, stream);
+        return handleCtrlTableCommand(strToCtrlTable_[i].item, words, stream);
       }
     }
   }
@@ -376,95 +662,74 @@ Result bb::Servos::handleConsoleCommand(const std::vector<String>& words, Consol
   return bb::Subsystem::handleConsoleCommand(words, stream);
 }
 
-Result bb::Servos::handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const std::vector<String>& words, ConsoleStream* stream) {
+Result bb::Servos::handleCtrlTableCommand(Item item, const std::vector<String>& words, ConsoleStream* stream) {
   if (words.size() < 2 || words.size() > 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
   int id = words[1].toInt();
-  if (words.size() == 2) {
-    int val = (int)dxl_.readControlTableItem(idx, id);
-    if(stream) stream->printf("%s=%d\n", words[0].c_str(), val);
-  } else {
-    int val = words[2].toInt();
-    if(stream) stream->printf("Setting %s (%d) to %d\n", words[0].c_str(), (int)idx, val);
-    dxl_.writeControlTableItem(idx, id, val);
-    val = (int)dxl_.readControlTableItem(idx, id);
-    if(stream) stream->printf("%s=%d\n", words[0].c_str(), val);
+  Servo *s = servoWithID(id);
+  if(s == NULL) return RES_CMD_INVALID_ARGUMENT;
+  int32_t val;
+  Result res;
+  if (words.size() == 3) {
+    val = words[2].toInt();
+    if(stream) stream->printf("Setting %s (%d) to %d\n", words[0].c_str(), s->model->table[item].addr, (int)val);
+    res = writeItem(id, item, val);
+    if(res != RES_OK) return res;
   }
+  res = readItem(id, item, val);
+  if(res != RES_OK) return res;
+  if(stream) stream->printf("%s=%d\n", words[0].c_str(), (int)val);
   return RES_OK;
 }
 
 #define ABS(x) (((x)<0?-(x):(x)))
 
 Result bb::Servos::home(uint8_t id, float vel, unsigned int maxLoadPercent, ConsoleStream* stream) {
-  Servo *s = NULL;
-  if(id != ID_ALL) {
-    s = servoWithID(id);
+  (void)stream;
+  std::vector<Servo*> homing;
+  if(id == ID_ALL) {
+    for(auto& s: servos_) homing.push_back(&s);
+  } else {
+    Servo *s = servoWithID(id);
     if(s == NULL) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+    homing.push_back(s);
   }
 
-  Result res;
-  int maxoffs = 0;
-  uint32_t rawVel = vel / 0.229; // vel is given in units of 0.229rev/min
-  unsigned int maxLoad = maxLoadPercent * 10;
-
-  res = syncReadInfo();
+  Result res = syncInfo();
   if(res != RES_OK) return res;
 
-  // store last profile velocity, switch torque on, and set new profile velocity
-  if(id == ID_ALL) {
-    for(auto& s: servos_) {
-      s.lastVel = s.profileVel;
-      switchTorque(s.id, true);
-      setProfileVelocity(s.id, rawVel, VALUE_RAW);
-    }
-  } else {
+  // store last profile velocity, switch torque on, and set new profile velocity. vel is given in rev/min.
+  for(auto s: homing) {
     s->lastVel = s->profileVel;
-    switchTorque(id, true);
-    setProfileVelocity(id, rawVel, VALUE_RAW);
+    switchTorque(s->id, true);
+    setProfileVelocity(s->id, vel / s->model->rpmPerVelocityUnit, VALUE_RAW);
   }
-  res = syncWriteInfo();
+  res = syncInfo();
   if(res != RES_OK) return res;
 
-  // set goal. Can't do this in one with profile velocity setting.
-  if(id == ID_ALL) {
-    for(auto& s: servos_) {
-      setGoalPos(s.id, s.min + (s.max - s.min)/2, VALUE_RAW); // FIXME Maybe home pos is not in the middle?
-      int offs = (int)s.presentPos - (int)s.goalPos;
-      if(offs < 0) offs = -offs;
-      if(offs > maxoffs) maxoffs = offs;
-    }
-  } else {
-    setGoalPos(id, s->min + (s->max - s->min)/2, VALUE_RAW);
-    maxoffs = abs((int)s->presentPos - (int)s->goalPos);
-  }      
-  res = syncWriteInfo();
+  // set goal. Can't do this in one with profile velocity setting. Also work out how many ms it should take to reach it.
+  float timeToReachGoalMS = 0;
+  for(auto s: homing) {
+    setGoalPos(s->id, s->min + (s->max - s->min)/2, VALUE_RAW); // FIXME Maybe home pos is not in the middle?
+    float ticksPerMS = (vel * 360.0 * s->model->ticksPerDegree) / 60000;
+    float t = abs((int)s->presentPos - (int)s->goalPos) / ticksPerMS;
+    if(t > timeToReachGoalMS) timeToReachGoalMS = t;
+  }
+  res = syncInfo();
   if(res != RES_OK) return res;
 
-  // how many ms should it take to reach the goal?
-  float timeToReachGoalMS = maxoffs / ((vel * 4096.0) / 60000);
-
   int timeRemaining = (int)(2*timeToReachGoalMS);
   bool allReachedGoal = false;
   while(timeRemaining > 0) {
-    syncReadInfo();
+    syncInfo();
     allReachedGoal = true;
-    if(id == ID_ALL) {
-      for(auto& s: servos_) {
-        int diff = abs((int)s.presentPos - (int)s.goalPos);
-        // Console::console.printfBroadcast("%d Servo %d: Pos %d Goal %d Diff %d Load %d vel %d\n", timeRemaining, s.id, s.present, s.goal, diff, s.load, rawVel);
-        if(diff > 10) allReachedGoal = false;
-        if(abs(s.load) > maxLoad) {
-          Console::console.printfBroadcast("ERROR: MAX LOAD OF %d EXCEEDED BY SERVO %d (%d)!!! SWITCHING OFF.\n",
-                                           maxLoad, s.id, s.load);
-          switchTorque(s.id, false);
-          return RES_SUBSYS_HW_DEPENDENCY_MISSING;
-        }
-      }
-    } else {
+    for(auto s: homing) {
       int diff = abs((int)s->presentPos - (int)s->goalPos);
-      // Console::console.printfBroadcast("%d Servo %d: Pos %d Offs %d Goal %d Diff %d Load %d vel %d\n", timeRemaining, s->id, s->present, s->offset, s->goal, diff, s->load, rawVel);
-      if(diff > 10) allReachedGoal = false;
+      int maxLoad = s->maxLoad * maxLoadPercent / 100;
+      // Console::console.printfBroadcast("%d Servo %d: Pos %d Goal %d Diff %d Load %d\n", timeRemaining, s->id, s->presentPos, s->goalPos, diff, s->load);
+      if(diff > s->model->ticksPerDegree) allReachedGoal = false;
       if(ABS(s->load) > maxLoad) {
-        Console::console.printfBroadcast("ERROR: MAX LOAD OF %d EXCEEDED BY SERVO %d (%d)!!! SWITCHING OFF.", maxLoad, s->id, s->load);
+        Console::console.printfBroadcast("ERROR: MAX LOAD OF %d EXCEEDED BY SERVO %d (%d)!!! SWITCHING OFF.\n",
+                                         maxLoad, s->id, s->load);
         switchTorque(s->id, false);
         return RES_SUBSYS_HW_DEPENDENCY_MISSING;
       }
@@ -476,14 +741,10 @@ Result bb::Servos::home(uint8_t id, float vel, unsigned int maxLoadPercent, Cons
   }
 
   // restore old profile velocities
-  if(id == ID_ALL) {
-    for(auto& s: servos_) {
-      setProfileVelocity(s.id, s.lastVel, VALUE_RAW);
-    }
-  } else {
-    setProfileVelocity(id, s->lastVel, VALUE_RAW);
+  for(auto s: homing) {
+    setProfileVelocity(s->id, s->lastVel, VALUE_RAW);
   }
-  res = syncWriteInfo();
+  res = syncInfo();
   if(res != RES_OK) return res;
 
   return RES_OK;
@@ -492,21 +753,22 @@ Result bb::Servos::home(uint8_t id, float vel, unsigned int maxLoadPercent, Cons
 
 Result bb::Servos::switchTorque(uint8_t id, bool onoff) {
   if (operationStatus_ != RES_OK) return operationStatus_;
+  idleBus();
   if(id == ID_ALL) {
     for(auto& s: servos_) {
-      if(onoff) dxl_.torqueOn(s.id);
-      else dxl_.torqueOff(s.id);
+      Result res = writeItem(s.id, ITEM_TORQUE_ENABLE, onoff ? 1 : 0);
+      if(res != RES_OK) return res;
     }
-  } else {
-    if(onoff) dxl_.torqueOn(id);
-    else dxl_.torqueOff(id);
+    return RES_OK;
   }
-  
-  return RES_OK;
+
+  return writeItem(id, ITEM_TORQUE_ENABLE, onoff ? 1 : 0);
 }
 
 bool bb::Servos::isTorqueOn(uint8_t id) {
-  return dxl_.readControlTableItem(ControlTableItem::TORQUE_ENABLE, id);
+  int32_t val;
+  if(readItem(id, ITEM_TORQUE_ENABLE, val) != RES_OK) return false;
+  return val != 0;
 }
 
 void bb::Servos::printStatus(ConsoleStream* stream, int id) {
@@ -521,32 +783,39 @@ void bb::Servos::printStatus(ConsoleStream* stream, int id) {
     return;
   }
 
-  stream->printf("Servo #%d: ", id);
-  if (dxl_.ping(id)) {
+  stream->printf("Servo #%d on bus %d: ", id, s->bus);
+  uint16_t model;
+  if (buses_[s->bus].ping(id, &model) == RES_OK) {
     stream->printf("model #%d, present pos: %.1f° (%d), goal pos: %.1f° (%d), goal vel: %.1f°/s (%d), goal cur: %.1fmA (%d), load: %.1f (%d), ", 
-      dxl_.getModelNumber(id), presentPos(id), s->presentPos, goalPos(id), s->goalPos, goalVel(id), s->goalVel, goalCur(id), s->goalCur, load(id), s->load);
+      model, presentPos(id), s->presentPos, goalPos(id), s->goalPos, goalVel(id), s->goalVel, goalCur(id), s->goalCur, load(id), s->load);
     switch(controlMode(id)) {
     case CONTROL_POSITION: stream->printf("pos ctrl mode, "); break;
     case CONTROL_VELOCITY: stream->printf("vel ctrl mode, "); break;
     case CONTROL_CURRENT: stream->printf("cur ctrl mode, "); break;
     default: stream->printf("unknonw ctrl mode, "); break;
     }
-    
-    stream->printf("range: [%d..%d], offset: %d, invert: %d, ", s->min, s->max, s->offset, dxl_.readControlTableItem(ControlTableItem::DRIVE_MODE, id) & 0x1);
-
-    stream->printf("hw err: $%x", dxl_.readControlTableItem(ControlTableItem::HARDWARE_ERROR_STATUS, id));
-    uint8_t operatingMode = dxl_.readControlTableItem(ControlTableItem::OPERATING_MODE, id);
-    stream->printf(", mode: %d", operatingMode);
-    if(operatingMode == OP_CURRENT_BASED_POSITION) {
-      stream->printf(", goal current: %d", dxl_.readControlTableItem(ControlTableItem::GOAL_CURRENT, id));
+
+    int32_t driveMode = 0, hwErr = 0, operatingMode = 0, goalCurrent = 0, shutdown = 0, torque = 0, profileVel = 0, profileAcc = 0;
+    readItem(id, ITEM_DRIVE_MODE, driveMode);
+    readItem(id, ITEM_HARDWARE_ERROR_STATUS, hwErr);
+    readItem(id, ITEM_OPERATING_MODE, operatingMode);
+    readItem(id, ITEM_SHUTDOWN, shutdown);
+    readItem(id, ITEM_TORQUE_ENABLE, torque);
+    readItem(id, ITEM_PROFILE_VELOCITY, profileVel);
+    readItem(id, ITEM_PROFILE_ACCELERATION, profileAcc);
+
+    stream->printf("range: [%d..%d], offset: %d, invert: %d, ", s->min, s->max, s->offset, (int)(driveMode & 0x1));
+    stream->printf("hw err: $%x", (int)hwErr);
+    stream->printf(", mode: %d", (int)operatingMode);
+    if(s->model->mAPerCurrentUnit > 0 && operatingMode == OPMODE_CURRENT_BASED_POSITION) {
+      readItem(id, ITEM_GOAL_CURRENT, goalCurrent);
+      stream->printf(", goal current: %d", (int)goalCurrent);
     }
-    stream->printf(", alarm shutdown: $%x", dxl_.readControlTableItem(ControlTableItem::SHUTDOWN, id));
-    stream->printf(", torque limit: %d", (int)dxl_.readControlTableItem(ControlTableItem::TORQUE_LIMIT, id));
-    stream->printf(", max torque: %d", (int)dxl_.readControlTableItem(ControlTableItem::MAX_TORQUE, id));
-    stream->printf(", torque enabled: %d", (int)dxl_.readControlTableItem(ControlTableItem::TORQUE_ENABLE, id));
-    stream->printf(", drive mode: %d", (int)dxl_.readControlTableItem(ControlTableItem::DRIVE_MODE, id));
-    stream->printf(", profile vel: %d", (int)dxl_.readControlTableItem(ControlTableItem::PROFILE_VELOCITY, id));
-    stream->printf(", profile acc: %d", (int)dxl_.readControlTableItem(ControlTableItem::PROFILE_ACCELERATION, id));
+    stream->printf(", alarm shutdown: $%x", (int)shutdown);
+    stream->printf(", torque enabled: %d", (int)torque);
+    stream->printf(", drive mode: %d", (int)driveMode);
+    stream->printf(", profile vel: %d", (int)profileVel);
+    stream->printf(", profile acc: %d", (int)profileAcc);
     stream->printf("\n");
   } else {
     stream->printf("#%d not found! ", id);
@@ -562,11 +831,11 @@ bool bb::Servos::setRange(uint8_t id, float min, float max, ValueType t) {
   if(s == NULL) return false;
   
   if(min < max) {
-    s->min = computeRawValue(min, t);
-    s->max = computeRawValue(max, t);
+    s->min = rawPosition(*s, min, t);
+    s->max = rawPosition(*s, max, t);
   } else {
-    s->max = computeRawValue(min, t);
-    s->min = computeRawValue(max, t);
+    s->max = rawPosition(*s, min, t);
+    s->min = rawPosition(*s, max, t);
   }
 
   setGoalPos(id, constrain(s->goalPos, s->min, s->max), VALUE_RAW);
@@ -579,7 +848,7 @@ bool bb::Servos::setOffset(uint8_t id, float offset, ValueType t) {
   if(s == NULL) return false;
 
   if(t == VALUE_DEGREE) {
-    s->offset = (offset * 4096.0) / 360.0;
+    s->offset = offset * s->model->ticksPerDegree;
   } else {
     s->offset = offset;
   }
@@ -587,16 +856,17 @@ bool bb::Servos::setOffset(uint8_t id, float offset, ValueType t) {
 }
 
 bool bb::Servos::setInverted(uint8_t id, bool invert) {
-  uint8_t dm = dxl_.readControlTableItem(ControlTableItem::DRIVE_MODE, id);
+  int32_t dm;
+  if(readItem(id, ITEM_DRIVE_MODE, dm) != RES_OK) return false;
   if(invert) dm |= 0x1;
   else dm &= ~0x1;
-  dxl_.writeControlTableItem(ControlTableItem::DRIVE_MODE, id, dm);
-
-  return true;
+  return writeItem(id, ITEM_DRIVE_MODE, dm) == RES_OK;
 }
 
 bool bb::Servos::inverted(uint8_t id) {
-  return dxl_.readControlTableItem(ControlTableItem::DRIVE_MODE, id) & 0x1;
+  int32_t dm;
+  if(readItem(id, ITEM_DRIVE_MODE, dm) != RES_OK) return false;
+  return dm & 0x1;
 }
 
 bool bb::Servos::setControlMode(uint8_t id, ControlMode mode) {
@@ -607,24 +877,29 @@ bool bb::Servos::setControlMode(uint8_t id, ControlMode mode) {
   int32_t op;
 
   switch(mode) {
-  case CONTROL_POSITION: op = OP_POSITION; break;
-  case CONTROL_VELOCITY: op = OP_VELOCITY; break;
-  case CONTROL_CURRENT: op = OP_CURRENT; break;
+  case CONTROL_POSITION: op = s->model->opPosition; break;
+  case CONTROL_VELOCITY: op = s->model->opVelocity; break;
+  case CONTROL_CURRENT: op = s->model->opCurrent; break;
   default:
-    bb::printf("Can't switch to control mode %d\n", mode);
+    op = OPMODE_NONE;
+    break;
+  }
+  if(op == OPMODE_NONE) {
+    bb::printf("Can't switch servo %d (model %d) to control mode %d\n", id, s->modelNumber, mode);
     return false;
   }
 
-  bool torque = dxl_.getTorqueEnableStat(s->id);
+  bool torque = isTorqueOn(s->id);
   if(torque) bb::printf("Need to switch torque off\n");
   else bb::printf("No need to switch torque\n");
 
-  if(torque) dxl_.torqueOff(s->id);
-  dxl_.writeControlTableItem(ControlTableItem::OPERATING_MODE, id, op);
-  if(dxl_.readControlTableItem(ControlTableItem::OPERATING_MODE, id) == op) {
+  if(torque) writeItem(s->id, ITEM_TORQUE_ENABLE, 0);
+  writeItem(s->id, ITEM_OPERATING_MODE, op);
+  int32_t newOp;
+  if(readItem(s->id, ITEM_OPERATING_MODE, newOp) == RES_OK && newOp == op) {
     bb::printf("Successfully changed operating mode to %d\n", op);
     s->mode = mode;
-    if(torque) dxl_.torqueOn(s->id);
+    if(torque) writeItem(s->id, ITEM_TORQUE_ENABLE, 1);
     return true;
   }
   bb::printf("Error changing operating mode to %d\n", op);
@@ -635,23 +910,24 @@ bb::Servos::ControlMode bb::Servos::controlMode(uint8_t id) {
   Servo *s = servoWithID(id);
   if(s == nullptr) return CONTROL_UNKNOWN; // no such servo
 
-  uint8_t op = dxl_.readControlTableItem(ControlTableItem::OPERATING_MODE, id);
+  int32_t op;
+  if(readItem(id, ITEM_OPERATING_MODE, op) != RES_OK) return CONTROL_UNKNOWN;
   switch(s->mode) {
   case CONTROL_POSITION:
-    if(op == OP_POSITION) return CONTROL_POSITION;
+    if(op == s->model->opPosition) return CONTROL_POSITION;
     break;
   case CONTROL_VELOCITY:
-    if(op == OP_VELOCITY) return CONTROL_VELOCITY;
+    if(op == s->model->opVelocity) return CONTROL_VELOCITY;
     break;
   case CONTROL_CURRENT:
-    if(op == OP_CURRENT) return CONTROL_CURRENT;
+    if(op == s->model->opCurrent) return CONTROL_CURRENT;
     break;
   case CONTROL_UNKNOWN:
   default:
     return CONTROL_UNKNOWN;
     break;
   }
-  bb::printf("Control mode of servo (%d) and our entry (%d) disagree!\n", op, s->mode);
+  bb::printf("Control mode of servo (%d) and our entry (%d) disagree!\n", (int)op, s->mode);
   return CONTROL_UNKNOWN;
 }
 
@@ -668,10 +944,10 @@ bool bb::Servos::setGoalPos(uint8_t id, float goalPos, ValueType t) {
 
   Servo *s = servoWithID(id);
   if (s == NULL) return false;
-  uint32_t g = computeRawValue(goalPos, t);
+  uint32_t g = rawPosition(*s, goalPos, t);
   s->goalPos = constrain(g, s->min, s->max) + s->offset; // FIXME - s->offset can be negative, is this safe?
   //if(s->id == 4) Console::console.printfBroadcast("Goal: %d Min: %d Max: %d Final: %d\n", g, s->min, s->max, s->goal);
-  swGoalPosInfos.is_info_changed = true;
+  buses_[s->bus].setGoal(s->id, ServoBus::ITEM_GOAL_POSITION, s->goalPos);
 
   return true;
 }
@@ -687,14 +963,14 @@ bool bb::Servos::setGoalVel(uint8_t id, float goalVel, ValueType t) {
   }
 
   Servo *s = servoWithID(id);
-  if (s == NULL) return false;
+  if (s == NULL || s->model->table[ITEM_GOAL_VELOCITY].length == 0) return false;
   int32_t g;
   if(t == VALUE_RAW) g = int32_t(goalVel);
-  else { // goal vel is deg/s, convert to units of 0.229rev/min
-    g = int32_t(goalVel/(6*0.229));
+  else { // goal vel is deg/s, convert to the model's velocity unit (0.229rev/min for X series)
+    g = int32_t(goalVel/(6*s->model->rpmPerVelocityUnit));
   }
   s->goalVel = g;
-  swGoalVelInfos.is_info_changed = true;
+  buses_[s->bus].setGoal(s->id, ServoBus::ITEM_GOAL_VELOCITY, s->goalVel);
 
   return true;
 }
@@ -704,7 +980,7 @@ float bb::Servos::goalVel(uint8_t id, ValueType t) {
   if(s == NULL) return 0;
   if(t == VALUE_RAW) return s->goalVel;
   float g = s->goalVel;
-  return (g*(6.0*0.229));
+  return (g*(6.0*s->model->rpmPerVelocityUnit));
 }
 
 bool bb::Servos::setGoalCur(uint8_t id, float goalCur, ValueType t) {
@@ -718,14 +994,14 @@ bool bb::Servos::setGoalCur(uint8_t id, float goalCur, ValueType t) {
   }
 
   Servo *s = servoWithID(id);
-  if (s == NULL) return false;
+  if (s == NULL || s->model->mAPerCurrentUnit == 0) return false;
   int32_t g;
   if(t == VALUE_RAW) g = int16_t(goalCur);
-  else { // goal cur is mA, convert to units of 2.69mA
-    g = int16_t(goalCur/2.69);
+  else { // goal cur is mA, convert to the model's current unit (2.69mA for most X series)
+    g = int16_t(goalCur/s->model->mAPerCurrentUnit);
   }
   s->goalCur = g;
-  swGoalCurInfos.is_info_changed = true;
+  buses_[s->bus].setGoal(s->id, ServoBus::ITEM_GOAL_CURRENT, s->goalCur);
 
   return true;
 }
@@ -735,7 +1011,7 @@ float bb::Servos::goalCur(uint8_t id, ValueType t) {
   if(s == NULL) return 0;
   if(t == VALUE_RAW) return s->goalCur;
   float g = s->goalCur;
-  return g*2.69;
+  return g*s->model->mAPerCurrentUnit;
 }
 
 bool bb::Servos::setProfileVelocity(uint8_t id, float vel, ValueType t) {
@@ -752,11 +1028,11 @@ bool bb::Servos::setProfileVelocity(uint8_t id, float vel, ValueType t) {
   if(s == NULL) return false;
   uint32_t v = vel;
   if(t == VALUE_DEGREE) {
-    v = (uint32_t)((vel / 6.0f) / 0.229); // deg/s to rev/min, and then multiply with steps of 0.229
+    v = (uint32_t)((vel / 6.0f) / s->model->rpmPerVelocityUnit); // deg/s to rev/min, and then divide by the model's steps
   }
 
   s->profileVel = v;
-  swPrfVelInfos.is_info_changed = true;
+  buses_[s->bus].setGoal(s->id, ServoBus::ITEM_PROFILE_VELOCITY, s->profileVel);
 
   return true;
 }
@@ -780,9 +1056,23 @@ uint32_t bb::Servos::computeRawValue(float val, ValueType t) {
   return (uint32_t)retval;
 }
 
+uint32_t bb::Servos::rawPosition(const Servo& s, float val, ValueType t) {
+  if(t == VALUE_RAW) return val;
+
+  int32_t retval = val * s.model->ticksPerDegree;
+  if (retval < 0 || retval > s.model->maxPosition) {
+    Console::console.printfBroadcast("Capping %d (computed from %f) to [0..%d]!", retval, val, s.model->maxPosition);
+    retval = constrain(retval, 0, s.model->maxPosition);
+  }
+  return (uint32_t)retval;
+}
+
+float bb::Servos::rawToDegrees(const Servo& s, float raw) {
+  return raw / s.model->ticksPerDegree;
+}
+
 bool bb::Servos::setProfileAcceleration(uint8_t id, uint32_t val) {
-  dxl_.writeControlTableItem(ControlTableItem::PROFILE_ACCELERATION, id, val);
-  return true;
+  return writeItem(id, ITEM_PROFILE_ACCELERATION, val) == RES_OK;
 }
 
 float bb::Servos::goalPos(uint8_t id, ValueType t) {
@@ -790,7 +1080,7 @@ float bb::Servos::goalPos(uint8_t id, ValueType t) {
   if (s == NULL) return 0.0f;
 
   if (t == VALUE_DEGREE)
-    return 360.0 * (s->goalPos / 4096.0);
+    return rawToDegrees(*s, s->goalPos);
   else
     return s->goalPos;
 }
@@ -798,7 +1088,7 @@ float bb::Servos::goalPos(uint8_t id, ValueType t) {
 float bb::Servos::presentPos(uint8_t id, ValueType t) {
   Servo *s = servoWithID(id);
   if (s == NULL) return 0.0f;
-  if (t == VALUE_DEGREE) return (s->presentPos / 4096.0) * 360.0;
+  if (t == VALUE_DEGREE) return rawToDegrees(*s, s->presentPos);
   else return s->presentPos;
 }
 
@@ -811,27 +1101,54 @@ float bb::Servos::load(uint8_t id) {
 }
 
 uint8_t bb::Servos::errorStatus(uint8_t id) {
-  return dxl_.readControlTableItem(ControlTableItem::HARDWARE_ERROR_STATUS, id);
+  int32_t err;
+  if(readItem(id, ITEM_HARDWARE_ERROR_STATUS, err) != RES_OK) return 0;
+  return err;
 }
 
 bool bb::Servos::loadShutdownEnabled(uint8_t id) {
-  return dxl_.readControlTableItem(ControlTableItem::SHUTDOWN, id) & (1<<5);
+  Servo *s = servoWithID(id);
+  int32_t shutdown;
+  if(s == NULL || readItem(id, ITEM_SHUTDOWN, shutdown) != RES_OK) return false;
+  return shutdown & (1<<s->model->overloadBit);
 }
 
 void bb::Servos::setLoadShutdownEnabled(uint8_t id, bool yesno) {
-  uint8_t shutdown = dxl_.readControlTableItem(ControlTableItem::SHUTDOWN, id);
-  if(yesno) shutdown |= (1<<5);
-  else shutdown &= ~(1<<5);
-  dxl_.writeControlTableItem(ControlTableItem::SHUTDOWN, id, shutdown);
+  Servo *s = servoWithID(id);
+  int32_t shutdown;
+  if(s == NULL || readItem(id, ITEM_SHUTDOWN, shutdown) != RES_OK) return;
+  if(yesno) shutdown |= (1<<s->model->overloadBit);
+  else shutdown &= ~(1<<s->model->overloadBit);
+  writeItem(id, ITEM_SHUTDOWN, shutdown);
 }
 
 bool bb::Servos::setPIDValues(uint8_t id, uint16_t kp, uint16_t ki, uint16_t kd) {
-  dxl_.writeControlTableItem(ControlTableItem::P_GAIN, id, kp);
-  dxl_.writeControlTableItem(ControlTableItem::I_GAIN, id, ki);
-  dxl_.writeControlTableItem(ControlTableItem::D_GAIN, id, kd);
+  if(writeItem(id, ITEM_POSITION_P_GAIN, kp) != RES_OK) return false;
+  if(writeItem(id, ITEM_POSITION_I_GAIN, ki) != RES_OK) return false;
+  if(writeItem(id, ITEM_POSITION_D_GAIN, kd) != RES_OK) return false;
   return true;
 }
 
+Result bb::Servos::readItem(uint8_t id, Item item, int32_t& value) {
+  if(item >= NUM_ITEMS) return RES_COMMON_OUT_OF_RANGE;
+  Servo *s = servoWithID(id);
+  if(s == NULL) return RES_COMMON_NOT_IN_LIST;
+  const CtrlTableEntry& entry = s->model->table[item];
+  if(entry.length == 0) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  idleBus();
+  return buses_[s->bus].read(id, entry.addr, entry.length, value);
+}
+
+Result bb::Servos::writeItem(uint8_t id, Item item, int32_t value) {
+  if(item >= NUM_ITEMS) return RES_COMMON_OUT_OF_RANGE;
+  Servo *s = servoWithID(id);
+  if(s == NULL) return RES_COMMON_NOT_IN_LIST;
+  const CtrlTableEntry& entry = s->model->table[item];
+  if(entry.length == 0) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  idleBus();
+  return buses_[s->bus].write(id, entry.addr, entry.length, value);
+}
+
 
 bb::Servos::Servo* bb::Servos::servoWithID(uint8_t id) {
   for(auto& s: servos_) {
@@ -840,200 +1157,85 @@ bb::Servos::Servo* bb::Servos::servoWithID(uint8_t id) {
   return NULL;
 }
 
-void bb::Servos::setupSyncBuffers() {
-  unsigned int i;
+Result bb::Servos::setupBus(unsigned int b) {
+  // Goal items in ServoBus::WriteItem order
+  static const Item writeItems[ServoBus::NUM_WRITE_ITEMS] = {
+    ITEM_PROFILE_VELOCITY, ITEM_GOAL_POSITION, ITEM_GOAL_VELOCITY, ITEM_GOAL_CURRENT
+  };
 
-  if (!servos_.size()) return;
-  if (infoXelsSrPresent != NULL || infoXelsSrLoad != NULL || infoXelsSwGoalPos != NULL || infoXelsSwPrfVel != NULL ||
-      infoXelsSwGoalVel != NULL || infoXelsSwGoalCur != NULL) {
-    return;
-  }
-
-  // Sync buffer for reading present position
-  srPresentInfos.packet.p_buf = userPktBufPresent;
-  srPresentInfos.packet.buf_capacity = userPktBufCap;
-  srPresentInfos.packet.is_completed = false;
-  srPresentInfos.addr = ctrlPresentPos_.addr;
-  srPresentInfos.addr_length = ctrlPresentPos_.addr_length;
-  infoXelsSrPresent = new DYNAMIXEL::XELInfoSyncRead_t[servos_.size()];
-  srPresentInfos.p_xels = infoXelsSrPresent;
-  i = 0;
-  for (auto& s : servos_) {
-    infoXelsSrPresent[i].id = s.id;
-    infoXelsSrPresent[i].p_recv_buf = (uint8_t*)&(s.presentPos);
-    i++;
-  }
-  srPresentInfos.xel_count = servos_.size();
-  srPresentInfos.is_info_changed = true;
-
-  // Sync buffer for reading present load
-  srLoadInfos.packet.p_buf = userPktBufLoad;
-  srLoadInfos.packet.buf_capacity = userPktBufCap;
-  srLoadInfos.packet.is_completed = false;
-  srLoadInfos.addr = ctrlPresentLoad_.addr;
-  srLoadInfos.addr_length = ctrlPresentLoad_.addr_length;
-  infoXelsSrLoad = new DYNAMIXEL::XELInfoSyncRead_t[servos_.size()];
-  srLoadInfos.p_xels = infoXelsSrLoad;
-  i = 0;
-  for (auto& s : servos_) {
-    infoXelsSrLoad[i].id = s.id;
-    infoXelsSrLoad[i].p_recv_buf = (uint8_t*)&(s.load);
-    i++;
-  }
-  srLoadInfos.xel_count = servos_.size();
-  srLoadInfos.is_info_changed = true;
-
-  // Sync buffer for writing goal position
-  swGoalPosInfos.packet.p_buf = NULL;
-  swGoalPosInfos.packet.is_completed = false;
-  swGoalPosInfos.addr = ctrlGoalPos_.addr;
-  swGoalPosInfos.addr_length = ctrlGoalPos_.addr_length;
-  infoXelsSwGoalPos = new DYNAMIXEL::XELInfoSyncWrite_t[servos_.size()];
-  swGoalPosInfos.p_xels = infoXelsSwGoalPos;
-  i = 0;
-  for (auto& s : servos_) {
-    infoXelsSwGoalPos[i].id = s.id;
-    infoXelsSwGoalPos[i].p_data = (uint8_t*)&(s.goalPos);
-    i++;
-  }
-  swGoalPosInfos.xel_count = servos_.size();
-  swGoalPosInfos.is_info_changed = true;
-
-  // Sync buffer for writing goal velocity
-  swGoalVelInfos.packet.p_buf = NULL;
-  swGoalVelInfos.packet.is_completed = false;
-  swGoalVelInfos.addr = ctrlGoalVel_.addr;
-  swGoalVelInfos.addr_length = ctrlGoalVel_.addr_length;
-  infoXelsSwGoalVel = new DYNAMIXEL::XELInfoSyncWrite_t[servos_.size()];
-  swGoalVelInfos.p_xels = infoXelsSwGoalVel;
-  i = 0;
-  for (auto& s : servos_) {
-    infoXelsSwGoalVel[i].id = s.id;
-    infoXelsSwGoalVel[i].p_data = (uint8_t*)&(s.goalVel);
-    i++;
-  }
-  swGoalVelInfos.xel_count = servos_.size();
-  swGoalVelInfos.is_info_changed = true;
-
-  // Sync buffer for writing goal current
-  swGoalCurInfos.packet.p_buf = NULL;
-  swGoalCurInfos.packet.is_completed = false;
-  swGoalCurInfos.addr = ctrlGoalCur_.addr;
-  swGoalCurInfos.addr_length = ctrlGoalCur_.addr_length;
-  infoXelsSwGoalCur = new DYNAMIXEL::XELInfoSyncWrite_t[servos_.size()];
-  swGoalCurInfos.p_xels = infoXelsSwGoalCur;
-  i = 0;
-  for (auto& s : servos_) {
-    infoXelsSwGoalCur[i].id = s.id;
-    infoXelsSwGoalCur[i].p_data = (uint8_t*)&(s.goalCur);
-    i++;
-  }
-  swGoalCurInfos.xel_count = servos_.size();
-  swGoalCurInfos.is_info_changed = true;
-
-  // Sync buffer for writing profile velocity -- not sure if needed?
-  swPrfVelInfos.packet.p_buf = NULL;
-  swPrfVelInfos.packet.is_completed = false;
-  swPrfVelInfos.addr = ctrlProfileVel_.addr;
-  swPrfVelInfos.addr_length = ctrlProfileVel_.addr_length;
-  infoXelsSwPrfVel = new DYNAMIXEL::XELInfoSyncWrite_t[servos_.size()];
-  swPrfVelInfos.p_xels = infoXelsSwPrfVel;
-  i = 0;
-  for (auto& s : servos_) {
-    infoXelsSwPrfVel[i].id = s.id;
-    infoXelsSwPrfVel[i].p_data = (uint8_t*)&(s.profileVel);
-    i++;
-  }
-  swPrfVelInfos.xel_count = servos_.size();
-  swPrfVelInfos.is_info_changed = true;
-}
+  ServoBus& bus = buses_[b];
+  bus.clear();
+  for(auto& s: servos_) {
+    if(s.bus != b) continue;
+    bus.addServo(s.id);
 
-void bb::Servos::teardownSyncBuffers() {
-  delete infoXelsSrPresent;
-  infoXelsSrPresent = NULL;
-  delete infoXelsSrLoad;
-  infoXelsSrLoad = NULL;
-  delete infoXelsSwGoalPos;
-  infoXelsSwGoalPos = NULL;
-  delete infoXelsSwPrfVel;
-  infoXelsSwPrfVel = NULL;
-  delete infoXelsSwGoalVel;
-  infoXelsSwGoalVel = NULL;
-  delete infoXelsSwGoalCur;
-  infoXelsSwGoalCur = NULL;
-
-  srPresentInfos.p_xels = NULL;
-  srPresentInfos.xel_count = 0;
-  srLoadInfos.p_xels = NULL;
-  srLoadInfos.xel_count = 0;
-  swGoalPosInfos.p_xels = NULL;
-  swGoalPosInfos.xel_count = 0;
-  swPrfVelInfos.p_xels = NULL;
-  swPrfVelInfos.xel_count = 0;
-  swGoalVelInfos.p_xels = NULL;
-  swGoalVelInfos.xel_count = 0;
-  swGoalCurInfos.p_xels = NULL;
-  swGoalCurInfos.xel_count = 0;
-}
+    const CtrlTableEntry* table = s.model->table;
+    for(unsigned int i=0; i<ServoBus::NUM_WRITE_ITEMS; i++) {
+      bus.setWriteItem(s.id, ServoBus::WriteItem(i), table[writeItems[i]].addr, table[writeItems[i]].length);
+    }
 
-Result bb::Servos::syncReadInfo(ConsoleStream *stream) {
-  uint8_t recv_cnt;
-  
-  recv_cnt = dxl_.syncRead(&srPresentInfos);
-  if(recv_cnt != servos_.size()) {
-    if(stream) stream->printf("servo: Receiving position failed (%d instead of %d replies), error code %d!\n", recv_cnt, servos_.size(), dxl_.getLastLibErrCode());
-    else Console::console.printfBroadcast("servo: Receiving position failed (%d instead of %d replies), error code %d!\n", recv_cnt, servos_.size(), dxl_.getLastLibErrCode());
-    return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+    // Present load and position are read as one block, present velocity coming along for free.
+    const CtrlTableEntry &load = table[ITEM_PRESENT_CURRENT], &pos = table[ITEM_PRESENT_POSITION];
+    uint16_t first = load.addr < pos.addr ? load.addr : pos.addr;
+    uint16_t end = load.addr + load.length > pos.addr + pos.length ? load.addr + load.length : pos.addr + pos.length;
+    Result res = bus.setReadBlock(s.id, first, end - first);
+    if(res != RES_OK) return res;
+
+    bus.setGoal(s.id, ServoBus::ITEM_PROFILE_VELOCITY, s.profileVel);
+    bus.setGoal(s.id, ServoBus::ITEM_GOAL_POSITION, s.goalPos);
+    bus.setGoal(s.id, ServoBus::ITEM_GOAL_VELOCITY, s.goalVel);
+    bus.setGoal(s.id, ServoBus::ITEM_GOAL_CURRENT, s.goalCur);
   }
+  bus.invalidate();
 
-  recv_cnt = dxl_.syncRead(&srLoadInfos);
-  if(recv_cnt != servos_.size()) {
-    if(stream) stream->printf("servo: Receiving load failed!\n");
-    else Console::console.printfBroadcast("servo: Receiving load failed!\n");
-    return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+#if defined(SERIAL_BUFFER_SIZE)
+  // Replies sit in the UART's receive buffer until the next step() collects them
+  if(bus.replyBytes() > SERIAL_BUFFER_SIZE) {
+    bb::printf("Warning: servo replies on bus %d (%d bytes) exceed the serial receive buffer (%d bytes)\n", b, bus.replyBytes(), SERIAL_BUFFER_SIZE);
   }
+#endif
 
   return RES_OK;
 }
 
-Result bb::Servos::syncWriteInfo(ConsoleStream* stream) {
-  if(swPrfVelInfos.is_info_changed == true) {
-    if(dxl_.syncWrite(&swPrfVelInfos) == false) {
-#if 0
-      if(stream) stream->printf("servo: Sending servo profile velocity failed!\n");
-      else Console::console.printfBroadcast("servo: Sending servo profile velocity failed!\n");
-#endif
-      return RES_SUBSYS_COMM_ERROR;
-    }
+void bb::Servos::copyPresentValues() {
+  for(auto& s: servos_) {
+    ServoBus& bus = buses_[s.bus];
+    if(!bus.received(s.id)) continue;
+    const CtrlTableEntry &load = s.model->table[ITEM_PRESENT_CURRENT], &pos = s.model->table[ITEM_PRESENT_POSITION];
+    s.presentPos = bus.present(s.id, pos.addr, pos.length);
+    int32_t l = bus.present(s.id, load.addr, load.length);
+    uint16_t dir = s.model->loadDirectionBit;
+    if(dir != 0 && (l & dir) != 0) l = -(l & (dir-1)); // magnitude plus direction bit, set for CW
+    s.load = l;
   }
+}
 
-  if(swGoalPosInfos.is_info_changed == true) {
-    if(dxl_.syncWrite(&swGoalPosInfos) == false) {
-#if 0
-      if(stream) stream->printf("servo: Sending servo position goal failed!\n");
-      else Console::console.printfBroadcast("servo: Sending servo position goal failed!\n");
-#endif
-      return RES_SUBSYS_COMM_ERROR;
-    }
+void bb::Servos::idleBus() {
+  for(unsigned int b=0; b<numBuses_; b++) {
+    if(buses_[b].busy()) buses_[b].wait();
   }
+}
 
-  if(swGoalVelInfos.is_info_changed == true) {
-    if(dxl_.syncWrite(&swGoalVelInfos) == false) {
-#if 0
-      if(stream) stream->printf("servo: Sending servo velocity goal failed!\n");
-      else Console::console.printfBroadcast("servo: Sending servo velocity goal failed!\n");
-#endif
-      return RES_SUBSYS_COMM_ERROR;
-    }
-  }
+Result bb::Servos::syncInfo(ConsoleStream *stream) {
+  idleBus();
 
-  if(swGoalCurInfos.is_info_changed == true) {
-    if(dxl_.syncWrite(&swGoalCurInfos) == false) {
-      if(stream) stream->printf("servo: Sending servo current goal failed!\n");
-      else Console::console.printfBroadcast("servo: Sending servo current goal failed!\n");
-      return RES_SUBSYS_COMM_ERROR;
-    }
+  // Start all buses before waiting for any, so that their replies come in at the same time
+  Result res[MAX_BUSES];
+  for(unsigned int b=0; b<numBuses_; b++) res[b] = buses_[b].startCycle();
+  for(unsigned int b=0; b<numBuses_; b++) {
+    if(res[b] == RES_OK) res[b] = buses_[b].wait();
+  }
+  copyPresentValues();
+
+  Result retval = RES_OK;
+  for(unsigned int b=0; b<numBuses_; b++) {
+    if(res[b] == RES_OK) continue;
+    if(stream) stream->printf("servo: Receiving present values failed on bus %d (%d instead of %d replies), error %s!\n", b, buses_[b].repliesReceived(), buses_[b].numServos(), errorMessage(res[b]));
+    else Console::console.printfBroadcast("servo: Receiving present values failed on bus %d (%d instead of %d replies), error %s!\n", b, buses_[b].repliesReceived(), buses_[b].numServos(), errorMessage(res[b]));
+    retval = RES_SUBSYS_HW_DEPENDENCY_MISSING;
   }
 
-  return RES_OK;
+  return retval;
+
 }
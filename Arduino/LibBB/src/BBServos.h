@@ -3,11 +3,22 @@
 
 #include "BBControllers.h"
 #include "BBConsole.h"
-#include <DynamixelShield.h>
+#include "BBServoBus.h"
+#include "BBTrajectory.h"
 #include <vector>
 
 namespace bb {
 
+/*!
+  \brief Dynamixel servos, on one or more buses.
+
+  Servos with IDs 1..MAX_SERVO_ID are detected on every bus. Each servo's model decides its control table layout and
+  units, so X series, MX series (Protocol 2.0) and XL-320 servos can be mixed freely. Servo IDs must be unique across
+  all buses.
+
+  Each bus has its own ServoBus; step() starts a cycle on all of them, and the replies come in in parallel. Putting
+  servos on more than one UART keeps the cycle time down as servos are added.
+*/
 class Servos: public Subsystem {
 public:
   typedef enum {
@@ -26,13 +37,52 @@ public:
   static Servos servos;
 
   static const uint8_t ID_ALL = 255;
+  static const uint8_t MAX_SERVO_ID = 32;
+  static const unsigned int MAX_BUSES = 4;
+
+  //! Control table items, see the X series e-Manual.
+  enum Item {
+    ITEM_MODEL_NUMBER,
+    ITEM_BAUD_RATE,
+    ITEM_RETURN_DELAY_TIME,
+    ITEM_DRIVE_MODE,
+    ITEM_OPERATING_MODE,
+    ITEM_CURRENT_LIMIT,
+    ITEM_VELOCITY_LIMIT,
+    ITEM_MAX_POSITION_LIMIT,
+    ITEM_MIN_POSITION_LIMIT,
+    ITEM_SHUTDOWN,
+    ITEM_TORQUE_ENABLE,
+    ITEM_HARDWARE_ERROR_STATUS,
+    ITEM_POSITION_D_GAIN,
+    ITEM_POSITION_I_GAIN,
+    ITEM_POSITION_P_GAIN,
+    ITEM_GOAL_CURRENT,
+    ITEM_GOAL_VELOCITY,
+    ITEM_PROFILE_ACCELERATION,
+    ITEM_PROFILE_VELOCITY,
+    ITEM_GOAL_POSITION,
+    ITEM_PRESENT_CURRENT,
+    ITEM_PRESENT_VELOCITY,
+    ITEM_PRESENT_POSITION,
+    NUM_ITEMS
+  };
 
 	virtual Result initialize();
 	virtual Result start(ConsoleStream *stream = NULL);
 	virtual Result stop(ConsoleStream *stream = NULL);
 	virtual Result step();
   virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
-  Result handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const std::vector<String>& words, ConsoleStream *stream);
+  Result handleCtrlTableCommand(Item item, const std::vector<String>& words, ConsoleStream *stream);
+
+  //! Makes port the only bus. Defaults to the Dynamixel shield's; host builds have to set one. Only while stopped.
+  void setPort(ServoPort* port);
+  //! Adds another bus, e.g. a ServoSerialPort on a second UART. Only while stopped.
+  Result addPort(ServoPort* port);
+  unsigned int numBuses() { return numBuses_; }
+  ServoBus& bus(unsigned int num = 0) { return buses_[num < numBuses_ ? num : 0]; }
+  //! Bus the servo is on, or -1.
+  int busOf(uint8_t id);
 
   void setRequiredIds(const std::vector<uint8_t>& ids) { requiredIds_ = ids; }
 
@@ -52,6 +102,9 @@ public:
   bool setControlMode(uint8_t id, ControlMode mode);
   ControlMode controlMode(uint8_t id);
 
+  //! Goals that moved by no more than deadband raw units since they were last sent are not sent again.
+  void setGoalDeadband(ServoBus::WriteItem item, uint32_t deadband);
+
   bool setGoalPos(uint8_t id, float goal, ValueType t=VALUE_DEGREE);
   bool setProfileVelocity(uint8_t id, float vel, ValueType t=VALUE_DEGREE); // in this case deg/s, while raw value is in rev/min
   bool setProfileAcceleration(uint8_t id, uint32_t val);
@@ -73,16 +126,28 @@ public:
   Result switchTorque(uint8_t id, bool onoff);
   bool isTorqueOn(uint8_t id);
 
+  //! Raw position for X series servos. See rawPosition() for other models.
   uint32_t computeRawValue(float val, ValueType t=VALUE_DEGREE);
 
-  Result write() { return syncWriteInfo(); }
+  //! Blocking access to any control table item. Fails if the servo's model doesn't have it.
+  Result readItem(uint8_t id, Item item, int32_t& value);
+  Result writeItem(uint8_t id, Item item, int32_t value);
+
+  //! Sends goals and reads present values right away, waiting for the replies.
+  Result write() { return syncInfo(); }
+
+  //! Control table layout and units of a servo model.
+  struct ModelInfo;
 
 protected:
   Servos();
-  DynamixelShield dxl_;
 
   struct Servo {
     uint8_t id;
+    uint8_t bus;
+    uint16_t modelNumber;
+    const ModelInfo* model;
+    int16_t maxLoad;
     ControlMode mode;
     uint32_t goalPos;
     uint32_t profileVel;
@@ -97,50 +162,25 @@ protected:
 
   std::vector<Servo> servos_;
   Servo *servoWithID(uint8_t id);
+  uint32_t rawPosition(const Servo& s, float val, ValueType t);
+  float rawToDegrees(const Servo& s, float raw);
 
   std::vector<uint8_t> requiredIds_;
-  DYNAMIXEL::ControlTableItemInfo_t ctrlPresentPos_, ctrlGoalPos_, ctrlProfileVel_, ctrlPresentLoad_, ctrlGoalVel_, ctrlGoalCur_;
-  static const uint16_t userPktBufCap = 128;
-  uint8_t userPktBufPresent[userPktBufCap], userPktBufLoad[userPktBufCap];
   bool torqueOffOnStop_;
 
-  bool getControlTableItemInfo(uint16_t model, uint8_t item, DYNAMIXEL::ControlTableItemInfo_t& info);
-
-  typedef struct {
-    int32_t presentPos;
-  } __attribute((packed)) srDataPresent_t;
-  typedef struct {
-    int16_t load;
-  } __attribute((packed)) srDataLoad_t;
-  typedef struct {
-    int32_t goalPos;
-  } __attribute((packed)) swDataGoalPos_t;
-  typedef struct {
-    int32_t prfVel;
-  } __attribute((packed)) swDataPrfVel_t;
-
-  DYNAMIXEL::InfoSyncReadInst_t srPresentInfos;
-  DYNAMIXEL::XELInfoSyncRead_t *infoXelsSrPresent;
-
-  DYNAMIXEL::InfoSyncReadInst_t srLoadInfos;
-  DYNAMIXEL::XELInfoSyncRead_t *infoXelsSrLoad;
-
-  DYNAMIXEL::InfoSyncWriteInst_t swGoalPosInfos;
-  DYNAMIXEL::XELInfoSyncWrite_t *infoXelsSwGoalPos;
-
-  DYNAMIXEL::InfoSyncWriteInst_t swPrfVelInfos;
-  DYNAMIXEL::XELInfoSyncWrite_t *infoXelsSwPrfVel;
-
-  DYNAMIXEL::InfoSyncWriteInst_t swGoalVelInfos;
-  DYNAMIXEL::XELInfoSyncWrite_t *infoXelsSwGoalVel;
-
-  DYNAMIXEL::InfoSyncWriteInst_t swGoalCurInfos;
-  DYNAMIXEL::XELInfoSyncWrite_t *infoXelsSwGoalCur;
-
-  void setupSyncBuffers();
-  void teardownSyncBuffers();
-  Result syncReadInfo(ConsoleStream *stream = NULL);
-  Result syncWriteInfo(ConsoleStream *stream = NULL);
+#if !defined(ARDUINO_ARCH_HOST)
+  ServoSerialPort serialPort_;
+#endif
+  ServoBus buses_[MAX_BUSES];
+  unsigned int numBuses_;
+
+  Result detectServos(unsigned int bus, ConsoleStream* stream, unsigned long& bps);
+  Result setupBus(unsigned int bus);
+  void copyPresentValues();
+  //! Waits for the cyclic transactions in flight, so that the buses are free.
+  void idleBus();
+  //! One complete transaction on every bus, blocking.
+  Result syncInfo(ConsoleStream *stream = NULL);
 };
 
 class ServoControlOutput: public bb::ControlOutput {
@@ -152,10 +192,18 @@ public:
   void setMode(Servos::ControlMode mode);
   Servos::ControlMode mode() { return mode_; }
 
+  //! In position mode, moves towards each goal on a minimum-jerk trajectory within these limits (deg/s, deg/s^2)
+  //! instead of passing it on as it is. set() then sends the next point on it every time it is called. 0 and 0 to
+  //! switch off.
+  void setTrajectoryLimits(float maxVel, float maxAccel);
+
 protected:
   uint8_t sn_;
   float offset_;
   Servos::ControlMode mode_;
+  Trajectory trajectory_;
+  bool smooth_, trajectoryStarted_;
+  unsigned long lastMicros_;
 };
 
 };
@@ -0,0 +1,224 @@
+#if !defined(BBSTATICPIDCONTROLLER_H)
+#define BBSTATICPIDCONTROLLER_H
+
+#include <math.h>
+#include <BBControllers.h>
+#include <BBLowPassFilter.h>
+#include <BBFixedPoint.h>
+
+namespace bb {
+
+// Derivative filters for StaticPIDController. They see the error difference per cycle, not divided by dt; the
+// controller folds 1/dt into kd.
+
+//! No derivative filtering.
+template<typename T> class PIDNoFilter {
+public:
+  void setSampleTime(float dt) { (void)dt; }
+  void reset() {}
+  T filter(T x) { return x; }
+};
+
+//! First order low pass. Cheap, and works in fixed point.
+template<typename T> class PIDFirstOrderFilter {
+public:
+  PIDFirstOrderFilter(float cutoff = 5.0f): cutoff_(cutoff), dt_(0.0f), alpha_(1.0f), y_(0.0f) {}
+  void setCutoff(float cutoff) { cutoff_ = cutoff; computeAlpha(); }
+  void setSampleTime(float dt) { dt_ = dt; computeAlpha(); }
+  void reset() { y_ = T(0.0f); }
+  T filter(T x) { y_ += alpha_ * (x - y_); return y_; }
+protected:
+  // Passes through until there is a sample time
+  void computeAlpha() {
+    if(dt_ <= 0) return;
+    float rc = 1.0f / (2 * M_PI * cutoff_);
+    alpha_ = T(dt_ / (rc + dt_));
+  }
+  float cutoff_, dt_;
+  T alpha_, y_;
+};
+
+//! 2nd order Butterworth, like PIDController uses. Float only.
+class PIDButterworthFilter {
+public:
+  PIDButterworthFilter(float cutoff = 5.0f): filter_(cutoff, 100) {}
+  void setCutoff(float cutoff) { filter_.setCutoff(cutoff); }
+  void setSampleTime(float dt) { filter_.setSampleFrequency(1.0f / dt); }
+  void reset() { filter_ = LowPassFilter(filter_.cutoff(), filter_.sampleFrequency()); }
+  float filter(float x) { return filter_.filter(x); }
+protected:
+  LowPassFilter filter_;
+};
+
+//! Compile time options for StaticPIDController. Derive from this and override what you need, e.g.
+//! struct MyOptions: public PIDOptions { static const bool RAMP = true; };
+struct PIDOptions {
+  typedef float Scalar;                          //!< float, or Fix16 on MCUs without FPU
+  typedef PIDFirstOrderFilter<float> DerivativeFilter;
+  static const bool BOUND_I = false;             //!< Clamp the integrated error to setIBounds()
+  static const bool BOUND_CONTROL = false;       //!< Clamp the control value to setControlBounds()
+  static const bool ERROR_DEADBAND = false;      //!< Treat errors within setErrorDeadband() as 0
+  static const bool CONTROL_DEADBAND = false;    //!< Output only the offset for control values within setControlDeadband()
+  static const bool RAMP = false;                //!< Move the setpoint towards the goal at setRamp() units per second
+  static const bool AUTO_UPDATE = true;          //!< Call the input's update() from update()
+  static const bool CONTROL_GAIN = false;        //!< Scale the control value by the input's controlGain()
+};
+
+//! PIDOptions for the Q16.16 backend.
+struct PIDFixedPointOptions: public PIDOptions {
+  typedef Fix16 Scalar;
+  typedef PIDFirstOrderFilter<Fix16> DerivativeFilter;
+};
+
+/*!
+  \brief PID controller with its features chosen at compile time.
+
+  Does the same as PIDController, but what is not needed is not compiled in, input and output are called directly
+  instead of through virtual functions (given concrete types), dt is set once instead of measured with micros() on
+  every update, and there is no division and no debug output in update(). With PIDFixedPointOptions it does all its
+  math in Q16.16, which is several times faster than soft float on MCUs without an FPU.
+
+  Input needs present() and update() (like ControlInput), Output needs set(float) (like ControlOutput). The controller
+  itself is a ControlOutput, so it can be the output of another controller.
+
+  dt is the time between updates in seconds - Runloop::runloop.cycleTimeSeconds() for a controller updated every
+  cycle. update(dt) changes it on the fly, for controllers that run at a varying rate.
+*/
+template<typename Input, typename Output, typename Options = PIDOptions> class StaticPIDController: public ControlOutput {
+public:
+  typedef typename Options::Scalar Scalar;
+
+  StaticPIDController(Input& input, Output& output, float dt):
+    input_(input), output_(output), reverse_(false), inhibit_(false) {
+    kp_ = ki_ = kd_ = 0;
+    inputScale_ = Scalar(1.0f);
+    iMin_ = iMax_ = controlMin_ = controlMax_ = Scalar(0.0f);
+    deadbandMin_ = deadbandMax_ = errDeadbandMin_ = errDeadbandMax_ = Scalar(0.0f);
+    controlOffset_ = ramp_ = Scalar(0.0f);
+    setCycleTime(dt);
+    setGoal(input_.present());
+    reset();
+  }
+
+  void reset() {
+    lastErr_ = errI_ = lastErrD_ = lastControl_ = Scalar(0.0f);
+    dFilter_.reset();
+  }
+
+  //! Cycle time in seconds. Precomputes everything that depends on it.
+  void setCycleTime(float dt) {
+    dtF_ = dt;
+    dt_ = Scalar(dt);
+    dFilter_.setSampleTime(dt);
+    computeGains();
+  }
+  float cycleTime() { return dtF_; }
+
+  void update() {
+    if(Options::AUTO_UPDATE) input_.update();
+
+    if(Options::RAMP) {
+      Scalar step = ramp_ * dt_;
+      if(curSetpoint_ < goal_) {
+        curSetpoint_ += step;
+        if(curSetpoint_ > goal_) curSetpoint_ = goal_;
+      } else if(curSetpoint_ > goal_) {
+        curSetpoint_ -= step;
+        if(curSetpoint_ < goal_) curSetpoint_ = goal_;
+      }
+    }
+
+    Scalar in = Scalar(input_.present()) * inputScale_;
+    Scalar err = reverse_ ? curSetpoint_ + in : curSetpoint_ - in;
+    if(Options::ERROR_DEADBAND && err > errDeadbandMin_ && err < errDeadbandMax_) err = Scalar(0.0f);
+
+    errI_ += err * dt_;
+    if(Options::BOUND_I) errI_ = clamp(errI_, iMin_, iMax_);
+
+    lastErrD_ = dFilter_.filter(err - lastErr_); // still needs * 1/dt, see kdInvDt_
+    lastErr_ = err;
+
+    lastControl_ = kpS_ * err + kiS_ * errI_ + kdInvDt_ * lastErrD_;
+    if(Options::CONTROL_GAIN) lastControl_ *= Scalar(input_.controlGain());
+    if(Options::BOUND_CONTROL) lastControl_ = clamp(lastControl_, controlMin_, controlMax_);
+
+    Scalar out;
+    if(Options::CONTROL_DEADBAND && lastControl_ > deadbandMin_ && lastControl_ < deadbandMax_) out = controlOffset_;
+    else if(reverse_) out = -(lastControl_ + controlOffset_);
+    else out = lastControl_ + controlOffset_;
+
+    if(inhibit_ == false) output_.set(toFloat(out));
+  }
+
+  void update(float dt) {
+    if(dt != dtF_) setCycleTime(dt);
+    update();
+  }
+
+  void setGoal(float sp) {
+    goal_ = Scalar(sp);
+    if(!Options::RAMP || ramp_ == Scalar(0.0f)) curSetpoint_ = goal_;
+    else curSetpoint_ = Scalar(input_.present());
+  }
+  void setPresentAsGoal() { setGoal(input_.present()); }
+  float goal() { return toFloat(goal_); }
+  float error() { return toFloat(lastErr_); }
+  virtual Result set(float value) { setGoal(value); return RES_OK; }
+  virtual float present() { return input_.present(); }
+
+  void setControlParameters(float kp, float ki, float kd) { kp_ = kp; ki_ = ki; kd_ = kd; computeGains(); }
+  void getControlParameters(float& kp, float& ki, float& kd) { kp = kp_; ki = ki_; kd = kd_; }
+  void getControlState(float& err, float& errI, float& errD, float& control) {
+    err = toFloat(lastErr_);
+    errI = toFloat(errI_);
+    errD = toFloat(lastErrD_) / dtF_;
+    control = toFloat(lastControl_);
+  }
+  void setControlOffset(float offset) { controlOffset_ = Scalar(offset); }
+  float controlOffset() { return toFloat(controlOffset_); }
+
+  void setIBounds(float iMin, float iMax) { iMin_ = Scalar(iMin); iMax_ = Scalar(iMax); }
+  void setControlBounds(float controlMin, float controlMax) { controlMin_ = Scalar(controlMin); controlMax_ = Scalar(controlMax); }
+  void setControlDeadband(float deadbandMin, float deadbandMax) { deadbandMin_ = Scalar(deadbandMin); deadbandMax_ = Scalar(deadbandMax); }
+  void setErrorDeadband(float errDeadbandMin, float errDeadbandMax) { errDeadbandMin_ = Scalar(errDeadbandMin); errDeadbandMax_ = Scalar(errDeadbandMax); }
+  void setRamp(float ramp) { ramp_ = Scalar(fabsf(ramp)); }
+  float ramp() { return toFloat(ramp_); }
+
+  void setInputScaleFactor(float inputScale) { inputScale_ = Scalar(inputScale); }
+  float inputScaleFactor() { return toFloat(inputScale_); }
+
+  void setReverse(bool yesno) { reverse_ = yesno; }
+  bool reverse() { return reverse_; }
+
+  void setInhibit(bool yesno) { inhibit_ = yesno; }
+  bool inhibit() { return inhibit_; }
+
+  typename Options::DerivativeFilter& derivativeFilter() { return dFilter_; }
+
+protected:
+  static Scalar clamp(Scalar v, Scalar lo, Scalar hi) { return v < lo ? lo : (v > hi ? hi : v); }
+
+  void computeGains() {
+    kpS_ = Scalar(kp_);
+    kiS_ = Scalar(ki_);
+    kdInvDt_ = Scalar(kd_ / dtF_);
+  }
+
+  Input& input_;
+  Output& output_;
+  bool reverse_, inhibit_;
+
+  float kp_, ki_, kd_, dtF_;
+  Scalar kpS_, kiS_, kdInvDt_;
+  Scalar dt_;
+  Scalar inputScale_;
+  Scalar lastErr_, errI_, lastErrD_, lastControl_;
+  Scalar iMin_, iMax_, controlMin_, controlMax_;
+  Scalar deadbandMin_, deadbandMax_, errDeadbandMin_, errDeadbandMax_;
+  Scalar goal_, curSetpoint_, ramp_, controlOffset_;
+  typename Options::DerivativeFilter dFilter_;
+};
+
+};
+
+#endif // BBSTATICPIDCONTROLLER_H
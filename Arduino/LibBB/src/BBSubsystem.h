@@ -53,6 +53,20 @@ public:
 	virtual Result operationStatus() { return operationStatus_; }
 	virtual unsigned long sequenceNumber(bool autoincrement = false) { unsigned long s = seqnum_; if(autoincrement) seqnum_++; return s; }
 
+	// Multi-rate scheduling. The runloop only calls step() every period cycles, in those cycles where
+	// (runloop sequence number % period) == phase. With AUTO_PHASE the runloop picks the least loaded phase.
+	static const unsigned int AUTO_PHASE = UINT_MAX;
+	void setStepRate(unsigned int period, unsigned int phase = AUTO_PHASE) { stepPeriod_ = period > 0 ? period : 1; stepPhase_ = phase; }
+	unsigned int stepPeriod() const { return stepPeriod_; }
+	unsigned int stepPhase() const { return stepPhase_; }
+
+	// Background subsystems are not stepped inside the cycle, but in the slack at its end, earliest deadline first and
+	// only if their usual step time still fits. The deadline is periodMicros after the last step, or the end of the
+	// next cycle if periodMicros is 0. Step rate settings are ignored for background subsystems.
+	void setBackgroundStep(bool background, unsigned long periodMicros = 0) { background_ = background; backgroundPeriod_ = periodMicros; }
+	bool isBackgroundStep() const { return background_; }
+	unsigned long backgroundPeriod() const { return backgroundPeriod_; }
+
 	void setLogLevel(unsigned int lvl) { loglevel_ = lvl; }
 
 	virtual Result registerWithManager() { return SubsystemManager::manager.registerSubsystem(this); }
@@ -215,8 +229,12 @@ protected:
 	const char *name_, *description_, *help_;
 	unsigned long seqnum_;
 	unsigned int loglevel_;
+	unsigned int stepPeriod_, stepPhase_;
+	bool background_;
+	unsigned long backgroundPeriod_;
 
-	Subsystem(): started_(false), operationStatus_(RES_SUBSYS_NOT_INITIALIZED), name_(""), description_(""), help_(""), seqnum_(0), loglevel_(LOG_INFO) {}
+	Subsystem(): started_(false), operationStatus_(RES_SUBSYS_NOT_INITIALIZED), name_(""), description_(""), help_(""), seqnum_(0), loglevel_(LOG_INFO),
+		stepPeriod_(1), stepPhase_(0), background_(false), backgroundPeriod_(0) {}
 	virtual ~Subsystem() { }
 };
 
@@ -0,0 +1,217 @@
+#include "BBTimerWheel.h"
+
+static inline unsigned int lowestBit(uint64_t mask) {
+	return __builtin_ctzll(mask);
+}
+
+// All bits from bit "from" upwards. from may be 64, giving an empty mask.
+static inline uint64_t bitsFrom(unsigned int from) {
+	return from >= 64 ? 0 : (~0ULL << from);
+}
+
+bb::TimerWheel::TimerWheel() {
+	for(unsigned int l=0; l<LEVELS; l++) {
+		for(unsigned int s=0; s<SLOTS; s++) heads_[l][s] = NIL;
+		occupied_[l] = 0;
+	}
+	overflow_ = NIL;
+
+	for(unsigned int i=0; i<MAX_TIMERS; i++) {
+		timers_[i].state = STATE_FREE;
+		timers_[i].generation = 0;
+		timers_[i].prev = NIL;
+		timers_[i].next = (i+1 < MAX_TIMERS) ? i+1 : NIL;
+	}
+	free_ = 0;
+	numScheduled_ = 0;
+	now_ = 0;
+	advancing_ = false;
+}
+
+bb::Result bb::TimerWheel::setTime(uint64_t nowUS) {
+	if(numScheduled_ != 0 || advancing_) return RES_COMMON_NOT_IN_LIST;
+	now_ = nowUS;
+	return RES_OK;
+}
+
+bb::Result bb::TimerWheel::cancel(Handle handle) {
+	int i = indexFor(handle);
+	if(i < 0) return RES_COMMON_NOT_IN_LIST;
+
+	Timer& t = timers_[i];
+	if(t.state == STATE_SCHEDULED) {
+		unlink(i);
+		release(i);
+	} else if(t.state == STATE_FIRING) {
+		t.state = STATE_FIRING_CANCELLED; // released by fireSlot() once the callback returns
+	} else {
+		return RES_COMMON_NOT_IN_LIST;
+	}
+	return RES_OK;
+}
+
+bool bb::TimerWheel::isScheduled(Handle handle) const {
+	int i = indexFor(handle);
+	if(i < 0) return false;
+	return timers_[i].state == STATE_SCHEDULED || timers_[i].state == STATE_FIRING;
+}
+
+void bb::TimerWheel::advance(uint64_t nowUS) {
+	if(nowUS < now_ || advancing_) return;
+	advancing_ = true;
+
+	while(true) {
+		// Fire everything in level 0 up to nowUS or the end of the current level 0 block, whatever comes first.
+		uint64_t blockEnd = now_ | (SLOTS-1);
+		uint64_t limit = nowUS < blockEnd ? nowUS : blockEnd;
+		while(true) {
+			uint64_t mask = occupied_[0] & bitsFrom(now_ & (SLOTS-1)) & ~bitsFrom((limit & (SLOTS-1)) + 1);
+			if(mask == 0) break;
+			unsigned int slot = lowestBit(mask);
+			now_ = (now_ & ~uint64_t(SLOTS-1)) | slot;
+			fireSlot(slot);
+		}
+		if(nowUS <= blockEnd) {
+			now_ = nowUS;
+			break;
+		}
+
+		// Jump to the next slot in a higher level that has timers in it, and cascade them down.
+		uint64_t next = nextSlotStart(blockEnd);
+		if(next > nowUS) {
+			now_ = nowUS;
+			break;
+		}
+		now_ = next;
+
+		if((now_ & ((uint64_t(1) << (SLOT_BITS*LEVELS)) - 1)) == 0) cascade(OVERFLOW_LEVEL, 0);
+		for(int l=LEVELS-1; l>=1; l--) {
+			uint64_t spanMask = (uint64_t(1) << (SLOT_BITS*l)) - 1;
+			if((now_ & spanMask) == 0) cascade(l, (now_ >> (SLOT_BITS*l)) & (SLOTS-1));
+		}
+	}
+
+	advancing_ = false;
+}
+
+uint64_t bb::TimerWheel::nextEventHint() const {
+	if(numScheduled_ == 0) return UINT64_MAX;
+
+	uint64_t mask = occupied_[0] & bitsFrom(now_ & (SLOTS-1));
+	if(mask != 0) return (now_ & ~uint64_t(SLOTS-1)) | lowestBit(mask);
+	return nextSlotStart(now_ | (SLOTS-1));
+}
+
+// Start of the first occupied slot above level 0 that begins after the given time, or the next top
+// level boundary if only the overflow list has timers. Level 0 must be empty up to after.
+uint64_t bb::TimerWheel::nextSlotStart(uint64_t after) const {
+	for(unsigned int l=1; l<LEVELS; l++) {
+		unsigned int shift = SLOT_BITS*l;
+		unsigned int current = (after >> shift) & (SLOTS-1);
+		uint64_t mask = occupied_[l] & bitsFrom(current+1);
+		if(mask != 0) {
+			uint64_t blockStart = (after >> (shift+SLOT_BITS)) << (shift+SLOT_BITS);
+			return blockStart | (uint64_t(lowestBit(mask)) << shift);
+		}
+	}
+	if(overflow_ != NIL) {
+		unsigned int shift = SLOT_BITS*LEVELS;
+		return ((after >> shift) + 1) << shift;
+	}
+	return UINT64_MAX;
+}
+
+void bb::TimerWheel::fireSlot(unsigned int slot) {
+	while(heads_[0][slot] != NIL) {
+		int i = heads_[0][slot];
+		Timer& t = timers_[i];
+		unlink(i);
+		t.state = STATE_FIRING;
+		t.cb();
+
+		if(t.state == STATE_FIRING_CANCELLED || t.period == 0) {
+			release(i);
+		} else {
+			t.state = STATE_SCHEDULED;
+			t.deadline += t.period;
+			if(t.deadline <= now_) t.deadline = now_ + t.period; // don't try to catch up after a stall
+			link(i);
+		}
+	}
+}
+
+void bb::TimerWheel::cascade(unsigned int level, unsigned int slot) {
+	int8_t i = head(level, slot);
+	head(level, slot) = NIL;
+	if(level != OVERFLOW_LEVEL) occupied_[level] &= ~(uint64_t(1) << slot);
+
+	while(i != NIL) {
+		int8_t next = timers_[i].next;
+		timers_[i].prev = timers_[i].next = NIL;
+		numScheduled_--;
+		link(i);
+		i = next;
+	}
+}
+
+int bb::TimerWheel::allocate() {
+	if(free_ == NIL) return -1;
+	int i = free_;
+	free_ = timers_[i].next;
+	timers_[i].prev = timers_[i].next = NIL;
+	timers_[i].state = STATE_SCHEDULED;
+	return i;
+}
+
+void bb::TimerWheel::release(int i) {
+	Timer& t = timers_[i];
+	t.cb.reset();
+	t.state = STATE_FREE;
+	t.generation++;
+	t.prev = NIL;
+	t.next = free_;
+	free_ = i;
+}
+
+void bb::TimerWheel::link(int i) {
+	Timer& t = timers_[i];
+	uint64_t expires = t.deadline < now_ ? now_ : t.deadline;
+
+	t.level = OVERFLOW_LEVEL;
+	t.slot = 0;
+	for(unsigned int l=0; l<LEVELS; l++) {
+		unsigned int shift = SLOT_BITS*(l+1);
+		if((expires >> shift) == (now_ >> shift)) {
+			t.level = l;
+			t.slot = (expires >> (SLOT_BITS*l)) & (SLOTS-1);
+			break;
+		}
+	}
+
+	int8_t& h = head(t.level, t.slot);
+	t.prev = NIL;
+	t.next = h;
+	if(h != NIL) timers_[h].prev = i;
+	h = i;
+	if(t.level != OVERFLOW_LEVEL) occupied_[t.level] |= uint64_t(1) << t.slot;
+	numScheduled_++;
+}
+
+void bb::TimerWheel::unlink(int i) {
+	Timer& t = timers_[i];
+	int8_t& h = head(t.level, t.slot);
+	if(t.prev != NIL) timers_[t.prev].next = t.next;
+	else h = t.next;
+	if(t.next != NIL) timers_[t.next].prev = t.prev;
+	t.prev = t.next = NIL;
+	if(h == NIL && t.level != OVERFLOW_LEVEL) occupied_[t.level] &= ~(uint64_t(1) << t.slot);
+	numScheduled_--;
+}
+
+int bb::TimerWheel::indexFor(Handle handle) const {
+	int i = int(handle & 0xff) - 1;
+	if(i < 0 || i >= int(MAX_TIMERS)) return -1;
+	if(timers_[i].generation != uint16_t(handle >> 8)) return -1;
+	if(timers_[i].state == STATE_FREE) return -1;
+	return i;
+}
@@ -0,0 +1,153 @@
+#if !defined(BBTIMERWHEEL_H)
+#define BBTIMERWHEEL_H
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include "BBError.h"
+
+namespace bb {
+
+/*!
+	\brief Callable with fixed inline storage.
+
+	Works like a std::function<void()>, but never allocates. Assigning a callable that does not fit into
+	SIZE bytes is a compile time error. Not copyable.
+*/
+template<size_t SIZE> class InplaceCallback {
+public:
+	InplaceCallback(): invoke_(nullptr), destroy_(nullptr) {}
+	~InplaceCallback() { reset(); }
+	InplaceCallback(const InplaceCallback&) = delete;
+	InplaceCallback& operator=(const InplaceCallback&) = delete;
+
+	template<typename F> void assign(F&& f) {
+		typedef typename std::decay<F>::type Fn;
+		static_assert(sizeof(Fn) <= SIZE, "Callback captures too much to be stored inline - capture less, e.g. only [this]");
+		static_assert(alignof(Fn) <= alignof(max_align_t), "Callback alignment not supported");
+		reset();
+		new(storage_) Fn(std::forward<F>(f));
+		invoke_ = &invokeImpl<Fn>;
+		destroy_ = &destroyImpl<Fn>;
+	}
+
+	void reset() {
+		if(destroy_ != nullptr) destroy_(storage_);
+		invoke_ = nullptr;
+		destroy_ = nullptr;
+	}
+
+	bool isSet() const { return invoke_ != nullptr; }
+	void operator()() { if(invoke_ != nullptr) invoke_(storage_); }
+
+protected:
+	template<typename Fn> static void invokeImpl(void* p) { (*static_cast<Fn*>(p))(); }
+	template<typename Fn> static void destroyImpl(void* p) { static_cast<Fn*>(p)->~Fn(); }
+
+	alignas(max_align_t) uint8_t storage_[SIZE];
+	void (*invoke_)(void*);
+	void (*destroy_)(void*);
+};
+
+/*!
+	\brief Hierarchical timer wheel with a fixed pool of timers.
+
+	Deadlines are 64bit microsecond values on whatever monotonic clock is passed to advance(), so they
+	never wrap. Level 0 has 64 slots of 1us each, every level above has 64 slots that are 64 times
+	as wide, timers are cascaded down as time advances. Timers further away than the top level can
+	reach (about 18 minutes) are kept on an overflow list.
+
+	Scheduling and cancelling are O(1). advance() skips empty stretches of time using occupancy bitmaps,
+	so calling it once per runloop cycle is cheap.
+
+	Handles stay valid until the timer has fired (oneshot) or was cancelled; after that they refer to
+	nothing, even if the pool slot gets reused.
+*/
+class TimerWheel {
+public:
+	static const unsigned int MAX_TIMERS = 16;
+	static const size_t CALLBACK_SIZE = 32;
+
+	typedef uint32_t Handle;
+	static const Handle INVALID_HANDLE = 0;
+
+	TimerWheel();
+
+	//! Current time of the wheel, i.e. the last value passed to advance().
+	uint64_t time() const { return now_; }
+	//! Sets the current time. Only possible while no timers are scheduled and advance() is not running.
+	Result setTime(uint64_t nowUS);
+
+	//! Schedule cb to be called at deadlineUS, and then every periodUS if periodUS is not 0.
+	//! Returns INVALID_HANDLE if the pool is exhausted.
+	template<typename F> Handle schedule(uint64_t deadlineUS, uint64_t periodUS, F&& cb) {
+		int i = allocate();
+		if(i < 0) return INVALID_HANDLE;
+		timers_[i].cb.assign(std::forward<F>(cb));
+		timers_[i].deadline = deadlineUS;
+		timers_[i].period = periodUS;
+		link(i);
+		return handleFor(i);
+	}
+
+	//! Cancel a timer. Can be called from within callbacks, including the timer's own.
+	Result cancel(Handle handle);
+	bool isScheduled(Handle handle) const;
+	unsigned int numScheduled() const { return numScheduled_; }
+
+	//! Runs the callbacks of all timers with a deadline up to and including nowUS, in deadline order.
+	void advance(uint64_t nowUS);
+
+	//! Lower bound for the next deadline (exact if it is less than 64us away), UINT64_MAX if nothing is scheduled.
+	uint64_t nextEventHint() const;
+
+protected:
+	static const unsigned int LEVELS = 5;
+	static const unsigned int SLOT_BITS = 6;
+	static const unsigned int SLOTS = 1 << SLOT_BITS;
+	static const int8_t NIL = -1;
+	static const uint8_t OVERFLOW_LEVEL = LEVELS;
+
+	enum State {
+		STATE_FREE,
+		STATE_SCHEDULED,
+		STATE_FIRING,
+		STATE_FIRING_CANCELLED
+	};
+
+	struct Timer {
+		uint64_t deadline, period;
+		int8_t prev, next;
+		uint8_t level, slot, state;
+		uint16_t generation;
+		InplaceCallback<CALLBACK_SIZE> cb;
+	};
+
+	int allocate();
+	void release(int i);
+	void link(int i);
+	void unlink(int i);
+	void fireSlot(unsigned int slot);
+	void cascade(unsigned int level, unsigned int slot);
+	int indexFor(Handle handle) const;
+	Handle handleFor(int i) const { return (uint32_t(timers_[i].generation) << 8) | uint32_t(i + 1); }
+	uint64_t nextSlotStart(uint64_t after) const;
+
+	Timer timers_[MAX_TIMERS];
+	int8_t& head(uint8_t level, uint8_t slot) { return level == OVERFLOW_LEVEL ? overflow_ : heads_[level][slot]; }
+
+	int8_t heads_[LEVELS][SLOTS];
+	int8_t overflow_;
+	uint64_t occupied_[LEVELS];
+	int8_t free_;
+	unsigned int numScheduled_;
+	uint64_t now_;
+	bool advancing_;
+};
+
+};
+
+#endif // BBTIMERWHEEL_H
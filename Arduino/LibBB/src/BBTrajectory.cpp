@@ -0,0 +1,129 @@
+#include <Arduino.h>
+#include "BBTrajectory.h"
+
+#include <math.h>
+
+// Peak velocity and acceleration of a minimum-jerk move from rest to rest over distance d in time t are
+// 1.875*d/t and 5.7735*d/t^2.
+static const float PEAK_VEL_FACTOR = 1.875f;
+static const float PEAK_ACCEL_FACTOR = 5.7735f;
+
+// Moves that start in motion have their peaks elsewhere; those are checked at this many points, and the duration is
+// stretched until they are within the limits (up to some tolerance), or until giving up.
+static const unsigned int CHECK_POINTS = 16;
+static const unsigned int MAX_STRETCHES = 10;
+static const float STRETCH = 1.25f;
+static const float TOLERANCE = 1.05f;
+
+// Shorter moves are jumps.
+static const float MIN_DURATION = 1e-4f;
+
+bb::Trajectory::Trajectory(unsigned int numAxes, float maxVel, float maxAccel) {
+  numAxes_ = numAxes < MAX_AXES ? numAxes : MAX_AXES;
+  setLimits(maxVel, maxAccel);
+  reset();
+}
+
+void bb::Trajectory::setLimits(unsigned int axis, float maxVel, float maxAccel) {
+  if(axis >= numAxes_) return;
+  axes_[axis].maxVel = fabsf(maxVel);
+  axes_[axis].maxAccel = fabsf(maxAccel);
+}
+
+void bb::Trajectory::setLimits(float maxVel, float maxAccel) {
+  for(unsigned int i=0; i<MAX_AXES; i++) {
+    axes_[i].maxVel = fabsf(maxVel);
+    axes_[i].maxAccel = fabsf(maxAccel);
+  }
+}
+
+void bb::Trajectory::reset(float pos) {
+  for(unsigned int i=0; i<MAX_AXES; i++) reset(i, pos);
+  duration_ = elapsed_ = 0;
+}
+
+void bb::Trajectory::reset(unsigned int axis, float pos) {
+  if(axis >= MAX_AXES) return;
+  Axis& a = axes_[axis];
+  a.pos = a.goal = pos;
+  a.vel = a.accel = 0;
+  plan(a, 0);
+}
+
+void bb::Trajectory::moveTo(const float* goals, float minDuration) {
+  // Longest time any axis needs for a move from rest
+  float t = minDuration > 0 ? minDuration : 0;
+  for(unsigned int i=0; i<numAxes_; i++) {
+    Axis& a = axes_[i];
+    a.goal = goals[i];
+    float d = fabsf(a.goal - a.pos);
+    if(a.maxVel > 0) t = fmaxf(t, PEAK_VEL_FACTOR * d / a.maxVel);
+    if(a.maxAccel > 0) t = fmaxf(t, fmaxf(sqrtf(PEAK_ACCEL_FACTOR * d / a.maxAccel), 2 * fabsf(a.vel) / a.maxAccel));
+  }
+
+  // Stretch it until axes that are already moving keep to their limits, too
+  for(unsigned int s=0; s<MAX_STRETCHES && t >= MIN_DURATION; s++) {
+    bool ok = true;
+    for(unsigned int i=0; i<numAxes_; i++) {
+      plan(axes_[i], t);
+      if(!withinLimits(axes_[i], t)) ok = false;
+    }
+    if(ok) break;
+    t *= STRETCH;
+  }
+
+  if(t < MIN_DURATION) t = 0;
+  for(unsigned int i=0; i<numAxes_; i++) plan(axes_[i], t);
+  duration_ = t;
+  elapsed_ = 0;
+  if(t == 0) update(0);
+}
+
+void bb::Trajectory::update(float dt) {
+  if(dt > 0) elapsed_ += dt;
+  if(elapsed_ >= duration_) {
+    elapsed_ = duration_;
+    for(unsigned int i=0; i<numAxes_; i++) {
+      Axis& a = axes_[i];
+      a.pos = a.goal;
+      a.vel = a.accel = 0;
+    }
+    return;
+  }
+  for(unsigned int i=0; i<numAxes_; i++) evaluate(axes_[i], elapsed_);
+}
+
+// Quintic from the present state to rest at the goal after t seconds
+void bb::Trajectory::plan(Axis& a, float t) {
+  a.c[0] = a.pos;
+  a.c[1] = a.vel;
+  a.c[2] = a.accel / 2;
+  if(t < MIN_DURATION) {
+    a.c[3] = a.c[4] = a.c[5] = 0;
+    return;
+  }
+  float d = a.goal - a.pos, t2 = t*t, t3 = t2*t;
+  a.c[3] = (20*d - 12*a.vel*t - 3*a.accel*t2) / (2*t3);
+  a.c[4] = (-30*d + 16*a.vel*t + 3*a.accel*t2) / (2*t3*t);
+  a.c[5] = (12*d - 6*a.vel*t - a.accel*t2) / (2*t3*t2);
+}
+
+void bb::Trajectory::evaluate(Axis& a, float t) {
+  const float* c = a.c;
+  a.pos = c[0] + t*(c[1] + t*(c[2] + t*(c[3] + t*(c[4] + t*c[5]))));
+  a.vel = c[1] + t*(2*c[2] + t*(3*c[3] + t*(4*c[4] + t*5*c[5])));
+  a.accel = 2*c[2] + t*(6*c[3] + t*(12*c[4] + t*20*c[5]));
+}
+
+// An axis already beyond a limit - because the limit was lowered during a move - only has to stay below where it is.
+bool bb::Trajectory::withinLimits(const Axis& a, float t) {
+  if(a.maxVel == 0 && a.maxAccel == 0) return true;
+  float maxVel = fmaxf(a.maxVel, fabsf(a.vel)) * TOLERANCE, maxAccel = fmaxf(a.maxAccel, fabsf(a.accel)) * TOLERANCE;
+  Axis probe = a;
+  for(unsigned int i=1; i<CHECK_POINTS; i++) {
+    evaluate(probe, t * i / CHECK_POINTS);
+    if(a.maxVel > 0 && fabsf(probe.vel) > maxVel) return false;
+    if(a.maxAccel > 0 && fabsf(probe.accel) > maxAccel) return false;
+  }
+  return true;
+}
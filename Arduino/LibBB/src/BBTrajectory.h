@@ -0,0 +1,71 @@
+#if !defined(BBTRAJECTORY_H)
+#define BBTRAJECTORY_H
+
+namespace bb {
+
+/*!
+  \brief Time-synchronized minimum-jerk trajectories for up to MAX_AXES axes, e.g. the servos of a head.
+
+  moveTo() plans a move of every axis from where it is - position, velocity and acceleration - to a goal, where it
+  comes to rest. Each axis follows the minimum-jerk path between the two states (a quintic polynomial), and all axes
+  take the same time, so they start and arrive together. That time is the longest of the minimum duration given and
+  what each axis needs to stay within its velocity and acceleration limits. A move can be replanned at any time, e.g.
+  whenever a remote packet brings a new goal, without a kink in position, velocity or acceleration.
+
+  update() advances by one control cycle; position() is then the goal to send. That way a servo gets small, smooth
+  steps at the control rate, however seldom and however far the goals jump.
+
+  A limit of 0 means none. Without limits and without a minimum duration, axes jump straight to their goals.
+*/
+class Trajectory {
+public:
+  static const unsigned int MAX_AXES = 8;
+
+  Trajectory(unsigned int numAxes = 1, float maxVel = 0, float maxAccel = 0);
+
+  unsigned int numAxes() const { return numAxes_; }
+  //! Velocity and acceleration limits for one axis, in units per second (squared). Take effect with the next move.
+  void setLimits(unsigned int axis, float maxVel, float maxAccel);
+  //! The same limits for all axes.
+  void setLimits(float maxVel, float maxAccel);
+
+  //! Puts all axes at rest at pos, ending any move.
+  void reset(float pos = 0);
+  void reset(unsigned int axis, float pos);
+
+  //! Plans a move of all axes to goals (numAxes() values), taking at least minDuration seconds.
+  void moveTo(const float* goals, float minDuration = 0);
+
+  //! Advances dt seconds along the current move.
+  void update(float dt);
+
+  float position(unsigned int axis) const { return axis < numAxes_ ? axes_[axis].pos : 0; }
+  float velocity(unsigned int axis) const { return axis < numAxes_ ? axes_[axis].vel : 0; }
+  float acceleration(unsigned int axis) const { return axis < numAxes_ ? axes_[axis].accel : 0; }
+  float goal(unsigned int axis) const { return axis < numAxes_ ? axes_[axis].goal : 0; }
+
+  //! Length of the current move, and how far along it is, in seconds.
+  float duration() const { return duration_; }
+  float elapsed() const { return elapsed_; }
+  bool done() const { return elapsed_ >= duration_; }
+
+protected:
+  struct Axis {
+    float maxVel, maxAccel;
+    float pos, vel, accel;
+    float goal;
+    float c[6]; // polynomial coefficients over time since the start of the move
+  };
+
+  static void plan(Axis& a, float t);
+  static void evaluate(Axis& a, float t);
+  static bool withinLimits(const Axis& a, float t);
+
+  Axis axes_[MAX_AXES];
+  unsigned int numAxes_;
+  float duration_, elapsed_;
+};
+
+};
+
+#endif // BBTRAJECTORY_H
@@ -0,0 +1,59 @@
+#include <Arduino.h>
+#include "BBVelocityProfile.h"
+
+#include <math.h>
+
+bb::VelocityProfile::VelocityProfile(float maxAccel, float maxJerk) {
+  setLimits(maxAccel, maxJerk);
+  reset();
+}
+
+void bb::VelocityProfile::setLimits(float maxAccel, float maxJerk) {
+  maxAccel_ = fabsf(maxAccel);
+  maxJerk_ = fabsf(maxJerk);
+}
+
+void bb::VelocityProfile::reset(float vel) {
+  vel_ = vel;
+  accel_ = 0;
+}
+
+float bb::VelocityProfile::update(float goal, float dt) {
+  if(dt <= 0) return vel_;
+
+  if(maxAccel_ == 0) {
+    accel_ = 0;
+    vel_ = goal;
+    return vel_;
+  }
+
+  float err = goal - vel_;
+
+  if(maxJerk_ == 0) {
+    float dv = constrain(err, -maxAccel_*dt, maxAccel_*dt);
+    accel_ = dv / dt;
+    vel_ += dv;
+    return vel_;
+  }
+
+  // Largest acceleration towards the goal after this step from which ramping acceleration down at max jerk, one step
+  // at a time, still stops short of the goal: v + (accel_ + a)/2 * dt + a*|a| / (2 * maxJerk) = goal, solved for a.
+  float dir = err > 0 ? 1 : -1;
+  float room = dir * (goal - vel_ - accel_ * dt / 2);
+  float h = maxJerk_ * dt / 2;
+  float accelGoal = room >= 0 ? -h + sqrtf(h*h + 2 * maxJerk_ * room) : h - sqrtf(h*h - 2 * maxJerk_ * room);
+  accelGoal = constrain(dir * accelGoal, -maxAccel_, maxAccel_);
+  float da = maxJerk_ * dt;
+  float accel = constrain(accelGoal, accel_ - da, accel_ + da);
+  float vel = vel_ + (accel_ + accel) / 2 * dt;
+
+  // Snap to the goal when this step reaches it, unless that would take more than one step's change in acceleration
+  if((goal - vel) * err <= 0 && fabsf(accel) <= da) {
+    accel_ = 0;
+    vel_ = goal;
+  } else {
+    accel_ = accel;
+    vel_ = vel;
+  }
+  return vel_;
+}
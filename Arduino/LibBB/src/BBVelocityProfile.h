@@ -0,0 +1,40 @@
+#if !defined(BBVELOCITYPROFILE_H)
+#define BBVELOCITYPROFILE_H
+
+namespace bb {
+
+/*!
+  \brief Jerk limited (S-curve) velocity ramp.
+
+  Follows a goal velocity with bounded acceleration and bounded change of acceleration, so that starts and stops
+  round off instead of kicking in at full acceleration. Acceleration eases off ahead of the goal so that it is zero
+  when the goal is reached.
+
+  A max acceleration of 0 means none - velocity jumps to the goal. A max jerk of 0 means none - velocity ramps
+  linearly at max acceleration, as a plain acceleration limit does.
+*/
+class VelocityProfile {
+public:
+  VelocityProfile(float maxAccel = 0, float maxJerk = 0);
+
+  void setLimits(float maxAccel, float maxJerk);
+  float maxAcceleration() const { return maxAccel_; }
+  float maxJerk() const { return maxJerk_; }
+
+  //! Sets velocity, with zero acceleration.
+  void reset(float vel = 0);
+
+  //! Moves dt seconds towards goal. Returns the new velocity.
+  float update(float goal, float dt);
+  float velocity() const { return vel_; }
+  //! Acceleration over the last update(). Always 0 without an acceleration limit, where velocity steps.
+  float acceleration() const { return accel_; }
+
+protected:
+  float maxAccel_, maxJerk_;
+  float vel_, accel_;
+};
+
+};
+
+#endif // BBVELOCITYPROFILE_H
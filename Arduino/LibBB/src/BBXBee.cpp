@@ -11,6 +11,23 @@ bb::XBee bb::XBee::xbee;
 
 static std::vector<unsigned int> baudRatesToTry = { 230400, 115200, 9600, 57600, 19200, 28800, 38400, 76800 }; // start with 115200, then try 9600
 
+static uint32_t bpsParamValue(uint32_t bps) {
+	switch(bps) {
+	case 1200:   return 0x0;
+	case 2400:   return 0x1;
+	case 4800:   return 0x2;
+	case 9600:   return 0x3;
+	case 19200:  return 0x4;
+	case 38400:  return 0x5;
+	case 57600:  return 0x6;
+	case 115200: return 0x7;
+	case 230400: return 0x8;
+	case 460800: return 0x9;
+	case 921600: return 0xa;
+	default:     return bps;
+	}
+}
+
 bb::XBee::XBee() {
 	uart_ = &Serial1;
 	debug_ = (XBee::DebugFlags)(DEBUG_PROTOCOL);
@@ -19,9 +36,14 @@ bb::XBee::XBee() {
 	atmode_millis_ = 0;
 	atmode_timeout_ = 10000;
 	currentBPS_ = 0;
-	memset(packetBuf_, 0, sizeof(packetBuf_));
-	packetBufPos_ = 0;
 	apiMode_ = false;
+	cacheHandle_ = 0;
+	linkModeAllowed_ = false;
+	flushTask_ = Runloop::INVALID_TASK;
+	linkPeersHandle_ = 0;
+	memset(&linkPeers_, 0, sizeof(linkPeers_));
+	startupState_ = STARTUP_IDLE;
+	guardTime_ = DEFAULT_GUARD_TIME;
 
 	name_ = "xbee";
 	description_ = "Communication via XBee 802.5.14";
@@ -29,7 +51,9 @@ bb::XBee::XBee() {
 	"Available commands:\r\n" \
 	"\tpacket_mode on|off: Switch to packet mode\r\n" \
 	"\tapi_mode on|off: Enter / leave API mode\r\n" \
-	"\tsend_api_packet <dest>: Send zero control packet to destination\r\n";
+	"\tsend_api_packet <dest>: Send zero control packet to destination\r\n" \
+	"\tlinks: Show link mode peers and statistics\r\n" \
+	"\tlink_mode <addrHi> <addrLo> on|off: Switch link mode to a peer on or off\r\n";
 
 	addParameter("channel", "Communication channel (between 11 and 26, usually 12)", params_.chan, 11, 26);
 	addParameter("pan", "Personal Area Network ID (16bit, 65535 is broadcast)", params_.pan, 0, 65535);
@@ -61,144 +85,286 @@ bb::Result bb::XBee::initialize(uint8_t chan, uint16_t pan, uint32_t bps, Hardwa
 }
 
 bb::Result bb::XBee::start(ConsoleStream *stream) {
-	if(isStarted()) return RES_SUBSYS_ALREADY_STARTED;
+	if(isStarted() || isStarting()) return RES_SUBSYS_ALREADY_STARTED;
 	if(NULL == uart_) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
 
-	// empty uart
-	while(uart_->available()) uart_->read();
-
-	if(stream == NULL) stream = Console::console.serialStream();
+	if(cacheHandle_ == 0) {
+		cacheHandle_ = ConfigStorage::storage.reserveBlock("xbeecache", sizeof(cache_), (uint8_t*)&cache_);
+	}
+	if(ConfigStorage::storage.blockIsValid(cacheHandle_)) {
+		ConfigStorage::storage.readBlock(cacheHandle_);
+	} else {
+		memset(&cache_, 0, sizeof(cache_));
+	}
 
-	currentBPS_ = 0;
-	if(currentBPS_ == 0) {
-		if(stream) stream->printf("Auto-detecting BPS: ");
-		
-		for(size_t i=0; i<baudRatesToTry.size(); i++) {
-			if(stream) {
-				stream->printf("%d... ", baudRatesToTry[i]); 
-			}
-			
-			//uart_->end();
-			delay(100);
-			uart_->begin(baudRatesToTry[i]);
-			
-			if(enterATModeIfNecessary() == RES_OK) {
-				Console::console.printfBroadcast("Success.\n");
-				currentBPS_ = baudRatesToTry[i];
-				break; 
-			}
-		}
-		if(currentBPS_ == 0) {
-			if(stream) stream->printf("failed.\n");
-			operationStatus_ = RES_SUBSYS_HW_DEPENDENCY_MISSING;
-			return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+	if(linkPeersHandle_ == 0) {
+		linkPeersHandle_ = ConfigStorage::storage.reserveBlock("xbeelinks", sizeof(linkPeers_), (uint8_t*)&linkPeers_);
+		if(ConfigStorage::storage.blockIsValid(linkPeersHandle_)) {
+			ConfigStorage::storage.readBlock(linkPeersHandle_);
+		} else {
+			memset(&linkPeers_, 0, sizeof(linkPeers_));
 		}
-	} else {
-		if(stream) stream->printf("Using %dbps.", currentBPS_);
-		uart_->begin(currentBPS_);
-		if(enterATModeIfNecessary() != RES_OK) {
-			operationStatus_ = RES_SUBSYS_HW_DEPENDENCY_MISSING;
-			return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+		for(unsigned int i=0; i<MAX_LINKS; i++) {
+			if(linkPeers_.peers[i].isZero()) continue;
+			setLinkMode(linkPeers_.peers[i], true);
 		}
 	}
 
-	String addrH = sendStringAndWaitForResponse("ATSH"); addrH.trim();
-	String addrL = sendStringAndWaitForResponse("ATSL"); addrL.trim();
-	String fw = sendStringAndWaitForResponse("ATVR"); fw.trim();
-	if(addrH == "" || addrL == "" || fw == "") return RES_SUBSYS_COMM_ERROR;
+	warmBoot_ = cache_.bps != 0;
+	reconfigure_ = !warmBoot_ || memcmp(&cache_.params, &params_, sizeof(params_)) != 0;
+	bpsIndex_ = 0;
+	startupCmd_ = CMD_SH;
+	currentBPS_ = 0;
+	apiMode_ = false;
+	atmode_ = false;
+	startupStart_ = millis();
+	operationStatus_ = RES_SUBSYS_NOT_STARTED;
 
-	hwAddress_ = {uint32_t(strtol(addrH.c_str(), 0, 16)), uint32_t(strtol(addrL.c_str(), 0, 16))};
-	if(stream) {
-		stream->printf("Found XBee at address: %s:%s (0x%lx:%lx) Firmware version: %s\n", addrH.c_str(), addrL.c_str(), hwAddress_.addrHi, hwAddress_.addrLo, fw.c_str());
+	if(warmBoot_) {
+		bb::printf(stream, "XBee: Using cached rate of %dbps%s\n", cache_.bps, reconfigure_ ? ", reconfiguring" : "");
+		openSerialForStartup(cache_.bps, cache_.guardTime);
 	} else {
-		Console::console.printfBroadcast("Found XBee at address: %s:%s (0x%lx:%lx) Firmware version: %s\n", addrH.c_str(), addrL.c_str(), hwAddress_.addrHi, hwAddress_.addrLo, fw.c_str());
-	}	
-
-	String retval = sendStringAndWaitForResponse("ATCT"); 
-	if(retval != "") {
-		atmode_timeout_ = strtol(retval.c_str(), 0, 16) * 100;
+		bb::printf(stream, "XBee: Auto-detecting BPS\n");
+		openSerialForStartup(baudRatesToTry[0], DEFAULT_GUARD_TIME);
 	}
 
-	retval = sendStringAndWaitForResponse("ATMM=3");
-	if(retval != "OK") {
-		Console::console.printfBroadcast("MM=3 response: %s\n", retval.c_str());
-	}
-	retval = sendStringAndWaitForResponse("ATRR");
-	if(retval != "OK") {
-		Console::console.printfBroadcast("RR response: %s\n", retval.c_str());
+	return RES_OK;
+}
+
+bb::Result bb::XBee::stepIfNotStarted() {
+	if(startupState_ != STARTUP_IDLE) stepStartup();
+	return RES_OK;
+}
+
+void bb::XBee::openSerialForStartup(int bps, uint16_t guardTime) {
+	uart_->begin(bps);
+	startupBPS_ = bps;
+	guardTime_ = guardTime;
+	startupDeadline_ = millis() + guardTime;
+	startupState_ = STARTUP_OPEN;
+}
+
+void bb::XBee::stepStartup() {
+	switch(startupState_) {
+	case STARTUP_OPEN:
+		// The module only takes "+++" after it has not been sent anything for the guard time. Whatever it sends us
+		// in the meantime is left over from before and is dropped.
+		while(uart_->available()) uart_->read();
+		if(long(millis() - startupDeadline_) < 0) break;
+		uart_->write("+++");
+		atResponseLen_ = 0;
+		startupDeadline_ = millis() + guardTime_ + AT_RESPONSE_TIMEOUT;
+		startupState_ = STARTUP_ENTER_AT;
+		break;
+
+	case STARTUP_ENTER_AT: {
+		ATPoll poll = pollATResponse();
+		if(poll == AT_PENDING) break;
+		if(poll == AT_RESPONSE && !strcmp(atResponse_, "OK")) {
+			atmode_ = true;
+			atmode_millis_ = millis();
+			currentBPS_ = startupBPS_;
+			Console::console.printfBroadcast("XBee: In AT mode at %dbps after %lums\n", currentBPS_, millis() - startupStart_);
+			sendStartupCommand(startupCmd_ == CMD_LEAVE_FOR_BD ? CMD_AP : CMD_SH);
+			break;
+		}
+
+		if(warmBoot_ || startupCmd_ == CMD_LEAVE_FOR_BD || ++bpsIndex_ >= baudRatesToTry.size()) {
+			startupFailed(RES_SUBSYS_HW_DEPENDENCY_MISSING);
+		} else {
+			openSerialForStartup(baudRatesToTry[bpsIndex_], DEFAULT_GUARD_TIME);
+		}
+		break;
 	}
 
-	if(setConnectionInfo(params_.chan, params_.pan, true) != RES_OK) {
-		if(stream) stream->printf("Setting connection info failed.\n");
-		return RES_SUBSYS_COMM_ERROR;
+	case STARTUP_COMMAND: {
+		ATPoll poll = pollATResponse();
+		if(poll == AT_PENDING) break;
+		if(poll == AT_TIMEOUT) {
+			Console::console.printfBroadcast("XBee: Timeout waiting for response to command %d\n", startupCmd_);
+			startupFailed(RES_COMM_TIMEOUT);
+			break;
+		}
+		if(debug_ & DEBUG_XBEE_COMM) Console::console.printfBroadcast("XBee: Response \"%s\"\n", atResponse_);
+		if(handleStartupResponse(startupCmd_) == false) {
+			startupFailed(RES_SUBSYS_COMM_ERROR);
+		} else if(startupCmd_ == CMD_CN) {
+			startupFinished();
+		} else if(startupCmd_ == CMD_LEAVE_FOR_BD) {
+			startupState_ = STARTUP_REOPEN;
+		} else {
+			sendStartupCommand(nextStartupCommand(startupCmd_));
+		}
+		break;
 	}
 
-	uint8_t chan; uint16_t pan; 
-	if(getConnectionInfo(chan, pan, true) != RES_OK) {
-		if(stream) stream->printf("Getting connection info failed.\n");
-		return RES_SUBSYS_COMM_ERROR;
+	case STARTUP_REOPEN:
+		uart_->end();
+		openSerialForStartup(params_.bps, guardTime_);
+		break;
+
+	default:
+		break;
 	}
-	params_.chan = chan;
-	params_.pan = pan;
+}
 
-	if(strlen(params_.name) != 0) {
-		String str = String("ATNI") + params_.name;
-		if(sendStringAndWaitForOK(str) == false) {
-			Console::console.printfBroadcast("Error setting name \"%s\"\n", params_.name);
-			return RES_SUBSYS_COMM_ERROR;
-		}
-	} else {
-		Console::console.printfBroadcast("Zero-length name, not setting\n");
-	} 
+bb::XBee::StartupCommand bb::XBee::nextStartupCommand(StartupCommand cmd) {
+	if(cmd == CMD_SL && !reconfigure_) return CMD_AP; // warm boot and nothing to change
 
-	if(sendStringAndWaitForOK("ATNT=64") == false) {
-		Console::console.printfBroadcast("Error setting node discovery timeout\n");
-		return RES_SUBSYS_COMM_ERROR;
-	} 
+	StartupCommand next = StartupCommand(cmd + 1);
+	if(next == CMD_NI && strlen(params_.name) == 0) next = CMD_NT;
+	if(next == CMD_BD && params_.bps == currentBPS_) next = CMD_WR;
+	if(next == CMD_LEAVE_FOR_BD && params_.bps == currentBPS_) next = CMD_AP;
+	return next;
+}
 
-	bool changedBPS = false;
+void bb::XBee::sendStartupCommand(StartupCommand cmd) {
+	char buf[40];
+
+	switch(cmd) {
+	case CMD_SH:           snprintf(buf, sizeof(buf), "ATSH"); break;
+	case CMD_SL:           snprintf(buf, sizeof(buf), "ATSL"); break;
+	case CMD_VR:           snprintf(buf, sizeof(buf), "ATVR"); break;
+	case CMD_CT:           snprintf(buf, sizeof(buf), "ATCT"); break;
+	case CMD_MM:           snprintf(buf, sizeof(buf), "ATMM=3"); break;
+	case CMD_RR:           snprintf(buf, sizeof(buf), "ATRR"); break;
+	case CMD_CH:           snprintf(buf, sizeof(buf), "ATCH=%x", params_.chan); break;
+	case CMD_ID:           snprintf(buf, sizeof(buf), "ATID=%x", params_.pan); break;
+	case CMD_MY:           snprintf(buf, sizeof(buf), "ATMY=FFFE"); break;
+	case CMD_READ_CH:      snprintf(buf, sizeof(buf), "ATCH"); break;
+	case CMD_READ_ID:      snprintf(buf, sizeof(buf), "ATID"); break;
+	case CMD_NI:           snprintf(buf, sizeof(buf), "ATNI%s", params_.name); break;
+	case CMD_NT:           snprintf(buf, sizeof(buf), "ATNT=64"); break;
+	case CMD_GT:           snprintf(buf, sizeof(buf), "ATGT=%x", STARTUP_GUARD_TIME); break;
+	case CMD_BD:           snprintf(buf, sizeof(buf), "ATBD=%x", (unsigned int)bpsParamValue(params_.bps)); break;
+	case CMD_WR:           snprintf(buf, sizeof(buf), "ATWR"); break;
+	case CMD_LEAVE_FOR_BD: snprintf(buf, sizeof(buf), "ATCN"); break;
+	case CMD_AP:           snprintf(buf, sizeof(buf), "ATAP=2"); break;
+	case CMD_CN:           snprintf(buf, sizeof(buf), "ATCN"); break;
+	}
 
-	if(params_.bps != currentBPS_) {
-		Console::console.printfBroadcast("Changing BPS from current %d to %d...\n", currentBPS_, params_.bps);
-		if(changeBPSTo(params_.bps, stream, true) != RES_OK) {
-			if(stream) stream->printf("Setting BPS failed.\n"); 
-			else Console::console.printfBroadcast("Setting BPS failed.\n"); 
-			currentBPS_ = 0;
-			return RES_SUBSYS_COMM_ERROR;
-		} else {
-			Console::console.printfBroadcast("Setting BPS to %d successful.\n", params_.bps); 
-			changedBPS = true;
+	if(debug_ & DEBUG_XBEE_COMM) Console::console.printfBroadcast("XBee: Sending \"%s\"\n", buf);
+	uart_->print(buf);
+	uart_->print("\r");
+
+	startupCmd_ = cmd;
+	atResponseLen_ = 0;
+	startupDeadline_ = millis() + AT_RESPONSE_TIMEOUT;
+	startupState_ = STARTUP_COMMAND;
+}
+
+bool bb::XBee::handleStartupResponse(StartupCommand cmd) {
+	bool ok = !strcmp(atResponse_, "OK");
+
+	switch(cmd) {
+	case CMD_SH:
+	case CMD_SL: {
+		if(atResponseLen_ == 0) return false;
+		uint32_t addr = strtoul(atResponse_, 0, 16);
+		if(cmd == CMD_SH) hwAddress_.addrHi = addr;
+		else hwAddress_.addrLo = addr;
+		if(cmd == CMD_SL && warmBoot_ && (hwAddress_.addrHi != cache_.addrHi || hwAddress_.addrLo != cache_.addrLo)) {
+			Console::console.printfBroadcast("XBee: Module has changed, reconfiguring\n");
+			reconfigure_ = true;
 		}
+		return true;
 	}
 
-	if(sendStringAndWaitForOK("ATWR") == false) {
-		if(stream) stream->printf("Couldn't write config!\n");
-		return RES_SUBSYS_COMM_ERROR;
+	case CMD_VR:
+		if(atResponseLen_ == 0) return false;
+		Console::console.printfBroadcast("XBee: Found XBee at address 0x%lx:%lx, firmware version %s\n", hwAddress_.addrHi, hwAddress_.addrLo, atResponse_);
+		return true;
+
+	case CMD_CT:
+		if(atResponseLen_ != 0) atmode_timeout_ = strtol(atResponse_, 0, 16) * 100;
+		return true;
+
+	case CMD_MM:
+	case CMD_RR:
+	case CMD_GT:
+		if(!ok) Console::console.printfBroadcast("XBee: Response to command %d: \"%s\"\n", cmd, atResponse_);
+		return true;
+
+	case CMD_READ_CH:
+		if(atResponseLen_ == 0) return false;
+		params_.chan = strtol(atResponse_, 0, 16);
+		return true;
+
+	case CMD_READ_ID:
+		if(atResponseLen_ == 0) return false;
+		params_.pan = strtol(atResponse_, 0, 16);
+		return true;
+
+	case CMD_LEAVE_FOR_BD:
+	case CMD_CN:
+		if(ok) atmode_ = false;
+		return ok;
+
+	default:
+		if(!ok) Console::console.printfBroadcast("XBee: Expected \"OK\" for command %d, got \"%s\"\n", cmd, atResponse_);
+		return ok;
 	}
+}
 
-	// we have changed the BPS successfully?
-	if(changedBPS) {
-		if(stream) stream->printf("Closing and reopening serial at %dbps\n", params_.bps);
-		leaveATMode();
-		uart_->end();
-		uart_->begin(params_.bps);
-		enterATModeIfNecessary();
-		if(sendStringAndWaitForOK("AT") == false) return RES_SUBSYS_COMM_ERROR;
-		currentBPS_ = params_.bps;
+bb::XBee::ATPoll bb::XBee::pollATResponse() {
+	while(uart_->available()) {
+		char c = uart_->read();
+		if(c == '\r') {
+			atResponse_[atResponseLen_] = '\0';
+			return AT_RESPONSE;
+		}
+		if(atResponseLen_ < sizeof(atResponse_)-1) atResponse_[atResponseLen_++] = c;
 	}
+	if(long(millis() - startupDeadline_) >= 0) return AT_TIMEOUT;
+	return AT_PENDING;
+}
 
-	setAPIMode(true);
+void bb::XBee::startupFailed(Result res) {
+	if(warmBoot_) {
+		// Maybe someone has fiddled with the module. Start over, from scratch.
+		Console::console.printfBroadcast("XBee: Warm boot failed at %dbps, auto-detecting\n", startupBPS_);
+		warmBoot_ = false;
+		reconfigure_ = true;
+		bpsIndex_ = 0;
+		startupCmd_ = CMD_SH;
+		atmode_ = false;
+		openSerialForStartup(baudRatesToTry[0], DEFAULT_GUARD_TIME);
+		return;
+	}
 
-	leaveATMode();
+	Console::console.printfBroadcast("XBee: Startup failed after %lums: %s\n", millis() - startupStart_, errorMessage(res));
+	currentBPS_ = 0;
+	startupState_ = STARTUP_IDLE;
+	operationStatus_ = res;
+}
 
+void bb::XBee::startupFinished() {
+	apiMode_ = true;
+	parser_.reset();
+	startupState_ = STARTUP_IDLE;
 	operationStatus_ = RES_OK;
 	started_ = true;
 
-	return RES_OK;
+	Console::console.printfBroadcast("XBee: Started at %dbps in %lums (%s)\n", currentBPS_, millis() - startupStart_,
+		warmBoot_ ? (reconfigure_ ? "warm boot, reconfigured" : "warm boot") : "cold boot");
+
+	StartupCache cache;
+	memset(&cache, 0, sizeof(cache));
+	cache.bps = currentBPS_;
+	cache.addrHi = hwAddress_.addrHi;
+	cache.addrLo = hwAddress_.addrLo;
+	cache.guardTime = reconfigure_ ? STARTUP_GUARD_TIME : cache_.guardTime;
+	cache.params = params_;
+	if(memcmp(&cache, &cache_, sizeof(cache)) != 0) {
+		cache_ = cache;
+		ConfigStorage::storage.writeBlock(cacheHandle_);
+		ConfigStorage::storage.commit();
+	}
 }
 
 bb::Result bb::XBee::stop(ConsoleStream *stream) {
 	if(stream) stream = stream; // make compiler happy
+	startupState_ = STARTUP_IDLE;
 	operationStatus_ = RES_SUBSYS_NOT_STARTED;
 	currentBPS_ = 0;
 	started_ = false;
@@ -206,30 +372,59 @@ bb::Result bb::XBee::stop(ConsoleStream *stream) {
 }
 
 bb::Result bb::XBee::step() {
-	int packetsHandled = 0;
-	while(available()) {
-		if(apiMode_) {
-			HWAddress srcAddr;
-			uint8_t rssi;
-			Packet packet;
-			Result retval = receiveAPIMode(srcAddr, rssi, packet);
-			if(retval != RES_OK) {
-				//Console::console.printfBroadcast("receiveAPIMode(): %s\n", errorMessage(retval));
-				continue;
-			}
-//			Console::console.printfBroadcast("Received packet from %lx:%lx type %d\n", srcAddr.addrHi, srcAddr.addrLo, packet.type);
-			for(auto& r: receivers_) {
-				r->incomingPacket(srcAddr, rssi, packet);
-			}
-			packetsHandled++;
-		} else {
+	if(!apiMode_) {
+		while(available()) {
 			bb::Console::console.printfBroadcast("%s\n", receive().c_str());
 		}
+		return RES_OK;
+	}
+
+	if(operationStatus_ != RES_OK) return RES_OK;
+	if(isInATMode()) leaveATMode();
+
+	// Take in whatever has arrived; partial frames stay in the parser until the next step.
+	while(parser_.consume(uart_) != 0) {
+		uint16_t length;
+		uint8_t *data;
+		while((data = parser_.frame(length)) != NULL) {
+			dispatchFrame(APIFrame(data, length));
+			parser_.pop();
+		}
 	}
 
 	return RES_OK;
 }
 
+bb::Result bb::XBee::dispatchFrame(const APIFrame& frame) {
+	HWAddress srcAddr;
+	uint8_t rssi;
+	const uint8_t *payload;
+	uint16_t length;
+	if(frame.unpackRXFrame(srcAddr, rssi, payload, length) == RES_OK && PacketLink::isLinkFrame(payload, length)) {
+		PacketLink *link = linkFor(srcAddr, true);
+		if(link == NULL) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+		Result retval = link->decode(payload, length, rssi, receivers_);
+		if(retval != RES_OK && (debug_ & DEBUG_XBEE_COMM)) {
+			bb::printf("Error decoding link frame from 0x%lx:%lx: %s\n", srcAddr.addrHi, srcAddr.addrLo, errorMessage(retval));
+		}
+		return retval;
+	}
+
+	Packet *packet;
+	Result retval = frame.unpackRXPacket(srcAddr, rssi, packet);
+	if(retval != RES_OK) {
+		if(retval == RES_PACKET_INVALID_PACKET && (debug_ & DEBUG_XBEE_COMM)) {
+			bb::printf("Error: Wrong CRC 0x%x, expected 0x%x\n", packet->calculateCRC(), packet->crc);
+		}
+		return retval;
+	}
+
+	for(auto& r: receivers_) {
+		r->incomingPacket(srcAddr, rssi, *packet);
+	}
+	return RES_OK;
+}
+
 bb::Result bb::XBee::parameterValue(const String& name, String& value) {
 	if(name == "channel") { 
 		value = String(params_.chan); return RES_OK; 
@@ -271,6 +466,27 @@ bb::Result bb::XBee::handleConsoleCommand(const std::vector<String>& words, Cons
 		return send(words[1]);
 	} 
 
+	else if(words[0] == "links") {
+		if(stream == NULL) return RES_OK;
+		stream->printf("Link mode %s\n", linkModeAllowed_ ? "allowed" : "not allowed");
+		for(unsigned int i=0; i<MAX_LINKS; i++) {
+			if(!links_[i].isUsed()) continue;
+			const PacketLink::Stats& s = links_[i].stats();
+			stream->printf("0x%lx:%lx%s: sent %lu frames, %lu bytes, %lu records (%lu delta); received %lu frames, %lu records, %lu recovered, %lu frames lost, %lu errors\n",
+				links_[i].peer().addrHi, links_[i].peer().addrLo, links_[i].isSending() ? " (sending)" : "",
+				s.framesSent, s.bytesSent, s.recordsSent, s.deltaRecordsSent, s.framesReceived, s.recordsReceived, s.recordsRecovered, s.framesLost, s.decodeErrors);
+		}
+		return RES_OK;
+	}
+
+	else if(words[0] == "link_mode") {
+		if(words.size() != 4) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		HWAddress peer = { uint32_t(strtoul(words[1].c_str(), NULL, 16)), uint32_t(strtoul(words[2].c_str(), NULL, 16)) };
+		if(words[3] == "on" || words[3] == "true") return setLinkMode(peer, true);
+		else if(words[3] == "off" || words[3] == "false") return setLinkMode(peer, false);
+		else return RES_CMD_INVALID_ARGUMENT;
+	}
+
 	else if(words[0] == "api_mode") {
 		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
 		else {
@@ -290,6 +506,7 @@ bb::Result bb::XBee::handleConsoleCommand(const std::vector<String>& words, Cons
 bb::Result bb::XBee::setAPIMode(bool onoff) {
 	Result res;
 	if(onoff == true) {
+		if(isStarting()) return RES_OK; // startup ends in API mode anyway
 		if(apiMode_ == true) {
 			return RES_CMD_INVALID_ARGUMENT;
 		}
@@ -297,6 +514,7 @@ bb::Result bb::XBee::setAPIMode(bool onoff) {
 		enterATModeIfNecessary();
 		if(sendStringAndWaitForOK("ATAP=2") == true) {
 			apiMode_ = true;
+			parser_.reset();
 			leaveATMode();
 			return RES_OK;
 		} else {
@@ -434,21 +652,7 @@ bb::Result bb::XBee::leaveATMode(ConsoleStream *stream) {
 }
 
 bb::Result bb::XBee::changeBPSTo(uint32_t bps, ConsoleStream *stream, bool stayInAT) {
-	uint32_t paramVal;
-	switch(bps) {
-	case 1200:   paramVal = 0x0; break;
-	case 2400:   paramVal = 0x1; break;
-	case 4800:   paramVal = 0x2; break;
-	case 9600:   paramVal = 0x3; break;
-	case 19200:  paramVal = 0x4; break;
-	case 38400:  paramVal = 0x5; break;
-	case 57600:  paramVal = 0x6; break;
-	case 115200: paramVal = 0x7; break;
-	case 230400: paramVal = 0x8; break;
-	case 460800: paramVal = 0x9; break;
-	case 921600: paramVal = 0xa; break;
-	default:     paramVal = bps; break;
-	}
+	uint32_t paramVal = bpsParamValue(bps);
 
 #if 0
 	String retval = sendStringAndWaitForResponse("ATBD");
@@ -521,56 +725,41 @@ bb::Result bb::XBee::discoverNodes(std::vector<bb::XBee::Node>& nodes) {
 	nodes = std::vector<bb::XBee::Node>();
 
 	Result res;
-	APIFrame request = APIFrame::atRequest(0x5, ('N'<<8 | 'D'));
-	res = send(request);
+	uint8_t request[4] = { APIFrame::ATREQUEST, 0x5, 'N', 'D' };
+	res = send(APIFrame(request, sizeof(request)));
 	if(res != RES_OK) return res;
 
-	int timeout = 10000;
+	unsigned long start = millis();
 
-	while(timeout > 0) {
-		delay(1);
-		timeout--;
-
-		if(available()) {
-			Result res;
-			APIFrame response;
-			res = receive(response);
-			if(res != RES_OK) {
-				Console::console.printfBroadcast("Error receiving response: %s\n", errorMessage(res));
-				continue;
-			}
+	while(millis() - start < 10000) {
+		APIFrame response;
+		if(waitForFrame(response, 10) != RES_OK) continue;
 
-			uint8_t frameID, status;
-			uint16_t command, length;
-			uint8_t *data;
-
-			res = response.unpackATResponse(frameID, command, status, &data, length);
-			if(res != RES_OK) {
-				continue;
-			}
-
-			if(status != 0) {
-				Console::console.printfBroadcast("Response with status %d\"", status);
-				continue;
-			}	
-
-			if(length < APIFrame::ATResponseNDMinLength) {
-				Console::console.printfBroadcast("Expected >=%d bytes, found %d\n", APIFrame::ATResponseNDMinLength, length);
-				continue;
-			}
+		uint8_t frameID, status;
+		uint16_t command, length;
+		uint8_t *data;
 
+		res = response.unpackATResponse(frameID, command, status, &data, length);
+		if(res != RES_OK) {
+			dispatchFrame(response); // not for us
+		} else if(status != 0) {
+			Console::console.printfBroadcast("Response with status %d\"", status);
+		} else if(length < APIFrame::ATResponseNDMinLength) {
+			Console::console.printfBroadcast("Expected >=%d bytes, found %d\n", APIFrame::ATResponseNDMinLength, length);
+		} else {
 			APIFrame::ATResponseND *r = (APIFrame::ATResponseND*)data;
 			Node n;
 			n.address = {r->addrHi, r->addrLo};
 			n.rssi = r->rssi;
 			memset(n.name, 0, sizeof(n.name));
 			if(length > APIFrame::ATResponseNDMinLength) {
-				strncpy(n.name, r->name, strlen(r->name));
+				memcpy(n.name, r->name, min(sizeof(n.name)-1, size_t(length - APIFrame::ATResponseNDMinLength)));
 			}
 
 			Console::console.printfBroadcast("Discovered station at address 0x%lx:%lx, RSSI %d, name \"%s\"\n", n.address.addrHi, n.address.addrLo, n.rssi, n.name);
 			nodes.push_back(n);	
 		}
+		parser_.pop();
 	}
 
 	return RES_OK;
@@ -650,10 +839,22 @@ bb::Result bb::XBee::sendToXBee3(const HWAddress& dest, const bb::Packet& packet
 	return send(frame);
 }
 
-bb::Result bb::XBee::sendToXBee(const HWAddress& dest, const bb::Packet& packet, bool ack) {
-	uint8_t buf[11+sizeof(packet)];
+bb::Result bb::XBee::sendTo(const HWAddress& dest, const Packet& packet, bool ack) {
+	if(packet.type == PACKET_TYPE_CONTROL || packet.type == PACKET_TYPE_STATE) {
+		PacketLink *link = linkFor(dest, false);
+		if(link != NULL && link->isSending()) return link->queue(packet);
+	}
+	return sendToXBee(dest, packet, ack);
+}
 
+bb::Result bb::XBee::sendToXBee(const HWAddress& dest, const bb::Packet& packet, bool ack) {
 	packet.crc = packet.calculateCRC();
+	return sendToXBee(dest, (const uint8_t*)&packet, sizeof(packet), ack);
+}
+
+bb::Result bb::XBee::sendToXBee(const HWAddress& dest, const uint8_t *bytes, size_t size, bool ack) {
+	uint8_t buf[11+PacketLink::MAX_FRAME_SIZE];
+	if(size > PacketLink::MAX_FRAME_SIZE) return RES_PACKET_TOO_LONG;
 
 	buf[0] = 0x0;  // transmit request - 64bit frame. This is deprecated.
 	buf[1] = 0x0;  // no response frame
@@ -676,12 +877,80 @@ bb::Result bb::XBee::sendToXBee(const HWAddress& dest, const bb::Packet& packet,
 		buf[10] = 0;						// Use default value of TO
 	}
 
-	memcpy(&(buf[11]), &packet, sizeof(packet));
+	memcpy(&(buf[11]), bytes, size);
 	
-	APIFrame frame(buf, 11+sizeof(packet));
+	APIFrame frame(buf, 11+size);
 	return send(frame);
 }
 
+bb::PacketLink* bb::XBee::linkFor(const HWAddress& peer, bool create) {
+	if(peer.isZero()) return NULL;
+	for(unsigned int i=0; i<MAX_LINKS; i++) {
+		if(links_[i].isUsed() && links_[i].peer() == peer) return &links_[i];
+	}
+	if(!create) return NULL;
+	for(unsigned int i=0; i<MAX_LINKS; i++) {
+		if(links_[i].isUsed()) continue;
+		links_[i].reset(peer);
+		return &links_[i];
+	}
+	// Full - take over a peer that only ever sent to us.
+	for(unsigned int i=0; i<MAX_LINKS; i++) {
+		if(links_[i].isSending()) continue;
+		links_[i].reset(peer);
+		return &links_[i];
+	}
+	return NULL;
+}
+
+bb::Result bb::XBee::setLinkMode(const HWAddress& peer, bool onoff) {
+	PacketLink *link = linkFor(peer, onoff);
+	if(link == NULL) return onoff ? RES_SUBSYS_RESOURCE_NOT_AVAILABLE : RES_OK;
+	if(link->isSending() == onoff) return RES_OK;
+
+	if(onoff && flushTask_ == Runloop::INVALID_TASK) {
+		flushTask_ = Runloop::runloop.addTask(NULL, "xbee_links", 1, []() { XBee::xbee.flushLinks(); });
+		if(flushTask_ == Runloop::INVALID_TASK) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+	}
+
+	link->setSending(onoff);
+	Console::console.printfBroadcast("XBee: Link mode to 0x%lx:%lx %s\n", peer.addrHi, peer.addrLo, onoff ? "on" : "off");
+	storeLinkPeers();
+	return RES_OK;
+}
+
+bool bb::XBee::linkMode(const HWAddress& peer) {
+	PacketLink *link = linkFor(peer, false);
+	return link != NULL && link->isSending();
+}
+
+void bb::XBee::storeLinkPeers() {
+	if(linkPeersHandle_ == 0) return; // not started yet; start() reads them back
+
+	LinkPeers peers;
+	memset(&peers, 0, sizeof(peers));
+	unsigned int n = 0;
+	for(unsigned int i=0; i<MAX_LINKS; i++) {
+		if(links_[i].isSending()) peers.peers[n++] = links_[i].peer();
+	}
+	if(memcmp(&peers, &linkPeers_, sizeof(peers)) == 0) return;
+
+	linkPeers_ = peers;
+	ConfigStorage::storage.writeBlock(linkPeersHandle_);
+	ConfigStorage::storage.commit();
+}
+
+void bb::XBee::flushLinks() {
+	if(!started_ || !apiMode_ || operationStatus_ != RES_OK) return;
+
+	uint8_t buf[PacketLink::MAX_FRAME_SIZE];
+	for(unsigned int i=0; i<MAX_LINKS; i++) {
+		if(!links_[i].isSending() || !links_[i].hasQueued()) continue;
+		size_t size = links_[i].encode(buf);
+		sendToXBee(links_[i].peer(), buf, size, false);
+	}
+}
+
 bb::Result bb::XBee::sendConfigPacket(const HWAddress& dest,  
                                       bb::PacketSource src, const ConfigPacket& cfg, ConfigPacket::ConfigReplyType& replyType,
 									  uint8_t seqnum, bool waitForReply) {
@@ -700,7 +969,7 @@ bb::Result bb::XBee::sendConfigPacket(const HWAddress& dest,
 
 	int timeout = 500;
 	while(true) {
-		while(uart_->available() == false) {
+		while(parser_.consume(uart_) == 0) {
 			timeout--;
 			delay(1);
 			if(timeout < 0) {
@@ -712,6 +981,7 @@ bb::Result bb::XBee::sendConfigPacket(const HWAddress& dest,
 		uint8_t rssi;
 		Packet rPacket;
 		Result res = receiveAPIMode(srcAddr, rssi, rPacket);
+		if(res == RES_SUBSYS_RESOURCE_NOT_AVAILABLE) continue; // link frame, already handed to the receivers
 		if(res != RES_OK) {
 			Console::console.printfBroadcast("sendConfigPacket(): receiveAPIMode(): %s\n", errorMessage(res));
 			return res;
@@ -739,6 +1009,11 @@ bb::Result bb::XBee::sendConfigPacket(const HWAddress& dest,
 bb::Result bb::XBee::sendPairingPacket(const HWAddress& dest, bb::PacketSource src, PairingPacket& pairing, uint8_t seqnum) {
 	bb::Packet sPacket(bb::PACKET_TYPE_PAIRING, src, seqnum);
 	sPacket.payload.pairing = pairing;
+	bool offerLink = pairing.type == PairingPacket::PAIRING_INFO_REQ && linkModeAllowed_;
+	if(pairing.type == PairingPacket::PAIRING_INFO_REQ) {
+		sPacket.payload.pairing.pairingPayload.info.linkCaps = offerLink ? PairingPacket::LINK_OFFER_V1 : PairingPacket::LINK_NONE;
+		sPacket.reserved = 1;
+	}
 
 	bb::printf("Sending pairing packet to 0x%lx:%lx\n", dest.addrHi, dest.addrLo);
 	Result res = sendTo(dest, sPacket, false);
@@ -749,7 +1024,7 @@ bb::Result bb::XBee::sendPairingPacket(const HWAddress& dest, bb::PacketSource s
 
 	int timeout = 500;
 	while(true) {
-		while(uart_->available() == false) {
+		while(parser_.consume(uart_) == 0) {
 			timeout--;
 			delay(1);
 			if(timeout < 0) {
@@ -761,6 +1036,7 @@ bb::Result bb::XBee::sendPairingPacket(const HWAddress& dest, bb::PacketSource s
 		uint8_t rssi;
 		Packet rPacket;
 		Result res = receiveAPIMode(srcAddr, rssi, rPacket);
+		if(res == RES_SUBSYS_RESOURCE_NOT_AVAILABLE) continue; // link frame, already handed to the receivers
 		if(res != RES_OK) {
 			bb::printf("sendPairingPacket(): receiveAPIMode(): %s\n", errorMessage(res));
 			return res;
@@ -781,6 +1057,10 @@ bb::Result bb::XBee::sendPairingPacket(const HWAddress& dest, bb::PacketSource s
 		}
 
 		pairing = rPacket.payload.pairing;
+		if(offerLink) {
+			setLinkMode(dest, pairing.reply == PairingPacket::PAIRING_OK && rPacket.reserved &&
+			                  pairing.pairingPayload.info.linkCaps == PairingPacket::LINK_ACCEPT_V1);
+		}
 		return RES_OK;
 	}
 }
@@ -796,7 +1076,7 @@ int bb::XBee::numFailedACKs() {
 bool bb::XBee::available() {
 	if(operationStatus_ != RES_OK) return false;
 	if(isInATMode()) leaveATMode();
-	return uart_->available();
+	return uart_->available() || parser_.numFrames() != 0;
 }
 
 String bb::XBee::receive() {
@@ -816,55 +1096,33 @@ bb::Result bb::XBee::receiveAPIMode(HWAddress& srcAddr, uint8_t& rssi, Packet& p
 		return RES_SUBSYS_WRONG_MODE;
 	} 
 
-	APIFrame frame;
-	Result retval;
-
-	retval = receive(frame);
-	if(retval != RES_OK) {
-		//bb::printf("receive(): %s\n", errorMessage(retval));
-		return retval;
-	}
+	if(parser_.consume(uart_) == 0) return RES_SUBSYS_COMM_ERROR;
 
-	//Console::console.printfBroadcast("Received frame of length %d, first char 0x%x\n", frame.length(), frame.data()[0]);
+	uint16_t length;
+	uint8_t *data = parser_.frame(length);
+	APIFrame frame(data, length);
 
-	if(frame.is16BitRXPacket()) { // 16bit address frame
-		bb::printf("16bit address packet!\n");
-		if(frame.length() != sizeof(bb::Packet) + 5) {
-			Console::console.printfBroadcast("Invalid API Mode 16bit addr packet size %d (expected %d)\n", frame.length(), sizeof(bb::Packet) + 5);
-			return RES_SUBSYS_COMM_ERROR;
-		}
-		srcAddr = {0, uint32_t(frame.data()[1] << 8) | frame.data()[2]};
-		rssi = frame.data()[3];
-		memcpy(&packet, &(frame.data()[5]), sizeof(packet));
-	} else if(frame.is64BitRXPacket()) { // 64bit address frame
-		if(frame.length() != sizeof(bb::Packet) + 11) {
-			Console::console.printfBroadcast("Invalid API Mode 64bit addr packet size %d (expected %d)\n", frame.length(), sizeof(bb::Packet) + 11);
-			return RES_SUBSYS_COMM_ERROR;
-		}
-		srcAddr.addrHi = (uint32_t(frame.data()[1]) << 24) | (uint32_t(frame.data()[2]) << 16) |
-				         (uint32_t(frame.data()[3]) <<  8) | uint32_t(frame.data()[4]);
-		srcAddr.addrLo = (uint32_t(frame.data()[5]) << 24) | (uint32_t(frame.data()[6]) << 16) |
-				         (uint32_t(frame.data()[7]) <<  8) | uint32_t(frame.data()[8]);
-		rssi = frame.data()[9];
-		memcpy(&packet, &(frame.data()[11]), sizeof(packet));
-#if 0
-		Console::console.printfBroadcast("Source addr: 0x%0lx:%0lx \n", srcAddr.addrHi, srcAddr.addrLo);
-		Console::console.printfBroadcast("Source: %d Type: %d Seqnum: %d\n", packet.source, packet.type, packet.seqnum);
-#endif
-	} else {
-		Console::console.printfBroadcast("Unknown frame type 0x%x\n", frame.data()[0]);
-		return RES_SUBSYS_COMM_ERROR;
+	const uint8_t *payload;
+	uint16_t payloadLength;
+	if(frame.unpackRXFrame(srcAddr, rssi, payload, payloadLength) == RES_OK && PacketLink::isLinkFrame(payload, payloadLength)) {
+		dispatchFrame(frame);
+		parser_.pop();
+		return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
 	}
 
-	uint8_t crc = packet.calculateCRC();
-	if(packet.calculateCRC() != packet.crc) {
+	Packet *p;
+	Result retval = frame.unpackRXPacket(srcAddr, rssi, p);
+	if(retval == RES_OK) {
+		memcpy(&packet, p, sizeof(packet));
+	} else if(retval == RES_PACKET_INVALID_PACKET) {
 		if(debug_ & DEBUG_XBEE_COMM) {
-			bb::printf("Error: Wrong CRC 0x%x, expected 0x%x\n", crc, packet.crc);
+			bb::printf("Error: Wrong CRC 0x%x, expected 0x%x\n", p->calculateCRC(), p->crc);
 		}
-		return RES_SUBSYS_COMM_ERROR;
+		retval = RES_SUBSYS_COMM_ERROR;
 	}
+	parser_.pop();
 
-	return RES_OK;
+	return retval;
 }
 
 String bb::XBee::sendStringAndWaitForResponse(const String& str, int predelay, bool cr) {
@@ -941,24 +1199,27 @@ bb::Result bb::XBee::sendAPIModeATCommand(uint8_t frameID, const char* cmd, uint
 	
 	if(send(frame) != RES_OK) return RES_SUBSYS_COMM_ERROR;
 
+	unsigned long start = millis();
 	bool received = false;
-	for(int i=0; i<10 && received == false; i++) {
-		if(uart_->available()) {
-			if(receive(frame) != RES_OK) return RES_SUBSYS_COMM_ERROR;
-			else if(!frame.isATResponse()) {
-				Console::console.printfBroadcast("Ignoring frame of type 0x%x while waiting for AT response\n", frame.data()[0]);
-				continue;
-			} 
-			received = true;
-		} else delay(1);
+	while(received == false && millis() - start < 10) {
+		if(waitForFrame(frame, 10 - (millis() - start)) != RES_OK) break;
+		if(!frame.isATResponse()) {
+			dispatchFrame(frame); // packets keep flowing while we wait
+			parser_.pop();
+			continue;
+		} 
+		received = true;
 	}
 	if(!received) {
 		Console::console.printfBroadcast("Timed out waiting for frame reply\n");
 		return RES_SUBSYS_COMM_ERROR;
 	}
 
-	uint16_t length = frame.length();
-	const uint8_t *data = frame.data();
+	// Copy out what we need so the parser slot can be released right away.
+	uint8_t data[5+sizeof(argument)];
+	uint16_t length = min(frame.length(), uint16_t(sizeof(data)));
+	memcpy(data, frame.data(), length);
+	parser_.pop();
 
 	Console::console.printfBroadcast("API reply (%d bytes): ", length);
 	for(unsigned int i=0; i<length; i++) Console::console.printfBroadcast("%x ", data[i]);
@@ -992,7 +1253,7 @@ bb::Result bb::XBee::sendAPIModeATCommand(uint8_t frameID, const char* cmd, uint
 
 	if(request) {
 		argument = 0;
-		for(unsigned int i=5; i<5+sizeof(argument)&&i<length; i++) {
+		for(unsigned int i=5; i<5+sizeof(argument) && i<length; i++) {
 			argument <<= 8;
 			argument |= data[i];
 		}
@@ -1000,155 +1261,30 @@ bb::Result bb::XBee::sendAPIModeATCommand(uint8_t frameID, const char* cmd, uint
 	return res;
 }
 
-static uint32_t total = 0;
-
-//#define MEMDEBUG
-
-static uint8_t *allocBlock(uint32_t size, const char *loc="unknown") {
-#if defined(MEMDEBUG)
-	bb::Console::console.printfBroadcast("Allocing block size %d from \"%s\"...", size, loc);
-#endif
-	uint8_t *block = new uint8_t[size];
-	total += size;
-#if defined(MEMDEBUG)
-	bb::Console::console.printfBroadcast("result: 0x%x, total %d.\n", block, total);
-#endif
-	return block;
-}
-
-static void freeBlock(uint8_t *block, uint32_t size, const char *loc="unknown") {
-	delete block;
-	total -= size;
-#if defined(MEMDEBUG)
-	bb::Console::console.printfBroadcast("Deleted block 0x%x, size %d, total %d from \"%s\"\n", block, size, total, loc);
-#endif
-}
-
-bb::XBee::APIFrame::APIFrame() {
-	data_ = NULL;
-	length_ = 0;
-	calcChecksum();
-}
-
-bb::XBee::APIFrame::APIFrame(const uint8_t *data, uint16_t length) {
-	//data_ = new uint8_t[length];
-	data_ = allocBlock(length, "APIFrame(const uint8_t*,uint16_t)");
-	length_ = length;
-	memcpy(data_, data, length);
-	calcChecksum();
-}
-
-bb::XBee::APIFrame::APIFrame(const bb::XBee::APIFrame& other) {
-	//Console::console.printfBroadcast("APIFrame 2\n");
-	if(other.data_ != NULL) {
-		length_ = other.length_;
-		data_ = allocBlock(length_, "APIFrame(const APIFrame&)");
-//		data_ = new uint8_t[length_];
-		memcpy(data_, other.data_, length_);
-	} else {
-		data_ = NULL;
-		length_ = 0;
-	}
-	checksum_ = other.checksum_;
-}
-
-bb::XBee::APIFrame::APIFrame(uint16_t length) {
-	//Console::console.printfBroadcast("APIFrame 1\n");
-	//data_ = new uint8_t[length];
-	data_ = allocBlock(length, "APIFrame(uint16_t)");
-	length_ = length;
-}
-
-bb::XBee::APIFrame& bb::XBee::APIFrame::operator=(const APIFrame& other) {
-	//Console::console.printfBroadcast("operator=\n");
-	if(other.data_ == NULL) {           	// they don't have data
-		if(data_ != NULL) {
-			freeBlock(data_, length_, "operator=(const APIFrame&) 1");
-			//delete data_; 	// ...but we do - delete
-		}
-		data_ = NULL;						// now we don't have data either
-		length_ = 0;
-	} else {  								// they do have data
-		if(data_ != NULL) {					// and so do we
-			if(length_ != other.length_) {	// but it's of a different size
-				//delete data_;				// reallocate
-				freeBlock(data_, length_, "operator=(const APIFrame&) 2");
-				length_ = other.length_;
-				//data_ = new uint8_t[length_];
-				data_ = allocBlock(length_, "operator=(const APIFrame&) 3");
-			}
-			memcpy(data_, other.data_, length_); // and copy
-		} else {							// and we don't
-			length_ = other.length_;		
-			//data_ = new uint8_t[length_];
-			data_ = allocBlock(length_, "operator=(const APIFrame&) 4");
-			memcpy(data_, other.data_, length_);
-		}
-	}
-	checksum_ = other.checksum_;
-
-	return *this;
-}
-
-bb::XBee::APIFrame::~APIFrame() {
-	if(data_ != NULL) {
-		//delete data_;
-		freeBlock(data_, length_, "~APIFrame");
-	}
-}
-
-void bb::XBee::APIFrame::calcChecksum() {
-	checksum_ = 0;
-	if(data_ != NULL) {
-		for(uint16_t i=0; i<length_; i++) {
-			checksum_ += data_[i];
-		}
-	}
-
-	checksum_ = 0xff - (checksum_ & 0xff);
-}
-
-bool bb::XBee::APIFrame::verifyChecksum(uint8_t checksum) {
-	uint16_t sum = checksum;
-	if(data_ != NULL) {
-		for(uint16_t i=0; i<length_; i++) {
-			sum += data_[i];
-		}
-	}
-	if((sum & 0xff) == 0xff) return true;
-	return false;
-}
-
-bb::XBee::APIFrame bb::XBee::APIFrame::atRequest(uint8_t frameID, uint16_t command) {
-	APIFrame frame(4);
-
-	frame.data_[0] = ATREQUEST; // local AT request
-	frame.data_[1] = frameID;
-	frame.data_[2] = (command>>8) & 0xff;
-	frame.data_[3] = command & 0xff;
-	frame.calcChecksum();
-
-	return frame;
+uint8_t bb::XBee::APIFrame::checksum() const {
+	uint8_t sum = 0;
+	for(uint16_t i=0; i<length_; i++) sum += data_[i];
+	return 0xff - sum;
 }
 
-bool bb::XBee::APIFrame::isATRequest() {
-	return data_[0] == ATREQUEST && length_ > 4;
+bool bb::XBee::APIFrame::isATRequest() const {
+	return length_ > 4 && data_[0] == ATREQUEST;
 }
 
-bool bb::XBee::APIFrame::isATResponse() {
-	return data_[0] == ATRESPONSE && length_ > 4;
+bool bb::XBee::APIFrame::isATResponse() const {
+	return length_ > 4 && data_[0] == ATRESPONSE;
 }
 
-bool bb::XBee::APIFrame::is16BitRXPacket() {
-	return data_[0] == RECEIVE16BIT && length_ > 5;
+bool bb::XBee::APIFrame::is16BitRXPacket() const {
+	return length_ > 5 && data_[0] == RECEIVE16BIT;
 }
 
-bool bb::XBee::APIFrame::is64BitRXPacket() {
-	return data_[0] == RECEIVE64BIT && length_ > 11;
+bool bb::XBee::APIFrame::is64BitRXPacket() const {
+	return length_ > 11 && data_[0] == RECEIVE64BIT;
 }
 
-bb::Result bb::XBee::APIFrame::unpackATResponse(uint8_t &frameID, uint16_t &command, uint8_t &status, uint8_t** data, uint16_t &length) {
-	if(data_[0] != ATRESPONSE) {
+bb::Result bb::XBee::APIFrame::unpackATResponse(uint8_t &frameID, uint16_t &command, uint8_t &status, uint8_t** data, uint16_t &length) const {
+	if(length_ == 0 || data_[0] != ATRESPONSE) {
 		return RES_SUBSYS_COMM_ERROR;
 	} 
 	if(length_ < 5) {
@@ -1171,6 +1307,42 @@ bb::Result bb::XBee::APIFrame::unpackATResponse(uint8_t &frameID, uint16_t &comm
 	return RES_OK;
 }
 
+bb::Result bb::XBee::APIFrame::unpackRXFrame(HWAddress& srcAddr, uint8_t& rssi, const uint8_t*& payload, uint16_t& length) const {
+	if(is16BitRXPacket()) { // 16bit address frame
+		if(length_ < 5) return RES_PACKET_TOO_SHORT;
+		srcAddr = {0, uint32_t(data_[1] << 8) | data_[2]};
+		rssi = data_[3];
+		payload = &(data_[5]);
+		length = length_ - 5;
+	} else if(is64BitRXPacket()) { // 64bit address frame
+		if(length_ < 11) return RES_PACKET_TOO_SHORT;
+		srcAddr.addrHi = (uint32_t(data_[1]) << 24) | (uint32_t(data_[2]) << 16) | (uint32_t(data_[3]) <<  8) | uint32_t(data_[4]);
+		srcAddr.addrLo = (uint32_t(data_[5]) << 24) | (uint32_t(data_[6]) << 16) | (uint32_t(data_[7]) <<  8) | uint32_t(data_[8]);
+		rssi = data_[9];
+		payload = &(data_[11]);
+		length = length_ - 11;
+	} else {
+		return RES_SUBSYS_COMM_ERROR;
+	}
+	return RES_OK;
+}
+
+bb::Result bb::XBee::APIFrame::unpackRXPacket(HWAddress& srcAddr, uint8_t& rssi, Packet*& packet) const {
+	const uint8_t *payload;
+	uint16_t length;
+	Result retval = unpackRXFrame(srcAddr, rssi, payload, length);
+	if(retval != RES_OK) return retval == RES_PACKET_TOO_SHORT ? RES_SUBSYS_COMM_ERROR : retval;
+
+	if(length != sizeof(bb::Packet)) {
+		Console::console.printfBroadcast("Invalid API Mode %s addr packet size %d (expected %d)\n", is16BitRXPacket() ? "16bit" : "64bit", length, sizeof(bb::Packet));
+		return RES_SUBSYS_COMM_ERROR;
+	}
+	packet = (Packet*)payload;
+
+	if(packet->calculateCRC() != packet->crc) return RES_PACKET_INVALID_PACKET;
+	return RES_OK;
+}
+
 static inline int writeEscapedByte(HardwareSerial* uart, uint8_t byte) {
 	int sent = 0;
 	if(byte == 0x7d || byte == 0x7e || byte == 0x11 || byte == 0x13) {
@@ -1182,12 +1354,6 @@ static inline int writeEscapedByte(HardwareSerial* uart, uint8_t byte) {
 	return sent;
 }
 
-static inline uint8_t readEscapedByte(HardwareSerial* uart) {
-	uint8_t byte = uart->read();
-	if(byte != 0x7d) return byte;
-	return (uart->read()^0x20);
-}
-
 bb::Result bb::XBee::send(const APIFrame& frame) {
 	if(apiMode_ == false) return RES_SUBSYS_WRONG_MODE;
 	
@@ -1219,65 +1385,15 @@ bb::Result bb::XBee::send(const APIFrame& frame) {
 }
 
 
-static bool waitfor(std::function<bool(void)> fn, uint8_t timeout) {
-	while(fn() == false && timeout>0) {
-		delayMicroseconds(1);
-		timeout = timeout - 1;
-	}
-	//bb::printf("remaining: %d\n", timeout);
-	if(timeout > 0) return true;
-	return false;
-}
-
-bb::Result bb::XBee::receive(APIFrame& frame) {
-	uint8_t byte = 0xff;
-
-	while(uart_->available()) {
-		byte = uart_->read();
-		if(byte == 0x7e) {
-			break;
-		} else {
-			// Console::console.printfBroadcast("Read garbage '%c' 0x%x\n", byte, byte);
-		}
-	}
-	if(byte != 0x7e) {
-		return RES_SUBSYS_COMM_ERROR;
-	}
-//	Console::console.printfBroadcast("Start delimiter found\n");
-
-	//if(!uart_->available()) delayMicroseconds(200);
-	//if(!uart_->available()) return RES_SUBSYS_COMM_ERROR;	
-	if(waitfor([this]()->bool {return uart_->available();}, 200) == false) return RES_SUBSYS_COMM_ERROR;
-	uint8_t lengthMSB = readEscapedByte(uart_);
-	if(waitfor([this]()->bool {return uart_->available();}, 200) == false) return RES_SUBSYS_COMM_ERROR;
-	//if(!uart_->available()) delayMicroseconds(200);
-	//if(!uart_->available()) return RES_SUBSYS_COMM_ERROR;	
-	uint8_t lengthLSB = readEscapedByte(uart_);
-
-	if(lengthLSB == 0x7e || lengthMSB == 0x7e) {
-		Console::console.printfBroadcast("Extra start delimiter found\n");
-		return RES_SUBSYS_COMM_ERROR;		
-	}
-
-	uint16_t length = (lengthMSB << 8) | lengthLSB;
-	frame = APIFrame(length);
-	uint8_t *buf = frame.data();
-	for(uint16_t i=0; i<length; i++) {
-		//Console::console.printfBroadcast("Reading byte %d of %d\n", i, length);
-		if(waitfor([this]()->bool {return uart_->available();}, 200) == false) return RES_SUBSYS_COMM_ERROR;
-		//if(!uart_->available()) delayMicroseconds(200);
-		buf[i] = readEscapedByte(uart_);
-	}
-	frame.calcChecksum();
-
-	if(waitfor([this]()->bool {return uart_->available();}, 200) == false) return RES_SUBSYS_COMM_ERROR;
-	//if(!uart_->available()) delayMicroseconds(200);
-	uint8_t checksum = readEscapedByte(uart_);
-
-	if(frame.verifyChecksum(checksum) == false) {
-		//Console::console.printfBroadcast("Checksum invalid - expected 0x%x, got 0x%x\n", frame.checksum(), checksum);
-		return RES_SUBSYS_COMM_ERROR;
+bb::Result bb::XBee::waitForFrame(APIFrame& frame, int timeout) {
+	unsigned long start = millis();
+	while(parser_.consume(uart_) == 0) {
+		if(int(millis() - start) >= timeout) return RES_COMM_TIMEOUT;
+		delay(1);
 	}
 
+	uint16_t length;
+	uint8_t *data = parser_.frame(length);
+	frame = APIFrame(data, length);
 	return RES_OK;
-}
\ No newline at end of file
+}
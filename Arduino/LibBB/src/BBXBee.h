@@ -5,7 +5,10 @@
 #include <vector>
 #include "BBSubsystem.h"
 #include "BBConfigStorage.h"
+#include "BBRunloop.h"
 #include "BBPacket.h"
+#include "BBXBeeFrameParser.h"
+#include "BBPacketLink.h"
 
 #define DEFAULT_CHAN    0x15   // Best channels for non-overlap with Wifi: 0x0d, 0x13, 0x19
 #define DEFAULT_PAN     0x3332
@@ -49,9 +52,16 @@ public:
 
 	HWAddress hwAddress() { return hwAddress_; }
 
+	// Starts bringing up the XBee. The AT command sequence (rate detection, address and firmware query, configuration,
+	// API mode) runs in the background from stepIfNotStarted(), so start() returns right away and isStarted() becomes
+	// true once the sequence has finished. The rate and configuration are cached in ConfigStorage, so a warm boot
+	// skips rate detection and, if nothing has changed, the configuration as well. How the startup begins is printed to
+	// stream (broadcast if NULL); how it ends is broadcast, as start() has returned by then.
 	virtual Result start(ConsoleStream *stream = NULL);
 	virtual Result stop(ConsoleStream *stream = NULL);
 	virtual Result step();
+	virtual Result stepIfNotStarted();
+	bool isStarting() { return startupState_ != STARTUP_IDLE; }
 	virtual Result parameterValue(const String& name, String& value);
 	virtual Result setParameterValue(const String& name, const String& value);
 	virtual Result initialize(uint8_t chan, uint16_t pan, uint32_t bps, HardwareSerial *uart=&Serial1);
@@ -88,11 +98,13 @@ public:
 	Result send(const Packet& packet);
 
 	//! Send a packet to the given 64bit HW address. Uses sendToXBee(), not sendtoXBee3(), because the latter is not supported by all firmwares.
-	Result sendTo(const HWAddress& dest, const Packet& packet, bool ack) { return sendToXBee(dest, packet, ack); }
+	//! Control and state packets to peers in link mode are queued instead, and go out batched in flushLinks().
+	Result sendTo(const HWAddress& dest, const Packet& packet, bool ack);
 	//! Send using the newer 0x10 instruction, which is not supported by older firmwares
 	Result sendToXBee3(const HWAddress& dest, const Packet& packet, bool ack);
 	//! Send using the old 0x00 instruction, deprecated but still supported by all firmwares
 	Result sendToXBee(const HWAddress& dest, const Packet& packet, bool ack);
+	Result sendToXBee(const HWAddress& dest, const uint8_t *bytes, size_t size, bool ack);
 	Result sendConfigPacket(const HWAddress& dest, bb::PacketSource src, const ConfigPacket& packet, ConfigPacket::ConfigReplyType& replyType,
 	                        uint8_t seqnum, bool waitForReply = true);
 	Result sendPairingPacket(const HWAddress& dest, bb::PacketSource src, PairingPacket& packet, uint8_t seqnum);
@@ -100,8 +112,21 @@ public:
 	
 	bool available();
 	String receive();
+	//! Copies the next received packet into packet. Only for waiting on replies; step() hands packets to the receivers without copying.
+	//! Link frames hold more than one packet; they go to the receivers instead, and RES_SUBSYS_RESOURCE_NOT_AVAILABLE is returned.
 	Result receiveAPIMode(HWAddress& src, uint8_t& rssi, Packet& packet);
 
+	// Link mode: control and state packets to and from a peer are batched into one delta encoded frame per cycle
+	// (see PacketLink). Peers agree on it during pairing, and only if both sides allow it. Off by default.
+	void setLinkModeAllowed(bool allowed) { linkModeAllowed_ = allowed; }
+	bool linkModeAllowed() { return linkModeAllowed_; }
+	Result setLinkMode(const HWAddress& peer, bool onoff);
+	bool linkMode(const HWAddress& peer);
+	//! Sends whatever has been queued for peers in link mode. Runs as a runloop task, after all subsystems have stepped.
+	void flushLinks();
+
+	const XBeeFrameParser& frameParser() const { return parser_; }
+
 	typedef enum {
 		DEBUG_SILENT = 0,
 		DEBUG_PROTOCOL   = 0x01,
@@ -133,32 +158,93 @@ protected:
 	ConfigStorage::HANDLE paramsHandle_;
 	std::vector<PacketReceiver*> receivers_;
 
-	uint8_t packetBuf_[255];
-	size_t packetBufPos_;
+	XBeeFrameParser parser_;
+
+	static const unsigned int MAX_LINKS = 4;
+	PacketLink links_[MAX_LINKS];
+	bool linkModeAllowed_;
+	Runloop::TaskID flushTask_;
+	// Peers we send to in link mode, so that it survives a reboot - pairing only happens once. Reserved in start(),
+	// like the startup cache.
+	struct LinkPeers {
+		HWAddress peers[MAX_LINKS];
+	};
+	LinkPeers linkPeers_;
+	ConfigStorage::HANDLE linkPeersHandle_;
+
+	//! Returns the link for the peer. If there is none and create is true, takes a free slot, or one we don't send to.
+	PacketLink* linkFor(const HWAddress& peer, bool create);
+	void storeLinkPeers();
+
+	// Startup state machine, see start().
+	static const uint16_t DEFAULT_GUARD_TIME = 1000; // ms, factory setting of ATGT
+	static const uint16_t STARTUP_GUARD_TIME = 100;  // ms, what we set ATGT to
+	static const unsigned long AT_RESPONSE_TIMEOUT = 1000; // ms
+
+	enum StartupState {
+		STARTUP_IDLE,
+		STARTUP_OPEN,     // serial open at a candidate rate, keeping quiet for the guard time before "+++"
+		STARTUP_ENTER_AT, // "+++" sent, waiting for "OK"
+		STARTUP_COMMAND,  // AT command sent, waiting for the response
+		STARTUP_REOPEN    // left AT mode after changing the rate, reopen serial at the new rate
+	};
 
+	// In the order they are sent on a cold boot. nextStartupCommand() skips what is not needed.
+	enum StartupCommand {
+		CMD_SH, CMD_SL, CMD_VR, CMD_CT, CMD_MM, CMD_RR,
+		CMD_CH, CMD_ID, CMD_MY, CMD_READ_CH, CMD_READ_ID, CMD_NI, CMD_NT, CMD_GT, CMD_BD, CMD_WR,
+		CMD_LEAVE_FOR_BD, CMD_AP, CMD_CN
+	};
+
+	// What the module was last brought up with. Reserved in start(), after all subsystems have reserved their
+	// parameter blocks, so that it does not move theirs around.
+	struct StartupCache {
+		int bps;
+		uint32_t addrHi, addrLo;
+		uint16_t guardTime;
+		XBeeParams params;
+	};
+	StartupCache cache_;
+	ConfigStorage::HANDLE cacheHandle_;
+
+	StartupState startupState_;
+	StartupCommand startupCmd_;
+	bool warmBoot_, reconfigure_;
+	unsigned int bpsIndex_;
+	int startupBPS_;
+	uint16_t guardTime_;
+	unsigned long startupStart_, startupDeadline_;
+	char atResponse_[32];
+	uint8_t atResponseLen_;
+
+	void stepStartup();
+	void openSerialForStartup(int bps, uint16_t guardTime);
+	void sendStartupCommand(StartupCommand cmd);
+	StartupCommand nextStartupCommand(StartupCommand cmd);
+	bool handleStartupResponse(StartupCommand cmd);
+	void startupFailed(Result res);
+	void startupFinished();
+
+	enum ATPoll { AT_PENDING, AT_RESPONSE, AT_TIMEOUT };
+	// Collects a '\r' terminated response into atResponse_ without blocking.
+	ATPoll pollATResponse();
+
+	// View onto the data of an API frame (without delimiter, length and checksum) that lives somewhere else - in
+	// a local buffer when sending, in the frame parser when receiving. Copying it never copies the data.
 	class APIFrame {
 	public:
-		APIFrame();
-		APIFrame(const uint8_t *data, uint16_t dataLength);
-		APIFrame(uint16_t length);
-		APIFrame(const APIFrame& frame);
-		~APIFrame();
-
-		APIFrame& operator=(const APIFrame& frame);
-		
-		virtual uint8_t *data() const { return data_; }
-		virtual uint16_t length() const { return length_; }
-		virtual uint8_t checksum() const { return checksum_; }
-
-		void calcChecksum();
-		bool verifyChecksum(uint8_t checksum);
-
-		static APIFrame atRequest(uint8_t frameID, uint16_t command);
-		bool isATRequest();
-		bool isATResponse();
-		bool is16BitRXPacket();
-		bool is64BitRXPacket();
-		bool isRXPacket() { return is16BitRXPacket() || is64BitRXPacket(); }
+		APIFrame(): data_(NULL), length_(0) {}
+		APIFrame(uint8_t *data, uint16_t length): data_(data), length_(length) {}
+
+		uint8_t *data() const { return data_; }
+		uint16_t length() const { return length_; }
+		uint8_t checksum() const;
+
+		bool isATRequest() const;
+		bool isATResponse() const;
+		bool is16BitRXPacket() const;
+		bool is64BitRXPacket() const;
+		bool isRXPacket() const { return is16BitRXPacket() || is64BitRXPacket(); }
 
 		enum Type {
 			TRANSMITLEGACY  = 0x00,
@@ -171,7 +257,11 @@ protected:
 
 
 
-		Result unpackATResponse(uint8_t &frameID, uint16_t &command, uint8_t &status, uint8_t** data, uint16_t &length);
+		Result unpackATResponse(uint8_t &frameID, uint16_t &command, uint8_t &status, uint8_t** data, uint16_t &length) const;
+		//! Points payload at the RF data inside an RX frame.
+		Result unpackRXFrame(HWAddress& src, uint8_t& rssi, const uint8_t*& payload, uint16_t& length) const;
+		//! Points packet at the packet inside an RX frame - Packet is packed, so this works at any alignment. Checks the CRC.
+		Result unpackRXPacket(HWAddress& src, uint8_t& rssi, Packet*& packet) const;
 
 		class __attribute__ ((packed)) EndianInt16 {
 			uint16_t value;
@@ -207,7 +297,6 @@ protected:
 	protected:
 		uint8_t *data_;
 		uint16_t length_;
-		uint8_t checksum_;
 	};
 
 	String sendStringAndWaitForResponse(const String& str, int predelay=0, bool cr=true);
@@ -215,7 +304,10 @@ protected:
 	bool readString(String& str, unsigned char terminator='\r');
 
 	Result send(const APIFrame& frame);
-	Result receive(APIFrame& frame);
+	//! Waits up to timeout ms for the next API frame. The frame stays valid until parser_.pop().
+	Result waitForFrame(APIFrame& frame, int timeout);
+	//! Hands an RX packet frame to all receivers, in place.
+	Result dispatchFrame(const APIFrame& frame);
 };
 
 };
@@ -0,0 +1,98 @@
+#include "BBXBeeFrameParser.h"
+
+bb::XBeeFrameParser::XBeeFrameParser() {
+	reset();
+}
+
+void bb::XBeeFrameParser::reset() {
+	head_ = 0;
+	count_ = 0;
+	state_ = STATE_IDLE;
+	escaped_ = false;
+	length_ = 0;
+	pos_ = 0;
+	sum_ = 0;
+	framesReceived_ = 0;
+	checksumErrors_ = 0;
+	droppedFrames_ = 0;
+}
+
+bool bb::XBeeFrameParser::consume(uint8_t byte) {
+	if(byte == START_DELIMITER) {
+		if(state_ != STATE_IDLE) droppedFrames_++;
+		state_ = STATE_LENGTH_MSB;
+		escaped_ = false;
+		return false;
+	}
+	if(state_ == STATE_IDLE) return false; // garbage between frames
+
+	if(byte == ESCAPE) {
+		escaped_ = true;
+		return false;
+	}
+	if(escaped_) {
+		byte ^= 0x20;
+		escaped_ = false;
+	}
+
+	switch(state_) {
+	case STATE_LENGTH_MSB:
+		length_ = uint16_t(byte) << 8;
+		state_ = STATE_LENGTH_LSB;
+		break;
+
+	case STATE_LENGTH_LSB:
+		length_ |= byte;
+		if(length_ == 0 || length_ > MAX_FRAME_LENGTH || count_ >= NUM_FRAMES) {
+			droppedFrames_++;
+			state_ = STATE_IDLE;
+			break;
+		}
+		pos_ = 0;
+		sum_ = 0;
+		state_ = STATE_DATA;
+		break;
+
+	case STATE_DATA:
+		slots_[(head_ + count_) % NUM_FRAMES][pos_++] = byte;
+		sum_ += byte;
+		if(pos_ == length_) state_ = STATE_CHECKSUM;
+		break;
+
+	case STATE_CHECKSUM:
+		state_ = STATE_IDLE;
+		if(uint8_t(sum_ + byte) != 0xff) {
+			checksumErrors_++;
+			break;
+		}
+		lengths_[(head_ + count_) % NUM_FRAMES] = length_;
+		count_++;
+		framesReceived_++;
+		return true;
+
+	default:
+		state_ = STATE_IDLE;
+		break;
+	}
+
+	return false;
+}
+
+unsigned int bb::XBeeFrameParser::consume(HardwareSerial* uart) {
+	while(count_ < NUM_FRAMES && uart->available()) {
+		consume(uint8_t(uart->read()));
+	}
+	return count_;
+}
+
+uint8_t* bb::XBeeFrameParser::frame(uint16_t& length) {
+	if(count_ == 0) return NULL;
+	length = lengths_[head_];
+	return slots_[head_];
+}
+
+void bb::XBeeFrameParser::pop() {
+	if(count_ == 0) return;
+	head_ = (head_ + 1) % NUM_FRAMES;
+	count_--;
+}
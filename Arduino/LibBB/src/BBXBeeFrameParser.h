@@ -0,0 +1,68 @@
+#if !defined(BBXBEEFRAMEPARSER_H)
+#define BBXBEEFRAMEPARSER_H
+
+#include <Arduino.h>
+#include <stdint.h>
+
+namespace bb {
+
+/*!
+	\brief Incremental, non-blocking parser for XBee API mode (AP=2, escaped) frames.
+
+	Bytes are fed in as they arrive, unescaped and checksummed on the fly, and written straight into one of
+	NUM_FRAMES fixed slots. Complete, valid frames are queued in arrival order and can be looked at in place
+	via frame() until they are released with pop() - no copies, no allocation. A partial frame simply stays in
+	its slot until the rest of it arrives. A start delimiter always starts a new frame, so the parser
+	resynchronizes by itself after garbage or lost bytes.
+*/
+class XBeeFrameParser {
+public:
+	static const uint16_t MAX_FRAME_LENGTH = 128; // enough for 100 bytes of RF payload plus the largest RX header
+	static const unsigned int NUM_FRAMES = 4;
+
+	static const uint8_t START_DELIMITER = 0x7e;
+	static const uint8_t ESCAPE = 0x7d;
+
+	XBeeFrameParser();
+	void reset();
+
+	//! Feed a single byte. Returns true if it completed a valid frame.
+	bool consume(uint8_t byte);
+	//! Read from uart without blocking, as long as there is room for another frame. Returns the number of queued frames.
+	unsigned int consume(HardwareSerial* uart);
+
+	unsigned int numFrames() const { return count_; }
+	//! Oldest complete frame (frame data without delimiter, length and checksum), or NULL. Valid until pop().
+	uint8_t* frame(uint16_t& length);
+	//! Release the oldest complete frame.
+	void pop();
+
+	unsigned long framesReceived() const { return framesReceived_; }
+	unsigned long checksumErrors() const { return checksumErrors_; }
+	//! Frames that were too long, truncated by a new start delimiter, or arrived while all slots were full.
+	unsigned long droppedFrames() const { return droppedFrames_; }
+
+protected:
+	enum State {
+		STATE_IDLE,
+		STATE_LENGTH_MSB,
+		STATE_LENGTH_LSB,
+		STATE_DATA,
+		STATE_CHECKSUM
+	};
+
+	uint8_t slots_[NUM_FRAMES][MAX_FRAME_LENGTH];
+	uint16_t lengths_[NUM_FRAMES];
+	unsigned int head_, count_;
+
+	State state_;
+	bool escaped_;
+	uint16_t length_, pos_;
+	uint8_t sum_;
+
+	unsigned long framesReceived_, checksumErrors_, droppedFrames_;
+};
+
+};
+
+#endif // BBXBEEFRAMEPARSER_H
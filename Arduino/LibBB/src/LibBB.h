@@ -6,17 +6,35 @@
 
 #include "BBSubsystem.h"
 #include "BBXBee.h"
-#include "BBWifiServer.h"
+#include "BBXBeeFrameParser.h"
+#include "BBPacketLink.h"
 #include "BBConsole.h"
 #include "BBRunloop.h"
+#include "BBTimerWheel.h"
 #include "BBConfigStorage.h"
 #include "BBControllers.h"
+#include "BBControlGraph.h"
+#include "BBFixedPoint.h"
+#include "BBStaticPIDController.h"
 #include "BBLowPassFilter.h"
+#include "BBFilterBank.h"
+#include "BBVelocityProfile.h"
+#include "BBTrajectory.h"
+#include "BBQuaternion.h"
+#include "BBAttitudeEstimator.h"
+#include "BBIMUCalibration.h"
+#include "BBRotation.h"
+#include "BBLinAlg.h"
 #include "BBDCMotor.h"
-#include "BBIMU.h"
+#include "BBServoBus.h"
 #include "BBServos.h"
+
+// The host build (see Utilities/HostBench) has no drivers for the hardware below.
+#if !defined(ARDUINO_ARCH_HOST)
+#include "BBWifiServer.h"
+#include "BBIMU.h"
 #include "BBEncoder.h"
-#include "BBLinAlg.h"
+#endif
 
 // A couple of convenience macros
 #define WRAPPEDDIFF(a, b, max) ((a>=b) ? a-b : (max-b)+a)
@@ -53,6 +53,8 @@ public:
   Result stepPowerProtect();
   Result stepDrive();
   Result stepHead();
+  Result stepStatus();
+  bool hardwareAvailable();
 
   virtual String statusLine();
   virtual void printExtendedStatus(ConsoleStream *stream = NULL);
@@ -227,6 +227,41 @@ Result DODroid::initialize(Uart* remoteUart) {
 
   receiver_->setDataFinishedCallback([this](const NodeAddr& addr, uint8_t seqnum) { dataFinishedCB(addr, seqnum); });
 
+  // Tasks run right after step(), with the runloop spreading them over cycles. Periods are in cycles at the
+  // default 100Hz: head and drive at 50Hz on alternating cycles, status at 25Hz, power protect at 1Hz.
+  // Status and power have no owner, so they also run before start() - telemetry and battery readings are
+  // wanted then, too - and look for themselves whether D-O is running.
+  // SD card check and status pixel updates can wait, so they only run in the slack at the end of a cycle.
+  Runloop::runloop.addTask(this, "head", 2, [this]() { if(hardwareAvailable()) stepHead(); });
+  Runloop::runloop.addTask(this, "drive", 2, [this]() {
+    if(!hardwareAvailable()) return;
+    stepDrive();
+    updateHead();
+  });
+  Runloop::runloop.addTask(NULL, "status", 4, [this]() {
+    if(isStarted() && operationStatus() == RES_OK) stepStatus();
+    else sendTelemetry();
+  });
+  Runloop::runloop.addTask(NULL, "power", 100, [this]() {
+    if(!isStarted() || operationStatus() != RES_OK) {
+      if(!DOBattStatus::batt.available()) return;
+      DOBattStatus::batt.updateVoltage();
+      DOBattStatus::batt.updateCurrent();
+      return;
+    }
+    // Look for battery undervoltage
+    if(!hardwareAvailable()) return;
+    Runloop::runloop.excuseOverrun();
+    stepPowerProtect();
+  });
+  Runloop::runloop.addBackgroundTask(this, "sdcard", 1000000, [this]() {
+    // Check if SD card was changed
+    if(!hardwareAvailable() || driveMode_ != DRIVE_OFF) return;
+    Runloop::runloop.excuseOverrun(); // usually longer than a cycle, so it may have to run without fitting into the slack
+    DOSound::sound.checkSDCard();
+  });
+  Runloop::runloop.addBackgroundTask(this, "pixels", 0, [this]() { if(hardwareAvailable()) statusPixels_.show(); });
+
   return Subsystem::initialize();
 }
 
@@ -327,14 +362,8 @@ void DODroid::setControlParameters() {
 Result DODroid::step() {
   protocol_.step();
 
-  unsigned long seqnum = Runloop::runloop.getSequenceNumber();
-  static unsigned long lastSDCardCheck = millis();
-
-  // We're broken; still send out the state packet.
-  if(!imu_.available() || !DOBattStatus::batt.available()) {
-    if((seqnum % 4) == 0) {
-      sendTelemetry();
-    }
+  // We're broken; the status task still sends out the state packet.
+  if(!hardwareAvailable()) {
     if(!imu_.available()) {
       LOG(LOG_FATAL, "IMU missing - critical error\n");
       leftMotor_.set(0);
@@ -349,42 +378,28 @@ Result DODroid::step() {
     return RES_SUBSYS_HW_DEPENDENCY_MISSING;
   }
 
-  // Look for battery undervoltage
-  if((Runloop::runloop.getSequenceNumber() % 100) == 0) {
-    Runloop::runloop.excuseOverrun();
-    stepPowerProtect();
-  }
-
-  // Check if SD card was changed
-  if(WRAPPEDDIFF(millis(), lastSDCardCheck, ULONG_MAX) > 1000 && driveMode_ == DRIVE_OFF) {
-    Runloop::runloop.excuseOverrun();
-    DOSound::sound.checkSDCard();
-    lastSDCardCheck = millis();
-  }
-
-  // Encoder and IMU updates are needed for everything, so we do them here.
+  // Encoder and IMU updates are needed for everything, so we do them here. Everything else runs at lower rates
+  // as runloop tasks, see initialize().
   leftEncoder_.update();  
-  rightEncoder_.update();  
+  rightEncoder_.update();
   imu_.update();
+  // The balance controller doesn't update its input itself (setAutoUpdate(false)), and present() only returns what
+  // the last sample took, so take it once per cycle here, before stepDrive() reads it.
+  balanceInput_.sample();
 
-  // We only run head and drive control at 50Hz
-  if((seqnum % 2) == 0) {
-    stepHead();
-  } else {
-    // stepDrive() takes less time than stepHead()
-    stepDrive();
-    updateHead();
-  }
-
-  if((seqnum % 4) == 0) {
-    sendTelemetry();
-    DOSound::sound.setVolume(remVol_*30);
-    if(Servos::servos.isStarted()) setLED(LED_STATUS, GREEN, false);
-    else setLED(LED_STATUS, YELLOW, false);
-  }
+  return RES_OK;
+}
 
-  statusPixels_.show();
+bool DODroid::hardwareAvailable() {
+  return imu_.available() && DOBattStatus::batt.available();
+}
 
+Result DODroid::stepStatus() {
+  sendTelemetry();
+  if(!hardwareAvailable()) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+  DOSound::sound.setVolume(remVol_*30);
+  if(Servos::servos.isStarted()) setLED(LED_STATUS, GREEN, false);
+  else setLED(LED_STATUS, YELLOW, false);
   return RES_OK;
 }
 
@@ -533,15 +548,6 @@ bb::Result DODroid::stepIfNotStarted() {
   if(imu_.available()) imu_.update();
   leftEncoder_.update();
   rightEncoder_.update();
-  if((Runloop::runloop.getSequenceNumber() % 4) == 0) {
-    sendTelemetry();
-  }
-  if((Runloop::runloop.getSequenceNumber() % 100) == 0 && DOBattStatus::batt.available()) {
-    DOBattStatus::batt.updateVoltage();
-    DOBattStatus::batt.updateCurrent();
-    bb::printf("Current: %f\n", DOBattStatus::batt.current());
-  }
-
   statusPixels_.show();
 
   return RES_OK;
@@ -286,7 +286,7 @@ DODroid::MotorStatus DODroid::singleMotorTest(bb::DCMotor& mot, bb::Encoder& enc
   imu_.update();
   imu_.getFilteredPRH(p, r, h0);
 
-  unsigned long microsPerLoop = (unsigned long)(1e6 / imu_.dataRate());
+  unsigned long microsPerLoop = Runloop::runloop.cycleTimeMicros();
 
   DOBattStatus::batt.updateCurrent();
   DOBattStatus::batt.updateVoltage();
@@ -110,9 +110,7 @@ Input::ButtonPin Input::buttonToPin(Input::Button button) {
 bool Input::initIMU() {
   for(auto addr: IMU_ADDRESSES) {
     if(imu_.begin(addr) == true) {
-      float dr = imu_.dataRate();
-      Console::console.printfBroadcast("Successfully initialized IMU; data rate: %f\n", dr);
-      Runloop::runloop.setCycleTimeMicros(1e6/dr);
+      Console::console.printfBroadcast("Successfully initialized IMU; data rate: %f\n", imu_.dataRate());
       return true;
     }
   }
@@ -112,9 +112,8 @@ RInput::ButtonPin RInput::buttonToPin(RInput::Button button) {
 bool RInput::initIMU() {
   for(uint8_t addr: IMU_ADDRESSES) {
     if(imu_.begin(addr) == true) {
-      float dr = imu_.dataRate();
-      Console::console.printfBroadcast("Successfully initialized IMU; data rate: %f\n", dr);
-      Runloop::runloop.setCycleTimeMicros(1e6/dr);
+      Console::console.printfBroadcast("Successfully initialized IMU; data rate: %f\n", imu_.dataRate());
+      imu_.setCalibrationStorage();
       return true;
     }
   }
@@ -214,9 +213,8 @@ void RInput::testMatrix() {
   Console::console.printfBroadcast("Testing eulerToRot() and rotToEuler\n");
   r = 45; p = -45; h = 10;
   Console::console.printfBroadcast("In: r: %f p: %f h: %f\n", r, p, h);
-  BLA::Matrix<3,3> R1 = eulerToRot(r, p, h);
-  R1.printTo(Serial);
-  Serial.println();
+  RotationMatrix R1 = eulerToRot(r, p, h);
+  for(int i=0; i<3; i++) Console::console.printfBroadcast("%f %f %f\n", R1.m[i][0], R1.m[i][1], R1.m[i][2]);
   r1 = 0; p1 = 0; h1 = 0;
   rotToEuler(R1, r1, p1, h1);
   Console::console.printfBroadcast("Out: r: %f p: %f h: %f\n", r1, p1, h1);
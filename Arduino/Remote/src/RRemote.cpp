@@ -399,7 +399,9 @@ bb::Result RRemote::fillAndSend() {
 
   // both remotes send to droid (unless we're calibrating)
   if(!params_.droidAddress.isZero() && mode_ == MODE_REGULAR) {
-    for(int i=0; i<params_.config.sendRepeats+1; i++) {
+    // In link mode the packet is only queued, and the link takes care of loss itself - no point repeating.
+    int repeats = bb::XBee::xbee.linkMode(params_.droidAddress) ? 0 : params_.config.sendRepeats;
+    for(int i=0; i<repeats+1; i++) {
       delayMicroseconds(random(100));
       res = bb::XBee::xbee.sendTo(params_.droidAddress, packet, false);
     }
@@ -77,6 +77,7 @@ void setup() {
 
   Serial1.setPins(pins.P_D_XBEE_RX, pins.P_D_XBEE_TX);
   XBee::xbee.initialize(DEFAULT_CHAN, DEFAULT_PAN, 230400, &Serial1);
+  XBee::xbee.setLinkModeAllowed(true);
 
   XBee::xbee.start();
   XBee::xbee.setAPIMode(true);
@@ -0,0 +1,28 @@
+#if !defined(HOSTSIM_EEPROM_H)
+#define HOSTSIM_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// EEPROM emulation backed by a file, in the style of the RP2040 core's EEPROM class (begin() / commit()).
+// The file name is taken from the LIBBB_EEPROM_FILE environment variable and defaults to "eeprom.bin".
+class EEPROMClass {
+public:
+	void begin(size_t size);
+	void end() { commit(); }
+
+	uint8_t read(int address) const;
+	void write(int address, uint8_t value);
+	void update(int address, uint8_t value) { if(read(address) != value) write(address, value); }
+	bool commit();
+	size_t length() const { return data_.size(); }
+
+protected:
+	std::vector<uint8_t> data_;
+	bool dirty_ = false;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // HOSTSIM_EEPROM_H
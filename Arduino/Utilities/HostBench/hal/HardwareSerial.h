@@ -0,0 +1,98 @@
+#if !defined(HOSTSIM_HARDWARESERIAL_H)
+#define HOSTSIM_HARDWARESERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include <functional>
+
+#include "WString.h"
+
+#define SERIAL_8N1 0x06
+
+class Print {
+public:
+	virtual ~Print() {}
+
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t* buf, size_t size) {
+		size_t n = 0;
+		while(size--) n += write(*buf++);
+		return n;
+	}
+	size_t write(const char* str) { return str == nullptr ? 0 : write((const uint8_t*)str, strlen(str)); }
+	size_t write(const char* buf, size_t size) { return write((const uint8_t*)buf, size); }
+	virtual void flush() {}
+
+	size_t print(const char* str) { return write(str); }
+	size_t print(const String& s) { return write(s.c_str(), s.length()); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned char n, int base = 10) { return print(String(n, base)); }
+	size_t print(int n, int base = 10) { return print(String(n, base)); }
+	size_t print(unsigned int n, int base = 10) { return print(String(n, base)); }
+	size_t print(long n, int base = 10) { return print(String(n, base)); }
+	size_t print(unsigned long n, int base = 10) { return print(String(n, base)); }
+	size_t print(double n, int digits = 2) { return print(String(n, digits)); }
+
+	size_t println() { return write("\r\n"); }
+	template<typename T> size_t println(const T& val) { size_t n = print(val); return n + println(); }
+	template<typename T> size_t println(const T& val, int fmt) { size_t n = print(val, fmt); return n + println(); }
+};
+
+class Stream: public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
+
+/*
+	In-memory serial port. Everything written by the firmware ends up in the transmit handler (if one is
+	set, e.g. a simulated XBee), is echoed to a FILE (for the console), or is collected in a bounded
+	buffer that the host program can take(). Bytes the firmware should receive are put in with inject().
+*/
+class HardwareSerial: public Stream {
+public:
+	HardwareSerial(const char* name): name_(name) {}
+
+	void begin(unsigned long baud, uint16_t config = SERIAL_8N1) { (void)config; baud_ = baud; open_ = true; }
+	void end() { open_ = false; }
+	unsigned long baudRate() const { return baud_; }
+	operator bool() const { return open_; }
+
+	virtual int available() { return rx_.size(); }
+	virtual int read() { if(rx_.empty()) return -1; int c = rx_.front(); rx_.pop_front(); return c; }
+	virtual int peek() { if(rx_.empty()) return -1; return rx_.front(); }
+	virtual size_t write(uint8_t c);
+	virtual size_t write(const uint8_t* buf, size_t size);
+	using Print::write;
+
+	// Host-side API
+	const char* name() const { return name_; }
+	void inject(const uint8_t* buf, size_t size) { rx_.insert(rx_.end(), buf, buf+size); }
+	void inject(const char* str) { inject((const uint8_t*)str, strlen(str)); }
+	void inject(uint8_t c) { rx_.push_back(c); }
+	void setTransmitHandler(std::function<void(const uint8_t*, size_t)> handler) { handler_ = handler; }
+	void setEcho(FILE* fp) { echo_ = fp; }
+	std::vector<uint8_t> take() { std::vector<uint8_t> retval(tx_.begin(), tx_.end()); tx_.clear(); return retval; }
+	void clear() { rx_.clear(); tx_.clear(); }
+
+	static const size_t MAX_TX_BUFFERED = 65536;
+
+protected:
+	const char* name_;
+	bool open_ = false;
+	unsigned long baud_ = 0;
+	std::deque<uint8_t> rx_, tx_;
+	std::function<void(const uint8_t*, size_t)> handler_;
+	FILE* echo_ = nullptr;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+
+#endif // HOSTSIM_HARDWARESERIAL_H
@@ -0,0 +1,170 @@
+#include "Arduino.h"
+#include "Wire.h"
+#include "EEPROM.h"
+#include "HostSim.h"
+
+#include <chrono>
+#include <map>
+
+HardwareSerial Serial("Serial");
+HardwareSerial Serial1("Serial1");
+HardwareSerial Serial2("Serial2");
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+static hostsim::ClockMode clockMode_ = hostsim::CLOCK_MODE_REALTIME;
+static const std::chrono::steady_clock::time_point startTime_ = std::chrono::steady_clock::now();
+static uint64_t virtualOffset_ = 0, delayed_ = 0, manualFrozenAt_ = 0;
+static std::map<uint8_t, int> pinOutputs_, pinInputs_;
+static std::map<uint8_t, std::pair<void (*)(void), int>> interrupts_;
+
+void hostsim::setClockMode(ClockMode mode) {
+	if(mode == clockMode_) return;
+	if(mode == CLOCK_MODE_MANUAL) {
+		manualFrozenAt_ = micros64();
+		virtualOffset_ = 0;
+	} else {
+		uint64_t real = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime_).count();
+		virtualOffset_ = manualFrozenAt_ + virtualOffset_ - real;
+	}
+	clockMode_ = mode;
+}
+
+hostsim::ClockMode hostsim::clockMode() {
+	return clockMode_;
+}
+
+void hostsim::advanceMicros(uint64_t us) {
+	virtualOffset_ += us;
+}
+
+uint64_t hostsim::micros64() {
+	if(clockMode_ == CLOCK_MODE_MANUAL) return manualFrozenAt_ + virtualOffset_;
+	uint64_t real = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime_).count();
+	return real + virtualOffset_;
+}
+
+uint64_t hostsim::microsDelayed() {
+	return delayed_;
+}
+
+int hostsim::pinValue(uint8_t pin) {
+	auto iter = pinOutputs_.find(pin);
+	return iter == pinOutputs_.end() ? 0 : iter->second;
+}
+
+void hostsim::setPinInput(uint8_t pin, int value) {
+	int old = digitalRead(pin);
+	pinInputs_[pin] = value;
+
+	auto iter = interrupts_.find(pin);
+	if(iter == interrupts_.end() || (old != LOW) == (value != LOW)) return;
+	int mode = iter->second.second;
+	if(mode == CHANGE || (mode == RISING && value != LOW) || (mode == FALLING && value == LOW)) iter->second.first();
+}
+
+unsigned long millis() {
+	return hostsim::micros64() / 1000;
+}
+
+unsigned long micros() {
+	return hostsim::micros64();
+}
+
+void delay(unsigned long ms) {
+	delayMicroseconds(ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+	delayed_ += us;
+	hostsim::advanceMicros(us);
+}
+
+void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+void digitalWrite(uint8_t pin, uint8_t val) { pinOutputs_[pin] = val; }
+void analogWrite(uint8_t pin, int val) { pinOutputs_[pin] = val; }
+void analogReadResolution(int bits) { (void)bits; }
+void analogWriteResolution(int bits) { (void)bits; }
+
+int digitalRead(uint8_t pin) {
+	auto iter = pinInputs_.find(pin);
+	return iter == pinInputs_.end() ? LOW : iter->second;
+}
+
+int analogRead(uint8_t pin) {
+	auto iter = pinInputs_.find(pin);
+	return iter == pinInputs_.end() ? 0 : iter->second;
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode) { interrupts_[interruptNum] = std::make_pair(userFunc, mode); }
+void detachInterrupt(uint8_t interruptNum) { interrupts_.erase(interruptNum); }
+void interrupts() {}
+void noInterrupts() {}
+
+long random(long howbig) {
+	if(howbig <= 0) return 0;
+	return ::random() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+	if(howsmall >= howbig) return howsmall;
+	return random(howbig - howsmall) + howsmall;
+}
+
+void randomSeed(unsigned long seed) {
+	srandom(seed);
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buf, size_t size) {
+	if(handler_) {
+		handler_(buf, size);
+	} else if(echo_ != nullptr) {
+		fwrite(buf, 1, size, echo_);
+	} else {
+		tx_.insert(tx_.end(), buf, buf+size);
+		while(tx_.size() > MAX_TX_BUFFERED) tx_.pop_front();
+	}
+	return size;
+}
+
+static const char* eepromFileName() {
+	const char* name = getenv("LIBBB_EEPROM_FILE");
+	return name != nullptr ? name : "eeprom.bin";
+}
+
+void EEPROMClass::begin(size_t size) {
+	data_.assign(size, 0xff);
+	FILE* fp = fopen(eepromFileName(), "rb");
+	if(fp == nullptr) return;
+	size_t n = fread(data_.data(), 1, size, fp);
+	(void)n;
+	fclose(fp);
+	dirty_ = false;
+}
+
+uint8_t EEPROMClass::read(int address) const {
+	if(address < 0 || size_t(address) >= data_.size()) return 0xff;
+	return data_[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+	if(address < 0 || size_t(address) >= data_.size()) return;
+	data_[address] = value;
+	dirty_ = true;
+}
+
+bool EEPROMClass::commit() {
+	if(!dirty_) return true;
+	FILE* fp = fopen(eepromFileName(), "wb");
+	if(fp == nullptr) return false;
+	bool ok = fwrite(data_.data(), 1, data_.size(), fp) == data_.size();
+	fclose(fp);
+	dirty_ = !ok;
+	return ok;
+}
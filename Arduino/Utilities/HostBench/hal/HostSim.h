@@ -0,0 +1,35 @@
+#if !defined(HOSTSIM_H)
+#define HOSTSIM_H
+
+#include <stdint.h>
+
+// Control over the simulated Arduino environment, for use by host programs only.
+namespace hostsim {
+
+enum ClockMode {
+	// micros() follows the host's monotonic clock, plus all time spent in delay() / delayMicroseconds(),
+	// which return immediately. Code runs at host speed, and step() timings measure real CPU time.
+	CLOCK_MODE_REALTIME,
+	// micros() only moves when the firmware delays or the host calls advanceMicros(). Fully deterministic.
+	CLOCK_MODE_MANUAL
+};
+
+void setClockMode(ClockMode mode);
+ClockMode clockMode();
+
+// Advance the simulated clock without spending host time.
+void advanceMicros(uint64_t us);
+// Microseconds since start of the program on the simulated clock, without wrap.
+uint64_t micros64();
+// Total time the firmware spent delay()ing. Useful to compute how much of the cycle budget was left idle.
+uint64_t microsDelayed();
+
+// Returns the last value written to the given pin with digitalWrite() / analogWrite().
+int pinValue(uint8_t pin);
+// Sets what digitalRead() / analogRead() return for the given pin. Runs the handler attached to the pin with
+// attachInterrupt() right away if the level changes in a way its mode triggers on, like an interrupt would.
+void setPinInput(uint8_t pin, int value);
+
+};
+
+#endif // HOSTSIM_H
@@ -0,0 +1,110 @@
+#include "WString.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <math.h>
+
+static std::string unsignedToString(unsigned long long value, unsigned char base) {
+	if(base < 2 || base > 36) base = 10;
+	if(value == 0) return "0";
+
+	char buf[65];
+	int pos = 64;
+	buf[pos] = 0;
+	while(value != 0 && pos > 0) {
+		unsigned digit = value % base;
+		buf[--pos] = digit < 10 ? '0' + digit : 'a' + digit - 10;
+		value /= base;
+	}
+	return std::string(&buf[pos]);
+}
+
+static std::string signedToString(long long value, unsigned char base) {
+	if(base == 10 && value < 0) return "-" + unsignedToString(0ULL - (unsigned long long)value, base);
+	return unsignedToString((unsigned long long)value, base);
+}
+
+static std::string floatToString(double value, unsigned char decimalPlaces) {
+	if(isnan(value)) return "nan";
+	if(isinf(value)) return value > 0 ? "inf" : "-inf";
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.*f", (int)decimalPlaces, value);
+	return std::string(buf);
+}
+
+// Like on the Arduino, unsigned types wrap into their own width, signed types are sign extended
+// for base 10 and printed as unsigned of their own width otherwise.
+String::String(unsigned char value, unsigned char base): str_(unsignedToString(value, base)) {}
+String::String(int value, unsigned char base):
+	str_(base == 10 ? signedToString(value, base) : unsignedToString((unsigned int)value, base)) {}
+String::String(unsigned int value, unsigned char base): str_(unsignedToString(value, base)) {}
+String::String(long value, unsigned char base):
+	str_(base == 10 ? signedToString(value, base) : unsignedToString((unsigned long)value, base)) {}
+String::String(unsigned long value, unsigned char base): str_(unsignedToString(value, base)) {}
+String::String(long long value, unsigned char base): str_(signedToString(value, base)) {}
+String::String(unsigned long long value, unsigned char base): str_(unsignedToString(value, base)) {}
+String::String(float value, unsigned char decimalPlaces): str_(floatToString(value, decimalPlaces)) {}
+String::String(double value, unsigned char decimalPlaces): str_(floatToString(value, decimalPlaces)) {}
+
+bool String::equalsIgnoreCase(const String& s) const {
+	if(str_.length() != s.str_.length()) return false;
+	for(size_t i=0; i<str_.length(); i++) {
+		if(tolower((unsigned char)str_[i]) != tolower((unsigned char)s.str_[i])) return false;
+	}
+	return true;
+}
+
+bool String::endsWith(const String& suffix) const {
+	if(suffix.str_.length() > str_.length()) return false;
+	return str_.compare(str_.length() - suffix.str_.length(), suffix.str_.length(), suffix.str_) == 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+	size_t pos = str_.find(ch, fromIndex);
+	return pos == std::string::npos ? -1 : int(pos);
+}
+
+int String::indexOf(const String& s, unsigned int fromIndex) const {
+	size_t pos = str_.find(s.str_, fromIndex);
+	return pos == std::string::npos ? -1 : int(pos);
+}
+
+int String::lastIndexOf(char ch) const {
+	size_t pos = str_.rfind(ch);
+	return pos == std::string::npos ? -1 : int(pos);
+}
+
+String String::substring(unsigned int beginIndex, unsigned int endIndex) const {
+	if(beginIndex > endIndex) std::swap(beginIndex, endIndex);
+	if(beginIndex >= str_.length()) return String();
+	if(endIndex > str_.length()) endIndex = str_.length();
+	return String(str_.substr(beginIndex, endIndex - beginIndex));
+}
+
+void String::replace(char find, char replace) {
+	for(auto& c: str_) if(c == find) c = replace;
+}
+
+void String::replace(const String& find, const String& replace) {
+	if(find.str_.length() == 0) return;
+	size_t pos = 0;
+	while((pos = str_.find(find.str_, pos)) != std::string::npos) {
+		str_.replace(pos, find.str_.length(), replace.str_);
+		pos += replace.str_.length();
+	}
+}
+
+void String::toLowerCase() {
+	for(auto& c: str_) c = tolower((unsigned char)c);
+}
+
+void String::toUpperCase() {
+	for(auto& c: str_) c = toupper((unsigned char)c);
+}
+
+void String::trim() {
+	size_t begin = 0, end = str_.length();
+	while(begin < end && isspace((unsigned char)str_[begin])) begin++;
+	while(end > begin && isspace((unsigned char)str_[end-1])) end--;
+	str_ = str_.substr(begin, end - begin);
+}
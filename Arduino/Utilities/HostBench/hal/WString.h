@@ -0,0 +1,98 @@
+#if !defined(HOSTSIM_WSTRING_H)
+#define HOSTSIM_WSTRING_H
+
+#include <stdlib.h>
+#include <string>
+
+// Host stand-in for Arduino's String class, backed by std::string. Implements the subset of the
+// Arduino API that LibBB uses, with the same formatting rules for numbers.
+
+class String {
+public:
+	String(): str_() {}
+	String(const char* cstr): str_(cstr != nullptr ? cstr : "") {}
+	String(const char* cstr, unsigned int length): str_(cstr, length) {}
+	String(const std::string& s): str_(s) {}
+	String(const String& s) = default;
+	String(String&& s) = default;
+	explicit String(char c): str_(1, c) {}
+	explicit String(unsigned char value, unsigned char base = 10);
+	explicit String(int value, unsigned char base = 10);
+	explicit String(unsigned int value, unsigned char base = 10);
+	explicit String(long value, unsigned char base = 10);
+	explicit String(unsigned long value, unsigned char base = 10);
+	explicit String(long long value, unsigned char base = 10);
+	explicit String(unsigned long long value, unsigned char base = 10);
+	explicit String(float value, unsigned char decimalPlaces = 2);
+	explicit String(double value, unsigned char decimalPlaces = 2);
+
+	String& operator=(const String& rhs) = default;
+	String& operator=(String&& rhs) = default;
+	String& operator=(const char* cstr) { str_ = cstr != nullptr ? cstr : ""; return *this; }
+
+	unsigned int length() const { return str_.length(); }
+	const char* c_str() const { return str_.c_str(); }
+	bool reserve(unsigned int size) { str_.reserve(size); return true; }
+	bool isEmpty() const { return str_.empty(); }
+
+	bool concat(const String& s) { str_ += s.str_; return true; }
+	bool concat(const char* cstr) { if(cstr != nullptr) str_ += cstr; return true; }
+	bool concat(char c) { str_ += c; return true; }
+	bool concat(unsigned char num) { return concat(String(num)); }
+	bool concat(int num) { return concat(String(num)); }
+	bool concat(unsigned int num) { return concat(String(num)); }
+	bool concat(long num) { return concat(String(num)); }
+	bool concat(unsigned long num) { return concat(String(num)); }
+	bool concat(long long num) { return concat(String(num)); }
+	bool concat(unsigned long long num) { return concat(String(num)); }
+	bool concat(float num) { return concat(String(num)); }
+	bool concat(double num) { return concat(String(num)); }
+
+	template<typename T> String& operator+=(const T& rhs) { concat(rhs); return *this; }
+
+	bool equals(const String& s) const { return str_ == s.str_; }
+	bool equals(const char* cstr) const { return str_ == (cstr != nullptr ? cstr : ""); }
+	bool equalsIgnoreCase(const String& s) const;
+	bool operator==(const String& rhs) const { return equals(rhs); }
+	bool operator==(const char* cstr) const { return equals(cstr); }
+	bool operator!=(const String& rhs) const { return !equals(rhs); }
+	bool operator!=(const char* cstr) const { return !equals(cstr); }
+	bool operator<(const String& rhs) const { return str_ < rhs.str_; }
+	bool operator>(const String& rhs) const { return str_ > rhs.str_; }
+	bool startsWith(const String& prefix) const { return str_.compare(0, prefix.str_.length(), prefix.str_) == 0; }
+	bool endsWith(const String& suffix) const;
+
+	char charAt(unsigned int index) const { return index < str_.length() ? str_[index] : 0; }
+	void setCharAt(unsigned int index, char c) { if(index < str_.length()) str_[index] = c; }
+	char operator[](unsigned int index) const { return charAt(index); }
+	char& operator[](unsigned int index) { return str_[index]; }
+
+	int indexOf(char ch, unsigned int fromIndex = 0) const;
+	int indexOf(const String& s, unsigned int fromIndex = 0) const;
+	int lastIndexOf(char ch) const;
+	String substring(unsigned int beginIndex) const { return substring(beginIndex, str_.length()); }
+	String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+	void replace(char find, char replace);
+	void replace(const String& find, const String& replace);
+	void remove(unsigned int index) { if(index < str_.length()) str_.erase(index); }
+	void remove(unsigned int index, unsigned int count) { if(index < str_.length()) str_.erase(index, count); }
+	void toLowerCase();
+	void toUpperCase();
+	void trim();
+
+	long toInt() const { return strtol(str_.c_str(), nullptr, 10); }
+	float toFloat() const { return float(toDouble()); }
+	double toDouble() const { return strtod(str_.c_str(), nullptr); }
+
+	const std::string& str() const { return str_; }
+
+protected:
+	std::string str_;
+};
+
+template<typename T> String operator+(const String& lhs, const T& rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(const char* lhs, const String& rhs) { String s(lhs); s.concat(rhs); return s; }
+inline String operator+(char lhs, const String& rhs) { String s(lhs); s.concat(rhs); return s; }
+
+#endif // HOSTSIM_WSTRING_H
@@ -0,0 +1,26 @@
+#if !defined(HOSTSIM_WIRE_H)
+#define HOSTSIM_WIRE_H
+
+#include "Arduino.h"
+
+// I2C stub. No devices are present on the host bus; every transmission is NACKed.
+class TwoWire: public Stream {
+public:
+	void begin() {}
+	void end() {}
+	void setClock(uint32_t freq) { (void)freq; }
+
+	void beginTransmission(uint8_t address) { (void)address; }
+	uint8_t endTransmission(bool sendStop = true) { (void)sendStop; return 2; }
+	uint8_t requestFrom(uint8_t address, size_t quantity, bool sendStop = true) { (void)address; (void)quantity; (void)sendStop; return 0; }
+
+	virtual size_t write(uint8_t c) { (void)c; return 1; }
+	using Print::write;
+	virtual int available() { return 0; }
+	virtual int read() { return -1; }
+	virtual int peek() { return -1; }
+};
+
+extern TwoWire Wire;
+
+#endif // HOSTSIM_WIRE_H
@@ -0,0 +1,56 @@
+#if !defined(BENCHSTATS_H)
+#define BENCHSTATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+// Helpers shared by the host benchmarks. Timing is done on the host's real clock in nanoseconds,
+// independent of the simulated Arduino clock.
+
+inline uint64_t benchNanos() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class BenchSamples {
+public:
+	BenchSamples(const char* name = ""): name_(name) {}
+
+	void reserve(size_t n) { samples_.reserve(n); }
+	void add(uint64_t ns) { samples_.push_back(ns); }
+	void clear() { samples_.clear(); }
+	size_t count() const { return samples_.size(); }
+	const char* name() const { return name_; }
+
+	static void printHeader(FILE* fp = stdout) {
+		fprintf(fp, "%-16s %8s %10s %10s %10s %10s %10s %10s\n", "name", "n", "min[ns]", "mean[ns]", "p50[ns]", "p90[ns]", "p99[ns]", "max[ns]");
+	}
+
+	void print(FILE* fp = stdout) const {
+		if(samples_.size() == 0) {
+			fprintf(fp, "%-16s %8d\n", name_, 0);
+			return;
+		}
+		std::vector<uint64_t> sorted = samples_;
+		std::sort(sorted.begin(), sorted.end());
+		uint64_t sum = 0;
+		for(auto s: sorted) sum += s;
+		fprintf(fp, "%-16s %8zu %10llu %10llu %10llu %10llu %10llu %10llu\n", name_, sorted.size(),
+			(unsigned long long)sorted.front(), (unsigned long long)(sum / sorted.size()),
+			(unsigned long long)percentile(sorted, 50), (unsigned long long)percentile(sorted, 90),
+			(unsigned long long)percentile(sorted, 99), (unsigned long long)sorted.back());
+	}
+
+protected:
+	static uint64_t percentile(const std::vector<uint64_t>& sorted, unsigned int p) {
+		size_t index = (sorted.size() - 1) * p / 100;
+		return sorted[index];
+	}
+
+	const char* name_;
+	std::vector<uint64_t> samples_;
+};
+
+#endif // BENCHSTATS_H
@@ -0,0 +1,419 @@
+#if !defined(DYNAMIXELSIM_H)
+#define DYNAMIXELSIM_H
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+
+// A Dynamixel Protocol 2.0 bus with simulated X series and XL-320 servos behind a bb::ServoPort, for running
+// bb::ServoBus and bb::Servos on the host. Each servo uses its model's control table layout.
+//
+// Timing follows the wire: transmit() moves the simulated clock along by the time the bytes take at the bus baud rate,
+// and every reply byte becomes available() at the time it would have arrived - after the servo's return delay time,
+// and after the replies of the servos before it. Servos only understand the bus at their own baud rate, and switch
+// when their BAUD_RATE item is written, as real ones do. Packets can be lost at a configurable rate; a lost fast sync
+// read part breaks the whole combined reply, as on the real bus.
+//
+// In manual clock mode, available() moves the clock by 1us whenever it has nothing, so a CPU spinning on the bus
+// makes time pass.
+//
+// Servos move towards their goal position at their profile velocity while torque is on. That is all the physics.
+class DynamixelSim: public bb::ServoPort {
+public:
+	static const uint16_t MODEL_XM430_W350 = 1020, MODEL_XL430_W250 = 1060, MODEL_XL320 = 350;
+
+	static const uint8_t ADDR_MODEL_NUMBER = 0, ADDR_FIRMWARE_VERSION = 6, ADDR_ID = 7, ADDR_BAUD_RATE = 8;
+	static const uint8_t ADDR_RETURN_DELAY_TIME = 9, ADDR_OPERATING_MODE = 11, ADDR_MAX_POSITION_LIMIT = 48;
+	static const uint8_t ADDR_TORQUE_ENABLE = 64, ADDR_HARDWARE_ERROR_STATUS = 70, ADDR_GOAL_VELOCITY = 104;
+	static const uint8_t ADDR_PROFILE_VELOCITY = 112, ADDR_GOAL_POSITION = 116, ADDR_PRESENT_VELOCITY = 128;
+	static const uint8_t ADDR_PRESENT_POSITION = 132;
+
+	// Where a model keeps the items the simulation uses, and its units. The ADDR_ constants above are the X series'.
+	struct Layout {
+		uint8_t firmwareVersion, baudRate, returnDelayTime, operatingMode, torqueEnable, hardwareErrorStatus;
+		uint8_t goalVelocity, profileVelocity, goalPosition, presentVelocity, presentPosition;
+		uint8_t length;         // of the position and velocity items
+		uint8_t opVelocity;     // operating mode for velocity control, 0xff if there is none
+		double ticksPerRev, rpmPerUnit;
+	};
+	static const Layout& layout(uint16_t model) {
+		static const Layout x = { ADDR_FIRMWARE_VERSION, ADDR_BAUD_RATE, ADDR_RETURN_DELAY_TIME, ADDR_OPERATING_MODE,
+		                          ADDR_TORQUE_ENABLE, ADDR_HARDWARE_ERROR_STATUS, ADDR_GOAL_VELOCITY, ADDR_PROFILE_VELOCITY,
+		                          ADDR_GOAL_POSITION, ADDR_PRESENT_VELOCITY, ADDR_PRESENT_POSITION, 4, 1, 4096, 0.229 };
+		static const Layout xl320 = { 2, 4, 5, 11, 24, 50, 0, 32, 30, 39, 37, 2, 0xff, 1024 * 360 / 300.0, 0.111 };
+		return model == MODEL_XL320 ? xl320 : x;
+	}
+
+	struct Servo {
+		const Layout* layout;
+		uint8_t id;
+		bool fastSyncRead;
+		unsigned long baud;
+		double pos;
+		uint8_t table[256];
+
+		int32_t value(uint8_t addr, uint8_t len) const {
+			uint32_t v = 0;
+			for(int i=len-1; i>=0; i--) v = (v << 8) | table[addr+i];
+			return int32_t(v);
+		}
+		void setValue(uint8_t addr, uint8_t len, int32_t v) {
+			for(uint8_t i=0; i<len; i++) table[addr+i] = (uint32_t(v) >> (8*i)) & 0xff;
+		}
+		unsigned long returnDelay() const { return table[layout->returnDelayTime] * 2; }
+	};
+
+	DynamixelSim(): baud_(0), loss_(0), seed_(1), lastMicros_(0), lost_(0) {}
+
+	// Adds a servo at its factory defaults, apart from ID and baud rate.
+	Servo& addServo(uint8_t id, unsigned long baud = 57600, uint16_t model = MODEL_XM430_W350) {
+		Servo s;
+		memset(&s, 0, sizeof(s));
+		s.layout = &layout(model);
+		s.id = id;
+		s.fastSyncRead = true;
+		s.baud = baud;
+		s.setValue(ADDR_MODEL_NUMBER, 2, model);
+		s.table[s.layout->baudRate] = baudValue(baud);
+		s.table[s.layout->returnDelayTime] = 250;
+		if(model == MODEL_XL320) {
+			s.pos = 512;
+			s.table[2] = 22;                       // firmware version
+			s.table[3] = id;
+			s.setValue(8, 2, 1023);                // CCW angle limit
+			s.table[11] = 2;                       // control mode: joint
+			s.table[18] = 0x03;                    // shutdown
+			s.table[29] = 32;                      // P gain
+		} else {
+			s.pos = 2048;
+			s.table[ADDR_FIRMWARE_VERSION] = 46;
+			s.table[ADDR_ID] = id;
+			s.table[ADDR_OPERATING_MODE] = 3;
+			if(model != MODEL_XL430_W250) s.setValue(38, 2, 1193); // current limit
+			s.setValue(44, 4, 200);                // velocity limit
+			s.setValue(ADDR_MAX_POSITION_LIMIT, 4, 4095);
+			s.table[63] = 0x34;                    // shutdown
+			s.setValue(84, 2, 800);                // position P gain
+		}
+		s.setValue(s.layout->goalPosition, s.layout->length, int32_t(s.pos));
+		s.setValue(s.layout->presentPosition, s.layout->length, int32_t(s.pos));
+		servos_.push_back(s);
+		return servos_.back();
+	}
+	void clear() { servos_.clear(); rx_.clear(); }
+	Servo* servo(uint8_t id) {
+		for(auto& s: servos_) if(s.id == id) return &s;
+		return NULL;
+	}
+	std::vector<Servo>& servos() { return servos_; }
+
+	// Probability of any one packet, from the host or from a servo, getting lost.
+	void setPacketLoss(float probability) { loss_ = probability; }
+	// Replies lost so far.
+	unsigned long lostPackets() const { return lost_; }
+
+	virtual void begin(unsigned long baud) {
+		baud_ = baud;
+		rx_.clear();
+	}
+	virtual unsigned long baudrate() { return baud_; }
+
+	virtual void transmit(const uint8_t* buf, size_t len) {
+		if(baud_ == 0) return;
+		rx_.clear();
+		hostsim::advanceMicros(wireMicros(len));
+		uint64_t now = hostsim::micros64();
+		move(now);
+
+		uint64_t t = now;
+		size_t pos = 0;
+		std::vector<uint8_t> body;
+		while(pos < len) {
+			uint8_t id = 0;
+			size_t consumed = unpack(buf+pos, len-pos, id, body);
+			if(consumed == 0) break;
+			pos += consumed;
+			if(randomLoss()) continue;
+			t = execute(id, body, t);
+		}
+	}
+
+	virtual int available() {
+		uint64_t now = hostsim::micros64();
+		int n = 0;
+		for(auto& b: rx_) {
+			if(b.first > now) break;
+			n++;
+		}
+		if(n == 0 && hostsim::clockMode() == hostsim::CLOCK_MODE_MANUAL) hostsim::advanceMicros(1);
+		return n;
+	}
+
+	virtual int read() {
+		if(rx_.size() == 0 || rx_.front().first > hostsim::micros64()) return -1;
+		uint8_t b = rx_.front().second;
+		rx_.pop_front();
+		return b;
+	}
+
+	// Moves all servos along to the current time.
+	void update() { move(hostsim::micros64()); }
+
+	static uint8_t baudValue(unsigned long baud) {
+		switch(baud) {
+		case 9600: return 0;
+		case 115200: return 2;
+		case 1000000: return 3;
+		case 2000000: return 4;
+		case 57600:
+		default: return 1;
+		}
+	}
+	static unsigned long baudFromValue(uint8_t value) {
+		static const unsigned long bauds[] = { 9600, 57600, 115200, 1000000, 2000000 };
+		return value < 5 ? bauds[value] : 57600;
+	}
+
+protected:
+	static const uint8_t INST_PING = 0x01, INST_READ = 0x02, INST_WRITE = 0x03, INST_REBOOT = 0x08, INST_STATUS = 0x55;
+	static const uint8_t INST_SYNC_READ = 0x82, INST_SYNC_WRITE = 0x83, INST_FAST_SYNC_READ = 0x8a;
+	static const uint8_t INST_BULK_READ = 0x92, INST_BULK_WRITE = 0x93;
+	static const uint8_t ERR_ACCESS = 0x07, ERR_INSTRUCTION = 0x02;
+	static const uint8_t BROADCAST = 0xfe;
+
+	unsigned long wireMicros(size_t bytes) const { return (unsigned long)(bytes * 10000000ULL / baud_); }
+
+	bool randomLoss() {
+		if(loss_ <= 0) return false;
+		seed_ = seed_ * 1103515245 + 12345;
+		bool lost = float((seed_ >> 8) & 0xffff) / 65536.0f < loss_;
+		if(lost) lost_++;
+		return lost;
+	}
+
+	// Takes one instruction packet off the front of buf. Returns bytes consumed, or 0 if there is no complete packet.
+	size_t unpack(const uint8_t* buf, size_t len, uint8_t& id, std::vector<uint8_t>& body) {
+		for(size_t start=0; start+10 <= len; start++) {
+			if(buf[start] != 0xff || buf[start+1] != 0xff || buf[start+2] != 0xfd || buf[start+3] != 0) continue;
+			uint16_t plen = buf[start+5] | (buf[start+6] << 8);
+			if(start + 7 + plen > len) return 0;
+			uint16_t crc = buf[start+7+plen-2] | (buf[start+7+plen-1] << 8);
+			if(bb::ServoBus::crc16(0, buf+start, 7+plen-2) != crc) return start + 7 + plen;
+			id = buf[start+4];
+			body.clear();
+			const uint8_t* raw = buf + start + 7;
+			for(size_t i=0; i<size_t(plen-2); i++) {
+				if(i >= 3 && raw[i] == 0xfd && raw[i-3] == 0xff && raw[i-2] == 0xff && raw[i-1] == 0xfd) continue;
+				body.push_back(raw[i]);
+			}
+			return start + 7 + plen;
+		}
+		return 0;
+	}
+
+	static void addStuffed(std::vector<uint8_t>& out, uint8_t b) {
+		out.push_back(b);
+		size_t n = out.size();
+		if(n >= 10 && out[n-3] == 0xff && out[n-2] == 0xff && out[n-1] == 0xfd) out.push_back(0xfd);
+	}
+
+	static std::vector<uint8_t> statusPacket(uint8_t id, uint8_t error, const uint8_t* params, size_t numParams) {
+		std::vector<uint8_t> out = { 0xff, 0xff, 0xfd, 0x00, id, 0, 0 };
+		addStuffed(out, INST_STATUS);
+		addStuffed(out, error);
+		for(size_t i=0; i<numParams; i++) addStuffed(out, params[i]);
+		finishPacket(out);
+		return out;
+	}
+
+	static void finishPacket(std::vector<uint8_t>& out) {
+		uint16_t plen = out.size() - 7 + 2;
+		out[5] = plen & 0xff;
+		out[6] = plen >> 8;
+		uint16_t crc = bb::ServoBus::crc16(0, out.data(), out.size());
+		out.push_back(crc & 0xff);
+		out.push_back(crc >> 8);
+	}
+
+	// Queues bytes to arrive back-to-back from t on. Returns when the last one is through.
+	uint64_t send(const std::vector<uint8_t>& bytes, uint64_t t) {
+		for(size_t i=0; i<bytes.size(); i++) rx_.push_back(std::make_pair(t + wireMicros(i+1), bytes[i]));
+		return t + wireMicros(bytes.size());
+	}
+
+	// A servo's answer to a unicast or sync instruction, unless it is lost on the way.
+	uint64_t reply(Servo& s, uint8_t error, const uint8_t* params, size_t numParams, uint64_t t) {
+		t += s.returnDelay();
+		std::vector<uint8_t> packet = statusPacket(s.id, error, params, numParams);
+		if(randomLoss()) return t + wireMicros(packet.size()); // sent, but garbled
+		return send(packet, t);
+	}
+
+	bool listening(const Servo& s) const { return s.baud == baud_; }
+
+	uint8_t writeTable(Servo& s, uint16_t addr, const uint8_t* data, size_t len) {
+		if(addr + len > sizeof(s.table)) return ERR_ACCESS;
+		if(addr < s.layout->torqueEnable && s.table[s.layout->torqueEnable] != 0) return ERR_ACCESS; // EEPROM area is locked
+		memcpy(s.table + addr, data, len);
+		return 0;
+	}
+
+	uint64_t execute(uint8_t id, const std::vector<uint8_t>& body, uint64_t t) {
+		if(body.size() == 0) return t;
+		uint8_t inst = body[0];
+		const uint8_t* p = body.data() + 1;
+		size_t np = body.size() - 1;
+
+		switch(inst) {
+		case INST_PING:
+		case INST_READ:
+		case INST_WRITE:
+		case INST_REBOOT: {
+			Servo* s = servo(id);
+			if(s == NULL || !listening(*s)) return t;
+			if(inst == INST_PING) {
+				uint8_t params[3] = { s->table[0], s->table[1], s->table[s->layout->firmwareVersion] };
+				return reply(*s, 0, params, 3, t);
+			} else if(inst == INST_READ) {
+				if(np < 4) return reply(*s, ERR_INSTRUCTION, NULL, 0, t);
+				uint16_t addr = p[0] | (p[1] << 8), len = p[2] | (p[3] << 8);
+				if(addr + len > sizeof(s->table)) return reply(*s, ERR_ACCESS, NULL, 0, t);
+				return reply(*s, 0, s->table + addr, len, t);
+			} else if(inst == INST_WRITE) {
+				if(np < 3) return reply(*s, ERR_INSTRUCTION, NULL, 0, t);
+				uint16_t addr = p[0] | (p[1] << 8);
+				uint8_t err = writeTable(*s, addr, p+2, np-2);
+				t = reply(*s, err, NULL, 0, t);
+				uint8_t baudRate = s->layout->baudRate;
+				if(err == 0 && addr <= baudRate && addr + np-2 > baudRate) s->baud = baudFromValue(s->table[baudRate]);
+				return t;
+			} else {
+				s->table[s->layout->hardwareErrorStatus] = 0;
+				s->table[s->layout->torqueEnable] = 0;
+				return reply(*s, 0, NULL, 0, t);
+			}
+		}
+
+		case INST_SYNC_WRITE: {
+			if(np < 4) return t;
+			uint16_t addr = p[0] | (p[1] << 8), len = p[2] | (p[3] << 8);
+			for(size_t i=4; i + 1 + len <= np; i += 1 + len) {
+				Servo* s = servo(p[i]);
+				if(s != NULL && listening(*s)) writeTable(*s, addr, p+i+1, len);
+			}
+			return t;
+		}
+
+		case INST_BULK_WRITE: {
+			for(size_t i=0; i + 5 <= np; ) {
+				uint16_t addr = p[i+1] | (p[i+2] << 8), len = p[i+3] | (p[i+4] << 8);
+				if(i + 5 + len > np) break;
+				Servo* s = servo(p[i]);
+				if(s != NULL && listening(*s)) writeTable(*s, addr, p+i+5, len);
+				i += 5 + len;
+			}
+			return t;
+		}
+
+		case INST_SYNC_READ:
+		case INST_BULK_READ: {
+			// Servos answer in the order they are listed, each one once it has heard the one before it.
+			bool bulk = inst == INST_BULK_READ;
+			size_t first = bulk ? 0 : 4, stride = bulk ? 5 : 1;
+			for(size_t i=first; i + stride <= np; i += stride) {
+				uint16_t addr = bulk ? (p[i+1] | (p[i+2] << 8)) : (p[0] | (p[1] << 8));
+				uint16_t len = bulk ? (p[i+3] | (p[i+4] << 8)) : (p[2] | (p[3] << 8));
+				Servo* s = servo(p[i]);
+				if(s == NULL || !listening(*s) || addr + len > sizeof(s->table)) continue;
+				t = reply(*s, 0, s->table + addr, len, t);
+			}
+			return t;
+		}
+
+		case INST_FAST_SYNC_READ: {
+			// One status packet from broadcast ID: every servo appends error, ID, data and the CRC so far. A servo that
+			// is missing, or didn't get the instruction, leaves a hole, and the packet is lost as a whole.
+			if(np < 5) return t;
+			uint16_t addr = p[0] | (p[1] << 8), len = p[2] | (p[3] << 8);
+			size_t n = np - 4;
+			std::vector<uint8_t> out = { 0xff, 0xff, 0xfd, 0x00, BROADCAST, 0, 0 };
+			addStuffed(out, INST_STATUS);
+			bool complete = true;
+			for(size_t i=0; i<n; i++) {
+				Servo* s = servo(p[4+i]);
+				if(s == NULL || !listening(*s) || !s->fastSyncRead || addr + len > sizeof(s->table)) {
+					complete = false;
+					continue;
+				}
+				if(i == 0) t += s->returnDelay();
+				addStuffed(out, 0);
+				addStuffed(out, s->id);
+				for(uint16_t j=0; j<len; j++) addStuffed(out, s->table[addr+j]);
+				if(i + 1 < n) {
+					uint16_t crc = bb::ServoBus::crc16(0, out.data(), out.size());
+					addStuffed(out, crc & 0xff);
+					addStuffed(out, crc >> 8);
+				}
+			}
+			if(out.size() == 8) return t; // nobody answered
+			// The length field announces every part, so a hole means the packet never completes.
+			uint16_t expected = 1 + n*(2+len) + (n-1)*2 + 2;
+			if(complete) finishPacket(out);
+			else {
+				out[5] = expected & 0xff;
+				out[6] = expected >> 8;
+			}
+			if(randomLoss()) return t + wireMicros(out.size());
+			return send(out, t);
+		}
+
+		default:
+			return t;
+		}
+	}
+
+	// Position and velocity control towards the goal, limited by the profile velocity.
+	void move(uint64_t now) {
+		double dt = (now - lastMicros_) / 1e6;
+		lastMicros_ = now;
+		if(dt <= 0) return;
+		for(auto& s: servos_) {
+			const Layout& l = *s.layout;
+			double rawToTicks = l.rpmPerUnit * l.ticksPerRev / 60.0;
+			double ticksPerSec = 0;
+			if(s.table[l.torqueEnable] != 0) {
+				if(s.table[l.operatingMode] == l.opVelocity) {
+					ticksPerSec = s.value(l.goalVelocity, l.length) * rawToTicks;
+					s.pos += ticksPerSec * dt;
+				} else {
+					double goal = s.value(l.goalPosition, l.length);
+					int32_t profile = s.value(l.profileVelocity, l.length);
+					double maxStep = profile == 0 ? 1e9 : profile * rawToTicks * dt;
+					double step = goal - s.pos;
+					if(step > maxStep) step = maxStep;
+					if(step < -maxStep) step = -maxStep;
+					s.pos += step;
+					ticksPerSec = step / dt;
+				}
+			}
+			int32_t vel = int32_t(ticksPerSec / rawToTicks);
+			if(l.length == 2 && vel < 0) vel = -vel | 1024; // XL-320: magnitude and direction bit
+			s.setValue(l.presentPosition, l.length, int32_t(s.pos));
+			s.setValue(l.presentVelocity, l.length, vel);
+		}
+	}
+
+	std::vector<Servo> servos_;
+	unsigned long baud_;
+	float loss_;
+	uint32_t seed_;
+	uint64_t lastMicros_;
+	unsigned long lost_;
+	std::deque<std::pair<uint64_t, uint8_t>> rx_;
+};
+
+#endif // DYNAMIXELSIM_H
@@ -0,0 +1,59 @@
+#if !defined(WHEELPLANT_H)
+#define WHEELPLANT_H
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+#include <math.h>
+
+// A D-O drive wheel for the host simulations: DC motor with first order speed response to PWM, static friction below
+// a PWM threshold, and encoder speed quantized to ticks and one control period late. advance() runs one period of
+// the 50Hz drive loop, and moves the simulated clock along.
+class WheelPlant: public bb::ControlInput, public bb::ControlOutput {
+public:
+	static constexpr float DT = 0.02f;           // D-O drive task period
+	static constexpr float MM_PER_TICK = 722.566f / (979.2f * 97.0f / 18.0f);
+	static constexpr float MOTOR_GAIN = 5.0f;    // mm/s per PWM unit
+	static constexpr float MOTOR_TAU = 0.12f;    // s
+	static constexpr float STICTION = 25.0f;     // PWM below which the wheel does not start moving
+
+	WheelPlant(bool advanceClock = true):
+		advanceClock_(advanceClock), pwm_(0), maxCommand_(0), speed_(0), pos_(0), lastTicks_(0), measured_(0), pending_(0) {}
+
+	virtual bb::Result set(float value) {
+		maxCommand_ = fmaxf(maxCommand_, fabsf(value));
+		pwm_ = constrain(value, -255.0f, 255.0f);
+		return bb::RES_OK;
+	}
+	virtual float present() { return measured_; }
+	virtual bb::Result update() { return bb::RES_OK; }
+
+	// One control period of physics at 1kHz.
+	void advance() {
+		for(int i=0; i<20; i++) {
+			float drive = fabsf(pwm_) < STICTION && fabsf(speed_) < 1.0f ? 0 : MOTOR_GAIN * pwm_;
+			speed_ += (drive - speed_) * 0.001f / MOTOR_TAU;
+			pos_ += speed_ * 0.001f;
+		}
+		long ticks = long(floorf(pos_ / MM_PER_TICK));
+		measured_ = pending_;
+		pending_ = (ticks - lastTicks_) * MM_PER_TICK / DT;
+		lastTicks_ = ticks;
+		if(advanceClock_) hostsim::advanceMicros(DT * 1e6);
+	}
+
+	float speed() const { return speed_; }
+	float pwm() const { return pwm_; }
+	// Largest command set() got, before the driver limits it to full PWM.
+	float maxCommand() const { return maxCommand_; }
+	// Motor current is proportional to the voltage not taken up by back EMF - in PWM units here.
+	float currentPWM() const { return pwm_ - speed_ / MOTOR_GAIN; }
+
+protected:
+	bool advanceClock_;
+	float pwm_, maxCommand_, speed_, pos_;
+	long lastTicks_;
+	float measured_, pending_;
+};
+
+#endif // WHEELPLANT_H
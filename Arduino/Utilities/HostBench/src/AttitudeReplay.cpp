@@ -0,0 +1,194 @@
+// Replays an IMU log through the Madgwick filter bb::IMU used to run and through bb::AttitudeEstimator, with and
+// without wheel odometry, and prints their roll / pitch error and time per update. The time is that of update() alone -
+// converting to angles is left out, as the filters do it on demand - and the best of several passes over the log.
+//
+// The log is CSV, one sample per line: gx,gy,gz[deg/s],ax,ay,az[g],v[m/s, along sensor y],roll,pitch[deg, ground
+// truth]. Without a log, one is synthesized: a balancing droid driving back and forth along sensor y, pitching about
+// sensor x, with gyro bias, gyro and accelerometer noise, and noisy wheel speed.
+//
+// Usage: attitude_replay [log.csv|""] [rate]
+
+#include <Arduino.h>
+#include <LibBB.h>
+
+#include <random>
+#include <stdio.h>
+
+#include "BenchStats.h"
+
+using namespace bb;
+
+struct Sample {
+	float gx, gy, gz, ax, ay, az, v, roll, pitch;
+};
+
+// Madgwick's IMU (gyro + accelerometer) gradient descent filter, as in the Arduino library bb::IMU used before.
+class MadgwickReference {
+public:
+	MadgwickReference(float sampleFreq, float beta = 0.1f): q0_(1), q1_(0), q2_(0), q3_(0), beta_(beta), dt_(1.0f/sampleFreq) {}
+
+	void update(float gx, float gy, float gz, float ax, float ay, float az) {
+		gx *= M_PI/180; gy *= M_PI/180; gz *= M_PI/180;
+		float qd0 = 0.5f * (-q1_*gx - q2_*gy - q3_*gz);
+		float qd1 = 0.5f * ( q0_*gx + q2_*gz - q3_*gy);
+		float qd2 = 0.5f * ( q0_*gy - q1_*gz + q3_*gx);
+		float qd3 = 0.5f * ( q0_*gz + q1_*gy - q2_*gx);
+
+		float n = sqrtf(ax*ax + ay*ay + az*az);
+		if(n > 0) {
+			ax /= n; ay /= n; az /= n;
+			// Gradient of the distance between predicted and measured gravity
+			float f1 = 2*(q1_*q3_ - q0_*q2_) - ax;
+			float f2 = 2*(q0_*q1_ + q2_*q3_) - ay;
+			float f3 = 1 - 2*(q1_*q1_ + q2_*q2_) - az;
+			float s0 = -2*q2_*f1 + 2*q1_*f2;
+			float s1 = 2*q3_*f1 + 2*q0_*f2 - 4*q1_*f3;
+			float s2 = -2*q0_*f1 + 2*q3_*f2 - 4*q2_*f3;
+			float s3 = 2*q1_*f1 + 2*q2_*f2;
+			float sn = sqrtf(s0*s0 + s1*s1 + s2*s2 + s3*s3);
+			if(sn > 0) {
+				qd0 -= beta_ * s0/sn; qd1 -= beta_ * s1/sn; qd2 -= beta_ * s2/sn; qd3 -= beta_ * s3/sn;
+			}
+		}
+
+		q0_ += qd0*dt_; q1_ += qd1*dt_; q2_ += qd2*dt_; q3_ += qd3*dt_;
+		float qn = sqrtf(q0_*q0_ + q1_*q1_ + q2_*q2_ + q3_*q3_);
+		q0_ /= qn; q1_ /= qn; q2_ /= qn; q3_ /= qn;
+	}
+
+	float getRoll() { return atan2f(q0_*q1_ + q2_*q3_, 0.5f - q1_*q1_ - q2_*q2_) * 180/M_PI; }
+	float getPitch() { return asinf(-2.0f * (q1_*q3_ - q0_*q2_)) * 180/M_PI; }
+
+protected:
+	float q0_, q1_, q2_, q3_, beta_, dt_;
+};
+
+static std::vector<Sample> synthesize(float rate, float seconds) {
+	std::mt19937 rng(42);
+	std::normal_distribution<float> gyroNoise(0, 0.3f), accelNoise(0, 0.02f), speedNoise(0, 0.01f);
+	const float biasX = 1.5f, biasY = -0.8f, biasZ = 0.5f;  // deg/s
+	const float dt = 1.0f/rate;
+
+	std::vector<Sample> log;
+	float v = 0, prevRoll = 0;
+	for(unsigned int i=0; i<seconds*rate; i++) {
+		float t = i*dt;
+		// Drive: accelerate, cruise, brake, reverse. Lean into the acceleration, wobble on top.
+		float phase = fmodf(t, 8.0f);
+		float a = phase < 1 ? 1.5f : (phase < 3 ? 0 : (phase < 5 ? -1.5f : (phase < 7 ? 0 : 1.5f)));
+		if(t < 2) a = 0;
+		v += a*dt;
+		float roll = -a/9.81f * 180/M_PI * 0.8f + 2.0f*sinf(2*M_PI*1.3f*t) + 0.5f*sinf(2*M_PI*7.0f*t);
+		float droll = i == 0 ? 0 : (roll - prevRoll)*rate;
+		prevRoll = roll;
+
+		// Specific force in the sensor frame: rotate world (0, a/g, 1) by -roll about x
+		float r = roll * M_PI/180, ag = a/9.81f;
+		Sample s;
+		s.gx = droll + biasX + gyroNoise(rng);
+		s.gy = biasY + gyroNoise(rng);
+		s.gz = biasZ + gyroNoise(rng);
+		s.ax = accelNoise(rng);
+		s.ay = cosf(r)*ag + sinf(r) + accelNoise(rng);
+		s.az = -sinf(r)*ag + cosf(r) + accelNoise(rng);
+		s.v = v + speedNoise(rng);
+		s.roll = roll;
+		s.pitch = 0;
+		log.push_back(s);
+	}
+	return log;
+}
+
+static bool load(const char* path, std::vector<Sample>& log) {
+	FILE* f = fopen(path, "r");
+	if(f == NULL) return false;
+	char line[256];
+	while(fgets(line, sizeof(line), f)) {
+		Sample s;
+		if(sscanf(line, "%f,%f,%f,%f,%f,%f,%f,%f,%f", &s.gx, &s.gy, &s.gz, &s.ax, &s.ay, &s.az, &s.v, &s.roll, &s.pitch) == 9) {
+			log.push_back(s);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+struct ReplayResult {
+	double rmsRoll, maxRoll, rmsPitch, nsPerUpdate;
+};
+
+static const unsigned int TIMING_PASSES = 10;
+
+// step(filter, i, sample) feeds sample i to the filter; angles(filter, roll, pitch) reads it out. Timing passes run on
+// copies of filter, the pass that measures the error on filter itself.
+template<typename Filter, typename F, typename A>
+static ReplayResult replay(const std::vector<Sample>& log, float rate, Filter& filter, F&& step, A&& angles) {
+	ReplayResult res = { 0, 0, 0, 0 };
+	for(unsigned int pass=0; pass<TIMING_PASSES; pass++) {
+		Filter copy = filter;
+		uint64_t t = benchNanos();
+		for(size_t i=0; i<log.size(); i++) step(copy, i, log[i]);
+		double ns = double(benchNanos() - t) / log.size();
+		if(pass == 0 || ns < res.nsPerUpdate) res.nsPerUpdate = ns;
+	}
+
+	std::vector<float> roll(log.size()), pitch(log.size());
+	for(size_t i=0; i<log.size(); i++) {
+		step(filter, i, log[i]);
+		angles(filter, roll[i], pitch[i]);
+	}
+
+	// Skip the first 5s - convergence from level is not what this is about
+	size_t start = std::min(log.size(), size_t(5*rate)), n = 0;
+	for(size_t i=start; i<log.size(); i++, n++) {
+		double er = roll[i] - log[i].roll, ep = pitch[i] - log[i].pitch;
+		res.rmsRoll += er*er;
+		res.rmsPitch += ep*ep;
+		res.maxRoll = fmax(res.maxRoll, fabs(er));
+	}
+	if(n) { res.rmsRoll = sqrt(res.rmsRoll/n); res.rmsPitch = sqrt(res.rmsPitch/n); }
+	return res;
+}
+
+int main(int argc, char** argv) {
+	float rate = argc > 2 ? atof(argv[2]) : 104.0f;
+	std::vector<Sample> log;
+	bool fromFile = argc > 1 && argv[1][0] != '\0';
+	if(fromFile) {
+		if(!load(argv[1], log)) { ::printf("Cannot read %s\n", argv[1]); return 1; }
+	} else {
+		log = synthesize(rate, 60);
+	}
+	::printf("%zu samples at %.0fHz%s\n", log.size(), rate, fromFile ? "" : ", synthetic");
+
+	MadgwickReference madgwick(rate);
+	ReplayResult resMadgwick = replay(log, rate, madgwick,
+		[](MadgwickReference& f, size_t i, const Sample& s) { f.update(s.gx, s.gy, s.gz, s.ax, s.ay, s.az); },
+		[](MadgwickReference& f, float& roll, float& pitch) { roll = f.getRoll(); pitch = f.getPitch(); });
+
+	AttitudeEstimator plain;
+	plain.begin(rate);
+	auto angles = [](AttitudeEstimator& f, float& roll, float& pitch) { roll = f.getRoll(); pitch = f.getPitch(); };
+	ReplayResult resPlain = replay(log, rate, plain,
+		[](AttitudeEstimator& f, size_t i, const Sample& s) { f.update(s.gx, s.gy, s.gz, s.ax, s.ay, s.az); }, angles);
+
+	// Wheel speed comes in once per 100Hz control cycle, the IMU samples in between
+	AttitudeEstimator odo;
+	odo.begin(rate);
+	unsigned int perCycle = std::max(1, int(rate / 100 + 0.5f));
+	ReplayResult resOdo = replay(log, rate, odo, [perCycle](AttitudeEstimator& f, size_t i, const Sample& s) {
+		f.update(s.gx, s.gy, s.gz, s.ax, s.ay, s.az);
+		if((i+1) % perCycle == 0) f.setOdometryVelocity(0, s.v);
+	}, angles);
+
+	::printf("%-28s %10s %10s %10s %10s\n", "", "rms roll", "max roll", "rms pitch", "ns/update");
+	::printf("%-28s %10.3f %10.3f %10.3f %10.1f\n", "Madgwick", resMadgwick.rmsRoll, resMadgwick.maxRoll, resMadgwick.rmsPitch, resMadgwick.nsPerUpdate);
+	::printf("%-28s %10.3f %10.3f %10.3f %10.1f\n", "AttitudeEstimator", resPlain.rmsRoll, resPlain.maxRoll, resPlain.rmsPitch, resPlain.nsPerUpdate);
+	::printf("%-28s %10.3f %10.3f %10.3f %10.1f\n", "AttitudeEstimator, odometry", resOdo.rmsRoll, resOdo.maxRoll, resOdo.rmsPitch, resOdo.nsPerUpdate);
+
+	float bx, by, bz;
+	odo.getGyroBias(bx, by, bz);
+	::printf("\nEstimated gyro bias: %.2f %.2f %.2f deg/s\n", bx, by, bz);
+
+	return resOdo.rmsRoll <= resMadgwick.rmsRoll ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+// Runs bb::PIDController's relay autotune on a simulated D-O wheel speed loop, then compares the step responses of
+// D-O's default wheel gains with the gains autotune proposes.
+//
+// The plant is a DC motor driving a wheel in D-O's 50Hz drive loop, see WheelPlant.h.
+//
+// Usage: autotune [amplitude] [hysteresis]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+#include "WheelPlant.h"
+
+using namespace bb;
+
+static const float DT = WheelPlant::DT;
+
+struct StepResult { float iae, overshoot, finalError; };
+
+// Goal steps 0 -> 400 -> 800 -> 200 mm/s, 2s each. Overshoot in percent of the largest step.
+static StepResult stepResponse(float kp, float ki, float kd) {
+	WheelPlant wheel;
+	PIDController pid(wheel, wheel);
+	pid.setControlParameters(kp, ki, kd);
+	pid.setIBounds(-255, 255);
+	pid.reset();
+
+	static const float GOALS[] = { 400, 800, 200 };
+	StepResult r = { 0, 0, 0 };
+	float from = 0;
+	for(float goal: GOALS) {
+		pid.setGoal(goal);
+		for(int i=0; i<100; i++) {
+			wheel.advance();
+			pid.update();
+			r.iae += fabsf(goal - wheel.speed()) * DT;
+			float over = (wheel.speed() - goal) / (goal - from) * 100;
+			r.overshoot = fmaxf(r.overshoot, over);
+		}
+		r.finalError = fmaxf(r.finalError, fabsf(goal - wheel.speed()));
+		from = goal;
+	}
+	return r;
+}
+
+int main(int argc, char** argv) {
+	float amplitude = argc > 1 ? atof(argv[1]) : 60;
+	float hysteresis = argc > 2 ? atof(argv[2]) : 15;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	WheelPlant wheel;
+	PIDController pid(wheel, wheel);
+	pid.setIBounds(-255, 255);
+	pid.setControlBounds(-255, 255);
+	pid.reset();
+	pid.setGoal(400);
+	Result res = pid.startAutotune(amplitude, hysteresis, 600, 8);
+	if(res != RES_OK) {
+		::printf("startAutotune() failed: %s\n", errorMessage(res));
+		return 1;
+	}
+
+	int steps = 0;
+	while(pid.autotuneState() == PIDController::AUTOTUNE_RUNNING) {
+		wheel.advance();
+		pid.update();
+		steps++;
+	}
+	float ku, tu;
+	if(!pid.getAutotuneResult(ku, tu)) {
+		::printf("Autotune failed after %.2fs\n", steps * DT);
+		return 1;
+	}
+	::printf("Relay +-%.0f PWM, hysteresis %.0fmm/s: done after %.2fs, Ku %.4f, Tu %.3fs\n\n", amplitude, hysteresis, steps * DT, ku, tu);
+
+	struct Row { const char* name; float kp, ki, kd; } rows[4] = { { "D-O defaults", 0.06f, 0.8f, 0.0f } };
+	const PIDController::AutotuneRule rules[] = { PIDController::AUTOTUNE_ZN_PI, PIDController::AUTOTUNE_TL_PI, PIDController::AUTOTUNE_ZN_PID };
+	const char* names[] = { "Ziegler-Nichols PI", "Tyreus-Luyben PI", "Ziegler-Nichols PID" };
+	for(int i=0; i<3; i++) {
+		rows[i+1].name = names[i];
+		pid.autotuneGains(rules[i], rows[i+1].kp, rows[i+1].ki, rows[i+1].kd);
+	}
+
+	::printf("Goal steps 0 -> 400 -> 800 -> 200mm/s, 2s each\n");
+	::printf("%-22s %8s %8s %8s %12s %10s %14s\n", "", "kp", "ki", "kd", "IAE[mm]", "overshoot", "final err");
+	bool ok = true;
+	for(const Row& row: rows) {
+		StepResult r = stepResponse(row.kp, row.ki, row.kd);
+		::printf("%-22s %8.4f %8.4f %8.5f %12.1f %9.1f%% %10.1fmm/s\n", row.name, row.kp, row.ki, row.kd, r.iae, r.overshoot, r.finalError);
+		ok = ok && r.finalError < 20;
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+// Drives D-O's DOVelControlOutput and wheel speed controllers on two simulated wheels through a remote-like sequence
+// of speed and turn commands, once with the old linear acceleration ramp and once with the jerk limited profile, each
+// with and without feed-forward. Prints how closely the wheels follow the profiled speed, and the peak motor current
+// and PWM step, which is what shows up as current spikes on starts and stops. Fails if either wheel PID
+// commands more than full PWM.
+//
+// Built with ARDUINO_CYTRON_MOTION_2350_PRO for bb::Encoder, which DODriveController.h needs (see EncoderBenchmark).
+//
+// Usage: drive_profile [wheel_kv [wheel_ka]]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+#include "WheelPlant.h"
+#include "DODriveController.h"
+
+using namespace bb;
+
+static const float DT = WheelPlant::DT;
+static const float ACCEL = 2500, JERK = 10000; // D-O defaults
+
+// Speed and turn commands as from the remote: t until, mm/s, mm/s
+static const struct { float t, vel, rot; } COMMANDS[] = {
+	{ 0.5, 0, 0 }, { 3.5, 800, 0 }, { 6.5, 0, 0 }, { 8.5, -400, 0 }, { 10.5, 0, 300 }, { 12.5, 300, -200 }, { 15.0, 0, 0 }
+};
+
+struct DriveResult { float rmsErr, maxErr, maxCurrent, maxPWMStep, maxCommand; };
+
+static DriveResult drive(float jerk, float kv, float ka) {
+	WheelPlant left, right(false);
+	PIDController lSpeed(left, left), rSpeed(right, right);
+	for(PIDController* c: { &lSpeed, &rSpeed }) {
+		c->setControlParameters(0.06f, 0.8f, 0.0f);
+		c->setIBounds(-255, 255);
+		c->setControlBounds(-255, 255);
+		c->setAutoUpdate(false);
+		c->setGoal(0);
+		c->reset();
+	}
+	DOVelControlOutput velOut(lSpeed, rSpeed);
+	velOut.setAcceleration(ACCEL);
+	velOut.setJerk(jerk);
+	velOut.setFeedForward(kv, ka);
+	velOut.setMaxSpeed(1000);
+	velOut.reset();
+
+	DriveResult r = { 0, 0, 0, 0, 0 };
+	double sumSq = 0;
+	unsigned int n = 0, cmd = 0;
+	float lastL = 0, lastR = 0;
+	for(float t = 0; t < COMMANDS[sizeof(COMMANDS)/sizeof(COMMANDS[0]) - 1].t; t += DT) {
+		while(t >= COMMANDS[cmd].t) cmd++;
+		left.advance();
+		right.advance();
+		velOut.setGoalVelocity(COMMANDS[cmd].vel);
+		velOut.setGoalRotation(COMMANDS[cmd].rot);
+		velOut.set(0);
+		lSpeed.update();
+		rSpeed.update();
+
+		for(float err: { lSpeed.goal() - left.speed(), rSpeed.goal() - right.speed() }) {
+			sumSq += err*err;
+			r.maxErr = fmaxf(r.maxErr, fabsf(err));
+			n++;
+		}
+		r.maxCurrent = fmaxf(r.maxCurrent, fmaxf(fabsf(left.currentPWM()), fabsf(right.currentPWM())));
+		r.maxPWMStep = fmaxf(r.maxPWMStep, fmaxf(fabsf(left.pwm() - lastL), fabsf(right.pwm() - lastR)));
+		lastL = left.pwm();
+		lastR = right.pwm();
+	}
+	r.rmsErr = sqrt(sumSq / n);
+	r.maxCommand = fmaxf(left.maxCommand(), right.maxCommand());
+	return r;
+}
+
+int main(int argc, char** argv) {
+	// The plant's own model: PWM = (speed + tau * accel) / gain
+	float kv = argc > 1 ? atof(argv[1]) : 1.0f / WheelPlant::MOTOR_GAIN;
+	float ka = argc > 2 ? atof(argv[2]) : WheelPlant::MOTOR_TAU / WheelPlant::MOTOR_GAIN;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	const struct { const char* name; float jerk, kv, ka; } configs[] = {
+		{ "linear ramp", 0, 0, 0 },
+		{ "linear ramp + ff", 0, kv, ka },
+		{ "S-curve", JERK, 0, 0 },
+		{ "S-curve + ff", JERK, kv, ka }
+	};
+
+	::printf("accel %.0fmm/s^2, jerk %.0fmm/s^3, wheel_kv %.4f, wheel_ka %.5f, D-O default wheel PID\n", ACCEL, JERK, kv, ka);
+	::printf("%-20s %14s %14s %16s %14s\n", "", "RMS err[mm/s]", "max err[mm/s]", "peak current[%]", "max PWM step");
+	DriveResult results[4];
+	for(int i=0; i<4; i++) {
+		results[i] = drive(configs[i].jerk, configs[i].kv, configs[i].ka);
+		::printf("%-20s %14.1f %14.1f %16.1f %14.1f\n", configs[i].name, results[i].rmsErr, results[i].maxErr,
+		         results[i].maxCurrent / 255 * 100, results[i].maxPWMStep);
+	}
+
+	// Feed-forward goes into the control before its bounds, so the motors never get more than full PWM.
+	for(int i=0; i<4; i++) {
+		if(results[i].maxCommand > 255) {
+			::printf("FAILED: %s commands %.1f PWM\n", configs[i].name, results[i].maxCommand);
+			return 1;
+		}
+	}
+
+	// Without feed-forward the wheels lag so far behind that they never draw the current the acceleration takes, so
+	// current is compared between the two profiles with feed-forward.
+	bool ok = results[3].rmsErr < results[0].rmsErr / 2 && results[3].maxCurrent < results[1].maxCurrent &&
+	          results[3].maxPWMStep < results[1].maxPWMStep;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+// Drives bb::Encoder with simulated quadrature edges from a wheel turning slowly back and forth, and compares its raw
+// speed against the true speed - once as Encoder computes it from ISR edge timestamps, once the way it used to, from
+// the tick count difference between runloop cycles. Prints RMS and max error per speed range in ticks per second.
+//
+// Built with ARDUINO_CYTRON_MOTION_2350_PRO defined, because that is the path with LibBB's own encoder ISRs (the
+// others use the Encoder library, which is not available on the host).
+//
+// Usage: encoder [cycletime_us]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+#include <BBEncoder.h>
+#include <math.h>
+
+using namespace bb;
+
+static const uint8_t PIN_A = 2, PIN_B = 3;
+static const uint64_t SIM_STEP_US = 10;
+
+// Quadrature state for position k, in the order the ISR counts as forward
+static void setQuadrature(long k) {
+	static const uint8_t states[4][2] = { {0, 0}, {0, 1}, {1, 1}, {1, 0} };
+	const uint8_t* s = states[((k % 4) + 4) % 4];
+	// Only one of them changes per tick, so this is one edge
+	hostsim::setPinInput(PIN_A, s[0]);
+	hostsim::setPinInput(PIN_B, s[1]);
+}
+
+struct ErrorStats {
+	double sumSq = 0, max = 0;
+	unsigned long n = 0;
+	void add(double err) { sumSq += err*err; max = fmax(max, fabs(err)); n++; }
+	double rms() const { return n ? sqrt(sumSq / n) : 0; }
+};
+
+int main(int argc, char** argv) {
+	unsigned long cycleTime = argc > 1 ? strtoul(argv[1], nullptr, 10) : Runloop::DEFAULT_CYCLETIME;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	const double amplitudes[] = { 20, 100, 500, 2000 }; // peak speed in ticks per second
+	::printf("%lu us cycle time\n", cycleTime);
+	::printf("%12s %14s %14s %14s %14s\n", "peak[t/s]", "edge rms", "edge max", "cycle rms", "cycle max");
+
+	for(double amplitude: amplitudes) {
+		static Encoder* encoder = nullptr;
+		if(encoder == nullptr) encoder = new Encoder(PIN_A, PIN_B, Encoder::INPUT_SPEED, Encoder::UNIT_TICKS);
+
+		double pos = floor(encoder->presentPosition(true)) + 0.5;
+		long k = lround(floor(pos));
+		setQuadrature(k);
+		encoder->update();
+
+		ErrorStats edge, cycle;
+		long lastTicks = encoder->presentPosition(true);
+		uint64_t lastUS = hostsim::micros64(), nextCycleUS = lastUS + cycleTime;
+		const double period = 4.0; // s
+		uint64_t startUS = hostsim::micros64();
+
+		for(double t = 0; t < 3*period; t = (hostsim::micros64() - startUS) / 1e6) {
+			double v = amplitude * sin(2 * M_PI * t / period);
+			pos += v * SIM_STEP_US / 1e6;
+			hostsim::advanceMicros(SIM_STEP_US);
+			while(floor(pos) > k) setQuadrature(++k);
+			while(floor(pos) < k) setQuadrature(--k);
+
+			if(hostsim::micros64() < nextCycleUS) continue;
+			nextCycleUS += cycleTime;
+
+			encoder->update();
+			uint64_t us = hostsim::micros64();
+			long ticks = encoder->presentPosition(true);
+			double cycleSpeed = (ticks - lastTicks) * 1e6 / double(us - lastUS);
+			lastTicks = ticks;
+			lastUS = us;
+
+			if(t < 0.5) continue; // settle
+			edge.add(encoder->presentSpeed(true) - v);
+			cycle.add(cycleSpeed - v);
+		}
+
+		::printf("%12.0f %14.2f %14.2f %14.2f %14.2f\n", amplitude, edge.rms(), edge.max, cycle.rms(), cycle.max);
+	}
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+// Compares a set of bb::LowPassFilters, as the droids run them, against the implementation they replaced (history
+// shifted on every call, coefficients and sqrt(2) recomputed on every call in adaptive mode) and against one
+// bb::FilterBank holding all channels. Checks that all of them compute the same filter, then prints time per channel
+// and sample. Also checks the gain of a 4th order low pass and a notch at a few frequencies, and that the notch is
+// switched off while the sample rate is too low for it.
+//
+// Usage: filter [samples]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+#include "BenchStats.h"
+
+using namespace bb;
+
+static const unsigned int CHANNELS = 12;
+static const float RATE = 100.0f;
+
+// LowPassFilter as it was.
+class LegacyLowPassFilter {
+public:
+	LegacyLowPassFilter(float cutoff=100.0, float sampleFreq=0.1, bool adaptive=false) {
+		cutoff_ = cutoff;
+		adapt_ = adaptive;
+		dt_ = 1.0/sampleFreq;
+		tn1_ = -dt_;
+		for(int k = 0; k < 3; k++) x_[k] = y_[k] = 0;
+		computeCoefficients();
+	}
+
+	float filter(float xn) {
+		if(adapt_) computeCoefficients();
+		y_[0] = 0;
+		x_[0] = xn;
+		for(int k = 0; k < 2; k++) y_[0] += a_[k]*y_[k+1] + b_[k]*x_[k];
+		y_[0] += b_[2]*x_[2];
+		for(int k = 2; k > 0; k--) {
+			y_[k] = y_[k-1];
+			x_[k] = x_[k-1];
+		}
+		return y_[0];
+	}
+
+protected:
+	void computeCoefficients() {
+		float omega0 = 6.28318530718*cutoff_;
+		if(adapt_) {
+			float t = micros()/1.0e6;
+			dt_ = t - tn1_;
+			tn1_ = t;
+		}
+		float alpha = omega0*dt_;
+		float alphaSq = alpha*alpha;
+		float beta[] = {1, sqrt(2), 1};
+		float D = alphaSq*beta[0] + 2*alpha*beta[1] + 4*beta[2];
+		b_[0] = alphaSq/D;
+		b_[1] = 2*b_[0];
+		b_[2] = b_[0];
+		a_[0] = -(2*alphaSq*beta[0] - 8*beta[2])/D;
+		a_[1] = -(beta[0]*alphaSq - 2*beta[1]*alpha + 4*beta[2])/D;
+	}
+
+	float a_[2], b_[3];
+	float cutoff_, dt_, tn1_;
+	bool adapt_;
+	float x_[3], y_[3];
+};
+
+static float cutoffFor(unsigned int c) { return 5.0f + 2.5f * c; }
+
+static void makeInput(std::vector<float>& in, size_t samples) {
+	in.resize(samples * CHANNELS);
+	for(size_t i=0; i<samples; i++) {
+		for(unsigned int c=0; c<CHANNELS; c++) {
+			in[i*CHANNELS + c] = 100*sinf(i * 0.05f * (c+1)) + (random(2001) - 1000) * 0.01f;
+		}
+	}
+}
+
+template<typename F> static double nsPerChannelSample(size_t samples, F&& f) {
+	double best = 1e9;
+	for(int rep=0; rep<3; rep++) {
+		uint64_t t = benchNanos();
+		f();
+		best = fmin(best, double(benchNanos() - t) / (samples * CHANNELS));
+	}
+	return best;
+}
+
+template<typename Filter> static double runScalar(std::vector<Filter>& filters, const std::vector<float>& in, std::vector<float>& out, size_t samples, bool advanceClock) {
+	return nsPerChannelSample(samples, [&]() {
+		for(size_t i=0; i<samples; i++) {
+			if(advanceClock) hostsim::advanceMicros(10000 + (i % 7) * 10); // 100Hz, with a little jitter
+			for(unsigned int c=0; c<CHANNELS; c++) out[i*CHANNELS + c] = filters[c].filter(in[i*CHANNELS + c]);
+		}
+	});
+}
+
+static float maxDeviation(const std::vector<float>& a, const std::vector<float>& b) {
+	float dev = 0;
+	for(size_t i=0; i<a.size() && i<b.size(); i++) dev = fmaxf(dev, fabsf(a[i] - b[i]));
+	return dev;
+}
+
+// Steady state gain at freq, from the amplitude after the filter has settled.
+template<typename Bank> static float gainAt(Bank& bank, float freq) {
+	bank.reset();
+	float peak = 0;
+	for(unsigned int i=0; i<4000; i++) {
+		float v[1] = { sinf(2 * M_PI * freq * i / RATE) };
+		bank.filter(v);
+		if(i >= 3000) peak = fmaxf(peak, fabsf(v[0]));
+	}
+	return peak;
+}
+
+int main(int argc, char** argv) {
+	size_t samples = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	std::vector<float> in, outLegacy(samples * CHANNELS), outNew(samples * CHANNELS), outBank(samples * CHANNELS);
+	makeInput(in, samples);
+
+	std::vector<LegacyLowPassFilter> legacy, legacyAdaptive;
+	std::vector<LowPassFilter> lpf, lpfAdaptive;
+	FilterBank<CHANNELS> bank(RATE);
+	for(unsigned int c=0; c<CHANNELS; c++) {
+		legacy.push_back(LegacyLowPassFilter(cutoffFor(c), RATE));
+		legacyAdaptive.push_back(LegacyLowPassFilter(cutoffFor(c), RATE, true));
+		lpf.push_back(LowPassFilter(cutoffFor(c), RATE));
+		lpfAdaptive.push_back(LowPassFilter(cutoffFor(c), RATE, true));
+		bank.setLowPass(c, cutoffFor(c));
+	}
+
+	// Same filter - checked on the first repetition only, the state carries on after that
+	std::vector<LegacyLowPassFilter> legacyCheck = legacy;
+	std::vector<LowPassFilter> lpfCheck = lpf;
+	FilterBank<CHANNELS> bankCheck = bank;
+	for(size_t i=0; i<samples; i++) {
+		for(unsigned int c=0; c<CHANNELS; c++) {
+			outLegacy[i*CHANNELS + c] = legacyCheck[c].filter(in[i*CHANNELS + c]);
+			outNew[i*CHANNELS + c] = lpfCheck[c].filter(in[i*CHANNELS + c]);
+		}
+		bankCheck.filter(&in[i*CHANNELS], &outBank[i*CHANNELS]);
+	}
+	float devNew = maxDeviation(outLegacy, outNew), devBank = maxDeviation(outLegacy, outBank);
+
+	double tLegacy = runScalar(legacy, in, outLegacy, samples, false);
+	double tNew = runScalar(lpf, in, outNew, samples, false);
+	double tLegacyAdaptive = runScalar(legacyAdaptive, in, outLegacy, samples, true);
+	double tNewAdaptive = runScalar(lpfAdaptive, in, outNew, samples, true);
+	double tBank = nsPerChannelSample(samples, [&]() {
+		for(size_t i=0; i<samples; i++) bank.filter(&in[i*CHANNELS], &outBank[i*CHANNELS]);
+	});
+
+	::printf("%zu samples x %u channels at %.0fHz, %s\n", samples, CHANNELS, RATE, BB_FILTERBANK_SIMD ? "SIMD" : "scalar");
+	::printf("%-32s %10s %8s %14s\n", "", "ns/sample", "speedup", "max dev");
+	::printf("%-32s %10.2f %7.2fx %14s\n", "LowPassFilter, old", tLegacy, 1.0, "-");
+	::printf("%-32s %10.2f %7.2fx %14g\n", "LowPassFilter", tNew, tLegacy / tNew, devNew);
+	::printf("%-32s %10.2f %7.2fx %14s\n", "LowPassFilter adaptive, old", tLegacyAdaptive, tLegacy / tLegacyAdaptive, "-");
+	::printf("%-32s %10.2f %7.2fx %14s\n", "LowPassFilter adaptive", tNewAdaptive, tLegacy / tNewAdaptive, "-");
+	::printf("%-32s %10.2f %7.2fx %14g\n", "FilterBank", tBank, tLegacy / tBank, devBank);
+
+	FilterBank<1, 2> lp2(RATE), lp4(RATE), notch(RATE);
+	lp2.setLowPass(0, 10);
+	lp4.setLowPass(0, 10, 4);
+	notch.setNotch(0, 0, 25, 2);
+	::printf("\n%-10s %8s %8s %8s\n", "freq[Hz]", "LP2", "LP4", "notch25");
+	for(float f: { 2.0f, 10.0f, 20.0f, 25.0f, 40.0f }) {
+		::printf("%-10.0f %8.4f %8.4f %8.4f\n", f, gainAt(lp2, f), gainAt(lp4, f), gainAt(notch, f));
+	}
+
+	// A notch that drops out when the sample rate falls to its frequency, and comes back when it rises again
+	bool notchDropped = notch.setSampleFrequency(40) == RES_COMMON_OUT_OF_RANGE;
+	bool notchBack = notch.setSampleFrequency(RATE) == RES_OK && gainAt(notch, 25) < 0.01f;
+	::printf("notch25 at 40Hz sampling: %s, back at %.0fHz: %s\n", notchDropped ? "off" : "STILL ON", RATE,
+	         notchBack ? "on" : "STILL OFF");
+
+	bool ok = devNew < 1e-3f && devBank < 1e-3f && gainAt(notch, 25) < 0.01f && gainAt(lp4, 20) < gainAt(lp2, 20) &&
+	          notchDropped && notchBack;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,257 @@
+// Checks bb::Trajectory and compares it with what D-O's head did before.
+//
+// First some properties of the trajectory itself: a rest-to-rest move keeps to the velocity and acceleration limits
+// and takes as long as the most limited axis needs, all axes arrive together, and replanning in the middle of a move
+// doesn't jump.
+//
+// Then a remote session at 10 packets per second - the operator nodding, flicking the head around and rolling it,
+// then letting go - run at D-O's 100Hz control rate with the head stepped every HEAD_PERIOD cycles, as D-O's "head"
+// task is. Once the old way (remote offsets jump with every packet and anneal back linearly by a step computed from
+// the cycle time) and once through the trajectory, advanced by the time measured with micros() as DODroid::stepHead()
+// does now. Prints the largest goal step per head step, peak goal velocity and acceleration, how far the head lags
+// behind the operator, and how long it takes to get back to center after letting go.
+//
+// Finally bb::ServoControlOutput with trajectory limits, on a simulated servo (see DynamixelSim.h).
+//
+// Usage: head_trajectory [max_vel [max_accel]]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+#include "DynamixelSim.h"
+
+using namespace bb;
+
+static const float DT = 0.01;          // D-O control cycle
+static const unsigned int HEAD_PERIOD = 2; // cycles between runs of D-O's head task
+static const float PACKET_DT = 0.1;    // remote packet interval
+static const float RELEASE = 3.0;      // operator lets go of the head button
+static const float ANNEAL_DELAY = 0.3, ANNEAL_TIME = 0.5; // D-O defaults
+static const float END = 5.0;
+
+// Operator's head pitch, heading and roll at time t
+static void operatorHead(float t, float* prh) {
+	prh[0] = 20 * sinf(2 * M_PI * 0.5f * t);
+	prh[1] = t < 1.0f ? 0 : (t < 1.15f ? 40 * (t - 1.0f) / 0.15f : 40);
+	prh[2] = 10 * sinf(2 * M_PI * 0.8f * t);
+}
+
+static bool check(bool cond, const char* what) {
+	if(!cond) ::printf("  FAILED: %s\n", what);
+	return cond;
+}
+
+static bool trajectoryChecks(float maxVel, float maxAccel) {
+	bool ok = true;
+	Trajectory traj(3, maxVel, maxAccel);
+
+	// Rest to rest: the longest axis sets the pace, everything keeps to the limits and arrives together
+	float goals[3] = { 10, -60, 120 };
+	traj.moveTo(goals);
+	float expected = fmaxf(1.875f * 120 / maxVel, sqrtf(5.7735f * 120 / maxAccel));
+	::printf("  rest to rest over 10, -60, 120: %.3fs (expected %.3fs)\n", traj.duration(), expected);
+	ok = check(fabsf(traj.duration() - expected) < 0.01f, "duration of a move from rest") && ok;
+	float peakVel = 0, peakAccel = 0;
+	float arrived[3] = { -1, -1, -1 };
+	for(float t=DT; t<traj.duration() + 2*DT; t+=DT) {
+		traj.update(DT);
+		for(unsigned int i=0; i<3; i++) {
+			peakVel = fmaxf(peakVel, fabsf(traj.velocity(i)));
+			peakAccel = fmaxf(peakAccel, fabsf(traj.acceleration(i)));
+			if(arrived[i] < 0 && fabsf(traj.position(i) - goals[i]) < 0.001f * fabsf(goals[i])) arrived[i] = t;
+		}
+	}
+	::printf("  peak velocity %.1f (max %.1f), peak acceleration %.1f (max %.1f), arrivals %.2f %.2f %.2fs\n",
+	         peakVel, maxVel, peakAccel, maxAccel, arrived[0], arrived[1], arrived[2]);
+	ok = check(peakVel <= maxVel * 1.01f && peakAccel <= maxAccel * 1.01f, "limits on a move from rest") && ok;
+	ok = check(fabsf(arrived[0] - arrived[2]) < 2*DT && fabsf(arrived[1] - arrived[2]) < 2*DT, "axes arrive together") && ok;
+
+	// Replanning halfway, against the direction of motion: no jump, and the limits still hold
+	traj.reset(0.0f);
+	float there[3] = { 90, 90, 90 }, back[3] = { -30, 0, 30 };
+	traj.moveTo(there);
+	float half = traj.duration() / 2, maxJump = 0, maxVelJump = 0;
+	peakVel = peakAccel = 0;
+	for(float t=0; t<half; t+=DT) traj.update(DT);
+	for(unsigned int i=0; i<3; i++) {
+		float pos = traj.position(i), vel = traj.velocity(i);
+		Trajectory copy = traj;
+		copy.moveTo(back);
+		maxJump = fmaxf(maxJump, fabsf(copy.position(i) - pos));
+		maxVelJump = fmaxf(maxVelJump, fabsf(copy.velocity(i) - vel));
+	}
+	traj.moveTo(back);
+	while(!traj.done()) {
+		traj.update(DT);
+		for(unsigned int i=0; i<3; i++) {
+			peakVel = fmaxf(peakVel, fabsf(traj.velocity(i)));
+			peakAccel = fmaxf(peakAccel, fabsf(traj.acceleration(i)));
+		}
+	}
+	::printf("  replanned halfway: jump %.3f, velocity jump %.3f, peak velocity %.1f, peak acceleration %.1f, %.2fs\n",
+	         maxJump, maxVelJump, peakVel, peakAccel, traj.duration());
+	ok = check(maxJump < 1e-3f && maxVelJump < 1e-3f, "continuity when replanning") && ok;
+	ok = check(peakVel <= maxVel * 1.1f && peakAccel <= maxAccel * 1.1f, "limits when replanning") && ok;
+	for(unsigned int i=0; i<3; i++) ok = check(traj.position(i) == back[i], "goal reached after replanning") && ok;
+
+	return ok;
+}
+
+struct HeadResult { float maxStep, peakVel, peakAccel, rmsLag, centered; };
+
+static HeadResult head(bool smooth, float maxVel, float maxAccel) {
+	HeadResult r = { 0, 0, 0, 0, -1 };
+	Trajectory traj(3, maxVel, maxAccel);
+	float remote[3] = { 0, 0, 0 }, anneal[3] = { 0, 0, 0 };
+	float last[3] = { 0, 0, 0 }, lastVel[3] = { 0, 0, 0 };
+	float lagSum = 0;
+	unsigned int lagSamples = 0, steps = 0;
+	float nextPacket = 0;
+	bool annealing = false;
+	unsigned long lastMicros = micros();
+
+	for(unsigned int cycle=0; cycle*DT<END; cycle++, hostsim::advanceMicros(DT * 1e6)) {
+		float t = cycle*DT;
+
+		// Packets only while the button is held
+		if(t < RELEASE && t >= nextPacket) {
+			nextPacket += PACKET_DT;
+			float prh[3];
+			operatorHead(t, prh);
+			for(unsigned int i=0; i<3; i++) {
+				remote[i] = prh[i];
+				anneal[i] = fabsf(remote[i] / (ANNEAL_TIME / DT));
+			}
+			if(smooth) traj.moveTo(remote);
+		}
+
+		if(cycle % HEAD_PERIOD != 0) continue;
+
+		// The head task from here on
+		unsigned long now = micros();
+		float dt = (now - lastMicros) / 1e6;
+		lastMicros = now;
+
+		float goal[3];
+		if(smooth) {
+			traj.update(dt < 0.1 ? dt : 0.1);
+			for(unsigned int i=0; i<3; i++) goal[i] = traj.position(i);
+		} else {
+			for(unsigned int i=0; i<3; i++) goal[i] = remote[i];
+		}
+
+		for(unsigned int i=0; i<3; i++) {
+			float vel = dt > 0 ? (goal[i] - last[i]) / dt : 0;
+			r.maxStep = fmaxf(r.maxStep, fabsf(goal[i] - last[i]));
+			r.peakVel = fmaxf(r.peakVel, fabsf(vel));
+			if(steps > 1) r.peakAccel = fmaxf(r.peakAccel, fabsf(vel - lastVel[i]) / dt);
+			last[i] = goal[i];
+			lastVel[i] = vel;
+		}
+		steps++;
+		if(t < RELEASE) {
+			float prh[3];
+			operatorHead(t, prh);
+			for(unsigned int i=0; i<3; i++) lagSum += (goal[i] - prh[i]) * (goal[i] - prh[i]);
+			lagSamples += 3;
+		}
+		if(r.centered < 0 && t > RELEASE && fabsf(goal[0]) < 0.5f && fabsf(goal[1]) < 0.5f && fabsf(goal[2]) < 0.5f) {
+			r.centered = t - RELEASE;
+		}
+
+		// Annealing as DODroid::stepHead() does it
+		if(t >= RELEASE + ANNEAL_DELAY) {
+			if(smooth) {
+				if(!annealing) {
+					for(unsigned int i=0; i<3; i++) remote[i] = 0;
+					traj.moveTo(remote, ANNEAL_TIME);
+					annealing = true;
+				}
+			} else {
+				for(unsigned int i=0; i<3; i++) {
+					if(remote[i] > 0.5) remote[i] = fmaxf(remote[i] - anneal[i], 0);
+					else if(remote[i] < -0.5) remote[i] = fminf(remote[i] + anneal[i], 0);
+					else remote[i] = 0;
+				}
+			}
+		}
+	}
+	r.rmsLag = sqrtf(lagSum / lagSamples);
+	return r;
+}
+
+static void printHead(const char* name, const HeadResult& r) {
+	::printf("  %-12s %10.2f %12.0f %14.0f %10.2f %14.2f\n", name, r.maxStep, r.peakVel, r.peakAccel, r.rmsLag, r.centered);
+}
+
+// ServoControlOutput moving a simulated servo by 90 degrees, smoothed or not
+static bool servoOutput(float maxVel, float maxAccel) {
+	DynamixelSim sim;
+	sim.addServo(1, 1000000);
+	Servos& servos = Servos::servos;
+	servos.setPort(&sim);
+	if(servos.start() != RES_OK) {
+		::printf("  Servos::start() failed\n");
+		return false;
+	}
+	servos.setProfileVelocity(1, 0); // no profile in the servo, it follows the goals
+
+	bool ok = true;
+	for(bool smooth: { false, true }) {
+		ServoControlOutput out(1);
+		if(smooth) out.setTrajectoryLimits(maxVel, maxAccel);
+		float start = servos.presentPos(1), goal = start - 90, last = servos.goalPos(1), maxStep = 0, reached = -1;
+		for(float t=0; t<4.0f; t+=DT) {
+			out.set(goal);
+			maxStep = fmaxf(maxStep, fabsf(servos.goalPos(1) - last));
+			last = servos.goalPos(1);
+			servos.step();
+			hostsim::advanceMicros(DT * 1e6);
+			sim.update();
+			if(reached < 0 && fabsf(servos.presentPos(1) - goal) < 1) reached = t;
+		}
+		::printf("  %-12s largest goal step %.2f deg, within 1 deg of the goal after %.2fs\n",
+		         smooth ? "trajectory" : "direct", maxStep, reached);
+		if(smooth) {
+			ok = check(maxStep <= maxVel * DT * 1.1f, "goal steps within the velocity limit") && ok;
+			ok = check(reached > 0 && reached < 1.875f * 90 / maxVel + 0.2f, "servo reaches the goal in time") && ok;
+		}
+		out.set(start);
+		for(int i=0; i<300; i++) {
+			out.set(start);
+			servos.step();
+			hostsim::advanceMicros(DT * 1e6);
+			sim.update();
+		}
+	}
+	servos.stop();
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	float maxVel = argc > 1 ? atof(argv[1]) : 180;    // D-O defaults
+	float maxAccel = argc > 2 ? atof(argv[2]) : 720;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	::printf("Trajectory, max velocity %.0f, max acceleration %.0f:\n", maxVel, maxAccel);
+	bool ok = trajectoryChecks(maxVel, maxAccel);
+
+	::printf("\nHead under remote control, %.0f packets/s, %.0fHz control rate, head task every %u cycles:\n",
+	         1 / PACKET_DT, 1 / DT, HEAD_PERIOD);
+	::printf("  %-12s %10s %12s %14s %10s %14s\n", "", "step[deg]", "vel[deg/s]", "acc[deg/s^2]", "lag[deg]", "centered[s]");
+	HeadResult direct = head(false, maxVel, maxAccel), smooth = head(true, maxVel, maxAccel);
+	printHead("old", direct);
+	printHead("trajectory", smooth);
+	ok = check(smooth.maxStep < direct.maxStep / 2, "smaller goal steps") && ok;
+	ok = check(smooth.peakAccel <= maxAccel * 1.1f, "acceleration limit at the control rate") && ok;
+	ok = check(smooth.centered > 0 && smooth.centered <= ANNEAL_DELAY + ANNEAL_TIME + 2*HEAD_PERIOD*DT, "back to center in time") && ok;
+
+	::printf("\nServoControlOutput, 90 degrees:\n");
+	Servos::servos.initialize();
+	ok = servoOutput(maxVel, maxAccel) && ok;
+
+	::printf("%s\n", ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
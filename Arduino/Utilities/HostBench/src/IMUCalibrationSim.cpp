@@ -0,0 +1,83 @@
+// Feeds bb::IMUCalibration an hour of a simulated IMU warming up from 25 to 40C: gyro bias and accelerometer offset
+// drifting linearly with temperature, accelerometer scale errors, noise. The sensor rests in eight poses in turn,
+// with rotation and vibration in between, like a remote picked up and put down. Prints the fitted model next to the
+// truth, and the heading drift left over with a one-off calibration at boot and with the fitted model.
+//
+// Usage: imu_calibration [minutes]
+
+#include <Arduino.h>
+#include <LibBB.h>
+
+#include <random>
+
+using namespace bb;
+
+static const float RATE = 416.0f;
+
+static const float GYRO_BIAS[3] = { 0.8f, -0.5f, 0.3f }, GYRO_SLOPE[3] = { 0.03f, -0.02f, 0.04f };
+static const float ACCEL_OFFSET[3] = { 0.02f, -0.015f, 0.03f }, ACCEL_SLOPE[3] = { 0.0005f, -0.0003f, 0.0008f };
+static const float ACCEL_SCALE[3] = { 1.02f, 0.98f, 1.01f };
+
+static const float POSES[8][3] = {
+	{ 0, 0, 1 }, { 0, 0, -1 }, { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 },
+	{ 0.577f, 0.577f, 0.577f }, { -0.577f, 0.577f, -0.577f }
+};
+
+static float temperatureAt(float t) { return 25.0f + 15.0f * (1 - expf(-t / 900.0f)); }
+
+int main(int argc, char** argv) {
+	float minutes = argc > 1 ? atof(argv[1]) : 60;
+	std::mt19937 rng(7);
+	std::normal_distribution<float> gyroNoise(0, 0.07f), accelNoise(0, 0.001f), vibration(0, 0.05f), turn(0, 30.0f);
+
+	IMUCalibration cal;
+	float bootBias[3];
+	for(int i=0; i<3; i++) bootBias[i] = GYRO_BIAS[i]; // what IMU::calibrate() at 25C would have found
+
+	// Heading error accumulated while at rest after warm-up, which is where drift shows
+	double driftBoot = 0, driftModel = 0, restSeconds = 0;
+	size_t samples = size_t(minutes * 60 * RATE);
+	for(size_t n=0; n<samples; n++) {
+		float t = n / RATE, T = temperatureAt(t), dT = T - 25.0f;
+		float phase = fmodf(t, 80.0f);
+		bool still = phase < 60.0f;
+		const float* pose = POSES[size_t(t / 80.0f) % 8];
+
+		float gyro[3], accel[3];
+		for(int i=0; i<3; i++) {
+			float rate = still ? 0 : turn(rng);
+			gyro[i] = rate + GYRO_BIAS[i] + GYRO_SLOPE[i]*dT + gyroNoise(rng);
+			float a = still ? pose[i] : pose[i] + vibration(rng);
+			accel[i] = a / ACCEL_SCALE[i] + ACCEL_OFFSET[i] + ACCEL_SLOPE[i]*dT + accelNoise(rng);
+		}
+		cal.addSample(gyro, accel, T);
+
+		if(still && t > 600) {
+			float g[3] = { gyro[0], gyro[1], gyro[2] };
+			cal.correctGyro(g, T);
+			driftModel += (g[2]) / RATE;
+			driftBoot += (gyro[2] - bootBias[2]) / RATE;
+			restSeconds += 1 / RATE;
+		}
+	}
+
+	IMUCalibration::Model& m = cal.model();
+	float T = temperatureAt(minutes * 60);
+	::printf("%.0f minutes, %u stationary windows, %.1fC at the end\n\n", minutes, cal.stationaryWindows(), T);
+	::printf("%-16s %28s %28s\n", "", "fitted", "true");
+	::printf("%-16s %8.4f %8.4f %8.4f     %8.4f %8.4f %8.4f\n", "gyro bias", m.gyroBias[0], m.gyroBias[1], m.gyroBias[2], GYRO_BIAS[0], GYRO_BIAS[1], GYRO_BIAS[2]);
+	::printf("%-16s %8.4f %8.4f %8.4f     %8.4f %8.4f %8.4f\n", "gyro slope", m.gyroSlope[0], m.gyroSlope[1], m.gyroSlope[2], GYRO_SLOPE[0], GYRO_SLOPE[1], GYRO_SLOPE[2]);
+	::printf("%-16s %8.4f %8.4f %8.4f     %8.4f %8.4f %8.4f\n", "accel offset", m.accelOffset[0], m.accelOffset[1], m.accelOffset[2], ACCEL_OFFSET[0], ACCEL_OFFSET[1], ACCEL_OFFSET[2]);
+	::printf("%-16s %8.5f %8.5f %8.5f     %8.5f %8.5f %8.5f\n", "accel slope", m.accelSlope[0], m.accelSlope[1], m.accelSlope[2], ACCEL_SLOPE[0], ACCEL_SLOPE[1], ACCEL_SLOPE[2]);
+	::printf("%-16s %8.4f %8.4f %8.4f     %8.4f %8.4f %8.4f\n", "accel scale", m.accelScale[0], m.accelScale[1], m.accelScale[2], ACCEL_SCALE[0], ACCEL_SCALE[1], ACCEL_SCALE[2]);
+
+	::printf("\nHeading drift over %.0f minutes at rest after warm-up:\n", restSeconds / 60);
+	::printf("  calibrated at boot:   %8.1f deg\n", driftBoot);
+	::printf("  temperature model:    %8.1f deg\n", driftModel);
+
+	bool ok = fabs(driftModel) < fabs(driftBoot) / 10;
+	for(int i=0; i<3; i++) {
+		ok = ok && fabsf(m.gyroSlope[i] - GYRO_SLOPE[i]) < 0.005f && fabsf(m.accelScale[i] - ACCEL_SCALE[i]) < 0.005f;
+	}
+	return ok ? 0 : 1;
+}
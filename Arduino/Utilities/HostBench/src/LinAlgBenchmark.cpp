@@ -0,0 +1,191 @@
+// Checks bb::eulerToRot(), rotToEuler(), transformRotation() and transformVector() against the BasicLinearAlgebra
+// based implementation they replaced (three matrices multiplied per conversion, generic matrix inverse), with exact
+// and with fast trig, and prints the time per call for each.
+//
+// Usage: linalg [calls]
+
+#include <Arduino.h>
+#include <LibBB.h>
+
+#include <random>
+
+#include "BenchStats.h"
+
+using namespace bb;
+
+// The old implementation, with BLA::Matrix<3,3> spelled out as float[3][3] and BLA::Inverse as Gauss-Jordan
+// elimination with partial pivoting, which is what it does.
+namespace legacy {
+	struct Mat { float m[3][3]; };
+
+	static Mat mul(const Mat& a, const Mat& b) {
+		Mat c;
+		for(int i=0; i<3; i++) for(int j=0; j<3; j++) {
+			c.m[i][j] = 0;
+			for(int k=0; k<3; k++) c.m[i][j] += a.m[i][k]*b.m[k][j];
+		}
+		return c;
+	}
+
+	static Mat inverse(Mat a) {
+		Mat inv = {{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}};
+		for(int col=0; col<3; col++) {
+			int pivot = col;
+			for(int r=col+1; r<3; r++) if(fabsf(a.m[r][col]) > fabsf(a.m[pivot][col])) pivot = r;
+			std::swap(a.m[col], a.m[pivot]);
+			std::swap(inv.m[col], inv.m[pivot]);
+			float d = a.m[col][col];
+			for(int j=0; j<3; j++) { a.m[col][j] /= d; inv.m[col][j] /= d; }
+			for(int r=0; r<3; r++) {
+				if(r == col) continue;
+				float f = a.m[r][col];
+				for(int j=0; j<3; j++) { a.m[r][j] -= f*a.m[col][j]; inv.m[r][j] -= f*inv.m[col][j]; }
+			}
+		}
+		return inv;
+	}
+
+	static Mat eulerToRot(float p, float r, float h) {
+		Mat Ax = {{{1, 0, 0}, {0, (float)cos(DEG_TO_RAD*p), (float)-sin(DEG_TO_RAD*p)}, {0, (float)sin(DEG_TO_RAD*p), (float)cos(DEG_TO_RAD*p)}}};
+		Mat Ay = {{{(float)cos(DEG_TO_RAD*r), 0, (float)sin(DEG_TO_RAD*r)}, {0, 1, 0}, {(float)-sin(DEG_TO_RAD*r), 0, (float)cos(DEG_TO_RAD*r)}}};
+		Mat Az = {{{(float)cos(DEG_TO_RAD*h), (float)-sin(DEG_TO_RAD*h), 0}, {(float)sin(DEG_TO_RAD*h), (float)cos(DEG_TO_RAD*h), 0}, {0, 0, 1}}};
+		return mul(mul(Az, Ay), Ax);
+	}
+
+	static void rotToEuler(const Mat& A, float &p, float &r, float &h) {
+		float p1 = -asin(A.m[2][0]);
+		r = RAD_TO_DEG*atan2(A.m[2][1]/cos(p1), A.m[2][2]/cos(p1));
+		h = RAD_TO_DEG*atan2(A.m[1][0]/cos(p1), A.m[0][0]/cos(p1));
+		p = RAD_TO_DEG*p1;
+	}
+
+	static void transformRotation(float pIn, float rIn, float hIn, float pXf, float rXf, float hXf,
+	                              float& rOut, float& pOut, float& hOut, bool inverse) {
+		Mat A = eulerToRot(pIn, rIn, hIn), B = eulerToRot(pXf, rXf, hXf);
+		if(inverse) B = legacy::inverse(B);
+		float r, p, h;
+		rotToEuler(mul(B, A), r, p, h);
+		rOut = r; pOut = p; hOut = h;
+	}
+
+	static void transformVector(float xIn, float yIn, float zIn, float pXf, float rXf, float hXf,
+	                            float &xOut, float &yOut, float& zOut, bool inverse) {
+		Mat B = eulerToRot(pXf, rXf, hXf);
+		if(inverse) B = legacy::inverse(B);
+		xOut = B.m[0][0]*xIn + B.m[0][1]*yIn + B.m[0][2]*zIn;
+		yOut = B.m[1][0]*xIn + B.m[1][1]*yIn + B.m[1][2]*zIn;
+		zOut = B.m[2][0]*xIn + B.m[2][1]*yIn + B.m[2][2]*zIn;
+	}
+};
+
+// transformRotation() and transformVector() with fast trig, for comparison in one binary
+static void fastTransformRotation(float pIn, float rIn, float hIn, float pXf, float rXf, float hXf,
+                                  float& rOut, float& pOut, float& hOut, bool inverse) {
+	RotationMatrix A = RotationMatrix::fromEuler<true>(DEG_TO_RAD*pIn, DEG_TO_RAD*rIn, DEG_TO_RAD*hIn);
+	RotationMatrix B = RotationMatrix::fromEuler<true>(DEG_TO_RAD*pXf, DEG_TO_RAD*rXf, DEG_TO_RAD*hXf);
+	float rx, ry, rz;
+	(inverse ? B.transposed()*A : B*A).toEuler<true>(rx, ry, rz);
+	rOut = RAD_TO_DEG*ry; pOut = RAD_TO_DEG*rx; hOut = RAD_TO_DEG*rz;
+}
+
+static void fastTransformVector(float xIn, float yIn, float zIn, float pXf, float rXf, float hXf,
+                                float &xOut, float &yOut, float& zOut, bool inverse) {
+	RotationMatrix B = RotationMatrix::fromEuler<true>(DEG_TO_RAD*pXf, DEG_TO_RAD*rXf, DEG_TO_RAD*hXf);
+	Vector3 c = (inverse ? B.transposed() : B) * Vector3{xIn, yIn, zIn};
+	xOut = c.x; yOut = c.y; zOut = c.z;
+}
+
+// Angle difference in degrees, modulo 360
+static float angleDiff(float a, float b) {
+	float d = fmodf(fabsf(a - b), 360.0f);
+	return d > 180 ? 360 - d : d;
+}
+
+struct Case { float in[6]; bool inverse; };
+
+typedef void (*TransformFn)(float, float, float, float, float, float, float&, float&, float&, bool);
+
+static double nsPerCall(const std::vector<Case>& cases, TransformFn fn) {
+	float sink = 0;
+	double best = 1e9;
+	for(int rep=0; rep<3; rep++) {
+		uint64_t t = benchNanos();
+		for(const Case& c: cases) {
+			float a, b, d;
+			fn(c.in[0], c.in[1], c.in[2], c.in[3], c.in[4], c.in[5], a, b, d, c.inverse);
+			sink += a + b + d;
+		}
+		best = fmin(best, double(benchNanos() - t) / cases.size());
+	}
+	if(sink == 12345.678f) ::printf("\n");
+	return best;
+}
+
+static float maxDeviation(const std::vector<Case>& cases, TransformFn fn, TransformFn ref, bool angles) {
+	float dev = 0;
+	for(const Case& c: cases) {
+		float a, b, d, ra, rb, rd;
+		fn(c.in[0], c.in[1], c.in[2], c.in[3], c.in[4], c.in[5], a, b, d, c.inverse);
+		ref(c.in[0], c.in[1], c.in[2], c.in[3], c.in[4], c.in[5], ra, rb, rd, c.inverse);
+		if(angles) dev = fmaxf(dev, fmaxf(angleDiff(a, ra), fmaxf(angleDiff(b, rb), angleDiff(d, rd))));
+		else dev = fmaxf(dev, fmaxf(fabsf(a - ra), fmaxf(fabsf(b - rb), fabsf(d - rd))));
+	}
+	return dev;
+}
+
+int main(int argc, char** argv) {
+	size_t calls = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+
+	// Rotations stay away from +-90deg about y, where the Euler decomposition is not unique
+	std::mt19937 rng(17);
+	std::uniform_real_distribution<float> angle(-180, 180), tilt(-60, 60), unit(-1, 1);
+	std::vector<Case> rotCases, vecCases;
+	for(size_t i=0; i<calls; i++) {
+		rotCases.push_back(Case{{tilt(rng), tilt(rng)/2, angle(rng), tilt(rng)/2, tilt(rng)/2, angle(rng)/2}, (i & 1) != 0});
+		vecCases.push_back(Case{{unit(rng), unit(rng), unit(rng), angle(rng), tilt(rng), angle(rng)}, (i & 1) != 0});
+	}
+
+	// Round trip through the matrix, which keeps its odd argument order
+	float roundTrip = 0;
+	for(size_t i=0; i<1000; i++) {
+		float p = rotCases[i].in[0], r = rotCases[i].in[1], h = rotCases[i].in[2], r1, p1, h1;
+		rotToEuler(eulerToRot(p, r, h), r1, p1, h1);
+		roundTrip = fmaxf(roundTrip, fmaxf(angleDiff(p, p1), fmaxf(angleDiff(r, r1), angleDiff(h, h1))));
+	}
+
+	// Gimbal lock: the old code always answered -90 here; any answer must give back the same rotation
+	float gimbal = 0;
+	for(float ry: { -90.0f, 90.0f }) {
+		RotationMatrix A = eulerToRot(30, ry, 20);
+		float r1, p1, h1;
+		rotToEuler(A, r1, p1, h1);
+		RotationMatrix B = eulerToRot(p1, r1, h1);
+		for(int i=0; i<3; i++) for(int j=0; j<3; j++) gimbal = fmaxf(gimbal, fabsf(A.m[i][j] - B.m[i][j]));
+	}
+
+	float devRot = maxDeviation(rotCases, transformRotation, legacy::transformRotation, true);
+	float devVec = maxDeviation(vecCases, transformVector, legacy::transformVector, false);
+	float devRotFast = maxDeviation(rotCases, fastTransformRotation, legacy::transformRotation, true);
+	float devVecFast = maxDeviation(vecCases, fastTransformVector, legacy::transformVector, false);
+
+	double tRotLegacy = nsPerCall(rotCases, legacy::transformRotation);
+	double tRot = nsPerCall(rotCases, transformRotation);
+	double tRotFast = nsPerCall(rotCases, fastTransformRotation);
+	double tVecLegacy = nsPerCall(vecCases, legacy::transformVector);
+	double tVec = nsPerCall(vecCases, transformVector);
+	double tVecFast = nsPerCall(vecCases, fastTransformVector);
+
+	::printf("%zu calls each, half of them inverse\n", calls);
+	::printf("%-32s %10s %8s %12s\n", "", "ns/call", "speedup", "max dev");
+	::printf("%-32s %10.1f %7.2fx %12s\n", "transformRotation, BLA", tRotLegacy, 1.0, "-");
+	::printf("%-32s %10.1f %7.2fx %10.2e d\n", "transformRotation", tRot, tRotLegacy / tRot, devRot);
+	::printf("%-32s %10.1f %7.2fx %10.2e d\n", "transformRotation, fast trig", tRotFast, tRotLegacy / tRotFast, devRotFast);
+	::printf("%-32s %10.1f %7.2fx %12s\n", "transformVector, BLA", tVecLegacy, 1.0, "-");
+	::printf("%-32s %10.1f %7.2fx %12.2e\n", "transformVector", tVec, tVecLegacy / tVec, devVec);
+	::printf("%-32s %10.1f %7.2fx %12.2e\n", "transformVector, fast trig", tVecFast, tVecLegacy / tVecFast, devVecFast);
+	::printf("\nrotToEuler(eulerToRot()) round trip: max %.2e deg\n", roundTrip);
+	::printf("Gimbal lock, rotation reproduced to %.2e\n", gimbal);
+
+	bool ok = devRot < 1e-2f && devVec < 1e-5f && devRotFast < 1e-2f && devVecFast < 1e-4f && roundTrip < 1e-2f && gimbal < 1e-3f;
+	return ok ? 0 : 1;
+}
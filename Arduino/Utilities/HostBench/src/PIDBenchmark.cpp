@@ -0,0 +1,143 @@
+// Compares bb::PIDController with bb::StaticPIDController - with the same Butterworth derivative filter, with the
+// default first order filter, and with the Q16.16 backend - on a simulated DC motor speed loop. Prints time and
+// (on x86) TSC cycles per update, and how far each one's motor speed strays from PIDController's.
+//
+// The host has an FPU, so the Q16.16 numbers here say little about MCUs without one; they show the code is sound.
+//
+// Usage: pid [updates]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+#include "BenchStats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t benchCycles() { return __rdtsc(); }
+#else
+static inline uint64_t benchCycles() { return 0; }
+#endif
+
+using namespace bb;
+
+static const float DT = 0.01f;
+
+// First order DC motor at a fixed step, so that every controller sees exactly the same plant.
+class StepMotor final: public ControlInput, public ControlOutput {
+public:
+	StepMotor(): pwm_(0), speed_(0) {}
+	virtual Result set(float value) { pwm_ = constrain(value, -1.0f, 1.0f); return RES_OK; }
+	virtual float present() { return speed_; }
+	virtual Result update() { speed_ += (500.0f*pwm_ - speed_) * DT / 0.05f; return RES_OK; }
+protected:
+	float pwm_, speed_;
+};
+
+struct ButterworthOptions: public PIDOptions {
+	typedef PIDButterworthFilter DerivativeFilter;
+	static const bool BOUND_I = true;
+	static const bool BOUND_CONTROL = true;
+};
+struct FirstOrderOptions: public PIDOptions {
+	static const bool BOUND_I = true;
+	static const bool BOUND_CONTROL = true;
+};
+struct FixedPointOptions: public PIDFixedPointOptions {
+	static const bool BOUND_I = true;
+	static const bool BOUND_CONTROL = true;
+};
+
+static float goalAt(unsigned long i) {
+	switch((i / 200) % 4) {
+	case 0:  return 100;
+	case 1:  return 300;
+	case 2:  return -50;
+	default: return 0;
+	}
+}
+
+struct Result_ {
+	double ns, cycles;
+	std::vector<float> speeds;
+};
+
+// Same loop without a controller, to take the loop overhead out of the numbers.
+class NoController {
+public:
+	NoController(StepMotor& motor): motor_(motor) {}
+	void setControlParameters(float, float, float) {}
+	void setIBounds(float, float) {}
+	void setControlBounds(float, float) {}
+	void setGoal(float goal) { goal_ = goal; }
+	void reset() {}
+	void update() { motor_.update(); }
+protected:
+	StepMotor& motor_;
+	volatile float goal_;
+};
+
+template<typename C> static Result_ run(C& controller, StepMotor& motor, unsigned long updates) {
+	Result_ r;
+	r.speeds.reserve(updates);
+	controller.setControlParameters(0.004f, 0.02f, 0.00005f);
+	controller.setIBounds(-50, 50);
+	controller.setControlBounds(-1, 1);
+	controller.reset(); // PIDController measures dt from here
+
+	// Timed as a whole - reading the clock around every update would cost more than the update. Best of three.
+	r.ns = r.cycles = 1e9;
+	for(int rep=0; rep<3; rep++) {
+		uint64_t t = benchNanos(), c = benchCycles();
+		for(unsigned long i=0; i<updates; i++) {
+			controller.setGoal(goalAt(i));
+			hostsim::advanceMicros(DT * 1e6);
+			controller.update();
+			if(rep == 0) r.speeds.push_back(motor.present());
+		}
+		r.cycles = fmin(r.cycles, double(benchCycles() - c) / updates);
+		r.ns = fmin(r.ns, double(benchNanos() - t) / updates);
+	}
+	return r;
+}
+
+static float maxDeviation(const std::vector<float>& a, const std::vector<float>& b) {
+	float dev = 0;
+	for(size_t i=0; i<a.size() && i<b.size(); i++) dev = fmaxf(dev, fabsf(a[i] - b[i]));
+	return dev;
+}
+
+int main(int argc, char** argv) {
+	unsigned long updates = argc > 1 ? strtoul(argv[1], nullptr, 10) : 200000;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	StepMotor m0, m1, m2, m3, m4;
+	NoController none(m0);
+	PIDController legacy(m1, m1);
+	StaticPIDController<StepMotor, StepMotor, ButterworthOptions> butterworth(m2, m2, DT);
+	StaticPIDController<StepMotor, StepMotor, FirstOrderOptions> firstOrder(m3, m3, DT);
+	StaticPIDController<StepMotor, StepMotor, FixedPointOptions> fixedPoint(m4, m4, DT);
+
+	Result_ rNone = run(none, m0, updates);
+	Result_ rLegacy = run(legacy, m1, updates);
+	Result_ rButterworth = run(butterworth, m2, updates);
+	Result_ rFirstOrder = run(firstOrder, m3, updates);
+	Result_ rFixedPoint = run(fixedPoint, m4, updates);
+
+	for(Result_* r: { &rLegacy, &rButterworth, &rFirstOrder, &rFixedPoint }) {
+		r->ns -= rNone.ns;
+		r->cycles -= rNone.cycles;
+	}
+
+	::printf("%lu updates, speed steps between -50 and 300 ticks/s, loop overhead of %.1fns subtracted\n", updates, rNone.ns);
+	::printf("%-32s %10s %10s %10s %16s\n", "", "ns/update", "cycles", "speedup", "max dev[t/s]");
+	::printf("%-32s %10.1f %10.1f %9.2fx %16s\n", "PIDController", rLegacy.ns, rLegacy.cycles, 1.0, "-");
+	::printf("%-32s %10.1f %10.1f %9.2fx %16.4f\n", "StaticPIDController butterworth", rButterworth.ns, rButterworth.cycles, rLegacy.ns / rButterworth.ns, maxDeviation(rLegacy.speeds, rButterworth.speeds));
+	::printf("%-32s %10.1f %10.1f %9.2fx %16.4f\n", "StaticPIDController first order", rFirstOrder.ns, rFirstOrder.cycles, rLegacy.ns / rFirstOrder.ns, maxDeviation(rLegacy.speeds, rFirstOrder.speeds));
+	::printf("%-32s %10.1f %10.1f %9.2fx %16.4f\n", "StaticPIDController Q16.16", rFixedPoint.ns, rFixedPoint.cycles, rLegacy.ns / rFixedPoint.ns, maxDeviation(rLegacy.speeds, rFixedPoint.speeds));
+
+	::printf("Q16.16 against float, same filter: max dev %.4f ticks/s\n", maxDeviation(rFirstOrder.speeds, rFixedPoint.speeds));
+
+	return 0;
+}
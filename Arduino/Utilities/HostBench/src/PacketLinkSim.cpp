@@ -0,0 +1,205 @@
+// Runs two bb::PacketLinks - a remote and a droid - against each other over a channel that drops frames, at the rates
+// the Remote and D-O send at: control from the remote and state from the droid, each every 4th cycle at 100Hz.
+//
+// Every payload that comes out is checked byte for byte against what was sent with that sequence number, and every
+// record has to arrive unless both the frame it was sent in and the next one were lost (or the very first frame was;
+// then the receiver can't know it missed anything). Recoveries after more than one lost frame are counted separately.
+// Prints, per loss rate, bytes sent to the XBee - frames plus API overhead - against plain Packets, sent as the Remote
+// does by default outside link mode (control packets twice); how many records went out as deltas; and how many were
+// recovered from the next frame.
+//
+// Usage: packet_link [cycles]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+using namespace bb;
+
+static const unsigned int PERIOD = 4;   // cycles between packets, in each direction
+static const unsigned int CONTROL_SENDS = 2; // RRemote's default send_repeats of 1
+static const size_t API_OVERHEAD = 15;  // start, length and checksum, and the TX request header XBee::sendToXBee() adds
+static const HWAddress REMOTE = { 0x0013a200, 0x1 }, DROID = { 0x0013a200, 0x2 };
+
+static uint32_t rngState;
+static float random01() {
+	rngState = rngState * 1664525u + 1013904223u;
+	return (rngState >> 8) / float(1 << 24);
+}
+
+// One direction: what was sent with each sequence number, and what came out at the other end
+class Direction: public PacketReceiver {
+public:
+	Direction(PacketType type): type_(type) {
+		memset(this->sent_, 0, sizeof(sent_));
+		memset(arrived_, 0, sizeof(arrived_));
+		seq_ = 0;
+		frames_ = 0;
+		lastReceived_ = beforeLastReceived_ = receivedBefore_ = false;
+		mismatches_ = duplicates_ = delivered_ = missing_ = recoveredAfterGap_ = 0;
+	}
+
+	// Control: sticks moving slowly, buttons now and then. State: attitude and speed drifting, battery seldom.
+	Packet next(unsigned int cycle) {
+		Packet p(type_, type_ == PACKET_TYPE_CONTROL ? PACKET_SOURCE_LEFT_REMOTE : PACKET_SOURCE_DROID, seq_++);
+		memset(&p.payload, 0, sizeof(p.payload));
+		float t = cycle * 0.01f;
+		if(type_ == PACKET_TYPE_CONTROL) {
+			ControlPacket& c = p.payload.control;
+			c.axis0 = 512 + 400 * sinf(t * 0.7f);
+			c.axis1 = 512 + 300 * sinf(t * 0.3f);
+			c.axis2 = (cycle / 200) % 2 ? 900 : 512;
+			c.axis3 = c.axis4 = 512;
+			c.axis5 = 128 + 100 * sinf(t * 1.1f);
+			c.axis6 = c.axis7 = 128;
+			c.button0 = (cycle / 150) % 2;
+			c.button3 = (cycle / 330) % 3 == 0;
+			c.battery = 28 - (cycle / 3000) % 3;
+		} else {
+			StatePacket& s = p.payload.state;
+			s.driveMode = StatePacket::DRIVE_VEL;
+			s.speed = 300 * sinf(t * 0.5f);
+			s.pitch = 512 + 20 * sinf(t * 2.0f);
+			s.roll = 512 + 10 * sinf(t * 1.3f);
+			s.heading = uint16_t(cycle / 10) % 1024;
+			s.battCurrent = 10 + (cycle / 77) % 5;
+			s.battVoltage = 120 - (cycle / 5000) % 4;
+		}
+		return p;
+	}
+
+	// Before a frame goes out with p in it
+	void sending(const Packet& p) {
+		memcpy(sent_[p.seqnum], &p.payload, sizeof(p.payload));
+		arrived_[p.seqnum] = false;
+	}
+
+	// After it has been decoded or dropped. The record of the frame before has had both its chances now - in that frame
+	// and, as redundancy, in this one, if the receiver got any frame before and so can tell that it missed one.
+	void settle(const Packet& p, bool received) {
+		if(frames_ > 0 && !arrived_[lastSeq_] && (lastReceived_ || (received && receivedBefore_))) missing_++;
+		if(frames_ > 1 && received && !lastReceived_ && !beforeLastReceived_ && arrived_[lastSeq_]) recoveredAfterGap_++;
+		receivedBefore_ = receivedBefore_ || lastReceived_;
+		beforeLastReceived_ = lastReceived_;
+		lastReceived_ = received;
+		lastSeq_ = p.seqnum;
+		frames_++;
+	}
+
+	Result incomingPacket(const HWAddress& src, uint8_t rssi, Packet& packet) {
+		if(packet.type != type_) return RES_OK;
+		if(arrived_[packet.seqnum]) duplicates_++;
+		if(memcmp(sent_[packet.seqnum], &packet.payload, payloadSize()) != 0) mismatches_++;
+		arrived_[packet.seqnum] = true;
+		delivered_++;
+		return RES_OK;
+	}
+
+	size_t payloadSize() const { return type_ == PACKET_TYPE_CONTROL ? sizeof(ControlPacket) : sizeof(StatePacket); }
+
+	unsigned long mismatches_, duplicates_, delivered_, missing_, recoveredAfterGap_, frames_;
+
+protected:
+	PacketType type_;
+	uint8_t seq_, lastSeq_;
+	bool lastReceived_, beforeLastReceived_, receivedBefore_;
+	uint8_t sent_[MAX_SEQUENCE_NUMBER][sizeof(Packet().payload)];
+	bool arrived_[MAX_SEQUENCE_NUMBER];
+};
+
+struct LinkResult {
+	unsigned long frames, lost, bytes, plainBytes, records, deltas, recovered, recoveredAfterGap, decodeErrors;
+	unsigned long mismatches, duplicates, missing;
+};
+
+static LinkResult run(float loss, unsigned int cycles) {
+	PacketLink remote, droid;
+	remote.reset(DROID);
+	remote.setSending(true);
+	droid.reset(REMOTE);
+	droid.setSending(true);
+
+	Direction control(PACKET_TYPE_CONTROL), state(PACKET_TYPE_STATE);
+	std::vector<PacketReceiver*> toDroid = { &control }, toRemote = { &state };
+	LinkResult r;
+	memset(&r, 0, sizeof(r));
+
+	uint8_t buf[PacketLink::MAX_FRAME_SIZE];
+	for(unsigned int cycle=0; cycle<cycles; cycle++) {
+		// Remote on phase 0, droid on phase 1, as the Remote and D-O send
+		bool fromRemote = cycle % PERIOD == 0, fromDroid = cycle % PERIOD == 1;
+		if(!fromRemote && !fromDroid) continue;
+
+		PacketLink& link = fromRemote ? remote : droid;
+		PacketLink& peer = fromRemote ? droid : remote;
+		Direction& dir = fromRemote ? control : state;
+
+		Packet p = dir.next(cycle);
+		link.queue(p);
+		size_t len = link.encode(buf);
+		r.bytes += len + API_OVERHEAD;
+		r.plainBytes += (sizeof(Packet) + API_OVERHEAD) * (fromRemote ? CONTROL_SENDS : 1);
+
+		dir.sending(p);
+		bool received = random01() >= loss;
+		if(received) {
+			if(peer.decode(buf, len, 0, fromRemote ? toDroid : toRemote) != RES_OK) r.decodeErrors++;
+		} else {
+			r.lost++;
+		}
+		dir.settle(p, received);
+	}
+
+	for(PacketLink* l: { &remote, &droid }) {
+		const PacketLink::Stats& s = l->stats();
+		r.frames += s.framesSent;
+		r.records += s.recordsSent;
+		r.deltas += s.deltaRecordsSent;
+		r.recovered += s.recordsRecovered;
+		r.decodeErrors += s.decodeErrors;
+	}
+	for(Direction* d: { &control, &state }) {
+		r.mismatches += d->mismatches_;
+		r.duplicates += d->duplicates_;
+		r.missing += d->missing_;
+		r.recoveredAfterGap += d->recoveredAfterGap_;
+	}
+	return r;
+}
+
+int main(int argc, char** argv) {
+	unsigned int cycles = argc > 1 ? atoi(argv[1]) : 100000;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	::printf("%u cycles, PacketLink is %u bytes\n", cycles, (unsigned int)sizeof(PacketLink));
+	::printf("%6s %8s %8s %12s %8s %10s %10s %8s %8s %10s\n", "loss", "frames", "lost", "bytes/plain", "deltas",
+	         "recovered", "after gap", "errors", "missing", "mismatches");
+	bool ok = true;
+	for(float loss: { 0.0f, 0.05f, 0.2f, 0.5f }) {
+		rngState = 12345;
+		LinkResult r = run(loss, cycles);
+		::printf("%5.0f%% %8lu %8lu %12.2f %7.0f%% %10lu %10lu %8lu %8lu %10lu\n", loss * 100, r.frames, r.lost,
+		         double(r.bytes) / r.plainBytes, 100.0 * r.deltas / r.records, r.recovered, r.recoveredAfterGap,
+		         r.decodeErrors, r.missing, r.mismatches + r.duplicates);
+		if(r.mismatches != 0 || r.duplicates != 0) {
+			::printf("  FAILED: %lu payloads differ from what was sent, %lu delivered twice\n", r.mismatches, r.duplicates);
+			ok = false;
+		}
+		if(r.missing != 0) {
+			::printf("  FAILED: %lu records lost although the frame after them arrived\n", r.missing);
+			ok = false;
+		}
+		if(loss == 0 && (r.bytes >= r.plainBytes || r.recovered != 0 || r.decodeErrors != 0)) {
+			::printf("  FAILED: no smaller than plain packets, or recovering without loss\n");
+			ok = false;
+		}
+		if(loss >= 0.2f && r.recoveredAfterGap == 0) {
+			::printf("  FAILED: nothing recovered after more than one lost frame\n");
+			ok = false;
+		}
+	}
+
+	::printf("%s\n", ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
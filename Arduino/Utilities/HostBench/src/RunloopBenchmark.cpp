@@ -0,0 +1,304 @@
+// Runs bb::Runloop::start() on the host for a number of cycles, with a set of subsystems that
+// resembles the D-O control loop (PID controllers on a simulated drive, IMU-style filtering,
+// packet dispatch, multi-rate droid tasks, and the console), and prints the distribution of step() times per subsystem.
+//
+// Usage: runloop [cycles] [cycletime_us]
+//
+// Environment: BENCH_QUIET_CONSOLE=1 stops the periodic console command, BENCH_FIXED_PHASES=1 schedules
+// the droid tasks the way D-O used to divide its rate by hand (everything slow in the same cycle),
+// BENCH_SPIKE_EVERY=n makes every n-th head step blow the cycle budget, to check overrun attribution.
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+#include "BenchStats.h"
+
+#include <new>
+
+using namespace bb;
+
+// Count heap allocations, to check that the runloop cycle itself does not allocate.
+static unsigned long allocations = 0;
+
+void* operator new(size_t size) {
+	allocations++;
+	void* p = malloc(size);
+	if(p == nullptr) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t size) noexcept { (void)size; free(p); }
+
+// Subsystem base class that times its own step() on the host clock.
+class BenchSubsystem: public Subsystem {
+public:
+	BenchSubsystem(const char* name): samples_(name) { name_ = name; description_ = "Benchmark workload"; help_ = ""; }
+
+	virtual Result step() {
+		uint64_t t = benchNanos();
+		Result res = work();
+		samples_.add(benchNanos() - t);
+		return res;
+	}
+
+	virtual Result work() = 0;
+
+	BenchSamples& samples() { return samples_; }
+
+protected:
+	BenchSamples samples_;
+};
+
+// First order DC motor plant, driven by a PWM value in [-1..1], reporting wheel speed.
+class SimMotor: public ControlInput, public ControlOutput {
+public:
+	SimMotor(float gain, float tau): gain_(gain), tau_(tau), pwm_(0), speed_(0), lastUS_(micros()) {}
+
+	virtual Result set(float value) { pwm_ = constrain(value, -1.0f, 1.0f); return RES_OK; }
+	virtual float present() { return speed_; }
+	virtual Result update() {
+		unsigned long us = micros();
+		float dt = (us - lastUS_) / 1e6;
+		lastUS_ = us;
+		speed_ += (gain_*pwm_ - speed_) * dt / tau_;
+		return RES_OK;
+	}
+
+protected:
+	float gain_, tau_, pwm_, speed_;
+	unsigned long lastUS_;
+};
+
+// Unstable first order pitch plant, stabilized by moving the wheels.
+class SimPitch: public ControlInput, public ControlOutput {
+public:
+	SimPitch(): pitch_(2.0f), accel_(0), lastUS_(micros()) {}
+
+	virtual Result set(float value) { accel_ = value; return RES_OK; }
+	virtual float present() { return pitch_; }
+	virtual Result update() {
+		unsigned long us = micros();
+		float dt = (us - lastUS_) / 1e6;
+		lastUS_ = us;
+		pitch_ += (0.5f*pitch_ - 0.1f*accel_) * dt;
+		return RES_OK;
+	}
+
+protected:
+	float pitch_, accel_;
+	unsigned long lastUS_;
+};
+
+// Sets both wheel speed goals from a single control value.
+class SpeedGoalOutput: public ControlOutput {
+public:
+	SpeedGoalOutput(PIDController& l, PIDController& r): l_(l), r_(r) {}
+	virtual float present() { return (l_.present() + r_.present()) / 2; }
+	virtual Result set(float value) { l_.setGoal(value); r_.setGoal(value); return RES_OK; }
+protected:
+	PIDController &l_, &r_;
+};
+
+class ControlWorkload: public BenchSubsystem {
+public:
+	ControlWorkload():
+		BenchSubsystem("control"),
+		lMotor_(500, 0.05), rMotor_(500, 0.05),
+		lSpeed_(lMotor_, lMotor_), rSpeed_(rMotor_, rMotor_),
+		speedGoal_(lSpeed_, rSpeed_), balance_(pitch_, speedGoal_) {
+		lSpeed_.setControlParameters(0.002, 0.01, 0); lSpeed_.setControlBounds(-1, 1);
+		rSpeed_.setControlParameters(0.002, 0.01, 0); rSpeed_.setControlBounds(-1, 1);
+		balance_.setControlParameters(40, 1, 0.5); balance_.setControlBounds(-500, 500);
+		balance_.setGoal(0);
+	}
+
+	virtual Result work() {
+		pitch_.set(lMotor_.present() + rMotor_.present());
+		balance_.update();
+		lSpeed_.update();
+		rSpeed_.update();
+		return RES_OK;
+	}
+
+protected:
+	SimMotor lMotor_, rMotor_;
+	SimPitch pitch_;
+	PIDController lSpeed_, rSpeed_;
+	SpeedGoalOutput speedGoal_;
+	PIDController balance_;
+};
+
+class FilterWorkload: public BenchSubsystem {
+public:
+	FilterWorkload(): BenchSubsystem("filter"), t_(0) {
+		for(int i=0; i<NUM_FILTERS; i++) filters_[i] = LowPassFilter(10.0 + i, 100.0);
+		filters_[NUM_FILTERS-1].setAdaptive(true);
+	}
+
+	virtual Result work() {
+		t_ += 0.01;
+		for(int i=0; i<NUM_FILTERS; i++) {
+			out_[i] = filters_[i].filter(sinf(t_ * (i+1)) + 0.1f * (random(1000) / 1000.0f - 0.5f));
+		}
+		return RES_OK;
+	}
+
+protected:
+	static const int NUM_FILTERS = 6;
+	LowPassFilter filters_[NUM_FILTERS];
+	float out_[NUM_FILTERS];
+	float t_;
+};
+
+class PacketWorkload: public BenchSubsystem, public PacketReceiver {
+public:
+	PacketWorkload(): BenchSubsystem("packet"), received_(0), crcErrors_(0) {}
+
+	virtual Result work() {
+		Packet packet(PACKET_TYPE_CONTROL, PACKET_SOURCE_LEFT_REMOTE, Runloop::runloop.getSequenceNumber());
+		memset(&packet.payload, 0, sizeof(packet.payload));
+		for(int i=0; i<10; i++) packet.payload.control.setAxis(i, sinf(Runloop::runloop.getSequenceNumber() * 0.01f + i));
+		packet.crc = packet.calculateCRC();
+
+		if(packet.crc != packet.calculateCRC()) crcErrors_++;
+		else incomingPacket(HWAddress{0x13a200, 0x42424242}, 0, packet);
+		return RES_OK;
+	}
+
+	virtual Result incomingControlPacket(const HWAddress& src, PacketSource source, uint8_t rssi, uint8_t seqnum, const ControlPacket& packet) {
+		received_++;
+		// Same as the comm LED handling in D-O
+		if(commLEDOn_ == false) {
+			commLEDOn_ = true;
+			Runloop::runloop.scheduleTimedCallback(100, [=]{ commLEDOn_ = false; });
+		}
+		return RES_OK;
+	}
+
+	unsigned long received() { return received_; }
+
+protected:
+	unsigned long received_, crcErrors_;
+	bool commLEDOn_ = false;
+};
+
+// Busy-waits, standing in for work that takes a known amount of time.
+static void spin(uint64_t ns) {
+	uint64_t until = benchNanos() + ns;
+	while(benchNanos() < until);
+}
+
+// Runloop tasks with the rates and rough relative costs of D-O's head, drive, status and power protect
+// steps, and its SD card check and status pixel update as background work.
+class DroidTasks: public Subsystem {
+public:
+	DroidTasks() { name_ = "droid"; description_ = "Multi-rate tasks"; help_ = ""; }
+
+	virtual Result initialize() {
+		bool fixed = getenv("BENCH_FIXED_PHASES") != nullptr;
+		const char* spike = getenv("BENCH_SPIKE_EVERY");
+		spikeEvery_ = spike != nullptr ? strtoul(spike, nullptr, 10) : 0;
+
+		Runloop::runloop.addTask(this, "head", 2, [this](){
+			spin(++heads_ == spikeEvery_ ? 20000000 : 20000);
+			if(heads_ == spikeEvery_) heads_ = 0;
+		}, fixed ? 0 : AUTO_PHASE);
+		Runloop::runloop.addTask(this, "drive", 2, [](){ spin(15000); }, fixed ? 1 : AUTO_PHASE);
+		Runloop::runloop.addTask(this, "status", 4, [](){ spin(8000); }, fixed ? 0 : AUTO_PHASE);
+		Runloop::runloop.addTask(this, "power", 100, [](){ spin(30000); }, fixed ? 0 : AUTO_PHASE);
+		Runloop::runloop.addBackgroundTask(this, "sdcard", 1000000, [](){ spin(30000); });
+		Runloop::runloop.addBackgroundTask(this, "pixels", 0, [](){ spin(5000); });
+		return Subsystem::initialize();
+	}
+
+	virtual Result step() { return RES_OK; }
+
+protected:
+	unsigned long heads_ = 0, spikeEvery_ = 0;
+};
+
+// Registered first, so the time between two of its steps is one runloop cycle. As delays only
+// advance the simulated clock, this is the host time the whole cycle was busy, runloop overhead included.
+// Also counts the cycles in which anything was allocated on the heap.
+class CycleProbe: public Subsystem {
+public:
+	CycleProbe(): samples_("cycle"), lastNS_(0), lastAllocations_(0), allocatingCycles_(0) { name_ = "probe"; description_ = "Cycle probe"; help_ = ""; }
+
+	virtual Result step() {
+		uint64_t ns = benchNanos();
+		if(lastNS_ != 0) {
+			samples_.add(ns - lastNS_);
+			if(allocations != lastAllocations_) allocatingCycles_++;
+		}
+		lastNS_ = ns;
+		lastAllocations_ = allocations;
+		return RES_OK;
+	}
+
+	BenchSamples& samples() { return samples_; }
+	unsigned long allocatingCycles() { return allocatingCycles_; }
+
+protected:
+	BenchSamples samples_;
+	uint64_t lastNS_;
+	unsigned long lastAllocations_, allocatingCycles_;
+};
+
+int main(int argc, char** argv) {
+	unsigned long cycles = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+	unsigned long cycleTime = argc > 2 ? strtoul(argv[2], nullptr, 10) : Runloop::DEFAULT_CYCLETIME;
+
+	Serial.begin(115200);
+
+	static CycleProbe probe;
+	static ControlWorkload control;
+	static FilterWorkload filter;
+	static PacketWorkload packet;
+	static DroidTasks droid;
+
+	ConfigStorage::storage.initialize();
+	Console::console.initialize();
+	Console::console.start();
+	Runloop::runloop.initialize();
+	probe.initialize(); probe.start();
+	control.initialize(); control.start();
+	filter.initialize(); filter.start();
+	packet.initialize(); packet.start();
+	droid.initialize(); droid.start();
+
+	// Keep the console busy with a command every now and then, like a user would. Unless told otherwise,
+	// because that allocates.
+	if(getenv("BENCH_QUIET_CONSOLE") == nullptr) {
+		Runloop::runloop.scheduleTimedCallback(500, [](){ Serial.inject("status\n"); }, false);
+	}
+
+	probe.samples().reserve(cycles);
+	control.samples().reserve(cycles);
+	filter.samples().reserve(cycles);
+	packet.samples().reserve(cycles);
+
+	Runloop::runloop.setCycleTimeMicros(cycleTime);
+	Runloop::runloop.setMaxCycles(cycles);
+
+	uint64_t startNS = benchNanos();
+	unsigned long startAllocations = allocations;
+	Runloop::runloop.start();
+	uint64_t totalNS = benchNanos() - startNS;
+
+	::printf("%lu cycles at %luus cycle time, %.1fms simulated, %.1fms host time, %lu control packets received\n",
+		cycles, cycleTime, hostsim::micros64() / 1000.0, totalNS / 1e6, packet.received());
+	::printf("%lu heap allocations, in %lu cycles\n\n", allocations - startAllocations, probe.allocatingCycles());
+	BenchSamples::printHeader();
+	control.samples().print();
+	filter.samples().print();
+	packet.samples().print();
+	probe.samples().print();
+
+	::printf("\n");
+	Serial.setEcho(stdout);
+	Runloop::runloop.printTiming(Console::console.serialStream());
+
+	return 0;
+}
@@ -0,0 +1,255 @@
+// Runs bb::ServoBus and bb::Servos against a simulated Dynamixel bus (see DynamixelSim.h), instead of the hand-run
+// DynamixelBenchmark sketch on real servos.
+//
+// First measures how long one cycle - all goal positions out, present load, velocity and position of every servo
+// in - takes on the wire for each read strategy and servo count, and what cycle rate that allows. For comparison,
+// the same with one Read and one Write instruction per servo. Then again with packet loss, counting failed cycles.
+// Then starts bb::Servos on the simulated bus - detection at 57600bps and switching to 1Mbps, falling back to
+// Sync Read for firmware without Fast Sync Read, mixing X series and XL-320 servos with their different control tables
+// - and checks that streamed goals are reached. Finally, how much spreading servos over several buses gains.
+//
+// Times are simulated wire time, not host CPU time.
+//
+// Usage: servo_bus [baud [return_delay_us [packet_loss]]]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+#include "DynamixelSim.h"
+
+using namespace bb;
+
+static const unsigned int CYCLES = 500;
+static const unsigned int SERVO_COUNTS[] = { 4, 8, 12, 16, 24, 32 };
+
+struct CycleResult { float micros, txBytes, rxBytes, failedPercent; };
+
+static void setupBus(DynamixelSim& sim, ServoBus& bus, unsigned int n, unsigned long baud, unsigned long returnDelay) {
+	sim.clear();
+	sim.begin(baud);
+	bus.clear();
+	for(unsigned int id=1; id<=n; id++) {
+		DynamixelSim::Servo& s = sim.addServo(id, baud);
+		s.table[DynamixelSim::ADDR_RETURN_DELAY_TIME] = returnDelay / 2;
+		bus.addServo(id);
+	}
+	// Same items as bb::Servos
+	bus.setWriteItem(ServoBus::ITEM_PROFILE_VELOCITY, 112, 4);
+	bus.setWriteItem(ServoBus::ITEM_GOAL_POSITION, 116, 4);
+	bus.setWriteItem(ServoBus::ITEM_GOAL_VELOCITY, 104, 4);
+	bus.setWriteItem(ServoBus::ITEM_GOAL_CURRENT, 102, 2);
+	bus.setReadBlock(126, 10);
+	bus.setReturnDelay(returnDelay);
+	bus.startCycle();
+	bus.wait();
+}
+
+// Every cycle moves every servo's goal position, the worst case for writes.
+static CycleResult cycles(DynamixelSim& sim, ServoBus& bus, ServoBus::ReadStrategy strategy, unsigned int n,
+                          unsigned long baud, unsigned long returnDelay, float loss) {
+	setupBus(sim, bus, n, baud, returnDelay);
+	bus.setReadStrategy(strategy);
+	sim.setPacketLoss(loss);
+
+	unsigned long tx = bus.bytesSent(), rx = bus.bytesReceived(), failed = bus.failedTransactions();
+	uint64_t micros = 0;
+	for(unsigned int c=0; c<CYCLES; c++) {
+		for(unsigned int id=1; id<=n; id++) bus.setGoal(id, ServoBus::ITEM_GOAL_POSITION, 1024 + (c*7 + id*31) % 2048);
+		uint64_t start = hostsim::micros64();
+		bus.startCycle();
+		bus.wait();
+		micros += hostsim::micros64() - start;
+	}
+	sim.setPacketLoss(0);
+
+	CycleResult r;
+	r.micros = float(micros) / CYCLES;
+	r.txBytes = float(bus.bytesSent() - tx) / CYCLES;
+	r.rxBytes = float(bus.bytesReceived() - rx) / CYCLES;
+	r.failedPercent = 100.0f * (bus.failedTransactions() - failed) / CYCLES;
+	return r;
+}
+
+// The same goals and present values with one Write and one Read instruction per servo, waiting for each status.
+static CycleResult unicastCycles(DynamixelSim& sim, ServoBus& bus, unsigned int n, unsigned long baud,
+                                 unsigned long returnDelay, float loss) {
+	setupBus(sim, bus, n, baud, returnDelay);
+	sim.setPacketLoss(loss);
+
+	unsigned long tx = bus.bytesSent(), rx = bus.bytesReceived(), failed = 0;
+	uint64_t micros = 0;
+	for(unsigned int c=0; c<CYCLES; c++) {
+		uint64_t start = hostsim::micros64();
+		bool ok = true;
+		for(unsigned int id=1; id<=n; id++) {
+			int32_t value;
+			if(bus.write(id, 116, 4, 1024 + (c*7 + id*31) % 2048) != RES_OK) ok = false;
+			if(bus.read(id, 132, 4, value) != RES_OK) ok = false;
+		}
+		if(!ok) failed++;
+		micros += hostsim::micros64() - start;
+	}
+	sim.setPacketLoss(0);
+
+	CycleResult r;
+	r.micros = float(micros) / CYCLES;
+	r.txBytes = float(bus.bytesSent() - tx) / CYCLES;
+	r.rxBytes = float(bus.bytesReceived() - rx) / CYCLES;
+	r.failedPercent = 100.0f * failed / CYCLES;
+	return r;
+}
+
+static void printResult(const char* name, unsigned int n, const CycleResult& r) {
+	::printf("%-12s %6u %10.1f %10.1f %12.0f %10.0f %10.1f%%\n", name, n, r.txBytes, r.rxBytes, r.micros, 1e6f / r.micros, r.failedPercent);
+}
+
+// Starts bb::Servos on the given buses, one ServoPort each.
+static Result startServos(const std::vector<DynamixelSim*>& buses) {
+	Servos& servos = Servos::servos;
+	servos.setPort(buses[0]);
+	for(size_t b=1; b<buses.size(); b++) servos.addPort(buses[b]);
+	return servos.start();
+}
+
+// bb::Servos end to end: detect, switch baud rate, stream goals at 100Hz, check they are reached.
+static bool servosRun(const char* name, const std::vector<DynamixelSim*>& buses, ServoBus::ReadStrategy expected) {
+	static const float GOALS[] = { 90, 135, 200, 270 };
+
+	Servos& servos = Servos::servos;
+	Result res = startServos(buses);
+	if(res != RES_OK) {
+		::printf("  Servos::start() failed: %s\n", errorMessage(res));
+		return false;
+	}
+	bool ok = true;
+	std::vector<uint8_t> ids;
+	for(size_t b=0; b<buses.size(); b++) {
+		for(auto& s: buses[b]->servos()) {
+			ids.push_back(s.id);
+			if(s.baud != 1000000) {
+				::printf("  servo #%d is at %lubps\n", s.id, s.baud);
+				ok = false;
+			}
+			if(servos.busOf(s.id) != int(b)) {
+				::printf("  servo #%d is on bus %d instead of %d\n", s.id, servos.busOf(s.id), int(b));
+				ok = false;
+			}
+		}
+		if(servos.bus(b).activeReadStrategy() != expected) {
+			::printf("  bus %d: read strategy %d, expected %d\n", int(b), servos.bus(b).activeReadStrategy(), expected);
+			ok = false;
+		}
+	}
+
+	unsigned long transactions = 0, failed = 0, written = 0, skipped = 0;
+	for(unsigned int b=0; b<servos.numBuses(); b++) {
+		ServoBus& bus = servos.bus(b);
+		transactions -= bus.transactions(); failed -= bus.failedTransactions();
+		written -= bus.goalsWritten(); skipped -= bus.goalsSkipped();
+	}
+	for(uint8_t id: ids) servos.setProfileVelocity(id, 90);
+	for(int step=0; step<300; step++) {
+		for(uint8_t id: ids) servos.setGoalPos(id, GOALS[id % 4]);
+		servos.step();
+		hostsim::advanceMicros(10000);
+		for(auto sim: buses) sim->update();
+	}
+	for(uint8_t id: ids) {
+		float err = servos.presentPos(id) - GOALS[id % 4];
+		if(fabsf(err) > 1) {
+			::printf("  servo #%d at %.1f instead of %.1f\n", id, servos.presentPos(id), GOALS[id % 4]);
+			ok = false;
+		}
+	}
+	for(unsigned int b=0; b<servos.numBuses(); b++) {
+		ServoBus& bus = servos.bus(b);
+		transactions += bus.transactions(); failed += bus.failedTransactions();
+		written += bus.goalsWritten(); skipped += bus.goalsSkipped();
+	}
+	::printf("  %s: 300 steps, %lu transactions, %lu failed, %lu goals written, %lu skipped\n",
+	         name, transactions, failed, written, skipped);
+
+	servos.stop();
+	return ok;
+}
+
+// Time for one blocking bb::Servos::write() moving every servo, with n servos spread evenly over the buses.
+static float shardedWrite(std::vector<DynamixelSim>& sims, unsigned int n, unsigned int numBuses) {
+	std::vector<DynamixelSim*> buses;
+	for(unsigned int b=0; b<numBuses; b++) {
+		sims[b].clear();
+		buses.push_back(&sims[b]);
+	}
+	for(unsigned int id=1; id<=n; id++) sims[id % numBuses].addServo(id, 1000000);
+
+	Servos& servos = Servos::servos;
+	if(startServos(buses) != RES_OK) return 0;
+	uint64_t micros = 0;
+	for(unsigned int c=0; c<CYCLES; c++) {
+		for(unsigned int id=1; id<=n; id++) servos.setGoalPos(id, 90 + (c*7 + id*31) % 180);
+		uint64_t start = hostsim::micros64();
+		servos.write();
+		micros += hostsim::micros64() - start;
+	}
+	servos.stop();
+	return float(micros) / CYCLES;
+}
+
+int main(int argc, char** argv) {
+	unsigned long baud = argc > 1 ? atol(argv[1]) : 1000000;
+	unsigned long returnDelay = argc > 2 ? atol(argv[2]) : 10; // what bb::Servos sets
+	float loss = argc > 3 ? atof(argv[3]) : 0.01f;
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.setEcho(nullptr);
+
+	DynamixelSim sim;
+	ServoBus bus(&sim);
+	const struct { const char* name; ServoBus::ReadStrategy strategy; } strategies[] = {
+		{ "sync", ServoBus::READ_SYNC }, { "bulk", ServoBus::READ_BULK }, { "fast sync", ServoBus::READ_FAST_SYNC }
+	};
+
+	for(float l: { 0.0f, loss }) {
+		::printf("%lubps, return delay %luus, packet loss %.1f%%, %u cycles\n", baud, returnDelay, l * 100, CYCLES);
+		::printf("%-12s %6s %10s %10s %12s %10s %11s\n", "strategy", "servos", "tx[B]", "rx[B]", "cycle[us]", "max[Hz]", "failed");
+		for(unsigned int n: SERVO_COUNTS) {
+			for(auto& s: strategies) printResult(s.name, n, cycles(sim, bus, s.strategy, n, baud, returnDelay, l));
+			printResult("unicast", n, unicastCycles(sim, bus, n, baud, returnDelay, l));
+		}
+		::printf("\n");
+	}
+
+	::printf("bb::Servos, 4 servos at 57600bps:\n");
+	Servos::servos.initialize();
+	std::vector<DynamixelSim> sims(3);
+	bool ok = true;
+	for(bool fastSyncRead: { true, false }) {
+		sim.clear();
+		for(uint8_t id=1; id<=4; id++) sim.addServo(id, 57600).fastSyncRead = fastSyncRead;
+		ok = servosRun(fastSyncRead ? "fast sync" : "sync", { &sim }, fastSyncRead ? ServoBus::READ_FAST_SYNC : ServoBus::READ_SYNC) && ok;
+	}
+	// Different control tables on one bus need Bulk Read; XL430 has present load instead of current.
+	sim.clear();
+	sim.addServo(1, 57600, DynamixelSim::MODEL_XM430_W350);
+	sim.addServo(2, 57600, DynamixelSim::MODEL_XM430_W350);
+	sim.addServo(3, 57600, DynamixelSim::MODEL_XL430_W250);
+	sim.addServo(4, 57600, DynamixelSim::MODEL_XL320);
+	ok = servosRun("mixed models", { &sim }, ServoBus::READ_BULK) && ok;
+	// Two buses, each with its own set of servos
+	sims[0].clear();
+	sims[1].clear();
+	for(uint8_t id=1; id<=8; id++) sims[id % 2].addServo(id, 57600);
+	ok = servosRun("two buses", { &sims[0], &sims[1] }, ServoBus::READ_FAST_SYNC) && ok;
+
+	::printf("\nbb::Servos::write(), moving all servos, fast sync read at 1Mbps:\n");
+	::printf("%6s %12s %12s %12s\n", "servos", "1 bus[us]", "2 buses[us]", "3 buses[us]");
+	for(unsigned int n: { 12, 24, 32 }) {
+		float t[3];
+		for(unsigned int b=0; b<3; b++) t[b] = shardedWrite(sims, n, b+1);
+		::printf("%6u %12.0f %12.0f %12.0f\n", n, t[0], t[1], t[2]);
+		// Sending stays sequential, so every extra bus gains less than the one before
+		if(t[0] == 0 || t[1] == 0 || t[2] == 0 || t[1] >= t[0] || t[2] >= t[0]) ok = false;
+	}
+	::printf("%s\n", ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
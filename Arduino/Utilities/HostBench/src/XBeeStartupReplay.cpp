@@ -0,0 +1,240 @@
+// Replays scripted XBee modem transcripts against bb::XBee's startup sequence: a cold boot, a warm boot from
+// the cached configuration, a warm boot with a different module of the same rate, and a warm boot with a module
+// that has been reset to factory settings. The simulated module only understands the firmware at its own rate,
+// only takes "+++" after the guard time, and checks every command it gets against the transcript.
+//
+// XBee::stepIfNotStarted() is called once per simulated runloop cycle and must never delay. Prints how long
+// each startup took in simulated time and exits with 1 if anything differs from the transcript.
+//
+// Usage: xbee_replay [cycletime_us]
+
+#include <Arduino.h>
+#include <LibBB.h>
+#include <HostSim.h>
+
+using namespace bb;
+
+struct Exchange {
+	const char* command; // what the firmware sends, without the trailing '\r'
+	const char* reply;   // what the module answers, without the trailing '\r'. NULL if it ignores the command
+};
+
+// A simulated XBee on Serial1 that follows a transcript.
+class SimXBee {
+public:
+	SimXBee(): bps_(9600), guardTime_(1000), addrLo_(0), cmdMode_(false), pendingBPS_(0), lastRxUS_(0), okAtUS_(0), transcript_(nullptr), len_(0), pos_(0), errors_(0) {
+		Serial1.setTransmitHandler([this](const uint8_t* buf, size_t size) { receive(buf, size); });
+	}
+
+	// Swap in a module with the given rate, guard time and serial number
+	void replace(unsigned long bps, uint16_t guardTime, uint32_t addrLo) { bps_ = bps; guardTime_ = guardTime; addrLo_ = addrLo; chan_ = 0xc; powerCycle(); }
+	void powerCycle() { cmdMode_ = false; pendingBPS_ = 0; line_ = ""; okAtUS_ = 0; lastRxUS_ = hostsim::micros64(); }
+
+	void setTranscript(const Exchange* transcript, size_t len) { transcript_ = transcript; len_ = len; pos_ = 0; errors_ = 0; }
+	bool transcriptDone() const { return pos_ == len_; }
+	unsigned int errors() const { return errors_; }
+
+	// Call regularly; sends the delayed "OK" for "+++".
+	void update() {
+		if(okAtUS_ != 0 && hostsim::micros64() >= okAtUS_) {
+			okAtUS_ = 0;
+			cmdMode_ = true;
+			expect("+++", "OK");
+		}
+	}
+
+protected:
+	void receive(const uint8_t* buf, size_t size) {
+		uint64_t now = hostsim::micros64();
+		uint64_t silence = now - lastRxUS_;
+		lastRxUS_ = now;
+		okAtUS_ = 0; // anything sent within the guard time after "+++" cancels it
+
+		if(Serial1.baudRate() != bps_) return; // garbage at the wrong rate
+
+		if(!cmdMode_) {
+			if(size == 3 && !memcmp(buf, "+++", 3)) {
+				if(silence >= guardTime_ * 1000ULL) okAtUS_ = now + guardTime_ * 1000ULL;
+				else expect("+++", NULL);
+			}
+			return;
+		}
+
+		for(size_t i=0; i<size; i++) {
+			if(buf[i] != '\r') { line_ += (char)buf[i]; continue; }
+			command(line_);
+			line_ = "";
+		}
+	}
+
+	void command(const String& cmd) {
+		char buf[32];
+		const char* reply = "OK";
+		if(cmd == "ATSH") reply = "13A200";
+		else if(cmd == "ATSL") { snprintf(buf, sizeof(buf), "%X", addrLo_); reply = buf; }
+		else if(cmd == "ATVR") reply = "2003";
+		else if(cmd == "ATCT") reply = "64";
+		else if(cmd == "ATRR") reply = "A";
+		else if(cmd == "ATCH") { snprintf(buf, sizeof(buf), "%X", chan_); reply = buf; }
+		else if(cmd == "ATID") { snprintf(buf, sizeof(buf), "%X", pan_); reply = buf; }
+		else if(cmd.startsWith("ATCH=")) chan_ = strtoul(cmd.c_str()+5, nullptr, 16);
+		else if(cmd.startsWith("ATID=")) pan_ = strtoul(cmd.c_str()+5, nullptr, 16);
+		else if(cmd.startsWith("ATBD=")) pendingBPS_ = bpsForParam(strtoul(cmd.c_str()+5, nullptr, 16));
+		else if(cmd.startsWith("ATGT=")) guardTime_ = strtoul(cmd.c_str()+5, nullptr, 16);
+		else if(cmd == "ATCN") {
+			cmdMode_ = false;
+			if(pendingBPS_ != 0) bps_ = pendingBPS_;
+			pendingBPS_ = 0;
+		}
+		expect(cmd.c_str(), reply);
+	}
+
+	// Checks that the firmware sent what the transcript says, and answers with the transcript's reply.
+	void expect(const char* cmd, const char* reply) {
+		if(pos_ >= len_) {
+			::printf("MISMATCH: unexpected \"%s\" after the end of the transcript\n", cmd);
+			errors_++;
+			return;
+		}
+		const Exchange& ex = transcript_[pos_++];
+		if(strcmp(ex.command, cmd)) {
+			::printf("MISMATCH at line %u: expected \"%s\", got \"%s\"\n", (unsigned)pos_, ex.command, cmd);
+			errors_++;
+		}
+		if((reply == NULL) != (ex.reply == NULL) || (reply != NULL && strcmp(reply, ex.reply))) {
+			::printf("MISMATCH at line %u: module would answer \"%s\", transcript says \"%s\"\n", (unsigned)pos_, reply ? reply : "(nothing)", ex.reply ? ex.reply : "(nothing)");
+			errors_++;
+		}
+		if(ex.reply != NULL) {
+			Serial1.inject(ex.reply);
+			Serial1.inject('\r');
+		}
+	}
+
+	static unsigned long bpsForParam(unsigned long param) {
+		static const unsigned long rates[] = { 1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+		return param < sizeof(rates)/sizeof(rates[0]) ? rates[param] : param;
+	}
+
+	unsigned long bps_;
+	uint16_t guardTime_;
+	uint32_t addrLo_, chan_ = 0xc, pan_ = 0x3332;
+	bool cmdMode_;
+	unsigned long pendingBPS_;
+	uint64_t lastRxUS_, okAtUS_;
+	String line_;
+	const Exchange* transcript_;
+	size_t len_, pos_;
+	unsigned int errors_;
+};
+
+// Factory-fresh module at 9600bps: rate detection, full configuration, rate change.
+static const Exchange coldBoot[] = {
+	{ "+++", "OK" },
+	{ "ATSH", "13A200" }, { "ATSL", "4242ABCD" }, { "ATVR", "2003" }, { "ATCT", "64" }, { "ATMM=3", "OK" }, { "ATRR", "A" },
+	{ "ATCH=15", "OK" }, { "ATID=3332", "OK" }, { "ATMY=FFFE", "OK" }, { "ATCH", "15" }, { "ATID", "3332" },
+	{ "ATNIReplay", "OK" }, { "ATNT=64", "OK" }, { "ATGT=64", "OK" }, { "ATBD=7", "OK" }, { "ATWR", "OK" }, { "ATCN", "OK" },
+	{ "+++", "OK" },
+	{ "ATAP=2", "OK" }, { "ATCN", "OK" }
+};
+
+// Same module again: cached rate and guard time, address check, API mode.
+static const Exchange warmBoot[] = {
+	{ "+++", "OK" },
+	{ "ATSH", "13A200" }, { "ATSL", "4242ABCD" },
+	{ "ATAP=2", "OK" }, { "ATCN", "OK" }
+};
+
+// A different module that runs at the cached rate, but still has the factory guard time: the first "+++" comes
+// too early, so the rate is detected again, and the module is reconfigured.
+static const Exchange swappedModule[] = {
+	{ "+++", NULL },
+	{ "+++", "OK" },
+	{ "ATSH", "13A200" }, { "ATSL", "4242F00D" }, { "ATVR", "2003" }, { "ATCT", "64" }, { "ATMM=3", "OK" }, { "ATRR", "A" },
+	{ "ATCH=15", "OK" }, { "ATID=3332", "OK" }, { "ATMY=FFFE", "OK" }, { "ATCH", "15" }, { "ATID", "3332" },
+	{ "ATNIReplay", "OK" }, { "ATNT=64", "OK" }, { "ATGT=64", "OK" }, { "ATWR", "OK" },
+	{ "ATAP=2", "OK" }, { "ATCN", "OK" }
+};
+
+// The module has been reset to factory settings: the cached rate does not work, so fall back to a cold boot.
+static const Exchange factoryReset[] = {
+	{ "+++", "OK" },
+	{ "ATSH", "13A200" }, { "ATSL", "4242F00D" }, { "ATVR", "2003" }, { "ATCT", "64" }, { "ATMM=3", "OK" }, { "ATRR", "A" },
+	{ "ATCH=15", "OK" }, { "ATID=3332", "OK" }, { "ATMY=FFFE", "OK" }, { "ATCH", "15" }, { "ATID", "3332" },
+	{ "ATNIReplay", "OK" }, { "ATNT=64", "OK" }, { "ATGT=64", "OK" }, { "ATBD=7", "OK" }, { "ATWR", "OK" }, { "ATCN", "OK" },
+	{ "+++", "OK" },
+	{ "ATAP=2", "OK" }, { "ATCN", "OK" }
+};
+
+struct Scenario {
+	const char* name;
+	unsigned long moduleBPS; // 0: keep the module from the last scenario
+	uint16_t moduleGuardTime;
+	uint32_t moduleAddrLo;
+	const Exchange* transcript;
+	size_t len;
+};
+
+#define SCENARIO(name, bps, gt, addr, t) { name, bps, gt, addr, t, sizeof(t)/sizeof(t[0]) }
+
+static const Scenario scenarios[] = {
+	SCENARIO("cold boot", 9600, 1000, 0x4242abcd, coldBoot),
+	SCENARIO("warm boot", 0, 0, 0, warmBoot),
+	SCENARIO("swapped module", 115200, 1000, 0x4242f00d, swappedModule),
+	SCENARIO("factory reset", 9600, 1000, 0x4242f00d, factoryReset)
+};
+
+int main(int argc, char** argv) {
+	unsigned long cycleTime = argc > 1 ? strtoul(argv[1], nullptr, 10) : Runloop::DEFAULT_CYCLETIME;
+
+	// Start without a cached configuration
+	setenv("LIBBB_EEPROM_FILE", "xbee_replay_eeprom.bin", 1);
+	remove("xbee_replay_eeprom.bin");
+
+	hostsim::setClockMode(hostsim::CLOCK_MODE_MANUAL);
+	Serial.begin(115200);
+	Serial.setEcho(getenv("BENCH_VERBOSE") != nullptr ? stdout : nullptr);
+
+	static SimXBee sim;
+
+	ConfigStorage::storage.initialize();
+	Console::console.initialize();
+	Console::console.start();
+	XBee::xbee.initialize(DEFAULT_CHAN, DEFAULT_PAN, 115200, &Serial1);
+	XBee::xbee.setName("Replay");
+
+	unsigned int failures = 0;
+	::printf("%-16s %10s %8s %s\n", "scenario", "time[ms]", "cycles", "result");
+
+	for(const Scenario& s: scenarios) {
+		if(s.moduleBPS != 0) sim.replace(s.moduleBPS, s.moduleGuardTime, s.moduleAddrLo);
+		else sim.powerCycle();
+		sim.setTranscript(s.transcript, s.len);
+
+		XBee::xbee.stop();
+		uint64_t startUS = hostsim::micros64();
+		XBee::xbee.start();
+
+		unsigned long cycles = 0, delayingSteps = 0;
+		while(XBee::xbee.isStarting() && cycles < 100000) {
+			uint64_t delayed = hostsim::microsDelayed();
+			XBee::xbee.stepIfNotStarted();
+			if(hostsim::microsDelayed() != delayed) delayingSteps++;
+			hostsim::advanceMicros(cycleTime);
+			sim.update();
+			cycles++;
+		}
+		uint64_t us = hostsim::micros64() - startUS;
+
+		bool ok = XBee::xbee.isStarted() && sim.transcriptDone() && sim.errors() == 0 && delayingSteps == 0;
+		::printf("%-16s %10.1f %8lu %s", s.name, us / 1000.0, cycles, ok ? "ok" : "FAILED");
+		if(!XBee::xbee.isStarted()) ::printf(" (not started: %s)", errorMessage(XBee::xbee.operationStatus()));
+		if(!sim.transcriptDone()) ::printf(" (transcript not finished)");
+		if(delayingSteps != 0) ::printf(" (%lu steps delayed)", delayingSteps);
+		::printf("\n");
+		if(!ok) failures++;
+	}
+
+	remove("xbee_replay_eeprom.bin");
+	return failures != 0 ? 1 : 0;
+}